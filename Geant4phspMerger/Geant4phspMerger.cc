@@ -1,9 +1,16 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <vector>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
 #include "iaea_phsp.h"    // Functions for PHSP file operations
 #include "iaea_header.h"  // Header handling functions
 #include "iaea_record.h"  // Record (particle) operations
@@ -17,23 +24,120 @@ const int ERROR_THRESHOLD = 10; // Maximum allowed read errors for one source
 void removeOutputFiles(const char* baseName) {
     string headerFile = string(baseName) + ".IAEAheader";
     string phspFile   = string(baseName) + ".IAEAphsp";
+    string packedFile = string(baseName) + ".IAEAphspz";
     remove(headerFile.c_str());
     remove(phspFile.c_str());
+    remove(packedFile.c_str());
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " <inputFileBase1> [<inputFileBase2> ...] <outputFileBase>" << endl;
-        return 1;
-    }
+// Helper function: Print the command line usage.
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [options] <inputFileBase1> [<inputFileBase2> ...] <outputFileBase>" << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --no-passthrough   Always decode and re-encode every particle," << endl;
+    cerr << "                     even when all inputs share the same record layout." << endl;
+    cerr << "  --threads N        Copy the inputs with N threads, each input going straight" << endl;
+    cerr << "                     to its own precomputed place in the output (default 1)." << endl;
+    cerr << "  --zero-copy        Let the kernel copy the records (copy_file_range) when all" << endl;
+    cerr << "                     inputs share the same record layout." << endl;
+    cerr << "  --pipeline         Overlap reading, converting and writing: a reader thread," << endl;
+    cerr << "                     N worker threads (see --threads) and an in-order writer." << endl;
+    cerr << "  --header-stats     Build the output statistics from the input headers instead" << endl;
+    cerr << "                     of recounting every particle, for inputs whose header" << endl;
+    cerr << "                     matches their file (such inputs are copied completely)." << endl;
+    cerr << "  --max-open N       Keep at most N (>= 2) inputs open at once: inputs are closed" << endl;
+    cerr << "                     once their header is read and reopened when their turn comes." << endl;
+    cerr << "  --tree K           Merge groups of at most K (>= 2) inputs into intermediate files," << endl;
+    cerr << "                     level by level, then merge the last level into the output;" << endl;
+    cerr << "                     with --threads N, N groups are merged at once." << endl;
+    cerr << "  --resume           With --tree, reuse the complete intermediate files left by an" << endl;
+    cerr << "                     interrupted run." << endl;
+    cerr << "  --header-cache     Load the input headers from binary caches (.IAEAcache) next to" << endl;
+    cerr << "                     them, writing the caches that are missing or out of date." << endl;
+    cerr << "  --virtual          Copy nothing: write only an output header that lists the records" << endl;
+    cerr << "                     of every input, read in place as one phase space (all inputs" << endl;
+    cerr << "                     must share one record layout)." << endl;
+    cerr << "  --history-index    Write the history index of the output (.IAEAidx), for seeking" << endl;
+    cerr << "                     to histories and history-aligned parallel chunks." << endl;
+    cerr << "  --zone-map         Write the zone map of the output (.IAEAzone): per block of" << endl;
+    cerr << "                     records, the ranges and types readers use to skip blocks." << endl;
+    cerr << "  --type-index       Write the type index of the output (.IAEAtype): the runs of" << endl;
+    cerr << "                     records of every particle type, for type-selective reads." << endl;
+    cerr << "  --grid-index N     Write the grid index of the output (.IAEAgrid): its records" << endl;
+    cerr << "                     bucketed in N x N (x,y) cells over the header ranges, for" << endl;
+    cerr << "                     reading only the particles of a field region." << endl;
+    cerr << "  --compress         Write the output as a compressed phase space (.IAEAphspz):" << endl;
+    cerr << "                     frames of records compressed with zlib, N at once (see" << endl;
+    cerr << "                     --threads), read back transparently by the library." << endl;
+    cerr << "  --frame-records N  Records per compressed frame (default 65536)." << endl;
+}
+
+// Helper function: For every extra variable of the output, the index of the
+// input extra variable of the same type (the k-th of a type maps to the k-th),
+// or -1 if the input does not store it. An incremental history counter
+// (long type 1) the input does not store is -2: it is made from the
+// new-history flag of each record, as the counter overrides that flag.
+void mapExtraVariables(IAEA_I32 src, IAEA_I32 dest, vector<int>& floatMap, vector<int>& longMap) {
+    IAEA_I32 nSrcFloats, nSrcLongs, nDestFloats, nDestLongs, result;
+    IAEA_I32 srcLongTypes[NUM_EXTRA_LONG], srcFloatTypes[NUM_EXTRA_FLOAT];
+    IAEA_I32 destLongTypes[NUM_EXTRA_LONG], destFloatTypes[NUM_EXTRA_FLOAT];
+    iaea_get_extra_numbers(&src, &nSrcFloats, &nSrcLongs);
+    iaea_get_extra_numbers(&dest, &nDestFloats, &nDestLongs);
+    iaea_get_type_extra_variables(&src, &result, srcLongTypes, srcFloatTypes);
+    iaea_get_type_extra_variables(&dest, &result, destLongTypes, destFloatTypes);
     
-    // The last argument is the output file base; all preceding ones are input files.
-    int numInput = argc - 2;
-    vector<string> inputFiles;
-    for (int i = 1; i <= numInput; i++) {
-        inputFiles.push_back(argv[i]);
+    auto mapTypes = [](const IAEA_I32* srcTypes, int nSrc, const IAEA_I32* destTypes, int nDest,
+                       vector<int>& map) {
+        map.assign(nDest, -1);
+        for (int j = 0; j < nDest; j++) {
+            int occurrence = 0;
+            for (int k = 0; k < j; k++) if (destTypes[k] == destTypes[j]) occurrence++;
+            for (int k = 0; k < nSrc; k++) {
+                if (srcTypes[k] != destTypes[j]) continue;
+                if (occurrence-- == 0) { map[j] = k; break; }
+            }
+        }
+    };
+    mapTypes(srcFloatTypes, nSrcFloats, destFloatTypes, nDestFloats, floatMap);
+    mapTypes(srcLongTypes, nSrcLongs, destLongTypes, nDestLongs, longMap);
+    for (int j = 0; j < nDestLongs; j++) {
+        if (destLongTypes[j] != 1) continue;
+        if (longMap[j] == -1) longMap[j] = -2;
+        break;
     }
-    const char* outFile = argv[argc - 1];
+}
+
+// Helper function: Size in bytes of the .IAEAphsp file of a base name, -1 if unknown.
+IAEA_I64 phspFileSize(const string& baseName) {
+    struct stat fileStatus;
+    string phspFile = baseName + ".IAEAphsp";
+    if (stat(phspFile.c_str(), &fileStatus) != 0) return -1;
+    return fileStatus.st_size;
+}
+
+// Options of one merge (see printUsage).
+struct MergeOptions {
+    bool allowPassthrough = true;
+    int numThreads = 1;
+    bool zeroCopy = false;
+    bool headerStats = false;
+    bool pipeline = false;
+    IAEA_I32 maxOpen = 0; // 0: every input stays open
+    bool verbose = true;  // progress of every input on cout
+};
+
+// Merges the inputs into the output; returns 0 on success. With
+// wholeInputs every record of every input is copied, as for the
+// intermediate files of a tree merge, which hold no extra last record.
+int mergeFiles(const vector<string>& inputFiles, const char* outFile,
+               const MergeOptions& opts, bool wholeInputs) {
+    // Progress goes to cout, or nowhere for the quiet merges of a tree
+    ostream quiet(nullptr);
+    ostream& out = opts.verbose ? cout : quiet;
+    
+    // A Geant4 worker header announces one record more than should be
+    // copied; intermediate files announce exactly what they hold.
+    IAEA_I64 extraRecords = wholeInputs ? 0 : 1;
     
     // Remove any pre-existing output files for a clean start.
     removeOutputFiles(outFile);
@@ -44,10 +148,45 @@ int main(int argc, char* argv[]) {
     
     // We store input source IDs in a vector so we can later destroy them.
     vector<IAEA_I32> inputSourceIDs;
+    vector<string> inputNames; // base names of the inputs that were opened
+    IAEA_I32 dest = -1;        // the output source
     IAEA_I32 res;
     IAEA_I32 accessRead = 1;
     
-    IAEA_I32 numExtraFloats = 0, numExtraInts = 0;
+    // Lazy inputs: each input is suspended (files closed, header released)
+    // once its header has been used, and resumed when its turn comes.
+    bool lazy = (opts.maxOpen > 0);
+    if (lazy) iaea_set_max_open_sources(&opts.maxOpen, &res);
+    auto resumeInput = [&](size_t idx) {
+        if (!lazy) return true;
+        IAEA_I32 result;
+        iaea_resume_source(&inputSourceIDs[idx], &result);
+        if (result < 0) cerr << "Error reopening input source: " << inputNames[idx] << endl;
+        return result >= 0;
+    };
+    auto suspendInput = [&](size_t idx) {
+        IAEA_I32 result;
+        if (lazy) iaea_suspend_source(&inputSourceIDs[idx], &result);
+    };
+    auto destroySources = [&]() {
+        IAEA_I32 result;
+        for (size_t j = 0; j < inputSourceIDs.size(); j++) {
+            iaea_destroy_source(&inputSourceIDs[j], &result);
+        }
+        iaea_destroy_source(&dest, &result);
+    };
+    
+    // Raw records can be copied without decoding when every input packs
+    // them exactly like the first one (comparing the first input with itself
+    // also checks that its byte order is the one of this machine); other
+    // inputs are converted record by record to the merged layout.
+    bool passthrough = opts.allowPassthrough;
+    
+    // The output is created from the first input that opens; it starts from
+    // the layout of that input and stores every variable some input stores
+    // (extra variables are matched by type).
+    int lenOut = strlen(outFile);
+    IAEA_I32 accessWrite = 2; // writing mode
     
     for (size_t i = 0; i < inputFiles.size(); i++) {
         IAEA_I32 src;
@@ -55,9 +194,11 @@ int main(int argc, char* argv[]) {
         iaea_new_source(&src, const_cast<char*>(inputFiles[i].c_str()), &accessRead, &res, len);
         if (res < 0) {
             cerr << "Error opening input source: " << inputFiles[i] << endl;
+            iaea_destroy_source(&src, &res);
             continue;
         }
         inputSourceIDs.push_back(src);
+        inputNames.push_back(inputFiles[i]);
         
         // Update merged statistics.
         IAEA_I64 origHist = 0, totParticles = 0;
@@ -66,66 +207,247 @@ int main(int argc, char* argv[]) {
         iaea_get_max_particles(&src, &res, &totParticles);
         mergedOrigHistories += origHist;
         mergedTotalParticles  += totParticles;
-
-        IAEA_I32 tempExtraFloats, tempExtraInts;
-        iaea_get_extra_numbers(&src, &tempExtraFloats, &tempExtraInts);
-        numExtraFloats = max(numExtraFloats, tempExtraFloats);
-        numExtraInts = max(numExtraInts, tempExtraInts);
+        
+        if (inputSourceIDs.size() == 1) {
+            // Create output source using the output base file (extension .IAEAheader will be added)
+            iaea_new_source(&dest, const_cast<char*>(outFile), &accessWrite, &res, lenOut);
+            if (res < 0) {
+                cerr << "Error creating output source: " << outFile << endl;
+                iaea_destroy_source(&src, &res);
+                return 1;
+            }
+            iaea_copy_header(&src, &dest, &res);
+            iaea_copy_record_layout(&src, &dest, &res);
+        } else {
+            iaea_merge_record_layout(&src, &dest, &res);
+            if (res < 0) {
+                cerr << "Cannot merge the record layout of " << inputFiles[i] << " (code " << res << ")." << endl;
+                destroySources();
+                return 1;
+            }
+        }
+        
+        if (passthrough) {
+            IAEA_I32 sameLayout;
+            iaea_compare_record_layout(&inputSourceIDs[0], &src, &sameLayout);
+            if (sameLayout != 1) passthrough = false;
+        }
+        // The first input is kept open for the layout comparisons.
+        if (inputSourceIDs.size() > 1) suspendInput(inputSourceIDs.size() - 1);
     }
     
     if (inputSourceIDs.empty()) {
         cerr << "No valid input sources were opened. Aborting." << endl;
         return 1;
     }
+    suspendInput(0);
     
-    // Create output source using the output base file (extension .IAEAheader will be added)
-    IAEA_I32 dest;
-    int lenOut = strlen(outFile);
-    IAEA_I32 accessWrite = 2; // writing mode
-    iaea_new_source(&dest, const_cast<char*>(outFile), &accessWrite, &res, lenOut);
-    if (res < 0) {
-        cerr << "Error creating output source: " << outFile << endl;
-        // Clean up all input sources.
-        for (size_t i = 0; i < inputSourceIDs.size(); i++) {
-            iaea_destroy_source(&inputSourceIDs[i], &res);
-        }
-        return 1;
-    }
-    
-    iaea_copy_header(&inputSourceIDs[0], &dest, &res);
-    iaea_set_extra_numbers(&dest, &numExtraFloats, &numExtraInts);
+    if (passthrough)
+        out << "All inputs share the same record layout: copying raw records." << endl;
+    else if (opts.allowPassthrough)
+        out << "Record layouts differ: converting records to the merged layout." << endl;
+    if (lazy)
+        out << "Lazy inputs: at most " << opts.maxOpen << " input(s) open at once." << endl;
     
-    IAEA_I32 extraLongTypes[NUM_EXTRA_LONG], extraFloatTypes[NUM_EXTRA_FLOAT];
-    IAEA_I32 result;
-    iaea_get_type_extra_variables(&inputSourceIDs[0], &result, extraLongTypes, extraFloatTypes);
     
-    for (IAEA_I32 i = 0; i < numExtraInts; i++) {
-        iaea_set_type_extralong_variable(&dest, &i, &extraLongTypes[i]);
+    // Planned merge: the place of every input in the output is known up
+    // front, so each thread copies (or transcodes) whole inputs straight
+    // into their own range of records.
+    bool planned = (opts.numThreads > 1 && !opts.pipeline) || opts.zeroCopy || opts.headerStats;
+    vector<IAEA_I64> plannedRecords, firstRecord;
+    vector<char> fromHeader; // statistics taken from the input header
+    vector<char> sameLayout; // records copied without conversion
+    IAEA_I64 totalRecords = 0;
+    if (planned) {
+        IAEA_I32 destLength;
+        iaea_get_record_length(&dest, &destLength);
+        for (size_t idx = 0; idx < inputSourceIDs.size(); idx++) {
+            if (!resumeInput(idx)) {
+                destroySources();
+                return 1;
+            }
+            IAEA_I64 expected;
+            IAEA_I32 srcLength;
+            res = -1;
+            iaea_get_max_particles(&inputSourceIDs[idx], &res, &expected);
+            iaea_get_record_length(&inputSourceIDs[idx], &srcLength);
+            IAEA_I32 same;
+            iaea_compare_record_layout(&inputSourceIDs[idx], &dest, &same);
+            sameLayout.push_back(same == 1);
+            // Same record count as the sequential merge, but never more
+            // records than the file really holds.
+            IAEA_I64 expectedRecords = (expected > 0) ? expected - extraRecords : expected;
+            // A virtual input has no phsp file; its members are checked
+            // as they are read.
+            IAEA_I64 phspSize = phspFileSize(inputNames[idx]);
+            IAEA_I64 inFile = (phspSize < 0) ? expected : phspSize / srcLength;
+            // The header statistics describe every particle of the file, so
+            // they can only be used when the whole file is copied.
+            fromHeader.push_back(opts.headerStats && expected == inFile);
+            if (fromHeader.back()) {
+                expectedRecords = expected;
+            } else if (expectedRecords > inFile) {
+                cerr << "Source " << inputNames[idx] << " holds only " << inFile << " records." << endl;
+                expectedRecords = inFile;
+            }
+            if (expectedRecords < 0) expectedRecords = 0;
+            plannedRecords.push_back(expectedRecords);
+            firstRecord.push_back(totalRecords);
+            totalRecords += expectedRecords;
+            suspendInput(idx);
+        }
+        
+        iaea_reserve_records(&dest, &totalRecords, &res);
+        if (res < 0) {
+            cerr << "Cannot reserve " << totalRecords << " records in the output; merging sequentially." << endl;
+            planned = false;
+        } else {
+            out << "Merging " << totalRecords << " records (" << (totalRecords * destLength)
+                 << " bytes) with " << opts.numThreads << " threads..." << endl;
+        }
+        
+        for (size_t idx = 0; planned && idx < inputSourceIDs.size(); idx++) {
+            if (!fromHeader[idx]) continue;
+            if (!resumeInput(idx)) {
+                destroySources();
+                return 1;
+            }
+            IAEA_I32 result;
+            iaea_merge_header_statistics(&inputSourceIDs[idx], &dest, &result);
+            suspendInput(idx);
+            if (result < 0) {
+                // The input is then recounted while it is copied.
+                cerr << "No usable statistics in the header of " << inputNames[idx] << "." << endl;
+                fromHeader[idx] = false;
+            }
+        }
     }
     
-    for (IAEA_I32 i = 0; i < numExtraFloats; i++) {
-        iaea_set_type_extrafloat_variable(&dest, &i, &extraFloatTypes[i]);
+    if (planned) {
+        atomic<size_t> nextInput(0);
+        atomic<bool> failed(false);
+        vector<IAEA_I64> copiedRecords(inputSourceIDs.size(), 0);
+        auto worker = [&]() {
+            for (size_t idx = nextInput++; idx < inputSourceIDs.size(); idx = nextInput++) {
+                if (!resumeInput(idx)) {
+                    copiedRecords[idx] = -1;
+                    failed = true;
+                    continue;
+                }
+                if (fromHeader[idx] && sameLayout[idx]) {
+                    // The statistics are already in the output header.
+                    iaea_splice_records(&inputSourceIDs[idx], &dest, &firstRecord[idx],
+                                        &plannedRecords[idx], &copiedRecords[idx]);
+                } else if (fromHeader[idx]) {
+                    iaea_transcode_records_at(&inputSourceIDs[idx], &dest, &firstRecord[idx],
+                                              &plannedRecords[idx], &copiedRecords[idx]);
+                } else if (opts.zeroCopy && sameLayout[idx]) {
+                    // The kernel moves the bytes; the statistics are
+                    // gathered from the copied range afterwards.
+                    iaea_splice_records(&inputSourceIDs[idx], &dest, &firstRecord[idx],
+                                        &plannedRecords[idx], &copiedRecords[idx]);
+                    IAEA_I64 counted;
+                    if (copiedRecords[idx] > 0)
+                        iaea_recount_records(&dest, &firstRecord[idx], &copiedRecords[idx], &counted);
+                } else {
+                    iaea_copy_records_at(&inputSourceIDs[idx], &dest, &firstRecord[idx],
+                                         &plannedRecords[idx], &copiedRecords[idx]);
+                }
+                if (copiedRecords[idx] != plannedRecords[idx]) failed = true;
+                suspendInput(idx);
+            }
+        };
+        vector<thread> pool;
+        int poolSize = min<int>(opts.numThreads, (int)inputSourceIDs.size());
+        for (int t = 0; t < poolSize; t++) pool.push_back(thread(worker));
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+        
+        for (size_t idx = 0; idx < inputSourceIDs.size(); idx++) {
+            if (copiedRecords[idx] < 0)
+                cerr << "Error copying records from " << inputNames[idx] << " (code " << copiedRecords[idx] << ")." << endl;
+            else
+                out << inputNames[idx] << ": Total copied records: " << copiedRecords[idx]
+                     << " of " << plannedRecords[idx] << endl;
+        }
+        if (failed) {
+            // Records that were not copied would leave holes in the output.
+            cerr << "Parallel merge failed; the output is incomplete." << endl;
+            destroySources();
+            return 1;
+        }
     }
     
+    // Pipelined merge: a reader thread, numThreads converting threads and
+    // this thread as in-order writer work on different blocks at once.
+    if (opts.pipeline) {
+        IAEA_I32 nSources = inputSourceIDs.size(), nReaders = 1, nWorkers = opts.numThreads;
+        vector<IAEA_I64> expectedRecords(nSources), copied(nSources);
+        out << "Merging " << nSources << " sources through a pipeline with " << nWorkers << " worker(s)..." << endl;
+        // Lazy inputs go through the pipeline maxOpen at a time.
+        IAEA_I32 batch = lazy ? opts.maxOpen : nSources;
+        for (IAEA_I32 first = 0; first < nSources; first += batch) {
+            IAEA_I32 nBatch = min(batch, nSources - first);
+            for (IAEA_I32 idx = first; idx < first + nBatch; idx++) {
+                if (!resumeInput(idx)) {
+                    destroySources();
+                    return 1;
+                }
+                IAEA_I64 expected;
+                res = -1;
+                iaea_get_max_particles(&inputSourceIDs[idx], &res, &expected);
+                // Same record count as the sequential merge.
+                expectedRecords[idx] = (expected > 0) ? expected - extraRecords : 0;
+            }
+            iaea_copy_records_pipelined(&inputSourceIDs[first], &nBatch, &dest, &expectedRecords[first],
+                                        &nReaders, &nWorkers, &copied[first]);
+            for (IAEA_I32 idx = first; idx < first + nBatch; idx++) suspendInput(idx);
+        }
+        for (size_t idx = 0; idx < inputSourceIDs.size(); idx++) {
+            if (copied[idx] < 0)
+                cerr << "Error copying records from " << inputNames[idx] << " (code " << copied[idx] << ")." << endl;
+            else if (copied[idx] < expectedRecords[idx])
+                cerr << "Source " << inputNames[idx] << " ended after " << copied[idx] << " records." << endl;
+            else
+                out << inputNames[idx] << ": Total copied records: " << copied[idx] << endl;
+        }
+    }
     
-    for (size_t idx = 0; idx < inputSourceIDs.size(); idx++) {
+    for (size_t idx = 0; !planned && !opts.pipeline && idx < inputSourceIDs.size(); idx++) {
         IAEA_I32 currSrc = inputSourceIDs[idx];
+        if (!resumeInput(idx)) continue;
         
         // Get the expected number of records from the header.
         IAEA_I64 expected;
         res = -1;
         iaea_get_max_particles(&currSrc, &res, &expected);
-        // Assume the header contains one extra record, so we process expected - 1 records.
-        IAEA_I64 expectedRecords = (expected > 0) ? expected - 1 : expected;
-        cout << "Processing source " << inputFiles[idx] << " (expected records = " << expectedRecords << ")..." << endl;
+        // Assume the header contains one extra record (see extraRecords).
+        IAEA_I64 expectedRecords = (expected > 0) ? expected - extraRecords : expected;
+        out << "Processing source " << inputNames[idx] << " (expected records = " << expectedRecords << ")..." << endl;
+        
+        if (opts.allowPassthrough) {
+            IAEA_I64 copied;
+            iaea_copy_records(&currSrc, &dest, &expectedRecords, &copied);
+            if (copied < 0) {
+                cerr << "Error copying records from " << inputNames[idx] << " (code " << copied << ")." << endl;
+                suspendInput(idx);
+                continue;
+            }
+            if (copied < expectedRecords)
+                cerr << "Source " << inputNames[idx] << " ended after " << copied << " records." << endl;
+            out << inputNames[idx] << ": Total copied records: " << copied << endl;
+            suspendInput(idx);
+            continue;
+        }
         
         IAEA_I64 count = 0;
         int errorCount = 0;
         IAEA_I32 n_stat, partType;
         IAEA_Float E, wt, x, y, z, u, v, w;
-        // In this merger we pass extra data through unchanged.
-        float extraFloats[NUM_EXTRA_FLOAT];
-        IAEA_I32 extraInts[NUM_EXTRA_LONG];
+        // Extra data is passed through, matched by the type of the variable.
+        float extraFloats[NUM_EXTRA_FLOAT], outFloats[NUM_EXTRA_FLOAT];
+        IAEA_I32 extraInts[NUM_EXTRA_LONG], outInts[NUM_EXTRA_LONG];
+        vector<int> floatMap, longMap;
+        mapExtraVariables(currSrc, dest, floatMap, longMap);
         
         for (IAEA_I64 j = 0; j < expectedRecords; j++) {
             iaea_get_particle(&currSrc, &n_stat, &partType, &E, &wt,
@@ -133,22 +455,28 @@ int main(int argc, char* argv[]) {
                               extraFloats, extraInts);
             if (n_stat == -1) {
                 errorCount++;
-                cerr << "Error reading particle from " << inputFiles[idx] << " at record " 
+                cerr << "Error reading particle from " << inputNames[idx] << " at record " 
                      << j << " (error count: " << errorCount << ")" << endl;
                 if (errorCount > ERROR_THRESHOLD) {
-                    cerr << "Too many errors in " << inputFiles[idx] << ". Aborting processing for this source." << endl;
+                    cerr << "Too many errors in " << inputNames[idx] << ". Aborting processing for this source." << endl;
                     break;
                 }
                 continue;
             }
+            for (size_t k = 0; k < floatMap.size(); k++)
+                outFloats[k] = (floatMap[k] < 0) ? 0.f : extraFloats[floatMap[k]];
+            for (size_t k = 0; k < longMap.size(); k++)
+                outInts[k] = (longMap[k] == -2) ? (n_stat > 0 ? 1 : 0) :
+                             (longMap[k] < 0) ? 0 : extraInts[longMap[k]];
             iaea_write_particle(&dest, &n_stat, &partType, &E, &wt,
                                 &x, &y, &z, &u, &v, &w,
-                                extraFloats, extraInts);
+                                outFloats, outInts);
             count++;
             if (count % 1000000 == 0)
-                cout << inputFiles[idx] << ": Processed " << count << " records." << endl;
+                out << inputNames[idx] << ": Processed " << count << " records." << endl;
         }
-        cout << inputFiles[idx] << ": Total processed records: " << count << endl;
+        out << inputNames[idx] << ": Total processed records: " << count << endl;
+        suspendInput(idx);
     }
     
     // Update the output header with merged statistics.
@@ -157,7 +485,7 @@ int main(int argc, char* argv[]) {
     if (res < 0)
         cerr << "Error updating output header (code " << res << ")." << endl;
     else
-        cout << "Output header updated successfully." << endl;
+        out << "Output header updated successfully." << endl;
     
     // Diagnostic: Read and print the output PHSP file size.
     string mergedPhspPath = string(outFile) + ".IAEAphsp";
@@ -166,21 +494,420 @@ int main(int argc, char* argv[]) {
     if (fp) {
         if (fstat(fileno(fp), &fileStatus) == 0) {
             IAEA_I64 fileSize = fileStatus.st_size;
-            cout << "Output PHSP file size: " << fileSize << " bytes." << endl;
+            out << "Output PHSP file size: " << fileSize << " bytes." << endl;
         }
         fclose(fp);
     } else {
         cerr << "Cannot open output PHSP file for size check: " << mergedPhspPath << endl;
     }
     
-    // Destroy all sources.
-    // First, destroy each input source.
-    for (size_t i = 0; i < inputSourceIDs.size(); i++) {
-        iaea_destroy_source(&inputSourceIDs[i], &res);
+    // Destroy all sources: the inputs, then the output.
+    destroySources();
+    
+    return 0;
+}
+
+// Writes a virtual phase space instead of merging: the output header lists
+// the records of every input (see iaea_add_virtual_member), which stay
+// where they are. One input is open at a time. Returns 0 on success.
+int virtualMerge(const vector<string>& inputFiles, const char* outFile,
+                 const MergeOptions& opts) {
+    removeOutputFiles(outFile);
+    
+    IAEA_I64 mergedOrigHistories = 0;
+    IAEA_I32 dest = -1, res;
+    IAEA_I32 accessRead = 1, accessWrite = 2;
+    bool failed = false;
+    for (size_t i = 0; i < inputFiles.size() && !failed; i++) {
+        IAEA_I32 src;
+        iaea_new_source(&src, const_cast<char*>(inputFiles[i].c_str()), &accessRead, &res, inputFiles[i].size());
+        if (res < 0) {
+            cerr << "Error opening input source: " << inputFiles[i] << endl;
+            iaea_destroy_source(&src, &res);
+            continue;
+        }
+        if (dest < 0) {
+            iaea_new_source(&dest, const_cast<char*>(outFile), &accessWrite, &res, strlen(outFile));
+            if (res < 0) {
+                cerr << "Error creating output source: " << outFile << endl;
+                iaea_destroy_source(&src, &res);
+                return 1;
+            }
+            iaea_copy_header(&src, &dest, &res);
+            iaea_copy_record_layout(&src, &dest, &res);
+        }
+        
+        // Same record count as a merge (see extraRecords in mergeFiles).
+        IAEA_I64 origHist = 0, expected;
+        iaea_get_total_original_particles(&src, &origHist);
+        res = -1;
+        iaea_get_max_particles(&src, &res, &expected);
+        IAEA_I64 records = (expected > 0) ? expected - 1 : 0;
+        
+        // With --header-stats, inputs whose header matches their file are
+        // listed whole without reading them.
+        IAEA_I32 count = 1, length;
+        iaea_get_record_length(&src, &length);
+        if (opts.headerStats && expected > 0 && phspFileSize(inputFiles[i]) == expected * length) {
+            iaea_merge_header_statistics(&src, &dest, &res);
+            if (res >= 0) {
+                count = 0;
+                records = expected;
+            }
+        }
+        
+        IAEA_I64 first = 0, added;
+        iaea_add_virtual_member(&src, &dest, &first, &records, &count, &added);
+        if (added == -2) {
+            cerr << "The record layout of " << inputFiles[i] << " differs from the first input;"
+                 << " a virtual merge cannot convert records." << endl;
+            failed = true;
+        } else if (added < 0) {
+            cerr << "Error listing the records of " << inputFiles[i] << " (code " << added << ")." << endl;
+            failed = true;
+        } else {
+            if (added < records)
+                cerr << "Source " << inputFiles[i] << " ended after " << added << " records." << endl;
+            if (opts.verbose)
+                cout << inputFiles[i] << ": Total listed records: " << added << endl;
+            mergedOrigHistories += origHist;
+        }
+        iaea_destroy_source(&src, &res);
+    }
+    
+    if (dest < 0) {
+        cerr << "No valid input sources were opened. Aborting." << endl;
+        return 1;
+    }
+    if (failed) {
+        iaea_destroy_source(&dest, &res);
+        removeOutputFiles(outFile);
+        return 1;
     }
-    // Then, destroy the output source.
+    
+    iaea_set_total_original_particles(&dest, &mergedOrigHistories);
+    iaea_update_header(&dest, &res);
     iaea_destroy_source(&dest, &res);
+    // The records are in the inputs; the empty phsp file is not needed.
+    remove((string(outFile) + ".IAEAphsp").c_str());
+    if (opts.verbose) cout << "Virtual phase space written to " << outFile << ".IAEAheader" << endl;
+    return 0;
+}
+
+// Helper function: True if baseName is a complete phase-space file: its
+// header can be read and its .IAEAphsp holds every particle it announces.
+bool isCompleteFile(const string& baseName) {
+    struct stat fileStatus;
+    string headerFile = baseName + ".IAEAheader";
+    if (stat(headerFile.c_str(), &fileStatus) != 0) return false;
     
+    IAEA_I32 src, res, accessRead = 1, allTypes = -1, length = 0;
+    string name = baseName;
+    iaea_new_source(&src, &name[0], &accessRead, &res, name.size());
+    bool complete = false;
+    if (res >= 0) {
+        IAEA_I64 particles;
+        iaea_get_max_particles(&src, &allTypes, &particles);
+        iaea_get_record_length(&src, &length);
+        complete = (length > 0 && phspFileSize(baseName) == particles * length);
+    }
+    iaea_destroy_source(&src, &res);
+    return complete;
+}
+
+// Helper function: Free bytes on the file system of a base name, -1 if unknown.
+IAEA_I64 freeDiskSpace(const string& baseName) {
+    size_t slash = baseName.find_last_of('/');
+    string dir = (slash == string::npos) ? "." : baseName.substr(0, slash + 1);
+    struct statvfs fsStatus;
+    if (statvfs(dir.c_str(), &fsStatus) != 0) return -1;
+    return (IAEA_I64)fsStatus.f_bavail * fsStatus.f_frsize;
+}
+
+// Helper function: The number of inputs per group of a tree merge, at most
+// requested, such that `parallel` groups merged at once stay within the
+// file-descriptor limit (two files per input, plus the output) and within
+// a quarter of the memory (a header and a record per open input).
+int treeWidthFor(int requested, int parallel) {
+    long width = requested;
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur != RLIM_INFINITY) {
+        long fit = ((long)fileLimit.rlim_cur - 16) / (2L * parallel) - 1;
+        width = min(width, fit);
+    }
+    long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0) {
+        double perInput = (double)(sizeof(iaea_header_type) + sizeof(iaea_record_type));
+        long fit = (long)((double)pages * pageSize / 4 / (parallel * perInput));
+        width = min(width, fit);
+    }
+    return (int)width;
+}
+
+// Merges the inputs as a k-ary tree: groups of inputs are merged at once
+// into intermediate files, which are merged again level by level until one
+// group is left for the output. With resume, intermediate files that are
+// complete (left by an interrupted run) are reused. Returns 0 on success.
+int treeMerge(const vector<string>& inputFiles, const char* outFile,
+              const MergeOptions& opts, int requestedWidth, bool resume) {
+    // Fewer groups at once if the budgets leave less than two inputs each
+    int parallel = opts.numThreads, width = treeWidthFor(requestedWidth, parallel);
+    while (width < 2 && parallel > 1) width = treeWidthFor(requestedWidth, --parallel);
+    
+    // Every level is written before the previous one is removed, so the
+    // intermediate files and the output need about twice the input size.
+    IAEA_I64 inputBytes = 0;
+    for (size_t i = 0; i < inputFiles.size(); i++) inputBytes += max<IAEA_I64>(phspFileSize(inputFiles[i]), 0);
+    IAEA_I64 freeBytes = freeDiskSpace(outFile);
+    if (width < 2 || (freeBytes >= 0 && freeBytes < 2 * inputBytes)) {
+        cerr << "No room for a tree merge (file descriptors, memory or disk space); merging in one pass." << endl;
+        MergeOptions flat = opts;
+        if (flat.maxOpen == 0) flat.maxOpen = 2;
+        return mergeFiles(inputFiles, outFile, flat, false);
+    }
+    cout << "Tree merge of " << inputFiles.size() << " inputs: " << width << " per group, "
+         << parallel << " group(s) at once." << endl;
+    
+    // Every group is merged quietly by one thread.
+    MergeOptions groupOpts = opts;
+    groupOpts.numThreads = 1;
+    groupOpts.maxOpen = 0;
+    groupOpts.verbose = false;
+    
+    vector<string> level = inputFiles;
+    vector<string> intermediate; // files of the level being merged, if not inputs
+    for (int depth = 0; (int)level.size() > width; depth++) {
+        size_t nGroups = (level.size() + width - 1) / width;
+        vector<string> next(nGroups);
+        for (size_t g = 0; g < nGroups; g++)
+            next[g] = string(outFile) + "_tree" + to_string(depth) + "_" + to_string(g);
+        
+        atomic<size_t> nextGroup(0);
+        atomic<bool> failed(false);
+        mutex logMutex;
+        auto worker = [&]() {
+            for (size_t g = nextGroup++; g < nGroups; g = nextGroup++) {
+                if (resume && isCompleteFile(next[g])) {
+                    lock_guard<mutex> lock(logMutex);
+                    cout << "Reusing " << next[g] << endl;
+                    continue;
+                }
+                size_t first = g * width, last = min(level.size(), first + width);
+                vector<string> group(level.begin() + first, level.begin() + last);
+                int rc = mergeFiles(group, next[g].c_str(), groupOpts, !intermediate.empty());
+                lock_guard<mutex> lock(logMutex);
+                if (rc != 0) {
+                    cerr << "Error merging " << group.size() << " inputs into " << next[g] << "." << endl;
+                    failed = true;
+                } else {
+                    cout << "Level " << depth << ": merged " << group.size() << " inputs into " << next[g] << endl;
+                }
+            }
+        };
+        vector<thread> pool;
+        for (int t = 0; t < min<int>(parallel, (int)nGroups); t++) pool.push_back(thread(worker));
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+        if (failed) {
+            // The complete intermediate files are kept for --resume.
+            cerr << "Tree merge failed at level " << depth << "." << endl;
+            return 1;
+        }
+        
+        for (size_t i = 0; i < intermediate.size(); i++) removeOutputFiles(intermediate[i].c_str());
+        intermediate = next;
+        level = next;
+    }
+    
+    int rc = mergeFiles(level, outFile, opts, !intermediate.empty());
+    if (rc == 0) {
+        for (size_t i = 0; i < intermediate.size(); i++) removeOutputFiles(intermediate[i].c_str());
+    }
+    return rc;
+}
+
+// Helper function: Compress a merged output into frames of frameRecords
+// records (0 for the library default), numThreads frames at once, and
+// remove its uncompressed phsp file once the header points to the frames.
+int compressOutput(const char* outFile, IAEA_I64 frameRecords, int numThreads) {
+    IAEA_I32 id, access = 1, result;
+    iaea_new_source(&id, const_cast<char*>(outFile), &access, &result, strlen(outFile));
+    if (result < 0) {
+        cerr << "Error opening output file " << outFile << " to compress it." << endl;
+        iaea_destroy_source(&id, &result);
+        return 1;
+    }
+    IAEA_I32 threads = numThreads, compressed;
+    iaea_compress_source(&id, &frameRecords, &threads, &compressed);
+    iaea_destroy_source(&id, &result);
+    if (compressed != 0) {
+        cerr << "Error compressing " << outFile << " (code " << compressed << ")." << endl;
+        return 1;
+    }
+    string phspFile = string(outFile) + ".IAEAphsp";
+    remove(phspFile.c_str());
+    cout << "Compressed phase space written to " << outFile << ".IAEAphspz" << endl;
+    return 0;
+}
+
+// Helper function: Write the history index, the zone map, the type index
+// and/or the grid index (of gridCells x gridCells cells, 0 for none) of a
+// merged output, reading it back once for each.
+int writeIndexes(const char* outFile, bool historyIndex, bool zoneMap, bool typeIndex, int gridCells) {
+    IAEA_I32 id, access = 1, result;
+    iaea_new_source(&id, const_cast<char*>(outFile), &access, &result, strlen(outFile));
+    if (result < 0) {
+        cerr << "Error opening output file " << outFile << " to index it." << endl;
+        iaea_destroy_source(&id, &result);
+        return 1;
+    }
+    int rc = 0;
+    if (historyIndex) {
+        iaea_write_history_index(&id, &result);
+        if (result != 0) {
+            cerr << "Error writing the history index of " << outFile << " (code " << result << ")." << endl;
+            rc = 1;
+        } else {
+            cout << "History index written to " << outFile << ".IAEAidx" << endl;
+        }
+    }
+    if (zoneMap) {
+        iaea_write_zone_map(&id, &result);
+        if (result != 0) {
+            cerr << "Error writing the zone map of " << outFile << " (code " << result << ")." << endl;
+            rc = 1;
+        } else {
+            cout << "Zone map written to " << outFile << ".IAEAzone" << endl;
+        }
+    }
+    if (typeIndex) {
+        iaea_write_type_index(&id, &result);
+        if (result != 0) {
+            cerr << "Error writing the type index of " << outFile << " (code " << result << ")." << endl;
+            rc = 1;
+        } else {
+            cout << "Type index written to " << outFile << ".IAEAtype" << endl;
+        }
+    }
+    if (gridCells > 0) {
+        IAEA_I32 cells = gridCells;
+        iaea_write_grid_index(&id, &cells, &cells, &result);
+        if (result != 0) {
+            cerr << "Error writing the grid index of " << outFile << " (code " << result << ")." << endl;
+            rc = 1;
+        } else {
+            cout << "Grid index written to " << outFile << ".IAEAgrid" << endl;
+        }
+    }
+    iaea_destroy_source(&id, &result);
+    return rc;
+}
+
+int main(int argc, char* argv[]) {
+    // Options come first; the remaining arguments are file bases.
+    MergeOptions opts;
+    int treeWidth = 0; // 0: one flat merge
+    bool resume = false;
+    bool virtualOutput = false;
+    bool historyIndex = false;
+    bool zoneMap = false;
+    bool typeIndex = false;
+    int gridCells = 0; // 0: no grid index
+    bool compress = false;
+    IAEA_I64 frameRecords = 0; // 0: the library default
+    vector<string> fileArgs;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--no-passthrough") {
+            opts.allowPassthrough = false;
+        } else if (arg == "--zero-copy") {
+            opts.zeroCopy = true;
+        } else if (arg == "--header-stats") {
+            opts.headerStats = true;
+        } else if (arg == "--pipeline") {
+            opts.pipeline = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            opts.numThreads = atoi(argv[++i]);
+            if (opts.numThreads < 1) {
+                cerr << "Invalid number of threads: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--max-open" && i + 1 < argc) {
+            opts.maxOpen = atoi(argv[++i]);
+            if (opts.maxOpen < 2) {
+                cerr << "Invalid number of open inputs: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--tree" && i + 1 < argc) {
+            treeWidth = atoi(argv[++i]);
+            if (treeWidth < 2) {
+                cerr << "Invalid tree width: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--virtual") {
+            virtualOutput = true;
+        } else if (arg == "--history-index") {
+            historyIndex = true;
+        } else if (arg == "--zone-map") {
+            zoneMap = true;
+        } else if (arg == "--type-index") {
+            typeIndex = true;
+        } else if (arg == "--grid-index" && i + 1 < argc) {
+            gridCells = atoi(argv[++i]);
+            if (gridCells < 1 || gridCells > 4096) {
+                cerr << "Invalid number of grid cells: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--frame-records" && i + 1 < argc) {
+            frameRecords = atoll(argv[++i]);
+            if (frameRecords < 1) {
+                cerr << "Invalid number of records per frame: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--header-cache") {
+            IAEA_I32 mode = 1, res;
+            iaea_set_header_cache(&mode, &res);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option: " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            fileArgs.push_back(arg);
+        }
+    }
+    if (fileArgs.size() < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (opts.pipeline && (opts.zeroCopy || opts.headerStats || !opts.allowPassthrough)) {
+        cerr << "--pipeline cannot be combined with --zero-copy, --header-stats or --no-passthrough; ignoring it." << endl;
+        opts.pipeline = false;
+    }
+    
+    // The last argument is the output file base; all preceding ones are input files.
+    vector<string> inputFiles(fileArgs.begin(), fileArgs.end() - 1);
+    const char* outFile = fileArgs.back().c_str();
+    
+    if (virtualOutput) {
+        if (treeWidth > 0 || opts.numThreads > 1 || opts.pipeline || opts.zeroCopy || !opts.allowPassthrough)
+            cerr << "--virtual copies no records; ignoring --tree, --threads, --pipeline, --zero-copy and --no-passthrough." << endl;
+        if (compress)
+            cerr << "--virtual writes no records to compress; ignoring --compress." << endl;
+        compress = false;
+        if (virtualMerge(inputFiles, outFile, opts) != 0) return 1;
+    } else if (treeWidth > 0 && (int)inputFiles.size() > treeWidth) {
+        if (treeMerge(inputFiles, outFile, opts, treeWidth, resume) != 0) return 1;
+    } else if (mergeFiles(inputFiles, outFile, opts, false) != 0) {
+        return 1;
+    }
+    // The indexes are built for the records as they are read, so compressed
+    // ones are indexed once compressed
+    if (compress && compressOutput(outFile, frameRecords, opts.numThreads) != 0) return 1;
+    if ((historyIndex || zoneMap || typeIndex || gridCells > 0) &&
+        writeIndexes(outFile, historyIndex, zoneMap, typeIndex, gridCells) != 0) return 1;
     cout << "Merging complete." << endl;
     return 0;
 }
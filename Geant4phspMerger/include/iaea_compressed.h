@@ -0,0 +1,132 @@
+#ifndef IAEA_COMPRESSED
+#define IAEA_COMPRESSED
+
+#include <cstdio>
+#include <mutex>
+
+#include "iaea_history_index.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the records of a compressed phsp, whose header has a
+// $RECORD_COMPRESSION: block (see iaea_compress_source)
+#define COMPRESSED_PHSP_EXTENSION ".IAEAphspz"
+
+// Changed whenever the container layout changes
+#define COMPRESSED_PHSP_VERSION 1
+
+// Records per frame unless another frame size is asked for
+#define COMPRESSED_FRAME_RECORDS 65536
+
+/* *********************************************************************** */
+// structures
+
+// The container holds a tag, the record length, frame size, records and
+// frames, the offset of every frame (and of the end of the last one), and
+// then the frames. A frame holds frame_records records (the last one the
+// remainder), compressed on its own: any frame can be read without the
+// others. The bytes of the records are stored column by column (the first
+// byte of every record, then the second...), which groups the bytes of
+// the floats that compress well.
+
+// One frame, decompressed
+struct iaea_compressed_frame
+{
+  IAEA_I64 number;         // -1 if none
+  IAEA_I64 n_records;
+  char *records;           // frame_records records
+  char *columns;           // the records column by column
+  char *packed;            // the compressed frame
+  IAEA_I64 packed_size;
+
+public:
+      void initialize() { number = -1; n_records = 0; records = columns = packed = NULL; packed_size = 0; }
+      void release();
+};
+
+// Reads the records of a compressed phsp as if they were a phsp file:
+// positions are byte offsets in the records, decompressed.
+struct iaea_compressed_reader
+{
+  FILE *file;
+  IAEA_I32 compression;
+  IAEA_I64 reclength;
+  IAEA_I64 frame_records;
+  IAEA_I64 n_records;
+  IAEA_I64 n_frames;
+  IAEA_I64 *offsets;       // of every frame in the file, and of its end
+
+  iaea_compressed_frame current;    // the frame read in turn
+  iaea_compressed_frame positioned_frame;  // the frame of read_at
+  IAEA_I64 position;       // next record
+  bool eof;                // a read went past the last record
+
+  std::mutex positioned;   // read_at may be called from several threads
+
+public:
+      iaea_compressed_reader();
+      ~iaea_compressed_reader();
+      // The container open in file (taken over), for records of reclength
+      // bytes; FAIL if it is not one written by this build for them
+      short initialize(FILE *p_file, IAEA_I64 record_length);
+
+      // As the functions of iaea_record_type of the same name
+      const char *fetch_records(char *buffer, IAEA_I64 *n);
+      IAEA_I64 tell_file() { return(position*reclength); }
+      short seek_file(IAEA_I64 offset);
+      bool end_of_file() { return(eof); }
+      void rewind_file() { seek_file(0); }
+      // Reads n_bytes from offset on without moving the position, as
+      // pread; returns the number of bytes read or -1
+      IAEA_I64 read_at(char *buffer, IAEA_I64 n_bytes, IAEA_I64 offset);
+      // Bytes of the records, decompressed
+      IAEA_I64 size() { return(n_records*reclength); }
+
+private:
+      // Decompresses frame f into frame; FAIL on errors
+      short load_frame(iaea_compressed_frame *frame, IAEA_I64 f);
+};
+
+// Writes a container frame by frame, in order, through a temporary file
+// that is renamed when it is complete (see iaea_open_sidecar)
+struct iaea_compressed_writer
+{
+  FILE *file;
+  char file_name[MAX_STR_LEN];
+  char temp_file[MAX_STR_LEN + 32];
+  IAEA_I32 compression;
+  IAEA_I64 reclength;
+  IAEA_I64 frame_records;
+  IAEA_I64 n_records;
+  IAEA_I64 n_frames;
+  IAEA_I64 n_written;      // frames written
+  IAEA_I64 *offsets;
+
+public:
+      iaea_compressed_writer() { file = NULL; offsets = NULL; }
+      ~iaea_compressed_writer() { discard(); }
+      short open(const char *container_file, IAEA_I32 method, IAEA_I64 record_length,
+                 IAEA_I64 records_per_frame, IAEA_I64 records);
+      // Appends the next frame, as iaea_pack_frame packed it
+      short write_frame(const char *packed, IAEA_I64 n_bytes);
+      // Writes the offsets and renames the container once every frame is in
+      short close();
+      // Drops the temporary file of a container not closed
+      void discard();
+};
+
+/* *********************************************************************** */
+// functions
+
+// Room iaea_pack_frame needs for n_bytes of records
+IAEA_I64 iaea_packed_bound(IAEA_I64 n_bytes);
+
+// Compresses n records of record_length bytes into packed (of
+// iaea_packed_bound bytes), using columns (n*record_length bytes) to
+// reorder them; packed_bytes is set to the bytes used
+short iaea_pack_frame(IAEA_I32 compression, const char *records, IAEA_I64 n,
+                      IAEA_I64 record_length, char *columns, char *packed,
+                      IAEA_I64 *packed_bytes);
+
+#endif
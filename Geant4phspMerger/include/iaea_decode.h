@@ -0,0 +1,56 @@
+#ifndef IAEA_DECODE
+#define IAEA_DECODE
+
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// defines
+
+// Records decoded at once by the block decoders: the columns of a block
+// stay in the first level caches
+#define DECODE_BLOCK_RECORDS 4096
+
+// Decoding kernels, from the most portable to the widest
+#define IAEA_DECODE_SCALAR 0
+#define IAEA_DECODE_SSE4   1
+#define IAEA_DECODE_AVX2   2
+#define IAEA_DECODE_AVX512 3
+
+/* *********************************************************************** */
+// structures
+
+// Packed records decoded column by column. Every column has one element
+// per record; fields that are not stored in the records are set to the
+// value left in the iaea_record_type, as decode_particle leaves them.
+struct iaea_decoded_block
+{
+  IAEA_I64 capacity;      // records the columns can hold
+
+  IAEA_I32 *particle;     // particle type, without the sign of w
+  IAEA_I32 *new_history;  // 1 if the energy was stored negative
+  float *energy;          // kinetic energy (absolute value)
+  float *x, *y, *z;
+  float *u, *v, *w;       // u and v are renormalized if u^2+v^2 > 1
+  float *weight;
+  float *extrafloat;      // extra float k of record i at [k*capacity + i]
+  IAEA_I32 *extralong;    // likewise
+
+public:
+      short allocate(IAEA_I64 n_records);
+      void release();
+};
+
+/* *********************************************************************** */
+// functions
+
+// Widest kernel supported by this processor (checked once)
+int iaea_decode_kernel();
+
+// Decodes n (<= capacity) packed records in the layout of p into the
+// columns of block, with the given kernel, and leaves p as decode_particle
+// leaves it after the last record. The result does not depend on the
+// kernel: every kernel gives exactly what decode_particle gives.
+void iaea_decode_records(iaea_record_type *p, const char *records, IAEA_I64 n,
+                         iaea_decoded_block *block, int kernel = iaea_decode_kernel());
+
+#endif
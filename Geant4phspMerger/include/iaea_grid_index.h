@@ -0,0 +1,64 @@
+#ifndef IAEA_GRID_INDEX
+#define IAEA_GRID_INDEX
+
+#include "iaea_history_index.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the grid index kept next to a phsp (see iaea_write_grid_index)
+#define GRID_INDEX_EXTENSION ".IAEAgrid"
+
+// Changed whenever the grid index layout changes
+#define GRID_INDEX_VERSION 1
+
+// Largest number of cells along x or y
+#define GRID_INDEX_MAX_CELLS 4096
+
+/* *********************************************************************** */
+// structures
+
+// The records of a phsp bucketed by the (x,y) cell of a grid over the
+// x and y ranges of its header. Records outside those ranges are counted in
+// the nearest border cell, so that a region always finds all its records.
+// The record numbers of the cells are stored one cell after the other, the
+// cells row by row (x varies fastest), every cell in increasing order; only
+// the cell starts are kept in memory, the record numbers stay in the file.
+struct iaea_grid_index
+{
+  iaea_phsp_file_id file;     // the file indexed
+  IAEA_I64 n_records;
+  IAEA_I32 n_x, n_y;
+  double minimum_x, maximum_x;
+  double minimum_y, maximum_y;
+  IAEA_I64 *cell_start;       // first record number of every cell, and n_records
+
+public:
+      void initialize();
+      void release();
+      // Column and row of x and y
+      IAEA_I32 column(double x) const;
+      IAEA_I32 row(double y) const;
+};
+
+/* *********************************************************************** */
+// functions
+
+// Reads the grid and the cell starts of an index written by this build;
+// FAIL (with index empty) otherwise
+short iaea_load_grid_index(const char *grid_file, iaea_grid_index *index);
+
+// Writes an index with the record numbers of its cells (cell_start[n_x*n_y]
+// of them); see iaea_save_sidecar
+short iaea_save_grid_index(const char *grid_file, const iaea_grid_index *index,
+                           const IAEA_I64 *records);
+
+// Reads the record numbers of the cells of columns first_column to
+// last_column and rows first_row to last_row into records (allocated with
+// malloc), in increasing order; n is set to their number
+short iaea_read_grid_records(const char *grid_file, const iaea_grid_index *index,
+                             IAEA_I32 first_column, IAEA_I32 last_column,
+                             IAEA_I32 first_row, IAEA_I32 last_row,
+                             IAEA_I64 **records, IAEA_I64 *n);
+
+#endif
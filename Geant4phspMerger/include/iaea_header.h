@@ -2,7 +2,10 @@
 #define IAEA_HEADER
 
 /* *********************************************************************** */
+#include <atomic>
+
 #include "iaea_record.h"
+#include "iaea_stats.h"
 
 // defines
 #define SEGMENT_BEG_TOKEN '$'
@@ -33,6 +36,99 @@
  //  more to be defined
 
 
+// Compression of the records ($RECORD_COMPRESSION:, see iaea_compressed.h)
+#define COMPRESSION_NONE 0
+#define COMPRESSION_ZLIB 1
+
+// Text fields of a header, in iaea_header_type::texts
+#define HEADER_COORDINATE_SYSTEM_DESCRIPTION   0
+#define HEADER_INPUT_FILE_FOR_EVENT_GENERATOR  1
+#define HEADER_TITLE                           2
+#define HEADER_MACHINE_TYPE                    3
+#define HEADER_MC_CODE_AND_VERSION             4
+#define HEADER_TRANSPORT_PARAMETERS            5
+#define HEADER_BEAM_NAME                       6
+#define HEADER_FIELD_SIZE                      7
+#define HEADER_NOMINAL_SSD                     8
+#define HEADER_VARIANCE_REDUCTION_TECHNIQUES   9
+#define HEADER_INITIAL_SOURCE_DESCRIPTION     10
+#define HEADER_MC_INPUT_FILENAME              11
+#define HEADER_PUBLISHED_REFERENCE            12  // the preferred citation
+#define HEADER_AUTHORS                        13
+#define HEADER_INSTITUTION                    14
+#define HEADER_LINK_VALIDATION                15
+#define HEADER_ADDITIONAL_NOTES               16
+#define NUM_HEADER_TEXTS                      17
+
+// Null terminated strings allocated at once, and freed with the last
+// iaea_header_string that points into them
+struct iaea_string_arena
+{
+  std::atomic<int> references;
+  char text[1];   // as long as needed
+};
+
+// A text field: where it is, its length and the arena that holds it. Headers
+// share texts by pointing into the same arena; texts are never changed in place.
+struct iaea_header_string
+{
+  const char *text;          // NULL reads as ""
+  IAEA_I32 length;
+  iaea_string_arena *arena;
+};
+
+// A member of a virtual phsp: records first_record to
+// first_record+n_records-1 (counted from zero) of the phsp file of the base
+// name file (see iaea_add_virtual_member)
+struct iaea_virtual_member
+{
+  char *file;
+  IAEA_I64 first_record;
+  IAEA_I64 n_records;
+};
+
+// A block name ($NAME:) of a header text and the line it is on
+struct iaea_header_block
+{
+  IAEA_I64 name;   // offset of the name in the lines
+  int line;
+};
+
+// A header file read into memory at once and split into the lines that
+// get_string would give, with its block names sorted, so that every keyword
+// is found without reading the file again (see read_header)
+struct iaea_header_text
+{
+  char *file;                 // the header file, as it was read
+  IAEA_I64 file_size;
+  char *lines;                // every line, null terminated, one after another
+  IAEA_I64 *line_offset;      // where every line starts in lines
+  int n_lines;
+  iaea_header_block *blocks;  // sorted by name, then by line
+  int n_blocks;
+  int next_line;              // line read by get_line
+
+  // Texts read so far (see read_text), null terminated one after another
+  char *texts;
+  IAEA_I64 texts_used, texts_size;
+  IAEA_I64 text_offset[NUM_HEADER_TEXTS];   // -1 if not read
+  char *block;                // zeroed buffer for a block of lines
+  IAEA_I64 block_extent;      // bytes of block written since it was zeroed
+
+public:
+      short load(FILE *fheader);
+      // Splits the file loaded into lines and blocks
+      short parse();
+      void release();
+      // Moves to the line after the first block called blockname
+      short find_block(const char *blockname);
+      // The next line, as get_string reads it
+      short get_line(char *line);
+      // The zeroed buffer (MAX_STR_LEN*MAX_NUMB_LINES+1 bytes), NULL if it cannot be allocated
+      char *get_block_buffer();
+      short add_text(int which, const char *s);
+};
+
 struct iaea_header_type
 {
   FILE *fheader;
@@ -70,57 +166,31 @@ struct iaea_header_type
   // ******************************************************************************
   // 2. Mandatory description of the phsp
   
-  char coordinate_system_description[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  // Text fields are kept in texts (see get_text): coordinate system
+  // description and, for event generators, the input file
 
   // Counters for phsp file
   IAEA_I64 orig_histories;  
   IAEA_I64 nParticles;
   IAEA_I64 particle_number[MAX_NUM_PARTICLES];
 
-  // Event generator input file
-  char input_file_for_event_generator[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
   // ******************************************************************************
   // 3. Mandatory additional information
   
   unsigned int iaea_index; // Agency ID
-  char title[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char machine_type[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char MC_code_and_version[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  // title, machine type, Monte Carlo code and version in texts
   
   float global_photon_energy_cutoff;
   
   float global_particle_energy_cutoff;
   
-  char transport_parameters[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  // transport parameters in texts
 
   // ******************************************************************************
   // 4. Optional description
-  
-  char beam_name[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char field_size[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char nominal_SSD[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char variance_reduction_techniques[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char initial_source_description[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  // All of it is text (beam name to additional notes, see HEADER_BEAM_NAME)
 
-  // Documentation sub-section
-  char MC_input_filename[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  // Assumed to be the preferred citation
-  char published_reference[MAX_STR_LEN*MAX_NUMB_LINES+1]; 
-  char authors[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char institution[MAX_STR_LEN*MAX_NUMB_LINES+1];
-  
-  char link_validation[MAX_STR_LEN*MAX_NUMB_LINES+1];
-
-  char additional_notes[MAX_STR_LEN*MAX_NUMB_LINES+1];
+  iaea_header_string texts[NUM_HEADER_TEXTS];
 
   // ******************************************************************************
   // 5. Optional statistical information
@@ -136,25 +206,92 @@ struct iaea_header_type
 
   IAEA_I64 read_indep_histories;  
 
+  // ******************************************************************************
+  // 6. Members of a virtual phsp ($VIRTUAL_MEMBERS:), none for a phsp file
+  iaea_virtual_member *members;
+  IAEA_I32 n_members, members_size;
+
+  // ******************************************************************************
+  // 7. Compression of the records ($RECORD_COMPRESSION:), COMPRESSION_NONE for
+  //    a phsp file; the records of a compressed phsp are in its .IAEAphspz
+  //    file, in frames of frame_records records
+  IAEA_I32 compression;
+  IAEA_I64 frame_records;
+
 // CLASS FUNCTIONS
 
 public:
-      int read_header();
+      // With a cache_file, the header is loaded from it if it matches the
+      // header file, and saved to it after being read otherwise
+      int read_header(const char *cache_file = NULL);
       int write_header();
+      // Writes the $RECORD_COMPRESSION: block (nothing if not compressed),
+      // as the last block of write_header
+      int write_compression();
       int print_header();
       int set_record_contents(iaea_record_type *p_iaea_record);
       int get_record_contents(iaea_record_type *p_iaea_record);
       void initialize_counters();
       void update_counters(iaea_record_type *p_iaea_record);
+      // As update_counters for n particles, given by quantity as they are
+      // stored in the records (new_history as IsNewHistory)
+      void update_counters(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                           const float weight[], const float x[], const float y[],
+                           const float z[], const IAEA_I32 new_history[]);
+      void merge_counters(const iaea_header_type *p_iaea_header);
+      void add_statistics(const iaea_statistics *s);
+      short merge_statistics(const iaea_header_type *p_iaea_header);
+
+      // Text fields (HEADER_TITLE, ...)
+      const char *get_text(int which) const
+      { return(texts[which].text != NULL ? texts[which].text : ""); }
+      short set_text(int which, const char *s);
+      // Sets the texts with offset >= 0 to the strings at those offsets of
+      // s (n_bytes long), all in one arena; the others are left unset
+      short set_texts(const char *s, const IAEA_I64 offset[NUM_HEADER_TEXTS], IAEA_I64 n_bytes);
+      // Shares a text of another header, without copying it
+      void share_text(int which, const iaea_header_type *p_iaea_header);
+      void release_texts();
+
+      // Members of a virtual phsp
+      short add_member(const char *file, IAEA_I64 first_record, IAEA_I64 n_records);
+      void release_members();
 
 private:
-      int read_block(char *lineread, const char *blockname);
-      int get_block(char *lineread);
-      int get_blockname(char *line, const char *blockname);
+      int read_header_text(iaea_header_text *text);
+      int read_text(iaea_header_text *text, int which, const char *blockname);
+      int read_block(iaea_header_text *text, char *lineread, const char *blockname);
+      int get_block(iaea_header_text *text, char *lineread, IAEA_I64 *extent = NULL);
+      int get_blockname(iaea_header_text *text, const char *blockname);
+      int read_compression(iaea_header_text *text);
+      int read_members(iaea_header_text *text);
       int write_blockname(const char *blockname);
 
       int check_byte_order();
       void print_statistics();
 };
 
+// The counters of a header, which grow as its particles are read, kept
+// while the header itself is released (see iaea_suspend_source)
+struct iaea_header_summary
+{
+  IAEA_I64 orig_histories;
+  IAEA_I64 nParticles;
+  IAEA_I64 particle_number[MAX_NUM_PARTICLES];
+  IAEA_I64 read_indep_histories;
+  double averageKineticEnergy[MAX_NUM_PARTICLES];
+  double sumParticleWeight[MAX_NUM_PARTICLES];
+  double maximumKineticEnergy[MAX_NUM_PARTICLES];
+  double minimumKineticEnergy[MAX_NUM_PARTICLES];
+  double minimumWeight[MAX_NUM_PARTICLES];
+  double maximumWeight[MAX_NUM_PARTICLES];
+  double minimumX, maximumX;
+  double minimumY, maximumY;
+  double minimumZ, maximumZ;
+
+public:
+      void save(const iaea_header_type *p_iaea_header);
+      void restore(iaea_header_type *p_iaea_header) const;
+};
+
 #endif
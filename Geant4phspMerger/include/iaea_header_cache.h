@@ -0,0 +1,43 @@
+#ifndef IAEA_HEADER_CACHE
+#define IAEA_HEADER_CACHE
+
+#include "iaea_history_index.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the binary cache kept next to a header (see iaea_set_header_cache)
+#define HEADER_CACHE_EXTENSION ".IAEAcache"
+
+// Changed whenever the cache layout changes
+#define HEADER_CACHE_VERSION 2
+
+/* *********************************************************************** */
+// structures
+
+// What a cached header is valid for: the size, modification time and
+// contents (FNV-1a hash) of its header file
+struct iaea_header_file_id
+{
+  IAEA_I64 size;              // -1 if unknown
+  IAEA_I64 mtime_sec, mtime_nsec;
+  IAEA_I64 hash;
+
+public:
+      short identify(FILE *fheader, const char *contents, IAEA_I64 n_bytes);
+};
+
+/* *********************************************************************** */
+// functions
+
+// Sets the fields read_header reads from the cache, if it was written for
+// a header file with the same id. Returns FAIL (and leaves p_iaea_header
+// as it was) otherwise.
+short iaea_load_header_cache(const char *cache_file, const iaea_header_file_id *id,
+                             iaea_header_type *p_iaea_header);
+
+// Writes the fields read by read_header to the cache (see iaea_save_sidecar)
+short iaea_save_header_cache(const char *cache_file, const iaea_header_file_id *id,
+                             const iaea_header_type *p_iaea_header);
+
+#endif
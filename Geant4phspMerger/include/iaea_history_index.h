@@ -0,0 +1,117 @@
+#ifndef IAEA_HISTORY_INDEX
+#define IAEA_HISTORY_INDEX
+
+#include <cstdio>
+
+#include "iaea_header.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the history index kept next to a phsp (see iaea_write_history_index)
+#define HISTORY_INDEX_EXTENSION ".IAEAidx"
+
+// Changed whenever the index layout changes
+#define HISTORY_INDEX_VERSION 1
+
+// History starts between two checkpoints of the number of histories
+#define HISTORY_INDEX_STRIDE 1024
+
+/* *********************************************************************** */
+// structures
+
+// The file an index of a phsp was built for: its phsp file, or its header
+// for a virtual phsp. Indexes are used only while it keeps its size and
+// modification time.
+struct iaea_phsp_file_id
+{
+  IAEA_I64 size;              // -1 if unknown
+  IAEA_I64 mtime_sec, mtime_nsec;
+  IAEA_I64 record_length;
+
+public:
+      short identify(FILE *file, IAEA_I64 reclength);
+      bool same_file(const iaea_phsp_file_id *other) const;
+};
+
+// The tag every file kept next to a phsp (index, map, cache or container)
+// starts with. Such files are only read by the build that wrote them: same
+// magic, version, type sizes and byte order, and the same layout (whatever
+// else the contents depend on, e.g. a stride or the size of a structure).
+struct iaea_sidecar_tag
+{
+  char magic[8];
+  IAEA_I32 version;
+  IAEA_I32 byte_order;        // 0x01020304 as written
+  IAEA_I32 size_of_i64;
+  IAEA_I32 layout;
+
+public:
+      void make(const char *kind_magic, IAEA_I32 kind_version, IAEA_I32 kind_layout);
+      bool matches(const iaea_sidecar_tag *other) const;
+      // Reads a tag from in; false unless it matches this one
+      bool read_matches(FILE *in) const;
+      bool write(FILE *out) const { return(fwrite(this, sizeof(*this), 1, out) == 1); }
+};
+
+// The records of a phsp that start a history, as get_n_stat finds them (a
+// stored incremental number of histories, or a negative energy), with the
+// number of histories before every HISTORY_INDEX_STRIDE-th start. Histories
+// are numbered as read_indep_histories counts them: every start adds its
+// n_stat, so histories without particles fall on the next start.
+struct iaea_history_index
+{
+  iaea_phsp_file_id file;     // the file indexed
+  IAEA_I64 n_records;         // records indexed
+  IAEA_I64 n_histories;       // histories in them
+  IAEA_I64 n_starts, starts_size;
+  IAEA_I64 *starts;           // record numbers (from 0), increasing
+  IAEA_I64 n_checkpoints, checkpoints_size;
+  IAEA_I64 *checkpoints;      // histories before starts[k*HISTORY_INDEX_STRIDE]
+
+public:
+      void initialize();
+      void release();
+
+      // Adds record, which starts n_stat histories; records are added in order
+      short add_start(IAEA_I64 record, IAEA_I64 n_stat);
+
+      // First start at or after record (n_starts if none)
+      IAEA_I64 find_start(IAEA_I64 record) const;
+      // Record of start s, n_records past the last start
+      IAEA_I64 start_record(IAEA_I64 s) const
+         { return((s < n_starts) ? starts[s] : n_records); }
+      // The checkpoint before history (1 to n_histories): the histories
+      // before its first start are in *before, those up to the next
+      // checkpoint in *after. Returns the checkpoint, -1 if out of range.
+      IAEA_I64 find_checkpoint(IAEA_I64 history, IAEA_I64 *before, IAEA_I64 *after) const;
+};
+
+/* *********************************************************************** */
+// functions
+
+// Name of the file with extension kept next to a phsp: the base name of
+// header_file (without .IAEAheader or .IAEAphsp) with extension. Returns
+// FAIL if it does not fit in MAX_STR_LEN.
+short iaea_sidecar_name(const char *header_file, const char *extension, char *sidecar_file);
+
+// Several processes (or threads) may write the same file next to a phsp at
+// once, so it is written to a temporary file of its own (temp_file, of
+// MAX_STR_LEN + 32 bytes) and renamed once complete: a file is never seen
+// half written. iaea_commit_sidecar closes out and renames it if ok, or
+// removes it; FAIL if it was not renamed.
+FILE *iaea_open_sidecar(const char *sidecar_file, char *temp_file);
+short iaea_commit_sidecar(FILE *out, bool ok, const char *temp_file, const char *sidecar_file);
+
+// Writes sidecar_file at once with write(out, data) (false on errors), as
+// iaea_open_sidecar and iaea_commit_sidecar do
+short iaea_save_sidecar(const char *sidecar_file, bool (*write)(FILE *out, const void *data),
+                        const void *data);
+
+// Reads an index written by this build; FAIL (with index empty) otherwise
+short iaea_load_history_index(const char *index_file, iaea_history_index *index);
+
+// Writes an index (see iaea_save_sidecar)
+short iaea_save_history_index(const char *index_file, const iaea_history_index *index);
+
+#endif
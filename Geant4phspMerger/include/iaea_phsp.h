@@ -61,6 +61,9 @@
 * The need for an Id arises from the fact that some applications may
 * want to use several IAEA sources at once. The implementation must therefore
 * maintain a list of already initialized sources.
+* The number of sources is not limited: the list grows as needed, the
+* smallest free Id is assigned, and sources may be created and destroyed
+* from several threads at once.
 * If an error occures (e.g. header file does not exist, there are errors
 * in the header file, etc.), assign a negative number to result.
 * (one may want to specify a list of error codes so that the application
@@ -77,6 +80,30 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
                      const IAEA_I32 *access, IAEA_I32 *result, 
                      int hf_length);
 
+/************************************************************************
+* Read path of the sources opened for reading
+*
+* Sets how the records of sources opened afterwards with access = 1 are
+* read: mode = 0 => stdio, mode = 1 => memory mapping (default),
+* mode = 2 => memory mapping with all pages read in at opening.
+* Mapped records are decoded in place, and iaea_set_record does not need
+* a system call. result is set to -1 for a wrong mode.
+*************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_mapping(const IAEA_I32 *mode, IAEA_I32 *result);
+
+/************************************************************************
+* Binary header cache
+*
+* mode = 1 => headers of sources opened afterwards with access = 1 are
+* loaded from a binary cache (base name with .IAEAcache) if it matches the
+* size, modification time and contents of the header file, and parsed and
+* cached otherwise. mode = 0 => headers are always parsed (default).
+* result is set to -1 for a wrong mode.
+*************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_header_cache(const IAEA_I32 *mode, IAEA_I32 *result);
+
 /************************************************************************
 * Maximum number of particles 
 *
@@ -309,6 +336,21 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
                        const IAEA_I32 *i_chunk, const IAEA_I32 *n_chunk, 
                        IAEA_I32 *is_ok);
 
+/**************************************************************************
+* Portion of a parallel run
+*
+* Sets first_record (counted from 0) and n_records to the records that
+* iaea_set_parallel delivers for chunk i_chunk of n_chunk of source id.
+* Portions start at the first record of a history, so a job reading
+* n_records particles after iaea_set_parallel reads whole histories only.
+* The variable result is set to 0 if everything went smoothly, or to the
+* error code of iaea_set_parallel.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_chunk(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                             const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                             IAEA_I64 *n_records, IAEA_I32 *result);
+
 /**************************************************************************
 * setting the pointer to a user-specified record no. in the file
 *
@@ -358,6 +400,25 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints);
 
+/**************************************************************************
+* Get a batch of particles
+*
+* Return up to n next particles of the source with Id id into arrays of n
+* elements, as n calls of iaea_get_particle would, but reading and
+* decoding the records a block at a time. Extra variables are stored
+* variable by variable: extra_floats[k*n + i] is extra float k of
+* particle i (an n x NUM_EXTRA_FLOAT array in Fortran), likewise
+* extra_ints. n_read is set to the number of particles returned (less
+* than n at the end of the file), -1 if the source does not exist and -3
+* if memory cannot be allocated.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+             IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+             IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+             IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+             IAEA_Float extra_floats[], IAEA_I32 extra_ints[]);
+
 /**************************************************************************
 * Write a particle 
 * n_stat = 0 for a secondary particle
@@ -378,18 +439,80 @@ const IAEA_Float *u,
 const IAEA_Float *v,
 const IAEA_Float *w,  /* direction in cartesian coordinates*/
 const IAEA_Float *extra_floats,
-const IAEA_I32 *extra_ints);
+const IAEA_I32 *extra_ints);
+
+/**************************************************************************
+* Write a batch of particles
+*
+* Write n particles given in arrays of n elements, one per quantity, to
+* the source with Id id, as n calls of iaea_write_particle would, with
+* one write per block of records. Extra variables are stored as for
+* iaea_get_particles. n_written is set to the number of particles written,
+* -1 if the source does not exist or writing fails and -3 if memory
+* cannot be allocated.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+             const IAEA_I32 n_stat[], const IAEA_I32 type[],
+             const IAEA_Float E[], const IAEA_Float wt[],
+             const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+             const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+             const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[]);
 
 /***************************************************************************
 * Destroy a source 
 *
 * This function de-initializes the source with Id id, closing all open
 * files, deallocating memory, etc. Nothing happens if a source with that
-* id does not exist. Header is updated.
+* id does not exist. Header is updated. The Id is given back, to be
+* assigned again by iaea_new_source.
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
 void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result);
 
+/***************************************************************************
+* Suspend a source opened for reading
+*
+* Closes the files of the source with Id id and releases its header,
+* keeping its Id, its file name, its position in the phsp file and the
+* counters of its header. The source cannot be used until it is resumed
+* with iaea_resume_source. This lets an application keep thousands of
+* sources without holding a header and two open files for each of them.
+*
+* result is set to 1 if the source is suspended (or already was), -1 if
+* it does not exist and -2 if it was not opened for reading (access = 1).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_suspend_source(const IAEA_I32 *id, IAEA_I32 *result);
+
+/***************************************************************************
+* Resume a suspended source
+*
+* Opens again the files of the source with Id id, reads its header and
+* goes back to where it was suspended, with the counters it had. If a
+* limit was set with iaea_set_max_open_sources, waits until fewer sources
+* are open for reading.
+*
+* result is set as by iaea_new_source (IAEA index, or negative if the
+* files cannot be opened or read), to 1 if the source was not suspended,
+* and to -1 if it does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_resume_source(const IAEA_I32 *id, IAEA_I32 *result);
+
+/***************************************************************************
+* Maximum number of sources open for reading
+*
+* Sets to max_open the number of sources opened for reading (access = 1)
+* that may be open at once; 0 (the default) sets no limit. Suspended
+* sources do not count. iaea_new_source and iaea_resume_source wait until
+* a source is suspended or destroyed by another thread when the limit is
+* reached, so a thread must not open more sources than max_open itself.
+* result is set to -1 if max_open is negative.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_max_open_sources(const IAEA_I32 *max_open, IAEA_I32 *result);
+
 /***************************************************************************
 * Print the current header associated to source id
 *
@@ -411,4 +534,396 @@ void iaea_copy_header(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
 IAEA_EXTERN_C IAEA_EXPORT 
 void iaea_update_header(const IAEA_I32 *source_ID, IAEA_I32 *result);
 
+/***************************************************************************
+* Compare the record layouts of two sources
+*
+* result is set to 1 if the records of source_ID and destiny_ID are packed
+* identically (same RECORD_CONTENTS, RECORD_CONSTANT, extra variable types
+* and record length) in the byte order of the running machine, so that raw
+* records can be moved between them without decoding. result is set to 0
+* if the layouts differ and to negative if a source does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compare_record_layout(const IAEA_I32 *source_ID,
+                                const IAEA_I32 *destiny_ID, IAEA_I32 *result);
+
+/***************************************************************************
+* Copy the record layout (RECORD_CONTENTS, RECORD_CONSTANT, extra variable
+* types and byte order) of the source_id to the destiny_id
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_record_layout(const IAEA_I32 *source_ID,
+                             const IAEA_I32 *destiny_ID, IAEA_I32 *result);
+
+/***************************************************************************
+* Widen the record layout of the destiny_id to hold records of source_id
+*
+* Variables stored by source_ID, or kept constant at another value, become
+* stored in destiny_ID. Extra variables are matched by type, and the ones
+* destiny_ID lacks are appended. result is set to negative if a source
+* does not exist (-1), if the layout is wrongly defined (-2) or if there
+* are too many extra variables (-3).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_record_layout(const IAEA_I32 *source_ID,
+                              const IAEA_I32 *destiny_ID, IAEA_I32 *result);
+
+/***************************************************************************
+* Copy records from the source_id to the destiny_id
+*
+* Up to n_records records are moved in large blocks from the current
+* position of source_ID to the end of destiny_ID without being decoded to
+* particles and encoded again. Records of the same layout are copied raw,
+* others are converted field by field to the layout of destiny_ID, with
+* extra variables matched by type. The counters of destiny_ID are updated
+* as iaea_write_particle would update them.
+*
+* n_copied is set to the number of records copied, -1 if a source does not
+* exist, -2 if the records cannot be converted (byte order differs from
+* the one of this machine), -3 if memory cannot be allocated and -4 if
+* writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                       const IAEA_I64 *n_records, IAEA_I64 *n_copied);
+
+/***************************************************************************
+* Get the length in bytes of one record of the source_id
+*
+* record_length is set to negative if phsp source does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_record_length(const IAEA_I32 *id, IAEA_I32 *record_length);
+
+/***************************************************************************
+* Reserve room for n_records records at the beginning of the destiny_id
+*
+* The phsp file is preallocated so that iaea_copy_records_at can fill it
+* from several threads. Particles written afterwards are appended after
+* the reserved room. result is set to negative if phsp source does not
+* exist (-1) or the file cannot be extended (-2).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_reserve_records(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                          IAEA_I32 *result);
+
+/***************************************************************************
+* Copy records from the source_id into a given place of the destiny_id
+*
+* Up to n_records records are read from the current position of source_ID
+* and written to destiny_ID starting at record first_record (counted from
+* zero). Records are copied raw when both layouts are the same and
+* converted to the layout of destiny_ID otherwise. Several threads may
+* call this function at once with different sources and disjoint ranges.
+*
+* n_copied is set to the number of records copied, -1 if a source does not
+* exist, -2 if the records cannot be converted, -3 if memory cannot be
+* allocated and -4 if reading or writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_at(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                          const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                          IAEA_I64 *n_copied);
+
+/***************************************************************************
+* Convert records from the source_id into a given place of the destiny_id
+* without updating the counters
+*
+* As iaea_copy_records_at, but the counters of destiny_ID are NOT updated
+* (see iaea_merge_header_statistics). Same return codes.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_transcode_records_at(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               IAEA_I64 *n_copied);
+
+/***************************************************************************
+* Copy records of several sources to the end of the destiny_id in a
+* pipeline of concurrent stages
+*
+* For every source k, up to n_records[k] records are copied from its
+* current position, with the same result as iaea_copy_records called for
+* the sources one after the other. n_readers threads read blocks of
+* records, n_workers threads convert them and gather their statistics and
+* the calling thread writes them in order.
+*
+* n_copied[k] is set to the number of records copied from source k, -1 if
+* the source does not exist, -2 if its records cannot be converted, -3 if
+* memory cannot be allocated and -4 if reading or writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_pipelined(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                 const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                 const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                 IAEA_I64 n_copied[]);
+
+/***************************************************************************
+* Copy raw records from the source_id into a given place of the destiny_id
+* without passing them through user space
+*
+* As iaea_copy_records_at for sources with the same record layout, but the
+* bytes are moved by the kernel (copy_file_range, with a pread/pwrite
+* fallback). The counters of destiny_ID are NOT updated.
+*
+* n_copied is set to the number of records copied, -1 if a source does not
+* exist, -2 if the record layouts differ, -3 if memory cannot be allocated
+* and -4 if reading or writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_splice_records(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                         IAEA_I64 *n_copied);
+
+/***************************************************************************
+* Add records already stored in the phsp file of the id to its counters
+*
+* Records first_record to first_record+n_records-1 (counted from zero) are
+* read back only to update the statistical information of the header.
+*
+* n_counted is set to the number of records counted, -1 if the phsp source
+* does not exist, -3 if memory cannot be allocated and -4 if reading fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_recount_records(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                          const IAEA_I64 *n_records, IAEA_I64 *n_counted);
+
+/***************************************************************************
+* Add the statistics of the source_id header to the counters of destiny_id
+*
+* The statistical information of the source_ID header is reduced into the
+* counters of destiny_ID, as if every particle of source_ID had been
+* written to it (sums, weighted averages, min of minima, max of maxima).
+*
+* result is set to negative if a source does not exist (-1) or if the
+* header of source_ID does not provide statistical information (-2).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_header_statistics(const IAEA_I32 *source_ID,
+                                  const IAEA_I32 *destiny_ID, IAEA_I32 *result);
+
+/***************************************************************************
+* Add records of the source_id to the virtual phsp destiny_id
+*
+* Records first_record to first_record+n_records-1 (counted from zero) of
+* source_ID (opened for reading) are added to destiny_ID by reference:
+* nothing is copied, the header of destiny_ID lists them in a
+* $VIRTUAL_MEMBERS: block. iaea_new_source then reads destiny_ID as one
+* phsp, member after member. Its phsp file stays empty and no particle may
+* be written to it. If count is set, the records are read once to update
+* the counters of destiny_ID; otherwise they must be set in another way
+* (e.g. iaea_merge_header_statistics).
+*
+* n_added is set to the number of records added, -1 if a source does not
+* exist, -2 if the record layouts differ, -3 if memory cannot be allocated,
+* -4 if reading fails, -5 if the file name cannot be listed and -6 if
+* source_ID is a compressed phsp.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_add_virtual_member(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                             const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                             const IAEA_I32 *count, IAEA_I64 *n_added);
+
+/***************************************************************************
+* Write the history index of a source
+*
+* Writes the .IAEAidx file of source id (opened for reading): the records
+* that start a history and periodic counts of the histories before them.
+* It is valid while the phsp file keeps its size and modification time,
+* and lets iaea_set_history, iaea_get_history_records and
+* iaea_set_parallel find history boundaries without reading the records.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* and -3 if the index file cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_history_index(const IAEA_I32 *id, IAEA_I32 *result);
+
+/***************************************************************************
+* Records of histories
+*
+* Sets first_record (counted from 0) and n_records to the records of the
+* n_histories histories from history first_history on (counted from 1) of
+* source id, opened for reading. A source without a valid index file is
+* read once to build the index in memory.
+*
+* result is set to 0 if everything went smoothly, -1 if the source does
+* not exist or was not opened for reading, -2 if the histories are out of
+* range and -3 if the records cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                              const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                              IAEA_I64 *n_records, IAEA_I32 *result);
+
+/***************************************************************************
+* Setting the pointer to a history
+*
+* The next particle read from source id is the first of history
+* history_num (counted from 1). result is set as by
+* iaea_get_history_records, or to -4 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result);
+
+/***************************************************************************
+* Write the zone map of a source
+*
+* Writes the .IAEAzone file of source id (opened for reading): for every
+* block of 65536 records, the counters the header keeps for the whole phsp
+* (per type counts, weight and energy ranges, position ranges, histories)
+* and the particle types present. It is valid while the phsp file keeps
+* its size and modification time.
+*
+* result is set to 0 if the map is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* and -3 if the map file cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_zone_map(const IAEA_I32 *id, IAEA_I32 *result);
+
+/***************************************************************************
+* Filter of the zones
+*
+* Sets what iaea_next_zone looks for in source id: particles of type type
+* (0 for any) with an energy and a position in the ranges given (ends
+* included). result is set to 0, or to -1 if the source does not exist or
+* was not opened for reading.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_zone_filter(const IAEA_I32 *id, const IAEA_I32 *type,
+                          const IAEA_Float *E_min, const IAEA_Float *E_max,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          const IAEA_Float *z_min, const IAEA_Float *z_max,
+                          IAEA_I32 *result);
+
+/***************************************************************************
+* Next zone that may hold particles passing the filter
+*
+* Moves source id to the next blocks of records (from the current position
+* on) that its zone map does not rule out for the filter of
+* iaea_set_zone_filter; first_record (counted from 0) and n_records are set
+* to those records, which must still be checked one by one. Without a
+* zone map all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record is left that may
+* pass the filter, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_zone(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                    IAEA_I32 *result);
+
+/***************************************************************************
+* Write the grid index of a source
+*
+* Writes the .IAEAgrid file of source id (opened for reading): its records
+* bucketed by the cell of a grid of n_x by n_y cells (1 to 4096 each) over
+* the x and y ranges of the header, the record numbers of every cell in
+* increasing order. It is valid while the phsp file keeps its size and
+* modification time.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read,
+* -3 if the index file cannot be written and -4 if n_x or n_y is out of
+* range.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_grid_index(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                           IAEA_I32 *result);
+
+/***************************************************************************
+* Region of the grid index
+*
+* Sets what iaea_next_grid_records looks for in source id: the records of
+* the cells of its grid index that overlap x_min to x_max and y_min to
+* y_max (ends included). result is set to 0, to -1 if the source does not
+* exist or was not opened for reading, or to -2 if the grid index file
+* cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_grid_region(const IAEA_I32 *id,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          IAEA_I32 *result);
+
+/***************************************************************************
+* Next records of the region of the grid index
+*
+* Moves source id to the next records of the region of
+* iaea_set_grid_region (from the current position on); first_record
+* (counted from 0) and n_records are set to the records of the region that
+* follow one another there, which must still be checked one by one.
+* Without a grid index all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record of the region is
+* left, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_grid_records(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result);
+
+/***************************************************************************
+* Write the type index of a source
+*
+* Writes the .IAEAtype file of source id (opened for reading): for every
+* particle type (the types without counters together), the runs of
+* records of that type that follow one another. It is valid while the phsp
+* file keeps its size and modification time.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* and -3 if the index file cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_type_index(const IAEA_I32 *id, IAEA_I32 *result);
+
+/***************************************************************************
+* Particle types of the type index
+*
+* Sets the particle types (n_types of types; a type out of 1 to
+* MAX_NUM_PARTICLES stands for all the types without counters) that
+* iaea_next_type_records looks for in source id; n_types 0 selects every
+* record. result is set to 0, to -1 if the source does not exist or was
+* not opened for reading, or to -2 if the type index file cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_select_types(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                       IAEA_I32 *result);
+
+/***************************************************************************
+* Next records of the types selected
+*
+* Moves source id to the next records of the types of iaea_select_types
+* (from the current position on); first_record (counted from 0) and
+* n_records are set to the records of those types that follow one another
+* there. Without a type index all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record of the types
+* selected is left, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_type_records(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result);
+
+/***************************************************************************
+* Compressed phsp
+*
+* Writes the records of source id (opened for reading) to a compressed
+* phsp, the base name of the source with .IAEAphspz: frames of
+* frame_records records (COMPRESSED_FRAME_RECORDS if 0) compressed with
+* zlib on their own, n_threads frames at once. The header is then given a
+* $RECORD_COMPRESSION: block, and iaea_new_source reads the compressed
+* phsp from then on; the phsp file can be removed. result is set to 0, to
+* -1 if the source does not exist or was not opened for reading, -2 if it
+* is virtual or compressed already, -3 if its records cannot be read or
+* compressed and -4 if the files cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compress_source(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                          const IAEA_I32 *n_threads, IAEA_I32 *result);
+
 #endif
@@ -0,0 +1,176 @@
+#ifndef IAEA_QUEUE
+#define IAEA_QUEUE
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/* *********************************************************************** */
+// defines
+
+// Tries of a blocking push or pop before it sleeps until the queue changes
+#ifndef QUEUE_SPINS
+  #define QUEUE_SPINS 64
+#endif
+
+/* *********************************************************************** */
+// structures
+
+// Bounded lock-free queue for several producers and consumers (after
+// D. Vyukov). Every cell carries a sequence number telling whether it is
+// free for the producer of that turn or filled for the consumer of that
+// turn, so producers and consumers only contend on their own position.
+// The capacity is rounded up to a power of two.
+//
+// The blocking push and pop spin a little and then sleep on a condition
+// variable. A successful push (pop) wakes a sleeping consumer (producer)
+// if their count says there is one; both sides fence between their change
+// and their check, so either the sleeper sees the change or the other side
+// sees the sleeper.
+template <class T>
+class iaea_bounded_queue
+{
+  struct cell_type
+  {
+     std::atomic<size_t> sequence;
+     T data;
+  };
+
+  cell_type *buffer;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_pos;
+  alignas(64) std::atomic<size_t> dequeue_pos;
+
+  alignas(64) std::mutex sleep_mutex;
+  std::condition_variable not_full, not_empty;
+  std::atomic<int> sleeping_pushers, sleeping_poppers;
+
+  // try_push and try_pop without waking anyone
+  bool push_cell(const T &data)
+  {
+     size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+     for(;;)
+     {
+        cell_type *cell = &buffer[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if(dif == 0)
+        {
+           if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+           {
+              cell->data = data;
+              cell->sequence.store(pos + 1, std::memory_order_release);
+              return true;
+           }
+        }
+        else if(dif < 0) return false;
+        else pos = enqueue_pos.load(std::memory_order_relaxed);
+     }
+  }
+
+  bool pop_cell(T &data)
+  {
+     size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+     for(;;)
+     {
+        cell_type *cell = &buffer[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(dif == 0)
+        {
+           if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+           {
+              data = cell->data;
+              cell->sequence.store(pos + mask + 1, std::memory_order_release);
+              return true;
+           }
+        }
+        else if(dif < 0) return false;
+        else pos = dequeue_pos.load(std::memory_order_relaxed);
+     }
+  }
+
+  // Wakes a thread sleeping on condition, if there is one
+  void wake(std::atomic<int> &sleeping, std::condition_variable &condition)
+  {
+     std::atomic_thread_fence(std::memory_order_seq_cst);
+     if(sleeping.load(std::memory_order_relaxed) == 0) return;
+     // Taken so that the notification cannot fall between the last try of
+     // a sleeper and its wait
+     std::lock_guard<std::mutex> lock(sleep_mutex);
+     condition.notify_one();
+  }
+
+  // Sleeps on condition until attempt succeeds
+  template <class F>
+  void sleep_until(std::atomic<int> &sleeping, std::condition_variable &condition, F attempt)
+  {
+     std::unique_lock<std::mutex> lock(sleep_mutex);
+     sleeping.fetch_add(1, std::memory_order_seq_cst);
+     std::atomic_thread_fence(std::memory_order_seq_cst);
+     condition.wait(lock, attempt);
+     sleeping.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+public:
+  explicit iaea_bounded_queue(size_t capacity)
+  {
+     size_t size = 2;
+     while(size < capacity) size *= 2;
+     buffer = new cell_type[size];
+     mask = size - 1;
+     for(size_t i=0;i<size;i++) buffer[i].sequence.store(i, std::memory_order_relaxed);
+     enqueue_pos.store(0, std::memory_order_relaxed);
+     dequeue_pos.store(0, std::memory_order_relaxed);
+     sleeping_pushers.store(0, std::memory_order_relaxed);
+     sleeping_poppers.store(0, std::memory_order_relaxed);
+  }
+  ~iaea_bounded_queue() { delete[] buffer; }
+
+  iaea_bounded_queue(const iaea_bounded_queue &) = delete;
+  iaea_bounded_queue &operator=(const iaea_bounded_queue &) = delete;
+
+  // Returns false if the queue is full
+  bool try_push(const T &data)
+  {
+     if(!push_cell(data)) return false;
+     wake(sleeping_poppers, not_empty);
+     return true;
+  }
+
+  // Returns false if the queue is empty
+  bool try_pop(T &data)
+  {
+     if(!pop_cell(data)) return false;
+     wake(sleeping_pushers, not_full);
+     return true;
+  }
+
+  // Blocking versions: the other stages are waited for by yielding
+  // QUEUE_SPINS times, then by sleeping until they push or pop
+  void push(const T &data)
+  {
+     for(int spin=0;spin<QUEUE_SPINS;spin++)
+     {
+        if(try_push(data)) return;
+        std::this_thread::yield();
+     }
+     sleep_until(sleeping_pushers, not_full, [&]() { return push_cell(data); });
+     wake(sleeping_poppers, not_empty);
+  }
+  void pop(T &data)
+  {
+     for(int spin=0;spin<QUEUE_SPINS;spin++)
+     {
+        if(try_pop(data)) return;
+        std::this_thread::yield();
+     }
+     sleep_until(sleeping_poppers, not_empty, [&]() { return pop_cell(data); });
+     wake(sleeping_pushers, not_full);
+  }
+};
+
+#endif
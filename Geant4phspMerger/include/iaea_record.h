@@ -24,7 +24,6 @@
                             // 3 positrons
                             // 4 neutrons
                             // 5 protons
-#define MAX_NUM_SOURCES 30
 
 #define OK     0
 #define FAIL  -1
@@ -32,10 +31,29 @@
 /* *********************************************************************** */
 // structures
 
+struct iaea_virtual_reader;
+struct iaea_compressed_reader;
+
 struct iaea_record_type
 {
   FILE *p_file;   // phase space file pointer   
 
+  // Read-only sources may be mapped into memory (see map_file); the
+  // records are then decoded straight from the mapping and p_file is only
+  // used for block copies. p_map is NULL when stdio is used.
+  const char *p_map;
+  IAEA_I64 map_size;
+  IAEA_I64 map_pos;  // offset of the next record
+  bool map_eof;      // a read went past the end of the mapping (as feof)
+
+  // The records of a virtual phsp are read from its members through
+  // p_virtual (see iaea_virtual_reader); p_file is then NULL
+  iaea_virtual_reader *p_virtual;
+
+  // The records of a compressed phsp are decompressed frame by frame
+  // through p_compressed (see iaea_compressed_reader); p_file is then NULL
+  iaea_compressed_reader *p_compressed;
+
   short particle; // mandatory       (photon:1 electron:2 positron:3 neutron:4 proton:5 ...)
   
   float  energy;  // mandatory
@@ -61,6 +79,27 @@ public:
       short read_particle();
       short write_particle();
       short initialize();
+      // Decodes one packed record stored in memory, as read_particle does
+      short decode_particle(const char *buffer);
+      // Packs the particle into memory, as write_particle does
+      short encode_particle(char *buffer);
+      // Number of bytes of one packed record for the current i/o flags
+      short get_record_length();
+      // Maps the whole p_file, advising the kernel of sequential access;
+      // populate prefaults the pages. FAIL if it cannot be mapped.
+      short map_file(bool populate);
+      void unmap_file();
+      // Offset of the next record and random access, through the mapping
+      // if there is one, the members of a virtual phsp, or p_file
+      IAEA_I64 tell_file();
+      short seek_file(IAEA_I64 offset);
+      bool end_of_file();
+      void rewind_file();
+      // Reads up to n packed records into buffer, returns the number read
+      IAEA_I64 read_records(char *buffer, IAEA_I64 n);
+      // As read_records, but mapped records are not copied: the returned
+      // pointer is either into the mapping or buffer
+      const char *fetch_records(char *buffer, IAEA_I64 *n);
 };
 
 #endif
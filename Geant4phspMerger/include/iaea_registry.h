@@ -0,0 +1,154 @@
+#ifndef IAEA_REGISTRY
+#define IAEA_REGISTRY
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// defines
+
+// Source slots are allocated SOURCE_CHUNK_SIZE at a time. The first
+// directory of chunks holds SOURCE_DIRECTORY_CHUNKS of them, each directory
+// chained after it twice as many as the one before.
+#define SOURCE_CHUNK_SIZE 256
+#define SOURCE_DIRECTORY_CHUNKS 64
+
+/* *********************************************************************** */
+// structures
+
+// Pointers indexed by source id. The slots live in chunks that are never
+// moved nor freed, and the directories of chunks are only ever chained, so
+// a slot can be read without a lock while other threads add sources. Ids
+// without a slot read as NULL.
+template <class T>
+class iaea_source_table
+{
+  struct directory
+  {
+     IAEA_I64 n_chunks;
+     std::atomic<T **> *chunks;
+     std::atomic<directory *> next;
+  };
+
+  std::atomic<T **> first_chunks[SOURCE_DIRECTORY_CHUNKS];
+  directory first;
+  std::mutex growing;
+
+  // Chunk pointer of id, NULL if its directory is not there yet
+  std::atomic<T **> *chunk_of(IAEA_I32 id)
+  {
+     IAEA_I64 c = id/SOURCE_CHUNK_SIZE;
+     directory *d = &first;
+     while(c >= d->n_chunks)
+     {
+        c -= d->n_chunks;
+        d = d->next.load(std::memory_order_acquire);
+        if(d == NULL) return(NULL);
+     }
+     return(&d->chunks[c]);
+  }
+
+  // Chains directories until id has a chunk pointer. Called under growing.
+  std::atomic<T **> *grow_to(IAEA_I32 id)
+  {
+     IAEA_I64 c = id/SOURCE_CHUNK_SIZE;
+     directory *d = &first;
+     while(c >= d->n_chunks)
+     {
+        c -= d->n_chunks;
+        directory *next = d->next.load(std::memory_order_relaxed);
+        if(next == NULL)
+        {
+           next = (directory *) malloc(sizeof(directory));
+           if(next == NULL) return(NULL);
+           next->n_chunks = 2*d->n_chunks;
+           next->chunks = (std::atomic<T **> *)
+              malloc((size_t) next->n_chunks*sizeof(std::atomic<T **>));
+           if(next->chunks == NULL) {free(next); return(NULL);}
+           for(IAEA_I64 i=0;i<next->n_chunks;i++)
+              new(&next->chunks[i]) std::atomic<T **>(NULL);
+           new(&next->next) std::atomic<directory *>(NULL);
+           d->next.store(next, std::memory_order_release);
+        }
+        d = next;
+     }
+     return(&d->chunks[c]);
+  }
+
+public:
+  iaea_source_table()
+  {
+     for(int i=0;i<SOURCE_DIRECTORY_CHUNKS;i++)
+        first_chunks[i].store(NULL, std::memory_order_relaxed);
+     first.n_chunks = SOURCE_DIRECTORY_CHUNKS;
+     first.chunks = first_chunks;
+     first.next.store(NULL, std::memory_order_relaxed);
+  }
+  ~iaea_source_table()
+  {
+     directory *d = &first;
+     while(d != NULL)
+     {
+        directory *next = d->next.load(std::memory_order_relaxed);
+        for(IAEA_I64 i=0;i<d->n_chunks;i++) free(d->chunks[i].load(std::memory_order_relaxed));
+        if(d != &first) {free(d->chunks); free(d);}
+        d = next;
+     }
+  }
+
+  iaea_source_table(const iaea_source_table &) = delete;
+  iaea_source_table &operator=(const iaea_source_table &) = delete;
+
+  T *&operator[](IAEA_I32 id)
+  {
+     std::atomic<T **> *chunk = (id >= 0) ? chunk_of(id) : NULL;
+     if(chunk != NULL)
+     {
+        T **slots = chunk->load(std::memory_order_acquire);
+        if(slots != NULL) return slots[id%SOURCE_CHUNK_SIZE];
+     }
+     static thread_local T *none;
+     none = NULL;
+     return none;
+  }
+
+  // Makes sure that id has a slot. Returns FAIL if it cannot be allocated.
+  short reserve(IAEA_I32 id)
+  {
+     if(id < 0) return(FAIL);
+     std::atomic<T **> *chunk = chunk_of(id);
+     if(chunk != NULL && chunk->load(std::memory_order_acquire) != NULL) return(OK);
+
+     std::lock_guard<std::mutex> lock(growing);
+     chunk = grow_to(id);
+     if(chunk == NULL) return(FAIL);
+     if(chunk->load(std::memory_order_relaxed) != NULL) return(OK);
+     T **slots = (T **) calloc(SOURCE_CHUNK_SIZE, sizeof(T *));
+     if(slots == NULL) return(FAIL);
+     chunk->store(slots, std::memory_order_release);
+     return(OK);
+  }
+};
+
+// Source ids in use. The smallest free id is handed out first, so ids
+// freed by iaea_destroy_source are reused as they always were.
+class iaea_source_ids
+{
+  std::mutex lock;
+  std::vector<IAEA_I32> free_ids;   // heap, smallest id on top
+  std::vector<char> used;
+
+public:
+  // Returns -1 if no id is left
+  IAEA_I32 acquire();
+  // Returns FAIL if id is not in use
+  short release(IAEA_I32 id);
+  bool in_use(IAEA_I32 id);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef IAEA_STATS
+#define IAEA_STATS
+
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// structures
+
+// Statistical counters of a set of particles: what update_counters adds to
+// a header, kept apart so that every thread can fill its own and merge
+// them at the end. Blocks of particles given by quantity are reduced with
+// vector kernels (per type masked sums, minima and maxima).
+struct iaea_statistics
+{
+  IAEA_I64 n_particles;
+  IAEA_I64 histories;     // sum of the positive new history counts
+
+  IAEA_I64 particle_number[MAX_NUM_PARTICLES];
+  double sum_weight[MAX_NUM_PARTICLES];
+  double sum_weighted_energy[MAX_NUM_PARTICLES];  // sum of weight*|energy|
+  double minimum_weight[MAX_NUM_PARTICLES], maximum_weight[MAX_NUM_PARTICLES];
+  double minimum_energy[MAX_NUM_PARTICLES], maximum_energy[MAX_NUM_PARTICLES];
+
+  double minimum_x, maximum_x;
+  double minimum_y, maximum_y;
+  double minimum_z, maximum_z;
+
+public:
+      void initialize();
+      // One particle, as update_counters takes it from the record
+      void add_particle(const iaea_record_type *p);
+      // n particles given by quantity (new_history as IsNewHistory)
+      void add_block(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                     const float weight[], const float x[], const float y[],
+                     const float z[], const IAEA_I32 new_history[]);
+      void merge(const iaea_statistics *s);
+};
+
+#endif
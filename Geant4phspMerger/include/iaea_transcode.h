@@ -0,0 +1,52 @@
+#ifndef IAEA_TRANSCODE
+#define IAEA_TRANSCODE
+
+#include "iaea_header.h"
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// defines
+
+// Fields of one record: particle type, energy, x, y, z, u, v, weight,
+// extra floats and extra longs
+#define MAX_NUM_FIELDS_RECORD (8+NUM_EXTRA_FLOAT+NUM_EXTRA_LONG)
+
+/* *********************************************************************** */
+// structures
+
+// Converts packed records of one layout (record contents, constants and
+// extra variable types) to packed records of another layout without
+// decoding them. The plan is built once per pair of layouts and then run
+// over whole blocks of records; extra variables are matched by type.
+struct iaea_transcode_plan
+{
+  int in_length;       // bytes of an input record
+  int out_length;      // bytes of an output record
+
+  // Byte ranges copied from the input record, adjacent ranges merged
+  int n_moves;
+  short move_from[MAX_NUM_FIELDS_RECORD];
+  short move_to[MAX_NUM_FIELDS_RECORD];
+  short move_size[MAX_NUM_FIELDS_RECORD];
+
+  // Output fields the input does not store: its constants or zero
+  int n_fills;
+  short fill_to[MAX_NUM_FIELDS_RECORD];
+  float fill_value[MAX_NUM_FIELDS_RECORD];
+
+  short w_sign;        // 0: sign of w copied, +1/-1: sign of w fixed
+  short history_long;  // offset of the input history counter (extralong
+                       // type 1) that sets the sign of energy, -1 if none
+  short history_fill;  // offset of the output history counter the input
+                       // does not store, set from the sign of energy; -1
+                       // if none
+
+public:
+      // Returns FAIL if the records cannot be converted byte-wise
+      short build(const iaea_header_type *p_in, const iaea_header_type *p_out);
+      void run(const char *in, char *out, IAEA_I64 n_records) const;
+      // Output records are the input records unchanged
+      bool is_identity() const;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef IAEA_TYPE_INDEX
+#define IAEA_TYPE_INDEX
+
+#include "iaea_history_index.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the type index kept next to a phsp (see iaea_write_type_index)
+#define TYPE_INDEX_EXTENSION ".IAEAtype"
+
+// Changed whenever the type index layout changes
+#define TYPE_INDEX_VERSION 1
+
+// Slots of the type index: 0 for the types without counters, then one per
+// type 1 to MAX_NUM_PARTICLES
+#define TYPE_INDEX_SLOTS (MAX_NUM_PARTICLES + 1)
+
+/* *********************************************************************** */
+// structures
+
+// Records following one another (counted from 0)
+struct iaea_record_run
+{
+  IAEA_I64 first, n;
+};
+
+// The records of a phsp as runs of records of the same particle type, the
+// runs of every slot in increasing order and the slots one after the
+// other. Only the run starts of the slots are kept in memory, the runs
+// stay in the file.
+struct iaea_type_index
+{
+  iaea_phsp_file_id file;     // the file indexed
+  IAEA_I64 n_records;
+  IAEA_I64 slot_start[TYPE_INDEX_SLOTS + 1];  // first run of every slot, and the runs
+
+public:
+      void initialize();
+      void release();
+      // Slot of particle type type (the sign of w taken away)
+      static int slot(IAEA_I32 type)
+         { return((type >= 1 && type <= MAX_NUM_PARTICLES) ? type : 0); }
+};
+
+/* *********************************************************************** */
+// functions
+
+// Reads the run starts of a type index written by this build; FAIL (with
+// index empty) otherwise
+short iaea_load_type_index(const char *type_file, iaea_type_index *index);
+
+// Writes an index with its runs (slot_start[TYPE_INDEX_SLOTS] of them); see
+// iaea_save_sidecar
+short iaea_save_type_index(const char *type_file, const iaea_type_index *index,
+                           const iaea_record_run *runs);
+
+// Reads the runs of the slots selected (selected[s] set for slot s) into
+// runs (allocated with malloc), in increasing order, runs of different
+// slots that follow one another joined; n is set to their number
+short iaea_read_type_runs(const char *type_file, const iaea_type_index *index,
+                          const bool *selected, iaea_record_run **runs, IAEA_I64 *n);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef IAEA_URING
+#define IAEA_URING
+
+#include "iaea_record.h"
+
+/* *********************************************************************** */
+// structures
+
+// Minimal io_uring ring (Linux only, through the raw system calls) used by
+// the block copies to keep many large reads or writes in flight. A ring
+// must only be used by one thread. On other systems, or when the kernel
+// refuses io_uring, initialize() fails and the callers keep using
+// pread/pwrite.
+struct iaea_uring
+{
+  int ring_fd;           // -1 if the ring is not available
+  unsigned entries;      // submission queue entries
+
+  // Submission queue
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  void *sqes;
+  unsigned to_submit;
+
+  // Completion queue
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  void *cqes;
+
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+
+  bool fixed_buffers;    // buffers registered with the kernel
+
+public:
+      iaea_uring();
+      ~iaea_uring();
+      short initialize(unsigned n_entries);
+      // Registers the buffers used for i/o; later reads and writes from
+      // them skip the page pinning of every request. Fails silently.
+      void register_buffers(char *const buffers[], unsigned n_buffers, size_t size);
+      // Queue a read or write of len bytes at offset of the file. buffer
+      // is the index given to register_buffers, or -1.
+      short queue_read(int fd, char *buf, int buffer, unsigned len,
+                       IAEA_I64 offset, IAEA_I64 user_data);
+      short queue_write(int fd, const char *buf, int buffer, unsigned len,
+                        IAEA_I64 offset, IAEA_I64 user_data);
+      // Submits the queued requests; if wait is set, also waits for at
+      // least one completion
+      short submit(bool wait);
+      // Takes one completion if there is any; result is the number of
+      // bytes transferred or -errno
+      bool get_completion(IAEA_I64 *user_data, IAEA_I32 *result);
+      void destroy();
+};
+
+#endif
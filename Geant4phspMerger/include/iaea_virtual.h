@@ -0,0 +1,62 @@
+#ifndef IAEA_VIRTUAL
+#define IAEA_VIRTUAL
+
+#include <mutex>
+
+#include "iaea_header.h"
+
+/* *********************************************************************** */
+// structures
+
+// Reads the records of the members of a virtual phsp (listed in the
+// $VIRTUAL_MEMBERS: block of its header) as if they were one phsp file.
+// Positions are byte offsets in that file, as for any other source. Only
+// the member being read is open; it is opened when the position enters it.
+// All members must store their records with the layout of the header.
+struct iaea_virtual_reader
+{
+  const iaea_virtual_member *members;  // those of the header, not owned
+  IAEA_I32 n_members;
+  IAEA_I64 *start;         // first record of every member, and the total
+  char directory[MAX_STR_LEN];  // of the header, for relative member names
+
+  int mapping;             // see iaea_set_read_mapping
+  IAEA_I32 current;        // member open in record, -1 if none
+  bool moved;              // record is not at position (see seek)
+  iaea_record_type record; // the member open, with the layout of the source
+  IAEA_I64 reclength;
+  IAEA_I64 position;       // next record
+  bool eof;                // a read went past the last record
+
+  std::mutex positioned;   // read_at may be called from several threads
+
+public:
+      iaea_virtual_reader();
+      ~iaea_virtual_reader();
+      // The members of h, whose header file is header_file
+      short initialize(const iaea_header_type *h, const char *header_file, int read_mapping);
+
+      // As the functions of iaea_record_type of the same name; layout is
+      // the record of the source, with its i/o flags
+      const char *fetch_records(const iaea_record_type *layout, char *buffer, IAEA_I64 *n);
+      IAEA_I64 tell_file();
+      short seek_file(IAEA_I64 offset);
+      bool end_of_file() { return(eof); }
+      void rewind_file() { seek_file(0); }
+      // Reads n_bytes from offset on without moving the position, as
+      // pread; returns the number of bytes read or -1
+      IAEA_I64 read_at(const iaea_record_type *layout, char *buffer, IAEA_I64 n_bytes,
+                       IAEA_I64 offset);
+      // Bytes the member files hold in the ranges listed, -1 if a member
+      // cannot be found
+      IAEA_I64 size();
+      // The phsp file name of member m (MAX_STR_LEN chars at most)
+      void member_file(IAEA_I32 m, char *file_name);
+
+private:
+      // Opens the member of position (positioned at it); FAIL on errors
+      short select_member(const iaea_record_type *layout);
+      void close_member();
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef IAEA_ZONE_MAP
+#define IAEA_ZONE_MAP
+
+#include "iaea_history_index.h"
+#include "iaea_stats.h"
+
+/* *********************************************************************** */
+// defines
+
+// Extension of the zone map kept next to a phsp (see iaea_write_zone_map)
+#define ZONE_MAP_EXTENSION ".IAEAzone"
+
+// Changed whenever the zone map layout changes
+#define ZONE_MAP_VERSION 1
+
+// Records summarized by one zone
+#define ZONE_BLOCK_RECORDS 65536
+
+/* *********************************************************************** */
+// structures
+
+// What a reader looks for: particles of one type (0 for any) with an
+// energy and a position in the ranges given (both ends included)
+struct iaea_zone_filter
+{
+  IAEA_I32 type;
+  double minimum_energy, maximum_energy;
+  double minimum_x, maximum_x;
+  double minimum_y, maximum_y;
+  double minimum_z, maximum_z;
+  bool empty;             // nothing can pass, e.g. a constant x outside the range
+};
+
+// The counters of the records of one block, as the header keeps them for
+// the whole phsp, and the particle types present
+struct iaea_zone
+{
+  iaea_statistics counters;
+  IAEA_I32 types;         // bit t-1 set if particles of type t are present
+
+public:
+      // Whether a particle of the block may pass the filter; positions that
+      // are not stored must have been checked when the filter was set
+      bool may_hold(const iaea_zone_filter *f) const;
+};
+
+// Zones of the blocks of ZONE_BLOCK_RECORDS records of a phsp
+struct iaea_zone_map
+{
+  iaea_phsp_file_id file;  // the file summarized
+  IAEA_I64 n_records;
+  IAEA_I64 block_records;
+  IAEA_I64 n_zones, zones_size;
+  iaea_zone *zones;
+
+public:
+      void initialize();
+      void release();
+      // Adds the zone of the next block
+      short add_zone(const iaea_zone *zone);
+};
+
+/* *********************************************************************** */
+// functions
+
+// Reads a zone map written by this build; FAIL (with map empty) otherwise
+short iaea_load_zone_map(const char *map_file, iaea_zone_map *map);
+
+// Writes a zone map (see iaea_save_sidecar)
+short iaea_save_zone_map(const char *map_file, const iaea_zone_map *map);
+
+#endif
@@ -127,5 +127,8 @@ int readBinaryDataFromFile(FILE *iStream, int nItemsToRead, float **arrayToRead,
 int readBinaryDataFromFile(FILE *iStream, int nItemsToRead, float *inputArray, int swab_flag);
 // RCN added
 int fget_c_string(char *string, int Max_Str_Len, FILE *fspec);
+// A text held in memory, read line by line as a file by sget_c_string
+struct text_stream { const char *pos, *end; };
+int sget_c_string(char *string, int Max_Str_Len, text_stream *text);
 int get_string(FILE *fspec, char *string);
 #endif
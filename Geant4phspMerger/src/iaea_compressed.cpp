@@ -0,0 +1,328 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined WIN32) || (defined WIN64)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if (defined IAEA_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "iaea_compressed.h"
+
+static const char compressed_magic[8] = {'I','A','E','A','p','h','s','z'};
+
+// Where the frame offsets start in a container
+static IAEA_I64 offsets_offset()
+{
+   return((IAEA_I64)(sizeof(iaea_sidecar_tag) + 4*sizeof(IAEA_I64)));
+}
+
+// Positioned reads, so that read_at and the reads in turn do not share a
+// file position
+static IAEA_I64 read_container_at(FILE *file, char *buffer, IAEA_I64 n_bytes, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   static std::mutex seek_mutex;
+   std::lock_guard<std::mutex> lock(seek_mutex);
+   if(_fseeki64(file, offset, SEEK_SET) != 0) return -1;
+   return (IAEA_I64)fread(buffer, 1, (size_t)n_bytes, file);
+#else
+   IAEA_I64 done = 0;
+   while(done < n_bytes)
+   {
+      ssize_t n = pread(fileno(file), buffer + done, (size_t)(n_bytes - done),
+                        (off_t)(offset + done));
+      if(n < 0) return -1;
+      if(n == 0) break; // end of file
+      done += n;
+   }
+   return done;
+#endif
+}
+
+static int seek_container(FILE *file, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   return _fseeki64(file, offset, SEEK_SET);
+#else
+   return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/* *********************************************************************** */
+// Without zlib (IAEA_ZLIB not defined) containers can be neither written
+// nor read
+IAEA_I64 iaea_packed_bound(IAEA_I64 n_bytes)
+{
+#if (defined IAEA_ZLIB)
+   return((IAEA_I64) compressBound((uLong) n_bytes));
+#else
+   return(n_bytes);
+#endif
+}
+
+// Decompresses packed_bytes of packed into n_bytes of columns
+static short unpack_frame(IAEA_I32 compression, const char *packed, IAEA_I64 packed_bytes,
+                          char *columns, IAEA_I64 n_bytes)
+{
+   if(compression != COMPRESSION_ZLIB) return(FAIL);
+#if (defined IAEA_ZLIB)
+   uLongf length = (uLongf) n_bytes;
+   if(uncompress((Bytef *) columns, &length, (const Bytef *) packed,
+                 (uLong) packed_bytes) != Z_OK || (IAEA_I64) length != n_bytes) return(FAIL);
+   return(OK);
+#else
+   return(FAIL);
+#endif
+}
+
+short iaea_pack_frame(IAEA_I32 compression, const char *records, IAEA_I64 n,
+                      IAEA_I64 record_length, char *columns, char *packed,
+                      IAEA_I64 *packed_bytes)
+{
+   if(compression != COMPRESSION_ZLIB) return(FAIL);
+#if (defined IAEA_ZLIB)
+   for(IAEA_I64 b=0;b<record_length;b++)
+   {
+      char *column = columns + b*n;
+      const char *from = records + b;
+      for(IAEA_I64 i=0;i<n;i++) column[i] = from[i*record_length];
+   }
+   uLongf length = (uLongf) iaea_packed_bound(n*record_length);
+   if(compress2((Bytef *) packed, &length, (const Bytef *) columns, (uLong)(n*record_length),
+                Z_DEFAULT_COMPRESSION) != Z_OK) return(FAIL);
+   *packed_bytes = (IAEA_I64) length;
+   return(OK);
+#else
+   fprintf(stderr, "\n ERROR: Built without zlib, phsp records cannot be compressed\n");
+   return(FAIL);
+#endif
+}
+
+/* *********************************************************************** */
+void iaea_compressed_frame::release()
+{
+   free(records);
+   free(columns);
+   free(packed);
+   initialize();
+}
+
+iaea_compressed_reader::iaea_compressed_reader()
+{
+   file = NULL;
+   compression = COMPRESSION_NONE;
+   reclength = frame_records = n_records = n_frames = 0;
+   offsets = NULL;
+   current.initialize();
+   positioned_frame.initialize();
+   position = 0;
+   eof = false;
+}
+
+iaea_compressed_reader::~iaea_compressed_reader()
+{
+   current.release();
+   positioned_frame.release();
+   free(offsets);
+   if(file != NULL) fclose(file);
+}
+
+short iaea_compressed_reader::initialize(FILE *p_file, IAEA_I64 record_length)
+{
+   file = p_file;
+   iaea_sidecar_tag tag, expected;
+   IAEA_I64 fields[4];
+   if(read_container_at(file, (char *) &tag, sizeof(tag), 0) != (IAEA_I64) sizeof(tag) ||
+      read_container_at(file, (char *) fields, sizeof(fields), sizeof(tag)) !=
+         (IAEA_I64) sizeof(fields)) return(FAIL);
+   expected.make(compressed_magic, COMPRESSED_PHSP_VERSION, COMPRESSION_ZLIB);
+   if(!expected.matches(&tag)) return(FAIL);
+#if !(defined IAEA_ZLIB)
+   fprintf(stderr, "\n ERROR: Built without zlib, compressed phsp cannot be read\n");
+   return(FAIL);
+#endif
+
+   compression = tag.layout;
+   reclength = fields[0];
+   frame_records = fields[1];
+   n_records = fields[2];
+   n_frames = fields[3];
+   if(reclength != record_length || frame_records <= 0 || n_records < 0 ||
+      n_frames != (n_records + frame_records - 1)/frame_records) return(FAIL);
+
+   offsets = (IAEA_I64 *) malloc((size_t)(n_frames + 1)*sizeof(IAEA_I64));
+   if(offsets == NULL) return(FAIL);
+   IAEA_I64 n_bytes = (n_frames + 1)*(IAEA_I64) sizeof(IAEA_I64);
+   if(read_container_at(file, (char *) offsets, n_bytes, offsets_offset()) != n_bytes)
+      return(FAIL);
+   for(IAEA_I64 f=0;f<n_frames;f++)
+      if(offsets[f+1] < offsets[f]) return(FAIL);
+   return(OK);
+}
+
+short iaea_compressed_reader::load_frame(iaea_compressed_frame *frame, IAEA_I64 f)
+{
+   if(frame->number == f) return(OK);
+   frame->number = -1;
+   IAEA_I64 frame_bytes = frame_records*reclength;
+   if(frame->records == NULL)
+   {
+      frame->records = (char *) malloc((size_t) frame_bytes);
+      frame->columns = (char *) malloc((size_t) frame_bytes);
+      if(frame->records == NULL || frame->columns == NULL) return(FAIL);
+   }
+
+   IAEA_I64 packed_bytes = offsets[f+1] - offsets[f];
+   if(packed_bytes > frame->packed_size)
+   {
+      char *grown = (char *) realloc(frame->packed, (size_t) packed_bytes);
+      if(grown == NULL) return(FAIL);
+      frame->packed = grown;
+      frame->packed_size = packed_bytes;
+   }
+   if(read_container_at(file, frame->packed, packed_bytes, offsets[f]) != packed_bytes)
+   {
+      fprintf(stderr, "\n ERROR: Failed to read frame %lld of a compressed phsp\n", (long long) f);
+      return(FAIL);
+   }
+
+   IAEA_I64 n = (f < n_frames - 1) ? frame_records : n_records - f*frame_records;
+   if(unpack_frame(compression, frame->packed, packed_bytes, frame->columns, n*reclength) != OK)
+   {
+      fprintf(stderr, "\n ERROR: Frame %lld of a compressed phsp is damaged\n", (long long) f);
+      return(FAIL);
+   }
+   for(IAEA_I64 b=0;b<reclength;b++)
+   {
+      const char *column = frame->columns + b*n;
+      char *to = frame->records + b;
+      for(IAEA_I64 i=0;i<n;i++) to[i*reclength] = column[i];
+   }
+   frame->number = f;
+   frame->n_records = n;
+   return(OK);
+}
+
+const char *iaea_compressed_reader::fetch_records(char *buffer, IAEA_I64 *n)
+{
+   IAEA_I64 wanted = *n, done = 0;
+   while(done < wanted)
+   {
+      if(position >= n_records) {eof = true; break;}
+      IAEA_I64 f = position/frame_records;
+      if(load_frame(&current, f) != OK) {eof = true; break;}
+
+      IAEA_I64 first = position - f*frame_records;
+      IAEA_I64 in_frame = current.n_records - first;
+      IAEA_I64 got = (wanted - done < in_frame) ? wanted - done : in_frame;
+      const char *records = current.records + first*reclength;
+      position += got;
+
+      // Records of one frame are not copied out of it
+      if(done == 0 && got == wanted) {*n = got; return(records);}
+      memcpy(buffer + done*reclength, records, (size_t)(got*reclength));
+      done += got;
+   }
+   *n = done;
+   return(buffer);
+}
+
+short iaea_compressed_reader::seek_file(IAEA_I64 offset)
+{
+   if(offset < 0 || offset % reclength != 0) return(FAIL);
+   position = offset/reclength;
+   eof = false;
+   return(OK);
+}
+
+IAEA_I64 iaea_compressed_reader::read_at(char *buffer, IAEA_I64 n_bytes, IAEA_I64 offset)
+{
+   if(offset < 0 || offset % reclength != 0) return(-1);
+   std::lock_guard<std::mutex> lock(positioned);
+   IAEA_I64 record = offset/reclength, done = 0, wanted = n_bytes/reclength;
+   while(done < wanted && record < n_records)
+   {
+      IAEA_I64 f = record/frame_records;
+      if(load_frame(&positioned_frame, f) != OK) return(-1);
+      IAEA_I64 first = record - f*frame_records;
+      IAEA_I64 got = positioned_frame.n_records - first;
+      if(got > wanted - done) got = wanted - done;
+      memcpy(buffer + done*reclength, positioned_frame.records + first*reclength,
+             (size_t)(got*reclength));
+      done += got;
+      record += got;
+   }
+   return(done*reclength);
+}
+
+/* *********************************************************************** */
+short iaea_compressed_writer::open(const char *container_file, IAEA_I32 method,
+                                   IAEA_I64 record_length, IAEA_I64 records_per_frame,
+                                   IAEA_I64 records)
+{
+   discard();
+   if(method != COMPRESSION_ZLIB || record_length <= 0 || records_per_frame <= 0 ||
+      records < 0 || strlen(container_file) >= MAX_STR_LEN) return(FAIL);
+
+   compression = method;
+   reclength = record_length;
+   frame_records = records_per_frame;
+   n_records = records;
+   n_frames = (n_records + frame_records - 1)/frame_records;
+   n_written = 0;
+   strcpy(file_name, container_file);
+
+   // Several processes (or threads) may write the same container at once
+   offsets = (IAEA_I64 *) malloc((size_t)(n_frames + 1)*sizeof(IAEA_I64));
+   file = iaea_open_sidecar(file_name, temp_file);
+   if(offsets == NULL || file == NULL) {discard(); return(FAIL);}
+
+   // The offsets are written once the frames are in
+   iaea_sidecar_tag tag;
+   tag.make(compressed_magic, COMPRESSED_PHSP_VERSION, compression);
+   IAEA_I64 fields[4] = {reclength, frame_records, n_records, n_frames};
+   offsets[0] = offsets_offset() + (n_frames + 1)*(IAEA_I64) sizeof(IAEA_I64);
+   if(!tag.write(file) || fwrite(fields, sizeof(fields), 1, file) != 1 ||
+      seek_container(file, offsets[0]) != 0) {discard(); return(FAIL);}
+   return(OK);
+}
+
+short iaea_compressed_writer::write_frame(const char *packed, IAEA_I64 n_bytes)
+{
+   if(file == NULL || n_written >= n_frames) return(FAIL);
+   if(fwrite(packed, 1, (size_t) n_bytes, file) != (size_t) n_bytes) return(FAIL);
+   offsets[n_written + 1] = offsets[n_written] + n_bytes;
+   n_written++;
+   return(OK);
+}
+
+short iaea_compressed_writer::close()
+{
+   if(file == NULL || n_written != n_frames) {discard(); return(FAIL);}
+   bool ok = seek_container(file, offsets_offset()) == 0 &&
+             fwrite(offsets, sizeof(IAEA_I64), (size_t)(n_frames + 1), file) ==
+                (size_t)(n_frames + 1);
+   FILE *written = file;
+   file = NULL;
+   free(offsets);
+   offsets = NULL;
+   return(iaea_commit_sidecar(written, ok, temp_file, file_name));
+}
+
+void iaea_compressed_writer::discard()
+{
+   if(file != NULL)
+   {
+      fclose(file);
+      remove(temp_file);
+   }
+   file = NULL;
+   free(offsets);
+   offsets = NULL;
+}
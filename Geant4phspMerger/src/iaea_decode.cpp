@@ -0,0 +1,403 @@
+#include <math.h>
+#include <cstdlib>
+#include <cstring>
+
+#if !(defined WIN32) && !(defined WIN64)
+using namespace std;
+#endif
+
+#include "iaea_decode.h"
+
+// The vector kernels are built with the target attributes of gcc and
+// clang and chosen at run time, so the library still runs everywhere
+#if (defined __GNUC__) && ((defined __x86_64__) || (defined __i386__))
+#define IAEA_DECODE_X86
+#include <immintrin.h>
+#endif
+
+short iaea_decoded_block::allocate(IAEA_I64 n_records)
+{
+  capacity = n_records;
+  size_t n = (size_t) n_records;
+
+  // One allocation: 9 float columns, then 2 integer columns, then extras
+  float *floats = (float *) malloc(n*(9 + NUM_EXTRA_FLOAT)*sizeof(float));
+  IAEA_I32 *longs = (IAEA_I32 *) malloc(n*(2 + NUM_EXTRA_LONG)*sizeof(IAEA_I32));
+  if(floats == NULL || longs == NULL)
+  {
+     free(floats); free(longs);
+     energy = NULL; particle = NULL;
+     return(FAIL);
+  }
+
+  energy = floats;
+  x = floats + n;    y = floats + 2*n;  z = floats + 3*n;
+  u = floats + 4*n;  v = floats + 5*n;  w = floats + 6*n;
+  weight = floats + 7*n;
+  extrafloat = floats + 9*n;
+  particle = longs;
+  new_history = longs + n;
+  extralong = longs + 2*n;
+  return(OK);
+}
+
+void iaea_decoded_block::release()
+{
+  free(energy);
+  free(particle);
+  energy = NULL; particle = NULL;
+}
+
+/* *********************************************************************** */
+// Kernels. Every kernel has three parts:
+//
+// gather:    the 32 bit word at base + i*length for n records
+// signs:     particle type and energy; the sign of w is kept in w as +-1
+// direction: w = sqrt(1 - u^2 - v^2) with the sign kept in w, or u and v
+//            renormalized and w = 0 if u^2 + v^2 > 1
+//
+// The arithmetic of direction is that of decode_particle: u^2 + v^2 in
+// single precision, 1 - u^2 - v^2 rounded to single precision (1.0 - aux
+// in double rounds to the same float) and correctly rounded square roots
+// and divisions, so every kernel gives the same bits.
+
+typedef void (*gather_function)(const char *base, IAEA_I64 length, IAEA_I64 n, void *out);
+typedef void (*signs_function)(const char *base, IAEA_I64 length, IAEA_I64 n,
+                               IAEA_I32 particle[], IAEA_I32 new_history[],
+                               float energy[], float sign[]);
+typedef void (*direction_function)(IAEA_I64 n, float u[], float v[], float w[]);
+
+// Scalar kernel
+
+static void gather_scalar(const char *base, IAEA_I64 length, IAEA_I64 n, void *out)
+{
+  char *o = (char *) out;
+  for(IAEA_I64 i=0; i<n; i++) memcpy(o + 4*i, base + i*length, 4);
+}
+
+static void signs_scalar(const char *base, IAEA_I64 length, IAEA_I64 n,
+                         IAEA_I32 particle[], IAEA_I32 new_history[],
+                         float energy[], float sign[])
+{
+  for(IAEA_I64 i=0; i<n; i++)
+  {
+     char ctmp;
+     float e;
+     memcpy(&ctmp, base + i*length, sizeof(char));
+     memcpy(&e, base + i*length + 1, sizeof(float));
+
+     short type = (short) ctmp;
+     sign[i] = 1.f;
+     if(type < 0) {sign[i] = -1.f; type = -type;}
+     particle[i] = type;
+
+     new_history[i] = (e < 0) ? 1 : 0;
+     energy[i] = fabs(e);
+  }
+}
+
+// One record as decode_particle does it
+static inline void direction_one(float &u, float &v, float &w)
+{
+  int is = (w < 0) ? -1 : 1;
+  w = 0.f;
+  double aux = (u*u + v*v);
+  if (aux<=1.0) w = (float) (is * sqrt((float)(1.0 - aux)));
+  else
+  {
+      aux = sqrt((float)aux);
+      u /= (float)aux;
+      v /= (float)aux;
+  }
+}
+
+static void direction_scalar(IAEA_I64 n, float u[], float v[], float w[])
+{
+  for(IAEA_I64 i=0; i<n; i++) direction_one(u[i], v[i], w[i]);
+}
+
+#ifdef IAEA_DECODE_X86
+
+// SSE4.1 kernel: no gather instruction, the words are loaded one by one
+
+__attribute__((target("sse4.1")))
+static void signs_sse4(const char *base, IAEA_I64 length, IAEA_I64 n,
+                       IAEA_I32 particle[], IAEA_I32 new_history[],
+                       float energy[], float sign[])
+{
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+  const __m128 minus_one = _mm_set1_ps(-1.f), sign_bit = _mm_set1_ps(-0.f);
+  IAEA_I64 i = 0;
+  for(; i+4<=n; i+=4)
+  {
+     const char *r = base + i*length;
+     float e[4];
+     for(int k=0;k<4;k++) memcpy(&e[k], r + k*length + 1, sizeof(float));
+     __m128i type = _mm_setr_epi32((signed char) r[0], (signed char) r[length],
+                                   (signed char) r[2*length], (signed char) r[3*length]);
+     __m128 negative = _mm_castsi128_ps(_mm_cmplt_epi32(type, _mm_setzero_si128()));
+     _mm_storeu_si128((__m128i *)(particle + i), _mm_abs_epi32(type));
+     _mm_storeu_ps(sign + i, _mm_blendv_ps(one, minus_one, negative));
+
+     __m128 energies = _mm_loadu_ps(e);
+     __m128 is_new = _mm_and_ps(_mm_cmplt_ps(energies, zero), one);
+     _mm_storeu_si128((__m128i *)(new_history + i), _mm_cvttps_epi32(is_new));
+     _mm_storeu_ps(energy + i, _mm_andnot_ps(sign_bit, energies));
+  }
+  signs_scalar(base + i*length, length, n - i, particle + i, new_history + i,
+               energy + i, sign + i);
+}
+
+__attribute__((target("sse4.1")))
+static void direction_sse4(IAEA_I64 n, float u[], float v[], float w[])
+{
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+  IAEA_I64 i = 0;
+  for(; i+4<=n; i+=4)
+  {
+     __m128 uu = _mm_loadu_ps(u + i), vv = _mm_loadu_ps(v + i), is = _mm_loadu_ps(w + i);
+     __m128 s = _mm_add_ps(_mm_mul_ps(uu, uu), _mm_mul_ps(vv, vv));
+     __m128 inside = _mm_cmple_ps(s, one);
+     __m128 ww = _mm_mul_ps(is, _mm_sqrt_ps(_mm_sub_ps(one, s)));
+     __m128 norm = _mm_sqrt_ps(s);
+     _mm_storeu_ps(w + i, _mm_blendv_ps(zero, ww, inside));
+     _mm_storeu_ps(u + i, _mm_blendv_ps(_mm_div_ps(uu, norm), uu, inside));
+     _mm_storeu_ps(v + i, _mm_blendv_ps(_mm_div_ps(vv, norm), vv, inside));
+  }
+  direction_scalar(n - i, u + i, v + i, w + i);
+}
+
+// AVX2 kernel: 8 records per step, loaded with gathers at byte offsets
+
+__attribute__((target("avx2")))
+static void gather_avx2(const char *base, IAEA_I64 length, IAEA_I64 n, void *out)
+{
+  const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                             _mm256_set1_epi32((int) length));
+  char *o = (char *) out;
+  IAEA_I64 i = 0;
+  for(; i+8<=n; i+=8)
+     _mm256_storeu_si256((__m256i *)(o + 4*i),
+        _mm256_i32gather_epi32((const int *)(base + i*length), offsets, 1));
+  gather_scalar(base + i*length, length, n - i, o + 4*i);
+}
+
+__attribute__((target("avx2")))
+static void signs_avx2(const char *base, IAEA_I64 length, IAEA_I64 n,
+                       IAEA_I32 particle[], IAEA_I32 new_history[],
+                       float energy[], float sign[])
+{
+  const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                             _mm256_set1_epi32((int) length));
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+  const __m256 minus_one = _mm256_set1_ps(-1.f), sign_bit = _mm256_set1_ps(-0.f);
+  IAEA_I64 i = 0;
+  for(; i+8<=n; i+=8)
+  {
+     const char *r = base + i*length;
+     // The type is the low byte of the first word of each record
+     __m256i word = _mm256_i32gather_epi32((const int *) r, offsets, 1);
+     __m256i type = _mm256_srai_epi32(_mm256_slli_epi32(word, 24), 24);
+     __m256 negative = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_setzero_si256(), type));
+     _mm256_storeu_si256((__m256i *)(particle + i), _mm256_abs_epi32(type));
+     _mm256_storeu_ps(sign + i, _mm256_blendv_ps(one, minus_one, negative));
+
+     __m256 energies = _mm256_i32gather_ps((const float *)(r + 1), offsets, 1);
+     __m256 is_new = _mm256_and_ps(_mm256_cmp_ps(energies, zero, _CMP_LT_OQ), one);
+     _mm256_storeu_si256((__m256i *)(new_history + i), _mm256_cvttps_epi32(is_new));
+     _mm256_storeu_ps(energy + i, _mm256_andnot_ps(sign_bit, energies));
+  }
+  signs_scalar(base + i*length, length, n - i, particle + i, new_history + i,
+               energy + i, sign + i);
+}
+
+__attribute__((target("avx2")))
+static void direction_avx2(IAEA_I64 n, float u[], float v[], float w[])
+{
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+  IAEA_I64 i = 0;
+  for(; i+8<=n; i+=8)
+  {
+     __m256 uu = _mm256_loadu_ps(u + i), vv = _mm256_loadu_ps(v + i);
+     __m256 is = _mm256_loadu_ps(w + i);
+     __m256 s = _mm256_add_ps(_mm256_mul_ps(uu, uu), _mm256_mul_ps(vv, vv));
+     __m256 inside = _mm256_cmp_ps(s, one, _CMP_LE_OQ);
+     __m256 ww = _mm256_mul_ps(is, _mm256_sqrt_ps(_mm256_sub_ps(one, s)));
+     __m256 norm = _mm256_sqrt_ps(s);
+     _mm256_storeu_ps(w + i, _mm256_blendv_ps(zero, ww, inside));
+     _mm256_storeu_ps(u + i, _mm256_blendv_ps(_mm256_div_ps(uu, norm), uu, inside));
+     _mm256_storeu_ps(v + i, _mm256_blendv_ps(_mm256_div_ps(vv, norm), vv, inside));
+  }
+  direction_scalar(n - i, u + i, v + i, w + i);
+}
+
+// AVX-512 kernel: 16 records per step, masks instead of blends
+
+#define IAEA_ROUND (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+
+__attribute__((target("avx512f")))
+static void gather_avx512(const char *base, IAEA_I64 length, IAEA_I64 n, void *out)
+{
+  const __m512i offsets = _mm512_mullo_epi32(
+     _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15),
+     _mm512_set1_epi32((int) length));
+  char *o = (char *) out;
+  IAEA_I64 i = 0;
+  for(; i+16<=n; i+=16)
+     _mm512_storeu_si512((void *)(o + 4*i),
+        _mm512_i32gather_epi32(offsets, (const void *)(base + i*length), 1));
+  gather_scalar(base + i*length, length, n - i, o + 4*i);
+}
+
+__attribute__((target("avx512f")))
+static void signs_avx512(const char *base, IAEA_I64 length, IAEA_I64 n,
+                         IAEA_I32 particle[], IAEA_I32 new_history[],
+                         float energy[], float sign[])
+{
+  const __m512i offsets = _mm512_mullo_epi32(
+     _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15),
+     _mm512_set1_epi32((int) length));
+  const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.f);
+  const __m512 minus_one = _mm512_set1_ps(-1.f);
+  IAEA_I64 i = 0;
+  for(; i+16<=n; i+=16)
+  {
+     const char *r = base + i*length;
+     __m512i word = _mm512_i32gather_epi32(offsets, (const void *) r, 1);
+     __m512i type = _mm512_srai_epi32(_mm512_slli_epi32(word, 24), 24);
+     __mmask16 negative = _mm512_cmplt_epi32_mask(type, _mm512_setzero_si512());
+     _mm512_storeu_si512((void *)(particle + i), _mm512_abs_epi32(type));
+     _mm512_storeu_ps(sign + i, _mm512_mask_blend_ps(negative, one, minus_one));
+
+     __m512 energies = _mm512_i32gather_ps(offsets, (const void *)(r + 1), 1);
+     __mmask16 is_new = _mm512_cmp_ps_mask(energies, zero, _CMP_LT_OQ);
+     _mm512_storeu_si512((void *)(new_history + i),
+                         _mm512_maskz_mov_epi32(is_new, _mm512_set1_epi32(1)));
+     _mm512_storeu_ps(energy + i, _mm512_abs_ps(energies));
+  }
+  signs_scalar(base + i*length, length, n - i, particle + i, new_history + i,
+               energy + i, sign + i);
+}
+
+__attribute__((target("avx512f")))
+static void direction_avx512(IAEA_I64 n, float u[], float v[], float w[])
+{
+  const __m512 one = _mm512_set1_ps(1.f);
+  IAEA_I64 i = 0;
+  for(; i+16<=n; i+=16)
+  {
+     __m512 uu = _mm512_loadu_ps(u + i), vv = _mm512_loadu_ps(v + i);
+     __m512 is = _mm512_loadu_ps(w + i);
+     // avx512f implies fma: the rounding forms keep u*u + v*v from being
+     // contracted into a fused multiply-add
+     __m512 s = _mm512_add_round_ps(_mm512_mul_round_ps(uu, uu, IAEA_ROUND),
+                                    _mm512_mul_round_ps(vv, vv, IAEA_ROUND), IAEA_ROUND);
+     __mmask16 inside = _mm512_cmp_ps_mask(s, one, _CMP_LE_OQ);
+     __m512 ww = _mm512_mul_ps(is, _mm512_sqrt_ps(_mm512_sub_ps(one, s)));
+     __m512 norm = _mm512_sqrt_ps(s);
+     _mm512_storeu_ps(w + i, _mm512_maskz_mov_ps(inside, ww));
+     _mm512_storeu_ps(u + i, _mm512_mask_blend_ps(inside, _mm512_div_ps(uu, norm), uu));
+     _mm512_storeu_ps(v + i, _mm512_mask_blend_ps(inside, _mm512_div_ps(vv, norm), vv));
+  }
+  direction_scalar(n - i, u + i, v + i, w + i);
+}
+
+#endif // IAEA_DECODE_X86
+
+/* *********************************************************************** */
+// Dispatch
+
+static int detect_kernel()
+{
+#ifdef IAEA_DECODE_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) return IAEA_DECODE_AVX512;
+  if(__builtin_cpu_supports("avx2"))    return IAEA_DECODE_AVX2;
+  if(__builtin_cpu_supports("sse4.1"))  return IAEA_DECODE_SSE4;
+#endif
+  return IAEA_DECODE_SCALAR;
+}
+
+int iaea_decode_kernel()
+{
+  static const int kernel = detect_kernel();
+  return kernel;
+}
+
+static void fill_column(float column[], float value, IAEA_I64 n)
+{
+  for(IAEA_I64 i=0; i<n; i++) column[i] = value;
+}
+
+void iaea_decode_records(iaea_record_type *p, const char *records, IAEA_I64 n,
+                         iaea_decoded_block *block, int kernel)
+{
+  if(n <= 0) return;
+
+  // Never more than the processor supports
+  if(kernel > iaea_decode_kernel()) kernel = iaea_decode_kernel();
+
+  gather_function gather = gather_scalar;
+  signs_function signs = signs_scalar;
+  direction_function direction = direction_scalar;
+#ifdef IAEA_DECODE_X86
+  if(kernel == IAEA_DECODE_SSE4)
+     {signs = signs_sse4; direction = direction_sse4;}
+  if(kernel == IAEA_DECODE_AVX2)
+     {gather = gather_avx2; signs = signs_avx2; direction = direction_avx2;}
+  if(kernel == IAEA_DECODE_AVX512)
+     {gather = gather_avx512; signs = signs_avx512; direction = direction_avx512;}
+#endif
+
+  IAEA_I64 length = p->get_record_length();
+  IAEA_I64 c = block->capacity;
+
+  signs(records, length, n, block->particle, block->new_history, block->energy, block->w);
+
+  // Stored floats follow the energy in a fixed order
+  int offset = sizeof(char) + sizeof(float);
+  struct {int stored; float *column; float value;} fields[6] = {
+     {p->ix, block->x, p->x}, {p->iy, block->y, p->y}, {p->iz, block->z, p->z},
+     {p->iu, block->u, p->u}, {p->iv, block->v, p->v},
+     {p->iweight, block->weight, p->weight}};
+  for(int f=0; f<6; f++)
+  {
+     if(fields[f].stored > 0)
+        {gather(records + offset, length, n, fields[f].column); offset += sizeof(float);}
+     else fill_column(fields[f].column, fields[f].value, n);
+  }
+  for(int k=0; k<p->iextrafloat; k++, offset += sizeof(float))
+     gather(records + offset, length, n, block->extrafloat + k*c);
+  for(int j=0; j<p->iextralong; j++, offset += sizeof(IAEA_I32))
+     gather(records + offset, length, n, block->extralong + j*c);
+
+  if(p->iw > 0)
+  {
+     if(p->iu > 0 && p->iv > 0) direction(n, block->u, block->v, block->w);
+     else
+     {
+        // A constant u or v is the value left in p, which the previous
+        // record may have renormalized: one record after the other
+        float u = p->u, v = p->v;
+        for(IAEA_I64 i=0; i<n; i++)
+        {
+           if(p->iu > 0) u = block->u[i];
+           if(p->iv > 0) v = block->v[i];
+           direction_one(u, v, block->w[i]);
+           block->u[i] = u;  block->v[i] = v;
+        }
+     }
+  }
+  else fill_column(block->w, p->w, n);
+
+  // Leave p as decode_particle leaves it after the last record
+  IAEA_I64 last = n - 1;
+  p->particle = (short) block->particle[last];
+  p->IsNewHistory = block->new_history[last];
+  p->energy = block->energy[last];
+  p->x = block->x[last];  p->y = block->y[last];  p->z = block->z[last];
+  p->u = block->u[last];  p->v = block->v[last];  p->w = block->w[last];
+  p->weight = block->weight[last];
+  for(int k=0; k<p->iextrafloat; k++) p->extrafloat[k] = block->extrafloat[k*c + last];
+  for(int j=0; j<p->iextralong; j++)  p->extralong[j] = block->extralong[j*c + last];
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "iaea_grid_index.h"
+
+static const char grid_magic[8] = {'I','A','E','A','g','r','i','d'};
+
+// Where the record numbers start in a grid index file
+static IAEA_I64 records_offset(const iaea_grid_index *index)
+{
+   return((IAEA_I64)(sizeof(iaea_sidecar_tag) + 7*sizeof(IAEA_I64) + 4*sizeof(double)) +
+          ((IAEA_I64) index->n_x*index->n_y + 1)*(IAEA_I64) sizeof(IAEA_I64));
+}
+
+static int seek_grid(FILE *file, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   return _fseeki64(file, offset, SEEK_SET);
+#else
+   return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Cell of value in n cells over [minimum, maximum], the border cells
+// taking what is outside
+static IAEA_I32 grid_cell(double value, double minimum, double maximum, IAEA_I32 n)
+{
+   if(n <= 1 || !(maximum > minimum) || !(value > minimum)) return(0);
+   double cell = (value - minimum)/(maximum - minimum)*n;
+   return((cell >= n) ? n - 1 : (IAEA_I32) cell);
+}
+
+/* *********************************************************************** */
+void iaea_grid_index::initialize()
+{
+   memset(this, 0, sizeof(*this));
+   file.size = -1;
+}
+
+void iaea_grid_index::release()
+{
+   free(cell_start);
+   initialize();
+}
+
+IAEA_I32 iaea_grid_index::column(double x) const
+{
+   return(grid_cell(x, minimum_x, maximum_x, n_x));
+}
+
+IAEA_I32 iaea_grid_index::row(double y) const
+{
+   return(grid_cell(y, minimum_y, maximum_y, n_y));
+}
+
+/* *********************************************************************** */
+short iaea_load_grid_index(const char *grid_file, iaea_grid_index *index)
+{
+   index->initialize();
+   FILE *in = fopen(grid_file, "rb");
+   if(in == NULL) return(FAIL);
+
+   // Tag, file indexed, counts and grid, then the cell starts (the record
+   // numbers after them are read by iaea_read_grid_records)
+   iaea_sidecar_tag expected;
+   expected.make(grid_magic, GRID_INDEX_VERSION, (IAEA_I32) sizeof(double));
+   IAEA_I64 fields[7] = {0};
+   double bounds[4] = {0};
+   bool ok = expected.read_matches(in) &&
+             fread(fields, sizeof(fields), 1, in) == 1 &&
+             fread(bounds, sizeof(bounds), 1, in) == 1;
+   IAEA_I64 n_x = fields[5], n_y = fields[6];
+   ok = ok && fields[4] >= 0 && n_x >= 1 && n_x <= GRID_INDEX_MAX_CELLS &&
+        n_y >= 1 && n_y <= GRID_INDEX_MAX_CELLS;
+   IAEA_I64 n_cells = n_x*n_y;
+   if(ok)
+   {
+      index->cell_start = (IAEA_I64 *) malloc((size_t)(n_cells + 1)*sizeof(IAEA_I64));
+      ok = index->cell_start != NULL &&
+           fread(index->cell_start, sizeof(IAEA_I64), (size_t)(n_cells + 1), in) ==
+              (size_t)(n_cells + 1) &&
+           index->cell_start[0] == 0 && index->cell_start[n_cells] == fields[4];
+      for(IAEA_I64 c = 0; ok && c < n_cells; c++)
+         ok = index->cell_start[c] <= index->cell_start[c+1];
+   }
+   index->n_x = (IAEA_I32) n_x;
+   index->n_y = (IAEA_I32) n_y;
+
+   // The record numbers must all be there, and nothing after them
+   char extra;
+   ok = ok && seek_grid(in, records_offset(index) + fields[4]*(IAEA_I64) sizeof(IAEA_I64) - 1) == 0 &&
+        fread(&extra, 1, 1, in) == 1 && fread(&extra, 1, 1, in) == 0;
+   fclose(in);
+   if(!ok) {index->release(); return(FAIL);}
+
+   index->file.size = fields[0];
+   index->file.mtime_sec = fields[1];
+   index->file.mtime_nsec = fields[2];
+   index->file.record_length = fields[3];
+   index->n_records = fields[4];
+   index->minimum_x = bounds[0]; index->maximum_x = bounds[1];
+   index->minimum_y = bounds[2]; index->maximum_y = bounds[3];
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_save_grid_index(const char *grid_file, const iaea_grid_index *index,
+                           const IAEA_I64 *records)
+{
+   char temp_file[MAX_STR_LEN + 32];
+   FILE *out = iaea_open_sidecar(grid_file, temp_file);
+   if(out == NULL) return(FAIL);
+
+   iaea_sidecar_tag tag;
+   tag.make(grid_magic, GRID_INDEX_VERSION, (IAEA_I32) sizeof(double));
+   IAEA_I64 n_cells = (IAEA_I64) index->n_x*index->n_y;
+   IAEA_I64 fields[7] = {index->file.size, index->file.mtime_sec, index->file.mtime_nsec,
+                         index->file.record_length, index->n_records, index->n_x, index->n_y};
+   double bounds[4] = {index->minimum_x, index->maximum_x, index->minimum_y, index->maximum_y};
+   bool ok = tag.write(out) &&
+             fwrite(fields, sizeof(fields), 1, out) == 1 &&
+             fwrite(bounds, sizeof(bounds), 1, out) == 1 &&
+             fwrite(index->cell_start, sizeof(IAEA_I64), (size_t)(n_cells + 1), out) ==
+                (size_t)(n_cells + 1) &&
+             fwrite(records, sizeof(IAEA_I64), (size_t) index->n_records, out) ==
+                (size_t) index->n_records;
+   return(iaea_commit_sidecar(out, ok, temp_file, grid_file));
+}
+
+/* *********************************************************************** */
+short iaea_read_grid_records(const char *grid_file, const iaea_grid_index *index,
+                             IAEA_I32 first_column, IAEA_I32 last_column,
+                             IAEA_I32 first_row, IAEA_I32 last_row,
+                             IAEA_I64 **records, IAEA_I64 *n)
+{
+   *records = NULL;
+   *n = 0;
+   first_column = max(first_column, 0); last_column = min(last_column, index->n_x - 1);
+   first_row = max(first_row, 0);       last_row = min(last_row, index->n_y - 1);
+   if(first_column > last_column || first_row > last_row) return(OK);
+
+   // The cells of a row are next to each other in the file
+   IAEA_I64 total = 0;
+   for(IAEA_I32 r = first_row; r <= last_row; r++)
+   {
+      const IAEA_I64 *row_start = index->cell_start + (IAEA_I64) r*index->n_x;
+      total += row_start[last_column + 1] - row_start[first_column];
+   }
+   if(total == 0) return(OK);
+
+   FILE *in = fopen(grid_file, "rb");
+   IAEA_I64 *found = (IAEA_I64 *) malloc((size_t) total*sizeof(IAEA_I64));
+   bool ok = in != NULL && found != NULL;
+   IAEA_I64 done = 0;
+   for(IAEA_I32 r = first_row; ok && r <= last_row; r++)
+   {
+      const IAEA_I64 *row_start = index->cell_start + (IAEA_I64) r*index->n_x;
+      IAEA_I64 m = row_start[last_column + 1] - row_start[first_column];
+      if(m == 0) continue;
+      ok = seek_grid(in, records_offset(index) +
+                         row_start[first_column]*(IAEA_I64) sizeof(IAEA_I64)) == 0 &&
+           fread(found + done, sizeof(IAEA_I64), (size_t) m, in) == (size_t) m;
+      done += m;
+   }
+   if(in != NULL) fclose(in);
+   if(!ok) {free(found); return(FAIL);}
+
+   // Every cell is in order already; several cells are merged
+   if(first_column != last_column || first_row != last_row) std::sort(found, found + total);
+   *records = found;
+   *n = total;
+   return(OK);
+}
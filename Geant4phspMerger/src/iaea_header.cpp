@@ -51,10 +51,13 @@
 #if (defined WIN32) || (defined WIN64)
 #include <iostream>  // so that namespace std becomes defined
 #endif
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <cstddef>
+#include <new>
 
 #if !(defined WIN32) && !(defined WIN64)
 using namespace std;
@@ -62,22 +65,71 @@ using namespace std;
 
 #include "utilities.h"
 #include "iaea_header.h"
+#include "iaea_header_cache.h"
 
-int iaea_header_type::read_header ()
+int iaea_header_type::read_header (const char *cache_file)
 {
-    char line[MAX_STR_LEN];
-
     if(fheader==NULL)
     {
       printf("\n ERROR: Unable to open header file \n");
         return(FAIL);
     }
 
+    // The file is read once; every keyword is then looked up in memory
+    iaea_header_text text;
+    if(text.load(fheader) != OK)
+    {
+      printf("\n ERROR: Unable to read header file \n");
+        return(FAIL);
+    }
+
+    // A header already parsed is taken from its cache, if it still
+    // matches the file
+    iaea_header_file_id id;
+    if(cache_file != NULL)
+    {
+      if(id.identify(fheader, text.file, text.file_size) == OK &&
+         iaea_load_header_cache(cache_file, &id, this) == OK)
+      {
+        text.release();
+        return(OK);
+      }
+    }
+
+    if(text.parse() != OK)
+    {
+      printf("\n ERROR: Unable to read header file \n");
+      text.release();
+        return(FAIL);
+    }
+    int rvalue = read_header_text(&text);
+
+    // The texts read go to one arena, shared by all of them
+    if(set_texts(text.texts, text.text_offset, text.texts_used) != OK)
+    {
+      printf("\n ERROR: Unable to allocate header texts \n");
+      text.release();
+      return(FAIL);
+    }
+    text.release();
+
+    // Only headers read completely are cached, and not those of virtual
+    // phsps (members are not cached); a cache that cannot be written
+    // (e.g. in a read-only directory) is not an error
+    if(rvalue == OK && cache_file != NULL && id.size >= 0 && n_members == 0)
+      iaea_save_header_cache(cache_file, &id, this);
+    return(rvalue);
+}
+
+int iaea_header_type::read_header_text (iaea_header_text *text)
+{
+    char line[MAX_STR_LEN];
+
   // ******************************************************************************
   // 1. PHSP format
 
       /*********************************************/
-      if ( read_block(line,"FILE_TYPE") == FAIL )
+      if ( read_block(text,line,"FILE_TYPE") == FAIL )
       {
             printf("\nMandatory keyword FILE_TYPE is not defined in input\n");
             return FAIL;
@@ -85,7 +137,7 @@ int iaea_header_type::read_header ()
       else file_type = atoi(line);
 
       /*********************************************/
-      if ( read_block(line,"CHECKSUM") == FAIL )
+      if ( read_block(text,line,"CHECKSUM") == FAIL )
       {
             printf("\nMandatory keyword CHECKSUM is not defined in input\n");
             return FAIL;
@@ -95,7 +147,7 @@ int iaea_header_type::read_header ()
 	  }
 
       /*********************************************/
-      if ( read_block(line,"RECORD_LENGTH") == FAIL )
+      if ( read_block(text,line,"RECORD_LENGTH") == FAIL )
       {
             printf("\nMandatory keyword RECORD_LENGTH is not defined in input\n");
             return FAIL;
@@ -103,7 +155,7 @@ int iaea_header_type::read_header ()
       else record_length = atoi(line);
 
       /*********************************************/
-      if ( read_block(line,"BYTE_ORDER") == FAIL )
+      if ( read_block(text,line,"BYTE_ORDER") == FAIL )
       {
             printf("\nMandatory keyword BYTE_ORDER is not defined in input\n");
             return FAIL;
@@ -111,7 +163,7 @@ int iaea_header_type::read_header ()
       else byte_order = atoi(line);
 
       /*********************************************/
-    if( get_blockname(line,"RECORD_CONTENTS") == FAIL)
+    if( get_blockname(text,"RECORD_CONTENTS") == FAIL)
     {
        printf("\nMandatory keyword RECORD_CONTENTS is not defined in input\n");
          return FAIL;
@@ -122,27 +174,27 @@ int iaea_header_type::read_header ()
 
     for (i=0;i<9;i++)
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( text->get_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break;
       record_contents[i] = atoi(line);
     };
 
     for(i=0;i<record_contents[7];i++)
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( text->get_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break;
       extrafloat_contents[i] = atoi(line);
     }
 
     for(i=0;i<record_contents[8];i++)
     {
-      if( get_string(fheader,line) == FAIL ) return FAIL;
+      if( text->get_line(line) == FAIL ) return FAIL;
       if( *line == SEGMENT_BEG_TOKEN ) break;
       extralong_contents[i] = atoi(line);
     }
 
     /*********************************************/
-    if( get_blockname(line,"RECORD_CONSTANT") == FAIL)
+    if( get_blockname(text,"RECORD_CONSTANT") == FAIL)
     {
        printf("\nMandatory keyword RECORD_CONSTANT is not defined in input\n");
          return FAIL;
@@ -152,7 +204,7 @@ int iaea_header_type::read_header ()
     {
         record_constant[i] = 32000.f;
         if(record_contents[i] > 0) continue;
-        if( get_string(fheader,line) == FAIL ) return FAIL;
+        if( text->get_line(line) == FAIL ) return FAIL;
         if( *line == SEGMENT_BEG_TOKEN ) break;
         record_constant[i] = (float)atof(line);
     };
@@ -160,7 +212,7 @@ int iaea_header_type::read_header ()
 // ******************************************************************************
 // 2. Mandatory description of the phsp
 
-      if ( read_block(coordinate_system_description,"COORDINATE_SYSTEM_DESCRIPTION") == FAIL)
+      if ( read_text(text,HEADER_COORDINATE_SYSTEM_DESCRIPTION,"COORDINATE_SYSTEM_DESCRIPTION") == FAIL)
       {
             printf("\nMandatory keyword COORDINATE_SYSTEM_DESCRIPTION is not defined in input\n");
             return FAIL;
@@ -169,7 +221,7 @@ int iaea_header_type::read_header ()
   if(file_type == 1) // For event generators
   {
     /*********************************************/
-      if ( read_block(line,"INPUT_FILE_FOR_EVENT_GENERATOR") == FAIL )
+      if ( read_block(text,line,"INPUT_FILE_FOR_EVENT_GENERATOR") == FAIL )
       {
             printf("\nMandatory keyword INPUT_FILE_FOR_EVENT_GENERATOR is not defined in input\n");
             return FAIL;
@@ -179,7 +231,7 @@ int iaea_header_type::read_header ()
   if(file_type == 0) // for phsp files
   {
       /*********************************************/
-      if ( read_block(line,"ORIG_HISTORIES") == FAIL )
+      if ( read_block(text,line,"ORIG_HISTORIES") == FAIL )
       {
             printf("\nMandatory keyword ORIG_HISTORIES is not defined in input\n");
             return FAIL;
@@ -191,7 +243,7 @@ int iaea_header_type::read_header ()
       }
 
       /*********************************************/
-      if ( read_block(line,"PARTICLES") == FAIL )
+      if ( read_block(text,line,"PARTICLES") == FAIL )
       {
             printf("\nMandatory keyword PARTICLES is not defined in input\n");
             return FAIL;
@@ -202,20 +254,20 @@ int iaea_header_type::read_header ()
       for(int itmp=0;itmp<MAX_NUM_PARTICLES;itmp++) particle_number[itmp]=0;
       IAEA_I64 npart;
 	  //atol(line); commented  //atol(0 was not working properly in Windows
-      if ( read_block(line,"PHOTONS") == OK )
+      if ( read_block(text,line,"PHOTONS") == OK )
             {npart = (IAEA_I64)atof(line); particle_number[0] = npart;}
-      if ( read_block(line,"ELECTRONS") == OK )
+      if ( read_block(text,line,"ELECTRONS") == OK )
             {npart = (IAEA_I64)atof(line); particle_number[1] = npart;}
-      if ( read_block(line,"POSITRONS") == OK )
+      if ( read_block(text,line,"POSITRONS") == OK )
             {npart = (IAEA_I64)atof(line); particle_number[2] = npart;}
-      if ( read_block(line,"NEUTRONS") == OK )
+      if ( read_block(text,line,"NEUTRONS") == OK )
             {npart = (IAEA_I64)atof(line); particle_number[3] = npart;}
-      if ( read_block(line,"PROTONS") == OK )
+      if ( read_block(text,line,"PROTONS") == OK )
             {npart = (IAEA_I64)atof(line); particle_number[4] = npart;}
   }
 // ******************************************************************************
 // 3. Mandatory additional information
-      if ( read_block(line,"IAEA_INDEX") == FAIL )
+      if ( read_block(text,line,"IAEA_INDEX") == FAIL )
       {
             printf("\nMandatory keyword IAEA_INDEX is not defined in input\n");
             return FAIL;
@@ -223,28 +275,28 @@ int iaea_header_type::read_header ()
       else iaea_index = atoi(line);
 
       /*********************************************/
-      if ( read_block(title,"TITLE") == FAIL )
+      if ( read_text(text,HEADER_TITLE,"TITLE") == FAIL )
       {
             printf("\nMandatory keyword TITLE is not defined in input\n");
             return FAIL;
       }
 
       /*********************************************/
-      if ( read_block(machine_type,"MACHINE_TYPE") == FAIL)
+      if ( read_text(text,HEADER_MACHINE_TYPE,"MACHINE_TYPE") == FAIL)
       {
             printf("\nMandatory keyword MACHINE_TYPE is not defined in input\n");
             return FAIL;
       }
 
       /*********************************************/
-      if ( read_block(MC_code_and_version,"MONTE_CARLO_CODE_VERSION") == FAIL )
+      if ( read_text(text,HEADER_MC_CODE_AND_VERSION,"MONTE_CARLO_CODE_VERSION") == FAIL )
       {
             printf("\nMandatory keyword MONTE_CARLO_CODE_VERSION is not defined in input\n");
             return FAIL;
       }
 
       /*********************************************/
-      if ( read_block(line,"GLOBAL_PHOTON_ENERGY_CUTOFF") == FAIL )
+      if ( read_block(text,line,"GLOBAL_PHOTON_ENERGY_CUTOFF") == FAIL )
       {
             printf("\nMandatory keyword GLOBAL_PHOTON_ENERGY_CUTOFF is not defined in input\n");
             return FAIL;
@@ -252,7 +304,7 @@ int iaea_header_type::read_header ()
       else global_photon_energy_cutoff = (float)atof(line);
 
       /*********************************************/
-      if ( read_block(line,"GLOBAL_PARTICLE_ENERGY_CUTOFF") == FAIL )
+      if ( read_block(text,line,"GLOBAL_PARTICLE_ENERGY_CUTOFF") == FAIL )
       {
             printf("\nMandatory keyword GLOBAL_PARTICLE_ENERGY_CUTOFF is not defined in input\n");
             return FAIL;
@@ -260,7 +312,7 @@ int iaea_header_type::read_header ()
       else global_particle_energy_cutoff = (float)atof(line);
 
       /*********************************************/
-      if ( read_block(transport_parameters,"TRANSPORT_PARAMETERS") == FAIL )
+      if ( read_text(text,HEADER_TRANSPORT_PARAMETERS,"TRANSPORT_PARAMETERS") == FAIL )
       {
             printf("\nMandatory keyword TRANSPORT_PARAMETERS is not defined in input\n");
             return FAIL;
@@ -269,39 +321,39 @@ int iaea_header_type::read_header ()
 // ******************************************************************************
 // 4. Optional description
 
-      if ( read_block(beam_name,"BEAM_NAME") == FAIL )
+      if ( read_text(text,HEADER_BEAM_NAME,"BEAM_NAME") == FAIL )
             printf("ERROR reading BEAM_NAME\n");
-      if ( read_block(field_size,"FIELD_SIZE") == FAIL )
+      if ( read_text(text,HEADER_FIELD_SIZE,"FIELD_SIZE") == FAIL )
             printf("ERROR reading FIELD_SIZE\n");
-      if ( read_block(nominal_SSD,"NOMINAL_SSD") == FAIL )
+      if ( read_text(text,HEADER_NOMINAL_SSD,"NOMINAL_SSD") == FAIL )
             printf("ERROR reading NOMINAL_SSD\n");
-      if ( read_block(variance_reduction_techniques,
+      if ( read_text(text,HEADER_VARIANCE_REDUCTION_TECHNIQUES,
                         "VARIANCE_REDUCTION_TECHNIQUES") == FAIL )
             printf("VARIANCE_REDUCTION_TECHNIQUES\n");
-      if ( read_block(initial_source_description,"INITIAL_SOURCE_DESCRIPTION") == FAIL )
+      if ( read_text(text,HEADER_INITIAL_SOURCE_DESCRIPTION,"INITIAL_SOURCE_DESCRIPTION") == FAIL )
             printf("INITIAL_SOURCE_DESCRIPTION:\n");
 
       // Documentation sub-section
       /*********************************************/
-      if ( read_block(MC_input_filename,"MC_INPUT_FILENAME") == FAIL )
+      if ( read_text(text,HEADER_MC_INPUT_FILENAME,"MC_INPUT_FILENAME") == FAIL )
             printf("MC_INPUT_FILENAME\n");
-      if ( read_block(published_reference,"PUBLISHED_REFERENCE") == FAIL )
+      if ( read_text(text,HEADER_PUBLISHED_REFERENCE,"PUBLISHED_REFERENCE") == FAIL )
             printf("PUBLISHED_REFERENCE\n");
-      if ( read_block(authors,"AUTHORS") == FAIL ) printf("AUTHORS\n");
-      if ( read_block(institution,"INSTITUTION") == FAIL ) printf("INSTITUTION\n");
-      if ( read_block(link_validation,"LINK_VALIDATION") == FAIL )
+      if ( read_text(text,HEADER_AUTHORS,"AUTHORS") == FAIL ) printf("AUTHORS\n");
+      if ( read_text(text,HEADER_INSTITUTION,"INSTITUTION") == FAIL ) printf("INSTITUTION\n");
+      if ( read_text(text,HEADER_LINK_VALIDATION,"LINK_VALIDATION") == FAIL )
             printf("LINK_VALIDATION\n");
-      if ( read_block(additional_notes,"ADDITIONAL_NOTES") == FAIL )
+      if ( read_text(text,HEADER_ADDITIONAL_NOTES,"ADDITIONAL_NOTES") == FAIL )
             printf("ADDITIONAL_NOTES\n");
 
 // ******************************************************************************
 // 5. Statistical information
       /*********************************************/
-    if( get_blockname(line,"STATISTICAL_INFORMATION_PARTICLES") == OK)
+    if( get_blockname(text,"STATISTICAL_INFORMATION_PARTICLES") == OK)
     {
         for(i=0;i<MAX_NUM_PARTICLES;i++)
         {
-              if( get_string(fheader,line) == FAIL ) return FAIL;
+              if( text->get_line(line) == FAIL ) return FAIL;
               if( *line == SEGMENT_BEG_TOKEN ) break;
 
               if(particle_number[i] == 0) continue;
@@ -324,7 +376,7 @@ int iaea_header_type::read_header ()
         }
     }
 
-    if( get_blockname(line,"STATISTICAL_INFORMATION_GEOMETRY") == OK)
+    if( get_blockname(text,"STATISTICAL_INFORMATION_GEOMETRY") == OK)
       {
         minimumX = minimumY = minimumZ = 32000.f;
         maximumX = maximumY = maximumZ = 0.f;
@@ -333,7 +385,7 @@ int iaea_header_type::read_header ()
         {
             if(record_contents[i] == 1)
             {
-                  if( get_string(fheader,line) == FAIL ) return FAIL;
+                  if( text->get_line(line) == FAIL ) return FAIL;
                   if( *line == SEGMENT_BEG_TOKEN ) break;
 
                 // -------------------------------------------------------
@@ -354,7 +406,15 @@ int iaea_header_type::read_header ()
         }
       }
 
-    return(OK);
+  // ******************************************************************************
+  // 6. Members of a virtual phsp
+
+    if(read_members(text) != OK) return(FAIL);
+
+  // ******************************************************************************
+  // 7. Compression of the records
+
+    return(read_compression(text));
 }
 
 int iaea_header_type::write_blockname(const char *blockname)
@@ -363,59 +423,150 @@ int iaea_header_type::write_blockname(const char *blockname)
   (fprintf(fheader,"%c%s%c\n",SEGMENT_BEG_TOKEN,blockname,SEGMENT_END_TOKEN));
 }
 
-int iaea_header_type::get_blockname(char *line, const char *blockname)
+int iaea_header_type::get_blockname(iaea_header_text *text, const char *blockname)
 {
-  char *begptr, *endptr;
-
   // printf("                       Reading block: %s ...\n",blockname);
 
-  if(fheader==NULL)
-  {
-    printf("\n ERROR: Opening header file to Get Block \n"); return(FAIL);
-  }
-  rewind(fheader) ;
-
-  while( get_string(fheader,line) == OK )
-  {
-    if( *line == SEGMENT_BEG_TOKEN )
-      {
-         begptr = line + 1 ;
-             // printf("                       Read line %s ...\n",line);
-         endptr = strchr(begptr,SEGMENT_END_TOKEN) ;
-         if( endptr != NULL ) {
-           *endptr = '\0' ;
-               // printf("                       Comparing %s ...\n",begptr);
-           if( strcmp(begptr,blockname) == 0 ) return(OK) ;
-         }
-      }
-  };
-  return(FAIL) ;
+  return(text->find_block(blockname));
 }
 
-int iaea_header_type::get_block(char *lineread)
+int iaea_header_type::get_block(iaea_header_text *text, char *lineread, IAEA_I64 *extent)
 {
       int read = FAIL, count = 0;
 
       char line[MAX_STR_LEN];
 
       strcpy (lineread,""); // Deleting lineread contents
-      while( get_string(fheader,line) == OK )
+      while( text->get_line(line) == OK )
     {
         if( *line == SEGMENT_BEG_TOKEN ) break;
-        strcat(lineread+count*MAX_NUMB_LINES,line); count++;
+        strcat(lineread+count*MAX_NUMB_LINES,line);
+        if(extent != NULL)
+        {
+          IAEA_I64 end = count*MAX_NUMB_LINES + strlen(lineread+count*MAX_NUMB_LINES) + 1;
+          if(end > *extent) *extent = end;
+        }
+        count++;
         read = OK;
     };
       return (read);
 }
 
-int iaea_header_type::read_block(char *lineread,const char *blockname)
+int iaea_header_type::read_block(iaea_header_text *text, char *lineread,const char *blockname)
 {
-    char line[MAX_STR_LEN];
-    if( get_blockname(line,blockname) != OK) return FAIL;
-      if( get_block(lineread) != OK) return FAIL;
+    if( get_blockname(text,blockname) != OK) return FAIL;
+      if( get_block(text,lineread) != OK) return FAIL;
       return OK;
 }
 
+// Reads a block of text lines into the texts of the header text
+int iaea_header_type::read_text(iaea_header_text *text, int which, const char *blockname)
+{
+    char *block = text->get_block_buffer();
+    if( block == NULL ) return FAIL;
+    if( get_blockname(text,blockname) != OK) return FAIL;
+    int rvalue = get_block(text,block,&text->block_extent);
+    if( text->add_text(which,block) != OK) return FAIL;
+    return rvalue;
+}
+
+// Reads the $VIRTUAL_MEMBERS: block, one member per line:
+// first record, number of records and base name of the member
+int iaea_header_type::read_members(iaea_header_text *text)
+{
+    char line[MAX_STR_LEN];
+
+    release_members();
+    if( get_blockname(text,"VIRTUAL_MEMBERS") != OK ) return OK; // a phsp file
+
+    while( text->get_line(line) == OK )
+    {
+        if( *line == SEGMENT_BEG_TOKEN ) break;
+
+        long long first = -1, n = -1;
+        int name = 0;
+        if( sscanf(line, "%lld %lld %n", &first, &n, &name) < 2 )
+        {
+            // Blank lines (comments) are skipped
+            if( strspn(line, " \t\r\n") == strlen(line) ) continue;
+            name = 0;
+        }
+        int end = strlen(line);
+        while( end > name && isspace((unsigned char) line[end-1]) ) end--;
+        line[end] = '\0';
+
+        if( name == 0 || first < 0 || n < 0 || end == name )
+        {
+            printf("\n ERROR: Wrong line in VIRTUAL_MEMBERS: %s\n", line);
+            return FAIL;
+        }
+        if( add_member(line + name, (IAEA_I64) first, (IAEA_I64) n) != OK )
+        {
+            printf("\n ERROR: Unable to allocate virtual members \n");
+            return FAIL;
+        }
+    }
+    return OK;
+}
+
+short iaea_header_type::add_member(const char *file, IAEA_I64 first_record, IAEA_I64 n_records)
+{
+    if( n_members == members_size )
+    {
+        IAEA_I32 size = members_size > 0 ? 2*members_size : 64;
+        iaea_virtual_member *grown = (iaea_virtual_member *)
+            realloc(members, size*sizeof(iaea_virtual_member));
+        if( grown == NULL ) return(FAIL);
+        members = grown; members_size = size;
+    }
+    char *name = (char *) malloc(strlen(file) + 1);
+    if( name == NULL ) return(FAIL);
+    strcpy(name, file);
+
+    members[n_members].file = name;
+    members[n_members].first_record = first_record;
+    members[n_members].n_records = n_records;
+    n_members++;
+    return(OK);
+}
+
+// Reads the $RECORD_COMPRESSION: block: the method (zlib) and the records
+// per frame
+int iaea_header_type::read_compression(iaea_header_text *text)
+{
+    char line[MAX_STR_LEN];
+
+    compression = COMPRESSION_NONE;
+    frame_records = 0;
+    if( get_blockname(text,"RECORD_COMPRESSION") != OK ) return OK; // not compressed
+
+    while( text->get_line(line) == OK )
+    {
+        if( *line == SEGMENT_BEG_TOKEN ) break;
+        if( strspn(line, " \t\r\n") == strlen(line) ) continue;
+
+        char method[32];
+        long long n = 0;
+        if( sscanf(line, "%31s %lld", method, &n) != 2 || strcmp(method, "zlib") != 0 || n <= 0 )
+        {
+            printf("\n ERROR: Wrong line in RECORD_COMPRESSION: %s\n", line);
+            return FAIL;
+        }
+        compression = COMPRESSION_ZLIB;
+        frame_records = (IAEA_I64) n;
+        break;
+    }
+    return OK;
+}
+
+void iaea_header_type::release_members()
+{
+    for(int i=0;i<n_members;i++) free(members[i].file);
+    free(members);
+    members = NULL;
+    n_members = members_size = 0;
+}
+
 int iaea_header_type::set_record_contents(iaea_record_type *p_iaea_record)
 {
    int i;
@@ -563,6 +714,142 @@ void iaea_header_type::update_counters(iaea_record_type *p_iaea_record)
 
 }
 
+// As update_counters for n particles at once: the block is reduced into
+// an iaea_statistics by its vector kernels and added to the counters
+void iaea_header_type::update_counters(IAEA_I64 n, const IAEA_I32 particle[],
+                                       const float energy[], const float weight[],
+                                       const float x[], const float y[], const float z[],
+                                       const IAEA_I32 new_history[])
+{
+  if(n <= 0) return;
+
+  iaea_statistics s;
+  s.initialize();
+  s.add_block(n, particle, energy, weight, x, y, z, new_history);
+  add_statistics(&s);
+}
+
+// Adds the counters gathered by update_counters in another header, e.g. for
+// records of the same file that were processed by a different thread
+void iaea_header_type::merge_counters(const iaea_header_type *p_iaea_header)
+{
+  if (p_iaea_header->maximumX > maximumX )  maximumX = p_iaea_header->maximumX;
+  if (p_iaea_header->minimumX < minimumX )  minimumX = p_iaea_header->minimumX;
+
+  if (p_iaea_header->maximumY > maximumY )  maximumY = p_iaea_header->maximumY;
+  if (p_iaea_header->minimumY < minimumY )  minimumY = p_iaea_header->minimumY;
+
+  if (p_iaea_header->maximumZ > maximumZ )  maximumZ = p_iaea_header->maximumZ;
+  if (p_iaea_header->minimumZ < minimumZ )  minimumZ = p_iaea_header->minimumZ;
+
+  nParticles += p_iaea_header->nParticles;
+  read_indep_histories += p_iaea_header->read_indep_histories;
+
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      if( p_iaea_header->particle_number[i] == 0 ) continue;
+      particle_number[i] += p_iaea_header->particle_number[i];
+      sumParticleWeight[i] += p_iaea_header->sumParticleWeight[i];
+      averageKineticEnergy[i] += p_iaea_header->averageKineticEnergy[i];
+      if (p_iaea_header->maximumWeight[i] > maximumWeight[i] )
+            maximumWeight[i] = p_iaea_header->maximumWeight[i];
+      if (p_iaea_header->minimumWeight[i] < minimumWeight[i] )
+            minimumWeight[i] = p_iaea_header->minimumWeight[i];
+      if (p_iaea_header->maximumKineticEnergy[i] > maximumKineticEnergy[i] )
+            maximumKineticEnergy[i] = p_iaea_header->maximumKineticEnergy[i];
+      if (p_iaea_header->minimumKineticEnergy[i] < minimumKineticEnergy[i] )
+            minimumKineticEnergy[i] = p_iaea_header->minimumKineticEnergy[i];
+  }
+}
+
+// Adds counters gathered in an iaea_statistics, as merge_counters adds
+// the ones of another header
+void iaea_header_type::add_statistics(const iaea_statistics *s)
+{
+  if( s->n_particles == 0 ) return;
+
+  if (s->maximum_x > maximumX )  maximumX = s->maximum_x;
+  if (s->minimum_x < minimumX )  minimumX = s->minimum_x;
+
+  if (s->maximum_y > maximumY )  maximumY = s->maximum_y;
+  if (s->minimum_y < minimumY )  minimumY = s->minimum_y;
+
+  if (s->maximum_z > maximumZ )  maximumZ = s->maximum_z;
+  if (s->minimum_z < minimumZ )  minimumZ = s->minimum_z;
+
+  nParticles += s->n_particles;
+  read_indep_histories += s->histories;
+
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      if( s->particle_number[i] == 0 ) continue;
+      particle_number[i] += s->particle_number[i];
+      sumParticleWeight[i] += s->sum_weight[i];
+      averageKineticEnergy[i] += s->sum_weighted_energy[i];
+      if (s->maximum_weight[i] > maximumWeight[i] )
+            maximumWeight[i] = s->maximum_weight[i];
+      if (s->minimum_weight[i] < minimumWeight[i] )
+            minimumWeight[i] = s->minimum_weight[i];
+      if (s->maximum_energy[i] > maximumKineticEnergy[i] )
+            maximumKineticEnergy[i] = s->maximum_energy[i];
+      if (s->minimum_energy[i] < minimumKineticEnergy[i] )
+            minimumKineticEnergy[i] = s->minimum_energy[i];
+  }
+}
+
+// Adds the statistical information read from the header of another phsp
+// file, as if all its particles had been passed to update_counters.
+// In a header <E> is stored as an average and constant coordinates are
+// not listed. Fails if the header has particles but no statistics.
+short iaea_header_type::merge_statistics(const iaea_header_type *p_iaea_header)
+{
+  IAEA_I64 ntypes = 0;
+  int i;
+  for(i=0;i<MAX_NUM_PARTICLES;i++) ntypes += p_iaea_header->particle_number[i];
+  if( p_iaea_header->nParticles > 0 && ntypes == 0 ) return(FAIL);
+  if( p_iaea_header->nParticles == 0 ) return(OK);
+
+  double minimum[3] = {p_iaea_header->minimumX, p_iaea_header->minimumY,
+                       p_iaea_header->minimumZ};
+  double maximum[3] = {p_iaea_header->maximumX, p_iaea_header->maximumY,
+                       p_iaea_header->maximumZ};
+  for(i=0;i<3;i++)
+  {
+      if( p_iaea_header->record_contents[i] != 0 ) continue;
+      minimum[i] = maximum[i] = p_iaea_header->record_constant[i];
+  }
+
+  if (maximum[0] > maximumX )  maximumX = maximum[0];
+  if (minimum[0] < minimumX )  minimumX = minimum[0];
+
+  if (maximum[1] > maximumY )  maximumY = maximum[1];
+  if (minimum[1] < minimumY )  minimumY = minimum[1];
+
+  if (maximum[2] > maximumZ )  maximumZ = maximum[2];
+  if (minimum[2] < minimumZ )  minimumZ = minimum[2];
+
+  // Independent histories are not stored in a header
+  nParticles += p_iaea_header->nParticles;
+
+  for(i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      if( p_iaea_header->particle_number[i] == 0 ) continue;
+      particle_number[i] += p_iaea_header->particle_number[i];
+      sumParticleWeight[i] += p_iaea_header->sumParticleWeight[i];
+      averageKineticEnergy[i] += p_iaea_header->averageKineticEnergy[i]*
+                                 p_iaea_header->sumParticleWeight[i];
+      if (p_iaea_header->maximumWeight[i] > maximumWeight[i] )
+            maximumWeight[i] = p_iaea_header->maximumWeight[i];
+      if (p_iaea_header->minimumWeight[i] < minimumWeight[i] )
+            minimumWeight[i] = p_iaea_header->minimumWeight[i];
+      if (p_iaea_header->maximumKineticEnergy[i] > maximumKineticEnergy[i] )
+            maximumKineticEnergy[i] = p_iaea_header->maximumKineticEnergy[i];
+      if (p_iaea_header->minimumKineticEnergy[i] < minimumKineticEnergy[i] )
+            minimumKineticEnergy[i] = p_iaea_header->minimumKineticEnergy[i];
+  }
+  return(OK);
+}
+
 void iaea_header_type::print_statistics()
 {
    printf("\n *************************************** \n");
@@ -713,7 +1000,7 @@ int iaea_header_type::write_header()
 
   fprintf(fheader,"%i   // Test header\n\n",iaea_index);
 
-  write_blockname("TITLE");fprintf(fheader,"%s \n\n",title);
+  write_blockname("TITLE");fprintf(fheader,"%s \n\n",get_text(HEADER_TITLE));
 
   write_blockname("FILE_TYPE");fprintf(fheader,"0\n\n"); // phasespace is assumed
 
@@ -918,17 +1205,40 @@ int iaea_header_type::write_header()
   if(record_contents[1] == 1) fprintf(fheader," %G  %G\n",minimumY,maximumY);
   if(record_contents[2] == 1) fprintf(fheader," %G  %G\n\n",minimumZ,maximumZ);
 
-  return(OK);
+  // 6. Members of a virtual phsp
+  if(n_members > 0)
+  {
+    fprintf(fheader,"\n");
+    write_blockname("VIRTUAL_MEMBERS");
+    fprintf(fheader,"//  First record      Records  Member\n");
+    for(i=0;i<n_members;i++)
+      fprintf(fheader,"  %12llu %12llu  %s\n",members[i].first_record,
+              members[i].n_records,members[i].file);
+    fprintf(fheader,"\n");
+  }
+
+  // 7. Compression of the records
+  return(write_compression());
 
 }
 
+int iaea_header_type::write_compression()
+{
+  if(compression != COMPRESSION_ZLIB) return(OK);
+  fprintf(fheader,"\n");
+  write_blockname("RECORD_COMPRESSION");
+  fprintf(fheader,"//  Method  Frame records\n");
+  fprintf(fheader,"    zlib    %lld\n\n",(long long) frame_records);
+  return(OK);
+}
+
 int iaea_header_type::print_header ()
 {
 
     if(checksum == 0) printf("\n NEW PHASE SPACE FILE WILL BE CREATED\n");
 
     printf("\n\nIAEA_INDEX: %i\n",iaea_index);
-    printf("TITLE: %s \n",title);
+    printf("TITLE: %s \n",get_text(HEADER_TITLE));
 
   // ******************************************************************************
   // 1. PHSP format
@@ -1000,14 +1310,14 @@ int iaea_header_type::print_header ()
 // ******************************************************************************
 // 2. Mandatory description of the phsp
 
-      if( strncmp(coordinate_system_description,"                ",15) > 0 )
+      if( strncmp(get_text(HEADER_COORDINATE_SYSTEM_DESCRIPTION),"                ",15) > 0 )
           printf("\nCOORDINATE_SYSTEM_DESCRIPTION: \n%s\n",
-            coordinate_system_description);
+            get_text(HEADER_COORDINATE_SYSTEM_DESCRIPTION));
 
       if(file_type == 1)
       {
             // For event generators
-          printf("INPUT FILE for event generator: %s \n",input_file_for_event_generator);
+          printf("INPUT FILE for event generator: %s \n",get_text(HEADER_INPUT_FILE_FOR_EVENT_GENERATOR));
             return OK;
       }
       printf("\n");
@@ -1025,48 +1335,48 @@ int iaea_header_type::print_header ()
 // ******************************************************************************
 // 3. Mandatory additional information
       /*********************************************/
-      if( strncmp(machine_type,"                ",15) > 0 )
-        printf("MACHINE_TYPE: %s\n",machine_type);
+      if( strncmp(get_text(HEADER_MACHINE_TYPE),"                ",15) > 0 )
+        printf("MACHINE_TYPE: %s\n",get_text(HEADER_MACHINE_TYPE));
 
-      if( strncmp(MC_code_and_version,"                ",15) > 0 )
-        printf("MONTE_CARLO_CODE_VERSION: %s \n",MC_code_and_version);
+      if( strncmp(get_text(HEADER_MC_CODE_AND_VERSION),"                ",15) > 0 )
+        printf("MONTE_CARLO_CODE_VERSION: %s \n",get_text(HEADER_MC_CODE_AND_VERSION));
 
       printf("GLOBAL_PHOTON_ENERGY_CUTOFF: %8.5f \n",global_photon_energy_cutoff);
       printf("GLOBAL_PARTICLE_ENERGY_CUTOFF: %8.5f \n",global_particle_energy_cutoff);
       printf("\n");
 
-      if( strncmp(transport_parameters,"                ",15) > 0 )
-        printf("\nTRANSPORT_PARAMETERS:\n%s\n",transport_parameters);
+      if( strncmp(get_text(HEADER_TRANSPORT_PARAMETERS),"                ",15) > 0 )
+        printf("\nTRANSPORT_PARAMETERS:\n%s\n",get_text(HEADER_TRANSPORT_PARAMETERS));
 
 // ******************************************************************************
 // 4. Optional description
-      if( strncmp(beam_name,"                ",15) > 0 )
-        printf("BEAM_NAME: %s\n",beam_name);
-      if( strncmp(field_size,"                ",15) > 0 )
-        printf("FIELD_SIZE: %s\n",field_size);
-      if( strncmp(nominal_SSD,"                ",15) > 0 )
-        printf("NOMINAL_SSD: %s\n",nominal_SSD);
-      if( strncmp(variance_reduction_techniques,"                ",15) > 0 )
+      if( strncmp(get_text(HEADER_BEAM_NAME),"                ",15) > 0 )
+        printf("BEAM_NAME: %s\n",get_text(HEADER_BEAM_NAME));
+      if( strncmp(get_text(HEADER_FIELD_SIZE),"                ",15) > 0 )
+        printf("FIELD_SIZE: %s\n",get_text(HEADER_FIELD_SIZE));
+      if( strncmp(get_text(HEADER_NOMINAL_SSD),"                ",15) > 0 )
+        printf("NOMINAL_SSD: %s\n",get_text(HEADER_NOMINAL_SSD));
+      if( strncmp(get_text(HEADER_VARIANCE_REDUCTION_TECHNIQUES),"                ",15) > 0 )
         printf("VARIANCE_REDUCTION_TECHNIQUES:\n%s\n",
-        variance_reduction_techniques);
-      if( strncmp(initial_source_description,"                ",15) > 0 )
+        get_text(HEADER_VARIANCE_REDUCTION_TECHNIQUES));
+      if( strncmp(get_text(HEADER_INITIAL_SOURCE_DESCRIPTION),"                ",15) > 0 )
         printf("INITIAL_SOURCE_DESCRIPTION: \n%s\n",
-        initial_source_description);
+        get_text(HEADER_INITIAL_SOURCE_DESCRIPTION));
 
       // Documentation sub-section
       /*********************************************/
-      if( strncmp(MC_input_filename,"                ",15) > 0 )
-        printf("MC_INPUT_FILENAME: %s\n",MC_input_filename);
-      if( strncmp(published_reference,"                ",15) > 0 )
-        printf("PUBLISHED_REFERENCE: \n%s\n",published_reference);
-      if( strncmp(authors,"                ",15) > 0 )
-        printf("AUTHORS: \n%s\n",authors);
-      if( strncmp(institution,"                ",15) > 0 )
-        printf("INSTITUTION: \n%s\n",institution);
-      if( strncmp(link_validation,"                ",15) > 0 )
-        printf("LINK_VALIDATION: \n%s\n",link_validation);
-      if( strncmp(additional_notes,"                ",15) > 0 )
-        printf("ADDITIONAL_NOTES: \n%s\n",additional_notes);
+      if( strncmp(get_text(HEADER_MC_INPUT_FILENAME),"                ",15) > 0 )
+        printf("MC_INPUT_FILENAME: %s\n",get_text(HEADER_MC_INPUT_FILENAME));
+      if( strncmp(get_text(HEADER_PUBLISHED_REFERENCE),"                ",15) > 0 )
+        printf("PUBLISHED_REFERENCE: \n%s\n",get_text(HEADER_PUBLISHED_REFERENCE));
+      if( strncmp(get_text(HEADER_AUTHORS),"                ",15) > 0 )
+        printf("AUTHORS: \n%s\n",get_text(HEADER_AUTHORS));
+      if( strncmp(get_text(HEADER_INSTITUTION),"                ",15) > 0 )
+        printf("INSTITUTION: \n%s\n",get_text(HEADER_INSTITUTION));
+      if( strncmp(get_text(HEADER_LINK_VALIDATION),"                ",15) > 0 )
+        printf("LINK_VALIDATION: \n%s\n",get_text(HEADER_LINK_VALIDATION));
+      if( strncmp(get_text(HEADER_ADDITIONAL_NOTES),"                ",15) > 0 )
+        printf("ADDITIONAL_NOTES: \n%s\n",get_text(HEADER_ADDITIONAL_NOTES));
 
 // ******************************************************************************
 // 5. Optional statistical information
@@ -1075,3 +1385,256 @@ int iaea_header_type::print_header ()
 
     return(OK);
 }
+
+void iaea_header_summary::save(const iaea_header_type *p_iaea_header)
+{
+  orig_histories = p_iaea_header->orig_histories;
+  nParticles = p_iaea_header->nParticles;
+  read_indep_histories = p_iaea_header->read_indep_histories;
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      particle_number[i] = p_iaea_header->particle_number[i];
+      averageKineticEnergy[i] = p_iaea_header->averageKineticEnergy[i];
+      sumParticleWeight[i] = p_iaea_header->sumParticleWeight[i];
+      maximumKineticEnergy[i] = p_iaea_header->maximumKineticEnergy[i];
+      minimumKineticEnergy[i] = p_iaea_header->minimumKineticEnergy[i];
+      minimumWeight[i] = p_iaea_header->minimumWeight[i];
+      maximumWeight[i] = p_iaea_header->maximumWeight[i];
+  }
+  minimumX = p_iaea_header->minimumX;  maximumX = p_iaea_header->maximumX;
+  minimumY = p_iaea_header->minimumY;  maximumY = p_iaea_header->maximumY;
+  minimumZ = p_iaea_header->minimumZ;  maximumZ = p_iaea_header->maximumZ;
+}
+
+void iaea_header_summary::restore(iaea_header_type *p_iaea_header) const
+{
+  p_iaea_header->orig_histories = orig_histories;
+  p_iaea_header->nParticles = nParticles;
+  p_iaea_header->read_indep_histories = read_indep_histories;
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      p_iaea_header->particle_number[i] = particle_number[i];
+      p_iaea_header->averageKineticEnergy[i] = averageKineticEnergy[i];
+      p_iaea_header->sumParticleWeight[i] = sumParticleWeight[i];
+      p_iaea_header->maximumKineticEnergy[i] = maximumKineticEnergy[i];
+      p_iaea_header->minimumKineticEnergy[i] = minimumKineticEnergy[i];
+      p_iaea_header->minimumWeight[i] = minimumWeight[i];
+      p_iaea_header->maximumWeight[i] = maximumWeight[i];
+  }
+  p_iaea_header->minimumX = minimumX;  p_iaea_header->maximumX = maximumX;
+  p_iaea_header->minimumY = minimumY;  p_iaea_header->maximumY = maximumY;
+  p_iaea_header->minimumZ = minimumZ;  p_iaea_header->maximumZ = maximumZ;
+}
+
+/* ***************************************************************************************************** */
+// Header text: the file is read and split into lines once, and block names
+// are then found by binary search
+
+// Appends n chars to a growing buffer
+static short append_text(char **buffer, IAEA_I64 *used, IAEA_I64 *size, const char *s, IAEA_I64 n)
+{
+   if(*used + n > *size)
+   {
+      IAEA_I64 new_size = *size > 0 ? *size : 4096;
+      while(*used + n > new_size) new_size *= 2;
+      char *grown = (char *) realloc(*buffer, (size_t) new_size);
+      if(grown == NULL) return(FAIL);
+      *buffer = grown; *size = new_size;
+   }
+   memcpy(*buffer + *used, s, (size_t) n);
+   *used += n;
+   return(OK);
+}
+
+short iaea_header_text::load(FILE *fheader)
+{
+   file = NULL; file_size = 0;
+   lines = NULL; line_offset = NULL; blocks = NULL;
+   n_lines = n_blocks = next_line = 0;
+   texts = NULL; texts_used = texts_size = 0;
+   for(int i=0;i<NUM_HEADER_TEXTS;i++) text_offset[i] = -1;
+   block = NULL; block_extent = 0;
+
+   IAEA_I64 allocated = 0;
+   char chunk[16384];
+   size_t n;
+   rewind(fheader);
+   while( (n = fread(chunk, 1, sizeof(chunk), fheader)) > 0 )
+   {
+      if(append_text(&file, &file_size, &allocated, chunk, (IAEA_I64) n) != OK)
+         {release(); return(FAIL);}
+   }
+   return(OK);
+}
+
+short iaea_header_text::parse()
+{
+   // The lines of the file, as get_string reads them one after another up
+   // to the first that cannot be read. Every block name follows its line.
+   IAEA_I64 used = 0, size = 0;
+   int offsets_size = 0, blocks_size = 0;
+   text_stream stream = {file, file + file_size};
+   char line[MAX_STR_LEN];
+   short rvalue = OK;
+   while( file != NULL && sget_c_string(line, MAX_STR_LEN, &stream) == OK )
+   {
+      if(n_lines == offsets_size)
+      {
+         offsets_size = offsets_size > 0 ? 2*offsets_size : 256;
+         IAEA_I64 *grown = (IAEA_I64 *) realloc(line_offset, offsets_size*sizeof(IAEA_I64));
+         if(grown == NULL) {rvalue = FAIL; break;}
+         line_offset = grown;
+      }
+      line_offset[n_lines] = used;
+      if(append_text(&lines, &used, &size, line, strlen(line) + 1) != OK) {rvalue = FAIL; break;}
+
+      char *endptr;
+      if( *line == SEGMENT_BEG_TOKEN &&
+          (endptr = strchr(line + 1, SEGMENT_END_TOKEN)) != NULL )
+      {
+         if(n_blocks == blocks_size)
+         {
+            blocks_size = blocks_size > 0 ? 2*blocks_size : 64;
+            iaea_header_block *grown =
+               (iaea_header_block *) realloc(blocks, blocks_size*sizeof(iaea_header_block));
+            if(grown == NULL) {rvalue = FAIL; break;}
+            blocks = grown;
+         }
+         *endptr = '\0';
+         blocks[n_blocks].name = used;
+         blocks[n_blocks].line = n_lines;
+         if(append_text(&lines, &used, &size, line + 1, endptr - line) != OK) {rvalue = FAIL; break;}
+         n_blocks++;
+      }
+      n_lines++;
+   }
+   if(rvalue != OK) {release(); return(FAIL);}
+
+   // Sorted by name; a header has a few dozen blocks, and insertion keeps
+   // repeated names in file order, so the first one is found as before
+   for(int i = 1; i < n_blocks; i++)
+   {
+      iaea_header_block b = blocks[i];
+      int j = i;
+      for(; j > 0 && strcmp(lines + blocks[j-1].name, lines + b.name) > 0; j--)
+         blocks[j] = blocks[j-1];
+      blocks[j] = b;
+   }
+   return(OK);
+}
+
+void iaea_header_text::release()
+{
+   free(file); file = NULL; file_size = 0;
+   free(lines); free(line_offset); free(blocks);
+   lines = NULL; line_offset = NULL; blocks = NULL;
+   n_lines = n_blocks = next_line = 0;
+   free(texts); free(block);
+   texts = NULL; texts_used = texts_size = 0;
+   block = NULL; block_extent = 0;
+}
+
+short iaea_header_text::find_block(const char *blockname)
+{
+   // The first block whose name is not before blockname
+   int lo = 0, hi = n_blocks;
+   while(lo < hi)
+   {
+      int mid = (lo + hi)/2;
+      if(strcmp(lines + blocks[mid].name, blockname) < 0) lo = mid + 1;
+      else hi = mid;
+   }
+   if(lo == n_blocks || strcmp(lines + blocks[lo].name, blockname) != 0) return(FAIL);
+   next_line = blocks[lo].line + 1;
+   return(OK);
+}
+
+short iaea_header_text::get_line(char *line)
+{
+   if(next_line >= n_lines) return(FAIL);
+   strcpy(line, lines + line_offset[next_line++]);
+   return(OK);
+}
+
+char *iaea_header_text::get_block_buffer()
+{
+   // get_block may leave bytes after the end of the string (a line goes
+   // MAX_NUMB_LINES bytes further for every line before it), so the bytes it
+   // wrote are zeroed again as if every block had a buffer of its own
+   if(block == NULL) block = (char *) calloc(MAX_STR_LEN*MAX_NUMB_LINES+1, 1);
+   else memset(block, 0, (size_t) block_extent);
+   block_extent = 0;
+   return(block);
+}
+
+short iaea_header_text::add_text(int which, const char *s)
+{
+   IAEA_I64 offset = texts_used;
+   if(append_text(&texts, &texts_used, &texts_size, s, strlen(s) + 1) != OK) return(FAIL);
+   text_offset[which] = offset;
+   return(OK);
+}
+
+/* ***************************************************************************************************** */
+// Text fields
+
+short iaea_header_type::set_text(int which, const char *s)
+{
+   IAEA_I64 length = strlen(s);
+   iaea_string_arena *arena = (iaea_string_arena *)
+      malloc(offsetof(iaea_string_arena, text) + (size_t) length + 1);
+   if(arena == NULL) return(FAIL);
+   new (&arena->references) std::atomic<int>(1);
+   memcpy(arena->text, s, (size_t) length + 1);
+
+   iaea_header_string old = texts[which];
+   texts[which].text = arena->text;
+   texts[which].length = (IAEA_I32) length;
+   texts[which].arena = arena;
+   if(old.arena != NULL && old.arena->references.fetch_sub(1) == 1) free(old.arena);
+   return(OK);
+}
+
+short iaea_header_type::set_texts(const char *s, const IAEA_I64 offset[NUM_HEADER_TEXTS],
+                                  IAEA_I64 n_bytes)
+{
+   release_texts();
+   int i, n_texts = 0;
+   for(i=0;i<NUM_HEADER_TEXTS;i++) if(offset[i] >= 0) n_texts++;
+   if(n_texts == 0) return(OK);
+
+   iaea_string_arena *arena = (iaea_string_arena *)
+      malloc(offsetof(iaea_string_arena, text) + (size_t) n_bytes);
+   if(arena == NULL) return(FAIL);
+   new (&arena->references) std::atomic<int>(n_texts);
+   memcpy(arena->text, s, (size_t) n_bytes);
+   for(i=0;i<NUM_HEADER_TEXTS;i++)
+   {
+      if(offset[i] < 0) continue;
+      texts[i].text = arena->text + offset[i];
+      texts[i].length = (IAEA_I32) strlen(texts[i].text);
+      texts[i].arena = arena;
+   }
+   return(OK);
+}
+
+void iaea_header_type::share_text(int which, const iaea_header_type *p_iaea_header)
+{
+   if(p_iaea_header == this) return;
+   iaea_header_string old = texts[which];
+   texts[which] = p_iaea_header->texts[which];
+   if(texts[which].arena != NULL) texts[which].arena->references.fetch_add(1);
+   if(old.arena != NULL && old.arena->references.fetch_sub(1) == 1) free(old.arena);
+}
+
+void iaea_header_type::release_texts()
+{
+   for(int i=0;i<NUM_HEADER_TEXTS;i++)
+   {
+      iaea_string_arena *arena = texts[i].arena;
+      if(arena != NULL && arena->references.fetch_sub(1) == 1) free(arena);
+      texts[i].text = NULL;
+      texts[i].length = 0;
+      texts[i].arena = NULL;
+   }
+}
@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if (defined WIN32) || (defined WIN64)
+#include <io.h>
+#endif
+
+#include "iaea_header_cache.h"
+
+// The fields read_header sets, in the order they are cached
+#define HEADER_CACHE_FIELDS(FIELD) \
+   FIELD(file_type) FIELD(checksum) FIELD(record_length) FIELD(byte_order) \
+   FIELD(record_contents) FIELD(record_constant) \
+   FIELD(extrafloat_contents) FIELD(extralong_contents) \
+   FIELD(orig_histories) FIELD(nParticles) FIELD(particle_number) \
+   FIELD(iaea_index) \
+   FIELD(global_photon_energy_cutoff) FIELD(global_particle_energy_cutoff) \
+   FIELD(sumParticleWeight) FIELD(minimumWeight) FIELD(maximumWeight) \
+   FIELD(averageKineticEnergy) FIELD(minimumKineticEnergy) FIELD(maximumKineticEnergy) \
+   FIELD(minimumX) FIELD(maximumX) FIELD(minimumY) FIELD(maximumY) \
+   FIELD(minimumZ) FIELD(maximumZ) \
+   FIELD(compression) FIELD(frame_records)
+
+static const char cache_magic[8] = {'I','A','E','A','h','d','r','C'};
+
+/* *********************************************************************** */
+short iaea_header_file_id::identify(FILE *fheader, const char *contents, IAEA_I64 n_bytes)
+{
+   size = -1;
+   mtime_sec = mtime_nsec = 0;
+
+   // FNV-1a over the whole file
+   unsigned long long h = 14695981039346656037ULL;
+   for(IAEA_I64 i = 0; i < n_bytes; i++)
+   {
+      h ^= (unsigned char) contents[i];
+      h *= 1099511628211ULL;
+   }
+   hash = (IAEA_I64) h;
+
+#if (defined WIN32) || (defined WIN64)
+   struct _stat64 status;
+   if(_fstat64(_fileno(fheader), &status) != 0) return(FAIL);
+   mtime_sec = (IAEA_I64) status.st_mtime;
+#else
+   struct stat status;
+   if(fstat(fileno(fheader), &status) != 0) return(FAIL);
+   mtime_sec = (IAEA_I64) status.st_mtime;
+#if (defined __APPLE__)
+   mtime_nsec = (IAEA_I64) status.st_mtimespec.tv_nsec;
+#else
+   mtime_nsec = (IAEA_I64) status.st_mtim.tv_nsec;
+#endif
+#endif
+   // The file read must be the whole file
+   if((IAEA_I64) status.st_size != n_bytes) return(FAIL);
+   size = n_bytes;
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_load_header_cache(const char *cache_file, const iaea_header_file_id *id,
+                             iaea_header_type *p_iaea_header)
+{
+   FILE *in = fopen(cache_file, "rb");
+   if(in == NULL) return(FAIL);
+
+   iaea_sidecar_tag expected;
+   iaea_header_file_id cached;
+   expected.make(cache_magic, HEADER_CACHE_VERSION, (IAEA_I32) sizeof(iaea_header_type));
+   if(!expected.read_matches(in) ||
+      fread(&cached, sizeof(cached), 1, in) != 1 ||
+      cached.size != id->size || cached.mtime_sec != id->mtime_sec ||
+      cached.mtime_nsec != id->mtime_nsec || cached.hash != id->hash)
+   {
+      fclose(in);
+      return(FAIL);
+   }
+
+   // Fields are read into a copy, so that a damaged cache changes nothing
+   iaea_header_type fields;
+   bool ok = true;
+#define READ_FIELD(f) ok = ok && fread(&fields.f, sizeof(fields.f), 1, in) == 1;
+   HEADER_CACHE_FIELDS(READ_FIELD)
+#undef READ_FIELD
+
+   // Texts: length (-1 if not set) and characters, each null terminated
+   char *texts = NULL;
+   IAEA_I64 offset[NUM_HEADER_TEXTS], n_bytes = 0, allocated = 0;
+   for(int i = 0; ok && i < NUM_HEADER_TEXTS; i++)
+   {
+      IAEA_I32 length;
+      ok = fread(&length, sizeof(length), 1, in) == 1 && length >= -1;
+      offset[i] = -1;
+      if(!ok || length < 0) continue;
+      if(n_bytes + length + 1 > allocated)
+      {
+         allocated = 2*(n_bytes + length + 1);
+         char *grown = (char *) realloc(texts, (size_t) allocated);
+         if(grown == NULL) {ok = false; break;}
+         texts = grown;
+      }
+      ok = (length == 0 || fread(texts + n_bytes, 1, (size_t) length, in) == (size_t) length);
+      texts[n_bytes + length] = '\0';
+      offset[i] = n_bytes;
+      n_bytes += length + 1;
+   }
+   char extra;
+   ok = ok && fread(&extra, 1, 1, in) == 0;   // nothing after the texts
+   fclose(in);
+
+   if(ok) ok = p_iaea_header->set_texts(texts, offset, n_bytes) == OK;
+   free(texts);
+   if(!ok) return(FAIL);
+
+#define COPY_FIELD(f) memcpy(&p_iaea_header->f, &fields.f, sizeof(fields.f));
+   HEADER_CACHE_FIELDS(COPY_FIELD)
+#undef COPY_FIELD
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_save_header_cache(const char *cache_file, const iaea_header_file_id *id,
+                             const iaea_header_type *p_iaea_header)
+{
+   char temp_file[MAX_STR_LEN + 32];
+   FILE *out = iaea_open_sidecar(cache_file, temp_file);
+   if(out == NULL) return(FAIL);
+
+   iaea_sidecar_tag tag;
+   tag.make(cache_magic, HEADER_CACHE_VERSION, (IAEA_I32) sizeof(iaea_header_type));
+   bool ok = tag.write(out) &&
+             fwrite(id, sizeof(*id), 1, out) == 1;
+#define WRITE_FIELD(f) ok = ok && fwrite(&p_iaea_header->f, sizeof(p_iaea_header->f), 1, out) == 1;
+   HEADER_CACHE_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+   for(int i = 0; ok && i < NUM_HEADER_TEXTS; i++)
+   {
+      const iaea_header_string *s = &p_iaea_header->texts[i];
+      IAEA_I32 length = (s->text != NULL) ? s->length : -1;
+      ok = fwrite(&length, sizeof(length), 1, out) == 1 &&
+           (length <= 0 || fwrite(s->text, 1, (size_t) length, out) == (size_t) length);
+   }
+   return(iaea_commit_sidecar(out, ok, temp_file, cache_file));
+}
@@ -0,0 +1,247 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if (defined WIN32) || (defined WIN64)
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "iaea_history_index.h"
+
+static const char index_magic[8] = {'I','A','E','A','h','I','d','x'};
+
+// Appends value to a growing array
+static short append_i64(IAEA_I64 **array, IAEA_I64 *n, IAEA_I64 *size, IAEA_I64 value)
+{
+   if(*n == *size)
+   {
+      IAEA_I64 new_size = *size > 0 ? 2*(*size) : 1024;
+      IAEA_I64 *grown = (IAEA_I64 *) realloc(*array, (size_t) new_size*sizeof(IAEA_I64));
+      if(grown == NULL) return(FAIL);
+      *array = grown; *size = new_size;
+   }
+   (*array)[(*n)++] = value;
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_phsp_file_id::identify(FILE *file, IAEA_I64 reclength)
+{
+   size = -1;
+   mtime_sec = mtime_nsec = 0;
+   record_length = reclength;
+#if (defined WIN32) || (defined WIN64)
+   struct _stat64 status;
+   if(_fstat64(_fileno(file), &status) != 0) return(FAIL);
+   mtime_sec = (IAEA_I64) status.st_mtime;
+#else
+   struct stat status;
+   if(fstat(fileno(file), &status) != 0) return(FAIL);
+   mtime_sec = (IAEA_I64) status.st_mtime;
+#if (defined __APPLE__)
+   mtime_nsec = (IAEA_I64) status.st_mtimespec.tv_nsec;
+#else
+   mtime_nsec = (IAEA_I64) status.st_mtim.tv_nsec;
+#endif
+#endif
+   size = (IAEA_I64) status.st_size;
+   return(OK);
+}
+
+bool iaea_phsp_file_id::same_file(const iaea_phsp_file_id *other) const
+{
+   return(size >= 0 && size == other->size && mtime_sec == other->mtime_sec &&
+          mtime_nsec == other->mtime_nsec && record_length == other->record_length);
+}
+
+/* *********************************************************************** */
+void iaea_sidecar_tag::make(const char *kind_magic, IAEA_I32 kind_version, IAEA_I32 kind_layout)
+{
+   memset(this, 0, sizeof(*this));
+   memcpy(magic, kind_magic, sizeof(magic));
+   version = kind_version;
+   byte_order = 0x01020304;
+   size_of_i64 = (IAEA_I32) sizeof(IAEA_I64);
+   layout = kind_layout;
+}
+
+bool iaea_sidecar_tag::matches(const iaea_sidecar_tag *other) const
+{
+   return(memcmp(this, other, sizeof(*this)) == 0);
+}
+
+bool iaea_sidecar_tag::read_matches(FILE *in) const
+{
+   iaea_sidecar_tag tag;
+   return(fread(&tag, sizeof(tag), 1, in) == 1 && matches(&tag));
+}
+
+/* *********************************************************************** */
+short iaea_sidecar_name(const char *header_file, const char *extension, char *sidecar_file)
+{
+   size_t len = strlen(header_file);
+   const char *dot = strrchr(header_file, '.');
+   if(dot != NULL && (strcmp(dot, ".IAEAheader") == 0 || strcmp(dot, ".IAEAphsp") == 0))
+      len = dot - header_file;
+   if(len + strlen(extension) >= MAX_STR_LEN) return(FAIL);
+   memcpy(sidecar_file, header_file, len);
+   strcpy(sidecar_file + len, extension);
+   return(OK);
+}
+
+FILE *iaea_open_sidecar(const char *sidecar_file, char *temp_file)
+{
+   static std::atomic<int> n_opened(0);
+#if (defined WIN32) || (defined WIN64)
+   int pid = _getpid();
+#else
+   int pid = (int) getpid();
+#endif
+   snprintf(temp_file, MAX_STR_LEN + 32, "%s.%d.%d", sidecar_file, pid, n_opened++);
+   return(fopen(temp_file, "wb"));
+}
+
+short iaea_commit_sidecar(FILE *out, bool ok, const char *temp_file, const char *sidecar_file)
+{
+   if(fclose(out) != 0) ok = false;
+#if (defined WIN32) || (defined WIN64)
+   if(ok) remove(sidecar_file);
+#endif
+   if(!ok || rename(temp_file, sidecar_file) != 0)
+   {
+      remove(temp_file);
+      return(FAIL);
+   }
+   return(OK);
+}
+
+short iaea_save_sidecar(const char *sidecar_file, bool (*write)(FILE *out, const void *data),
+                        const void *data)
+{
+   char temp_file[MAX_STR_LEN + 32];
+   FILE *out = iaea_open_sidecar(sidecar_file, temp_file);
+   if(out == NULL) return(FAIL);
+   return(iaea_commit_sidecar(out, write(out, data), temp_file, sidecar_file));
+}
+
+/* *********************************************************************** */
+void iaea_history_index::initialize()
+{
+   memset(this, 0, sizeof(*this));
+   file.size = -1;
+}
+
+void iaea_history_index::release()
+{
+   free(starts);
+   free(checkpoints);
+   initialize();
+}
+
+short iaea_history_index::add_start(IAEA_I64 record, IAEA_I64 n_stat)
+{
+   if(n_starts % HISTORY_INDEX_STRIDE == 0 &&
+      append_i64(&checkpoints, &n_checkpoints, &checkpoints_size, n_histories) != OK)
+      return(FAIL);
+   if(append_i64(&starts, &n_starts, &starts_size, record) != OK) return(FAIL);
+   n_histories += n_stat;
+   return(OK);
+}
+
+IAEA_I64 iaea_history_index::find_start(IAEA_I64 record) const
+{
+   IAEA_I64 lo = 0, hi = n_starts;
+   while(lo < hi)
+   {
+      IAEA_I64 mid = (lo + hi)/2;
+      if(starts[mid] < record) lo = mid + 1;
+      else hi = mid;
+   }
+   return(lo);
+}
+
+IAEA_I64 iaea_history_index::find_checkpoint(IAEA_I64 history, IAEA_I64 *before,
+                                             IAEA_I64 *after) const
+{
+   if(history < 1 || history > n_histories) return(-1);
+
+   // The last checkpoint with fewer histories before it
+   IAEA_I64 lo = 0, hi = n_checkpoints;
+   while(hi - lo > 1)
+   {
+      IAEA_I64 mid = (lo + hi)/2;
+      if(checkpoints[mid] < history) lo = mid;
+      else hi = mid;
+   }
+   *before = checkpoints[lo];
+   *after = (lo + 1 < n_checkpoints) ? checkpoints[lo + 1] : n_histories;
+   return(lo);
+}
+
+/* *********************************************************************** */
+short iaea_load_history_index(const char *index_file, iaea_history_index *index)
+{
+   index->initialize();
+   FILE *in = fopen(index_file, "rb");
+   if(in == NULL) return(FAIL);
+
+   // Tag, file indexed and counts, then the starts and the checkpoints
+   iaea_sidecar_tag expected;
+   expected.make(index_magic, HISTORY_INDEX_VERSION, HISTORY_INDEX_STRIDE);
+   IAEA_I64 fields[8] = {0};
+   bool ok = expected.read_matches(in) && fread(fields, sizeof(fields), 1, in) == 1;
+   IAEA_I64 n_starts = fields[6], n_checkpoints = fields[7];
+   ok = ok && n_starts >= 0 &&
+        n_checkpoints == (n_starts + HISTORY_INDEX_STRIDE - 1)/HISTORY_INDEX_STRIDE;
+   if(ok)
+   {
+      index->starts = (IAEA_I64 *) malloc((size_t)(n_starts + 1)*sizeof(IAEA_I64));
+      index->checkpoints = (IAEA_I64 *) malloc((size_t)(n_checkpoints + 1)*sizeof(IAEA_I64));
+      ok = index->starts != NULL && index->checkpoints != NULL &&
+           fread(index->starts, sizeof(IAEA_I64), (size_t) n_starts, in) == (size_t) n_starts &&
+           fread(index->checkpoints, sizeof(IAEA_I64), (size_t) n_checkpoints, in) ==
+              (size_t) n_checkpoints;
+   }
+   char extra;
+   ok = ok && fread(&extra, 1, 1, in) == 0;   // nothing after the checkpoints
+   fclose(in);
+   if(!ok) {index->release(); return(FAIL);}
+
+   index->file.size = fields[0];
+   index->file.mtime_sec = fields[1];
+   index->file.mtime_nsec = fields[2];
+   index->file.record_length = fields[3];
+   index->n_records = fields[4];
+   index->n_histories = fields[5];
+   index->n_starts = index->starts_size = n_starts;
+   index->n_checkpoints = index->checkpoints_size = n_checkpoints;
+   return(OK);
+}
+
+/* *********************************************************************** */
+static bool write_history_index(FILE *out, const void *data)
+{
+   const iaea_history_index *index = (const iaea_history_index *) data;
+   iaea_sidecar_tag tag;
+   tag.make(index_magic, HISTORY_INDEX_VERSION, HISTORY_INDEX_STRIDE);
+   IAEA_I64 fields[8] = {index->file.size, index->file.mtime_sec, index->file.mtime_nsec,
+                         index->file.record_length, index->n_records, index->n_histories,
+                         index->n_starts, index->n_checkpoints};
+   return(tag.write(out) &&
+          fwrite(fields, sizeof(fields), 1, out) == 1 &&
+          fwrite(index->starts, sizeof(IAEA_I64), (size_t) index->n_starts, out) ==
+             (size_t) index->n_starts &&
+          fwrite(index->checkpoints, sizeof(IAEA_I64), (size_t) index->n_checkpoints, out) ==
+             (size_t) index->n_checkpoints);
+}
+
+short iaea_save_history_index(const char *index_file, const iaea_history_index *index)
+{
+   return(iaea_save_sidecar(index_file, write_history_index, index));
+}
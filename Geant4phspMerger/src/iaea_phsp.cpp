@@ -56,6 +56,19 @@
 
 #include<sys/types.h>
 #include<sys/stat.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if (defined WIN32) || (defined WIN64)
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #if !(defined WIN32) && !(defined WIN64)
 using namespace std;
@@ -64,7 +77,20 @@ using namespace std;
 #include "utilities.h"
 #include "iaea_record.h"
 #include "iaea_header.h"
+#include "iaea_header_cache.h"
+#include "iaea_history_index.h"
 #include "iaea_phsp.h"
+#include "iaea_transcode.h"
+#include "iaea_queue.h"
+#include "iaea_uring.h"
+#include "iaea_decode.h"
+#include "iaea_stats.h"
+#include "iaea_registry.h"
+#include "iaea_virtual.h"
+#include "iaea_zone_map.h"
+#include "iaea_grid_index.h"
+#include "iaea_type_index.h"
+#include "iaea_compressed.h"
 
 #define false 0
 #define true  1
@@ -72,9 +98,92 @@ using namespace std;
 // These variables are defined globally. They contain pointers
 // to header and record structures defined by calling iaea_new_source()
 // routine to maintain a list of already initialized IAEA sources.
+// The tables grow as sources are added and may be read by any thread
+// while others create or destroy sources.
+
+static iaea_source_table<iaea_header_type> p_iaea_header;
+static iaea_source_table<iaea_record_type> p_iaea_record;
+static iaea_source_ids iaea_sources;
+
+// Sources opened for reading can be suspended: their files are closed and
+// their header is released, keeping only what is needed to open them again
+// where they were (see iaea_suspend_source)
+struct iaea_read_source
+{
+  char file_name[MAX_STR_LEN];
+  int suspended;
+  IAEA_I64 offset;               // position in the phsp file when suspended
+  iaea_header_summary counters;  // counters of the header when suspended
+  iaea_history_index *history;   // NULL until needed (see source_history_index)
+  int history_looked_up;         // the index file was looked for
+  iaea_zone_map *zones;          // NULL until needed (see source_zone_map)
+  int zones_looked_up;
+  iaea_zone_filter filter;       // see iaea_set_zone_filter
+  int filtered;
+  iaea_grid_index *grid;         // NULL until needed (see source_grid_index)
+  int grid_looked_up;
+  IAEA_I64 *region;              // records of the cells of iaea_set_grid_region,
+  IAEA_I64 n_region;             // in increasing order
+  int regioned;                  // 1 with region, 2 without a grid index
+  iaea_type_index *type_index;   // NULL until needed (see source_type_index)
+  int type_index_looked_up;
+  iaea_record_run *selection;    // runs of the types of iaea_select_types,
+  IAEA_I64 n_selection;          // in increasing order
+  int selected;                  // 1 with selection, 2 without a type index
+};
+static iaea_source_table<iaea_read_source> p_iaea_read_source;
+
+// Sources open for reading at once, at most __iaea_max_open (0: no limit)
+static std::mutex iaea_open_mutex;
+static std::condition_variable iaea_open_freed;
+static int __iaea_max_open = 0;
+static int __iaea_n_open = 0;
+
+static void acquire_open_source()
+{
+  std::unique_lock<std::mutex> lock(iaea_open_mutex);
+  while(__iaea_max_open > 0 && __iaea_n_open >= __iaea_max_open) iaea_open_freed.wait(lock);
+  __iaea_n_open++;
+}
+
+static void release_open_source()
+{
+  std::lock_guard<std::mutex> lock(iaea_open_mutex);
+  __iaea_n_open--;
+  iaea_open_freed.notify_one();
+}
+
+// Number of statistically independent events since the previous record.
+// The incremental history number (type 1 of the extralong stored variables)
+// takes precedence over the sign of the energy when it is stored.
+static IAEA_I32 get_n_stat(iaea_header_type *p_header, iaea_record_type *p)
+{
+      IAEA_I32 n_stat = 0;
+      if( p->IsNewHistory > 0) n_stat = 1;
+
+      for(int j=0;j<p->iextralong ;j++) {
+          // Looking for incremental number of histories
+          // (Type 1 of the extralong stored variable)
+          if(p_header->extralong_contents[j] == 1) {
+              n_stat = p->extralong[j];
+              p->IsNewHistory = n_stat;
+          }
+      }
+      return n_stat;
+}
 
-static iaea_header_type *p_iaea_header[MAX_NUM_SOURCES];
-static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
+// get_n_stat for a decoded block: new_history is replaced by n_stat, and p
+// is left as get_n_stat leaves it after the last record
+static void get_n_stats(iaea_header_type *p_header, iaea_record_type *p,
+                        iaea_decoded_block *block, IAEA_I64 n)
+{
+      for(int j=0;j<p->iextralong ;j++) {
+          if(p_header->extralong_contents[j] != 1) continue;
+          const IAEA_I32 *histories = block->extralong + j*block->capacity;
+          for(IAEA_I64 i=0;i<n;i++) block->new_history[i] = histories[i];
+      }
+      if(n > 0) p->IsNewHistory = block->new_history[n-1];
+}
 
 /************************************************************************
 * Initialization
@@ -86,6 +195,9 @@ static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
 * The need for an Id arises from the fact that some applications may
 * want to use several IAEA sources at once. The implementation must therefore
 * maintain a list of already initialized sources.
+* The number of sources is not limited: the list grows as needed, the
+* smallest free Id is assigned, and sources may be created and destroyed
+* from several threads at once.
 * If an error occures (e.g. header file does not exist, there are errors
 * in the header file, etc.), assign a negative number to result.
 * (one may want to specify a list of error codes so that the application
@@ -98,8 +210,87 @@ static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
 *
 ***********************************************************************/
 
-static int __iaea_source_used[MAX_NUM_SOURCES];
-static int __iaea_n_source = 0;
+static int __iaea_read_mapping = 1; // see iaea_set_read_mapping
+static int __iaea_header_cache = 0;  // see iaea_set_header_cache
+
+// Opens the header and the phsp file of source sid for reading (access = 1
+// of iaea_new_source). Returns the result of iaea_new_source.
+static IAEA_I32 open_source_for_reading(IAEA_I32 sid, char *header_file)
+{
+   // Creating IAEA phsp header and allocating memory for it
+   iaea_header_type *h = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+   p_iaea_header[sid] = h;
+   h->fheader = open_file(header_file,".IAEAheader","rb");
+   if(h->fheader == NULL) return(-96); // phsp failed to open
+
+   // Creating IAEA record and allocating memory for it
+   iaea_record_type *p = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
+   p_iaea_record[sid] = p;
+
+   h->initialize_counters();
+   char cache_file[MAX_STR_LEN];
+   bool cached = __iaea_header_cache > 0 &&
+                 iaea_sidecar_name(header_file, HEADER_CACHE_EXTENSION, cache_file) == OK;
+   if( h->read_header(cached ? cache_file : NULL) != OK) return(-93);
+
+   if(h->n_members > 0)
+   {
+      // A virtual phsp has no phsp file: its members are read in turn
+      p->p_virtual = new iaea_virtual_reader;
+      if(p->p_virtual->initialize(h, header_file, __iaea_read_mapping) != OK) return(-94);
+   }
+   else if(h->compression != COMPRESSION_NONE)
+   {
+      // A compressed phsp is decompressed frame by frame from its container
+      FILE *container = open_file(header_file, COMPRESSED_PHSP_EXTENSION, "rb");
+      if(container == NULL) return(-94);
+      p->p_compressed = new iaea_compressed_reader;
+      if(p->p_compressed->initialize(container, h->record_length) != OK ||
+         p->p_compressed->frame_records != h->frame_records)
+      {
+         printf("\n ERROR: %s%s is not a compressed phsp of this header\n",
+                header_file, COMPRESSED_PHSP_EXTENSION);
+         return(-94);
+      }
+   }
+   else
+   {
+      // Opening phsp file to read
+      p->p_file = open_file(header_file, ".IAEAphsp", "rb");
+      if(p->p_file == NULL) return(-94);
+
+      // Records are decoded from a memory mapping where possible,
+      // stdio is used otherwise
+      if(__iaea_read_mapping > 0) p->map_file(__iaea_read_mapping == 2);
+   }
+
+   if(p->initialize() != OK) return(-1);
+
+   // Get read/write logical block from the header
+   if( h->get_record_contents(p) == FAIL) return(-91);
+
+   return(h->iaea_index); // returning IAEA index
+}
+
+// Closes the files of source sid and releases its header and record
+static void close_source(IAEA_I32 sid)
+{
+   iaea_header_type *h = p_iaea_header[sid];
+   iaea_record_type *p = p_iaea_record[sid];
+   if(h != NULL && h->fheader != NULL) fclose(h->fheader);
+   if(p != NULL) delete p->p_virtual;
+   if(p != NULL) delete p->p_compressed;
+   if(h != NULL) {h->release_texts(); h->release_members();}
+   free(h);
+   if(p != NULL)
+   {
+      p->unmap_file();
+      if(p->p_file != NULL) fclose(p->p_file);
+      free(p);
+   }
+   p_iaea_header[sid] = NULL;
+   p_iaea_record[sid] = NULL;
+}
 
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
@@ -119,24 +310,18 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
        *result = -101 ; *source_ID = -1; return;
    } // String length < 1
 
-   if( !__iaea_n_source ) { // called for the first time
-       for(int j=0; j<MAX_NUM_SOURCES; j++) __iaea_source_used[j] = false;
-   }
-   int sid=-1;
-   // do we have a spare spot in the arrays ?
-   // (e.g. because a source was destroyed)
-   for(int j=0; j<__iaea_n_source; j++) {
-       if( !__iaea_source_used[j] ) { sid = j; break; }
-   }
+   // The smallest free Id (e.g. of a source that was destroyed), with a
+   // slot in the tables
+   int sid = iaea_sources.acquire();
    if( sid < 0 ) {
-       // so, we don't => increase source count and check if
-       // space left in arrays.
-       if( ++__iaea_n_source >= MAX_NUM_SOURCES ) {
-           *result = -98; *source_ID = -1; return;
-       }
-       sid = __iaea_n_source-1; *source_ID = sid;
+       *result = -98; *source_ID = -1; return;
+   }
+   if( p_iaea_header.reserve(sid) == FAIL || p_iaea_record.reserve(sid) == FAIL ||
+       p_iaea_read_source.reserve(sid) == FAIL ) {
+       iaea_sources.release(sid);
+       *result = -98; *source_ID = -1; return;
    }
-   __iaea_source_used[sid] = true;
+   *source_ID = sid;
 
    //int ilen = strlen(header_file);
    // the above requires a null-terminated string, which may not be
@@ -148,11 +333,22 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
        if( ilen < hf_length-1 ) header_file[ilen+1] = '\0';
    }
 
+   if(*access == 1)
+   {
+       // Remembered, to be opened again after iaea_suspend_source
+       iaea_read_source *s = (iaea_read_source *) calloc(1, sizeof(iaea_read_source));
+       strncpy(s->file_name, header_file, hf_length);
+       s->file_name[hf_length] = '\0';
+       p_iaea_read_source[sid] = s;
+
+       acquire_open_source();
+       *result = open_source_for_reading(sid, s->file_name);
+       return;
+   }
+
    // Creating IAEA phsp header and allocating memory for it
    p_iaea_header[*source_ID] = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
    // Opening header file
-   if(*access == 1) p_iaea_header[*source_ID]->fheader =
-         open_file(header_file,".IAEAheader","rb");
    if(*access == 2) p_iaea_header[*source_ID]->fheader =
          open_file(header_file,".IAEAheader","wb");
    if(*access == 3) p_iaea_header[*source_ID]->fheader =
@@ -169,12 +365,14 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
    {
          case 2: // writing a new phsp
 
-             strcpy(p_iaea_header[*source_ID]->title,"PHASESPACE in IAEA format");
+             if( p_iaea_header[*source_ID]->set_text(HEADER_TITLE,"PHASESPACE in IAEA format")
+                 == FAIL ) { *result = -1; return;}
              // Default IAEA index
              *result = p_iaea_header[*source_ID]->iaea_index = 1000;
 
+             // Also readable, so that written records can be recounted
              p_iaea_record[*source_ID]->p_file =
-                 open_file(header_file, ".IAEAphsp", "wb");
+                 open_file(header_file, ".IAEAphsp", "w+b");
 
              if(p_iaea_record[*source_ID]->p_file == NULL) { *result = -94 ; return; }
 
@@ -192,6 +390,13 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
              if( p_iaea_header[*source_ID]->read_header() != OK)
                  { *result = -93; return;}
 
+             // Records are not appended to a compressed phsp
+             if( p_iaea_header[*source_ID]->compression != COMPRESSION_NONE)
+             {
+                 printf("\n ERROR: Cannot append to the compressed phsp %s\n", header_file);
+                 *result = -94; return;
+             }
+
              int i;
              // Setting up Average Kinetic Energy counters to usable values
              for(i=0;i<MAX_NUM_PARTICLES;i++)
@@ -212,27 +417,6 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
 
              *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
 
-             break;
-
-         case 1 : // reading existing phsp
-
-             if( p_iaea_header[*source_ID]->read_header() != OK) { *result = -93; return;}
-
-             // Opening phsp file to read
-             p_iaea_record[*source_ID]->p_file =
-                 open_file(header_file, ".IAEAphsp", "rb");
-
-             if(p_iaea_record[*source_ID]->p_file == NULL)
-                 { *result = -94 ; return; }
-
-             if(p_iaea_record[*source_ID]->initialize() != OK) {*result = -1; return;}
-
-             // Get read/write logical block from the header
-             if( p_iaea_header[*source_ID]->get_record_contents(p_iaea_record[*source_ID])
-                 == FAIL) { *result = -91; return;}
-
-             *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
-
              break;
    }
 
@@ -270,6 +454,81 @@ void IAEA_NEW_SOURCE__(IAEA_I32 *source_ID, char *header_file,
     iaea_new_source(source_ID,header_file,access,result,hf_length);
 }
 
+/************************************************************************
+* Read path of the sources opened for reading
+*
+* Sets how the records of the sources opened afterwards with access = 1
+* are read:
+*
+* mode = 0 => stdio (one fread per particle)
+* mode = 1 => memory mapping, with sequential access advised (default)
+* mode = 2 => as 1, but all pages are read in when the source is opened
+*
+* Mapped records are decoded straight from the mapping, so neither
+* iaea_get_particle nor iaea_set_record needs a system call. Where a file
+* cannot be mapped, stdio is used. result is set to -1 for a wrong mode.
+*************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_mapping(const IAEA_I32 *mode, IAEA_I32 *result)
+{
+   if(*mode < 0 || *mode > 2) {*result = -1; return;}
+   __iaea_read_mapping = *mode;
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_mapping_(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_read_mapping(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_mapping__(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_read_mapping(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_MAPPING(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_read_mapping(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_MAPPING_(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_read_mapping(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_MAPPING__(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_read_mapping(mode, result); }
+
+/*************************************************************************
+* Binary header cache
+*
+* mode = 1 => the headers of the sources opened afterwards with access = 1
+*             are loaded from a binary cache next to them (the base name
+*             with .IAEAcache) when it was written for a header file of the
+*             same size, modification time and contents; otherwise the
+*             header is parsed and the cache written for the next time
+* mode = 0 => headers are always parsed (default)
+*
+* A cache that cannot be written (e.g. in a read-only directory) is
+* skipped. result is set to -1 for a wrong mode.
+*************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_header_cache(const IAEA_I32 *mode, IAEA_I32 *result)
+{
+   if(*mode < 0 || *mode > 1) {*result = -1; return;}
+   __iaea_header_cache = *mode;
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_header_cache_(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_header_cache(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_header_cache__(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_header_cache(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HEADER_CACHE(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_header_cache(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HEADER_CACHE_(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_header_cache(mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HEADER_CACHE__(const IAEA_I32 *mode, IAEA_I32 *result)
+{ iaea_set_header_cache(mode, result); }
+
 /************************************************************************
 * Maximum number of particles
 *
@@ -921,6 +1180,10 @@ void IAEA_SET_TOTAL_ORIGINAL_PARTICLES__(const IAEA_I32 *id,
                                                 IAEA_I64 *number_of_original_particles)
 { iaea_set_total_original_particles(id, number_of_original_particles); }
 
+// Defined with the positioned reads further down
+static short parallel_chunk(IAEA_I32 id, IAEA_I32 i_chunk, IAEA_I32 n_chunk,
+                            IAEA_I64 *first_record, IAEA_I64 *n_records);
+
 /**************************************************************************
 * Partitioning for parallel runs
 *
@@ -929,6 +1192,10 @@ void IAEA_SET_TOTAL_ORIGINAL_PARTICLES__(const IAEA_I32 *id,
 * should divide the available phase space of source with Id id
 * into n_chunk equal portions and from now on deliver particles
 * from the i_chunk-th portion. (i_chunk must be between 1 and n_chunk)
+* Portion boundaries are moved to the nearest record that starts a
+* history within half a portion, or else to the next one however far, so
+* that histories are never split (a portion may then be empty);
+* iaea_get_parallel_chunk tells how many records a portion holds.
 * The extra parameter i_parallel is needed
 * for the cases where the source is an event generator and should
 * be used to adjust the random number sequence.
@@ -947,18 +1214,19 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
    if(p_iaea_header[*id]->file_type == 1)
    {
          // set i_parallel for event generators
+         (void)i_parallel;
          *result = 0;
          return;
    }
 
-   IAEA_I64 nrecords =  p_iaea_header[*id]->nParticles;
    IAEA_I32 record_length =  p_iaea_header[*id]->record_length;
-   // IAEA_I32 number_record_per_chunk = (IAEA_I32)nrecords/(*n_chunk); // changed, May 2011
-   IAEA_I64 number_record_per_chunk = nrecords/(*n_chunk);
-
+   // Chunks start at the first record of a history (changed, Oct 2026), so
+   // that n_stat counts every history in one chunk only
+   IAEA_I64 first_record, n_records;
+   if(parallel_chunk(*id, *i_chunk, *n_chunk, &first_record, &n_records) != OK)
+      {*result = -1; return;}
 
-   // IAEA_I32 offset = ((*i_chunk)-1)*record_length * number_record_per_chunk;	// changed, May 2011
-   IAEA_I64 offset = ((*i_chunk)-1)*record_length * number_record_per_chunk;
+   IAEA_I64 offset = first_record*record_length;
    /*
    SEEK_CUR   Current position of file pointer
    SEEK_END   End of file
@@ -967,10 +1235,8 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32 *i_parallel,
    offset   Number of bytes from origin
    origin   Initial position
    */
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0)
+   if( p_iaea_record[*id]->seek_file(offset) == OK )
    {
-         // IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);  // changed, May 2011
-	     IAEA_I64 pos = (IAEA_I64)ftell(p_iaea_record[*id]->p_file);
          *result = 0;
          return;
    }
@@ -1014,6 +1280,54 @@ void IAEA_SET_PARALLEL__(const IAEA_I32 *id,
                                             IAEA_I32 *is_ok)
 { iaea_set_parallel(id, i_parallel, i_chunk, n_chunk, is_ok); }
 
+/**************************************************************************
+* Portion of a parallel run
+*
+* Sets first_record (counted from 0) and n_records to the records that
+* iaea_set_parallel delivers for chunk i_chunk of n_chunk of source id.
+* A job reading n_records particles after iaea_set_parallel reads whole
+* histories only, and all jobs together read every record once.
+* The variable result is set to 0 if everything went smoothly, or to the
+* error code of iaea_set_parallel.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_chunk(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                             const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                             IAEA_I64 *n_records, IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+   if(*n_chunk <= 0) {*result = -2; return;}
+   if( (*i_chunk < 1) || (*i_chunk > *n_chunk) ) {*result = -3; return;}
+   if(p_iaea_header[*id]->file_type == 1) {*result = -1; return;}
+
+   *result = (parallel_chunk(*id, *i_chunk, *n_chunk, first_record, n_records) == OK) ? 0 : -1;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_chunk_(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_parallel_chunk(id, i_chunk, n_chunk, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_chunk__(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                               const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                               IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_parallel_chunk(id, i_chunk, n_chunk, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_CHUNK(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                             const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                             IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_parallel_chunk(id, i_chunk, n_chunk, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_CHUNK_(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_parallel_chunk(id, i_chunk, n_chunk, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_CHUNK__(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                               const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                               IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_parallel_chunk(id, i_chunk, n_chunk, first_record, n_records, result); }
+
 /**************************************************************************
 * check that the file size equals the value of checksum in the header
 * and that the byte order of the machine being run on matches that of
@@ -1033,6 +1347,20 @@ void iaea_check_file_size_byte_order(const IAEA_I32 *id,
 
    int machine_byte_order = check_byte_order();
 
+   IAEA_I64 size;
+   if(p_iaea_record[*id]->p_virtual != NULL)
+   {
+     // What the members hold of their ranges
+     size = p_iaea_record[*id]->p_virtual->size();
+     if(size < 0) {*result = -2; return;}
+   }
+   else if(p_iaea_record[*id]->p_compressed != NULL)
+   {
+     // The records of the container, decompressed
+     size = p_iaea_record[*id]->p_compressed->size();
+   }
+   else
+   {
    #if (defined WIN32) || (defined WIN64)
      // IAEA_I64 size = _filelengthi64(fileno(p_iaea_record[*id]->p_file));
      struct _stati64 fileStatus;
@@ -1041,8 +1369,8 @@ void iaea_check_file_size_byte_order(const IAEA_I32 *id,
      struct stat fileStatus;
      fstat(fileno(p_iaea_record[*id]->p_file),&fileStatus);
    #endif
-
-   IAEA_I64 size = fileStatus.st_size;
+     size = fileStatus.st_size;
+   }
    printf(" phsp size = %llu\n",size);
 
    // bug found, changed to filelength use. May 2011
@@ -1121,9 +1449,8 @@ void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
    origin   Initial position
    */
 
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0)
+   if( p_iaea_record[*id]->seek_file(offset) == OK )
    {
-         IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);
          *result = 0;
          return;
    }
@@ -1185,9 +1512,9 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
 {
-      if(feof(p_iaea_record[*id]->p_file)) {
+      if(p_iaea_record[*id]->end_of_file()) {
          *n_stat = -2;
-         rewind (p_iaea_record[*id]->p_file);
+         p_iaea_record[*id]->rewind_file();
          return;
       }
 
@@ -1198,19 +1525,7 @@ IAEA_I32 *extra_ints)
       // Corrected on Dec. 2006. Before n_stat was not assigned if
       // (p->iextralong > 0)  and (p_iaea_header[*id]->extralong_contents[j] != 1)
 
-      if( p->IsNewHistory > 0) *n_stat=1;
-      else                     *n_stat=0;
-
-      if(p->iextralong > 0) {
-          for(int j=0;j<p->iextralong ;j++) {
-              // Looking for incremental number of histories
-              // (Type 1 of the extralong stored variable)
-              if(p_iaea_header[*id]->extralong_contents[j] == 1) {
-                  *n_stat = p->extralong[j];
-                  p->IsNewHistory = *n_stat;
-              }
-          }
-      }
+      *n_stat = get_n_stat(p_iaea_header[*id], p);
 
       *type  = p->particle; /* particle type */
       *E     = p->energy;   /* kinetic energy in MeV */
@@ -1329,6 +1644,143 @@ IAEA_I32 *extra_ints)
 { iaea_get_particle(id, n_stat, type,
                                 E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
+/**************************************************************************
+* Get a batch of particles
+*
+* Return up to n next particles from the source with Id id into arrays of
+* n elements, one per quantity, as iaea_get_particle would return them one
+* after the other. Extra variables are stored variable by variable:
+* extra_floats[k*n + i] is the extra float k of particle i (an n x
+* NUM_EXTRA_FLOAT array in Fortran), and the same for extra_ints.
+*
+* The records are read (or taken from the memory mapping) a block at a
+* time and decoded in one loop, without the per-particle call, end of
+* file check and read of iaea_get_particle. The counters are updated as
+* by iaea_get_particle.
+*
+* n_read is set to the number of particles returned, which is less than n
+* only at the end of the phase space file (the next iaea_get_particle
+* then reports the end of file). n_read is set to -1 if the source with
+* Id id does not exist and -3 if memory cannot be allocated.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+             IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+             IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+             IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+             IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*n_read = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   IAEA_I64 reclength = p->get_record_length();
+   IAEA_I64 records_per_block = min((IAEA_I64)DECODE_BLOCK_RECORDS, (IAEA_I64)max(*n, 1));
+
+   // Mapped sources are decoded in place and do not need the buffer
+   iaea_decoded_block block;
+   char *buffer = NULL;
+   if(p->p_map == NULL) buffer = (char *) malloc((size_t)(records_per_block*reclength));
+   if( (p->p_map == NULL && buffer == NULL) || block.allocate(records_per_block) == FAIL )
+   {
+      free(buffer);
+      *n_read = -3; return;
+   }
+
+   IAEA_I64 c = block.capacity;
+   IAEA_I32 i = 0;
+   while(i < *n)
+   {
+      IAEA_I64 n_block = min(records_per_block, (IAEA_I64)(*n - i));
+      IAEA_I64 n_fetched = n_block;
+      const char *records = p->fetch_records(buffer, &n_fetched);
+      if(n_fetched <= 0) break;
+
+      // Decoded a block at a time with the vector kernels
+      iaea_decode_records(p, records, n_fetched, &block);
+      get_n_stats(h, p, &block, n_fetched);
+
+      IAEA_I64 r;
+      for(r=0; r<n_fetched; r++)
+      {
+         n_stat[i+r] = block.new_history[r];
+         type[i+r]   = block.particle[r];
+         E[i+r]      = block.energy[r];
+      }
+      // Fields that are not stored are the constants of the header
+      struct {int stored; const float *column; IAEA_Float *out; int constant;} fields[7] = {
+         {p->ix, block.x, x, 0}, {p->iy, block.y, y, 1}, {p->iz, block.z, z, 2},
+         {p->iu, block.u, u, 3}, {p->iv, block.v, v, 4}, {p->iw, block.w, w, 5},
+         {p->iweight, block.weight, wt, 6}};
+      for(int f=0; f<7; f++)
+      {
+         IAEA_Float *out = fields[f].out + i;
+         if(fields[f].stored > 0)
+            for(r=0; r<n_fetched; r++) out[r] = fields[f].column[r];
+         else
+         {
+            IAEA_Float constant = h->record_constant[fields[f].constant];
+            for(r=0; r<n_fetched; r++) out[r] = constant;
+         }
+      }
+      for(int k=0;k<p->iextrafloat;k++)
+         for(r=0; r<n_fetched; r++) extra_floats[k*(*n) + i + r] = block.extrafloat[k*c + r];
+      for(int j=0;j<p->iextralong ;j++)
+         for(r=0; r<n_fetched; r++) extra_ints[j*(*n) + i + r] = block.extralong[j*c + r];
+
+      h->update_counters(n_fetched, block.particle, block.energy, block.weight,
+                         block.x, block.y, block.z, block.new_history);
+
+      i += (IAEA_I32)n_fetched;
+      if(n_fetched < n_block) break; // end of the phase space file
+   }
+
+   free(buffer);
+   block.release();
+   *n_read = i;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles_(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+              IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+              IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+              IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+              IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{ iaea_get_particles(id, n, n_read, n_stat, type, E, wt, x, y, z, u, v, w,
+                     extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles__(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+               IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+               IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+               IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+               IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{ iaea_get_particles(id, n, n_read, n_stat, type, E, wt, x, y, z, u, v, w,
+                     extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+             IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+             IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+             IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+             IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{ iaea_get_particles(id, n, n_read, n_stat, type, E, wt, x, y, z, u, v, w,
+                     extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+              IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+              IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+              IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+              IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{ iaea_get_particles(id, n, n_read, n_stat, type, E, wt, x, y, z, u, v, w,
+                     extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_read,
+               IAEA_I32 n_stat[], IAEA_I32 type[], IAEA_Float E[], IAEA_Float wt[],
+               IAEA_Float x[], IAEA_Float y[], IAEA_Float z[],
+               IAEA_Float u[], IAEA_Float v[], IAEA_Float w[],
+               IAEA_Float extra_floats[], IAEA_I32 extra_ints[])
+{ iaea_get_particles(id, n, n_read, n_stat, type, E, wt, x, y, z, u, v, w,
+                     extra_floats, extra_ints); }
+
 /**************************************************************************
 * Write a particle
 * n_stat = 0 for a secondary particle
@@ -1462,38 +1914,197 @@ const IAEA_I32 *extra_ints)
 { iaea_write_particle(id, n_stat, type,
                                 E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
+/**************************************************************************
+* Write a batch of particles
+*
+* Write n particles given in arrays of n elements, one per quantity, to
+* the source with Id id, as n calls of iaea_write_particle would. Extra
+* variables are stored variable by variable, as for iaea_get_particles:
+* extra_floats[k*n + i] is the extra float k of particle i.
+*
+* The particles are encoded into a buffer of WRITE_BLOCK_SIZE bytes that
+* is written at once, and the counters are updated for the whole buffer.
+*
+* n_written is set to the number of particles written, or -1 if the
+* source with Id id does not exist or writing fails, and -3 if memory
+* cannot be allocated.
+**************************************************************************/
+#define WRITE_BLOCK_SIZE 262144 // 256 kB of records per write
+
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+             const IAEA_I32 n_stat[], const IAEA_I32 type[],
+             const IAEA_Float E[], const IAEA_Float wt[],
+             const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+             const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+             const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*n_written = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   IAEA_I64 reclength = p->get_record_length();
+   IAEA_I64 records_per_block = max((IAEA_I64)1, WRITE_BLOCK_SIZE/reclength);
+   IAEA_I64 block_size = min(records_per_block, (IAEA_I64)max(*n, 1));
+
+   // The buffer of records, then the quantities the counters need
+   char *buffer = (char *) malloc((size_t)(block_size*reclength));
+   IAEA_I32 *particle = (IAEA_I32 *) malloc((size_t)block_size*sizeof(IAEA_I32));
+   float *stat = (float *) malloc((size_t)block_size*5*sizeof(float));
+   IAEA_I32 *new_history = (IAEA_I32 *) malloc((size_t)block_size*sizeof(IAEA_I32));
+   if(buffer == NULL || particle == NULL || stat == NULL || new_history == NULL)
+   {
+      free(buffer); free(particle); free(stat); free(new_history);
+      *n_written = -3; return;
+   }
+   float *energy = stat, *weight = stat + block_size;
+   float *px = stat + 2*block_size, *py = stat + 3*block_size, *pz = stat + 4*block_size;
+
+   *n_written = 0;
+   while(*n_written < *n)
+   {
+      IAEA_I32 first = *n_written;
+      IAEA_I64 n_block = min(block_size, (IAEA_I64)(*n - first));
+      char *record = buffer;
+
+      for(IAEA_I64 r=0; r<n_block; r++)
+      {
+         IAEA_I32 i = first + (IAEA_I32)r;
+         // Fields not stored keep their values, as in iaea_write_particle
+         p->IsNewHistory = (n_stat[i] > 0) ? n_stat[i] : 0;
+         p->particle = (short)type[i];
+         p->energy   = E[i];
+         if(p->iweight > 0) p->weight = wt[i];
+         if(p->ix > 0) p->x = x[i];
+         if(p->iy > 0) p->y = y[i];
+         if(p->iz > 0) p->z = z[i];
+         if(p->iu > 0) p->u = u[i];
+         if(p->iv > 0) p->v = v[i];
+         if(p->iw > 0) p->w = w[i];
+         for(int k=0;k<p->iextrafloat;k++) p->extrafloat[k] = extra_floats[k*(*n) + i];
+         for(int j=0;j<p->iextralong ;j++) p->extralong[j]  = extra_ints[j*(*n) + i];
+
+         record += p->encode_particle(record);
+
+         particle[r] = p->particle;   energy[r] = p->energy;   weight[r] = p->weight;
+         px[r] = p->x;   py[r] = p->y;   pz[r] = p->z;
+         new_history[r] = p->IsNewHistory;
+      }
+
+      if( fwrite(buffer, (size_t)reclength, (size_t)n_block, p->p_file) != (size_t)n_block )
+      {
+         fprintf(stderr, "\n ERROR: iaea_write_particles: Failed to write particle records\n");
+         *n_written = -1;
+         break;
+      }
+
+      h->update_counters(n_block, particle, energy, weight, px, py, pz, new_history);
+      *n_written += (IAEA_I32)n_block;
+   }
+
+   free(buffer); free(particle); free(stat); free(new_history);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles_(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+              const IAEA_I32 n_stat[], const IAEA_I32 type[],
+              const IAEA_Float E[], const IAEA_Float wt[],
+              const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+              const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+              const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{ iaea_write_particles(id, n, n_written, n_stat, type, E, wt, x, y, z, u, v, w,
+                       extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles__(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+               const IAEA_I32 n_stat[], const IAEA_I32 type[],
+               const IAEA_Float E[], const IAEA_Float wt[],
+               const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+               const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+               const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{ iaea_write_particles(id, n, n_written, n_stat, type, E, wt, x, y, z, u, v, w,
+                       extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+             const IAEA_I32 n_stat[], const IAEA_I32 type[],
+             const IAEA_Float E[], const IAEA_Float wt[],
+             const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+             const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+             const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{ iaea_write_particles(id, n, n_written, n_stat, type, E, wt, x, y, z, u, v, w,
+                       extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+              const IAEA_I32 n_stat[], const IAEA_I32 type[],
+              const IAEA_Float E[], const IAEA_Float wt[],
+              const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+              const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+              const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{ iaea_write_particles(id, n, n_written, n_stat, type, E, wt, x, y, z, u, v, w,
+                       extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n, IAEA_I32 *n_written,
+               const IAEA_I32 n_stat[], const IAEA_I32 type[],
+               const IAEA_Float E[], const IAEA_Float wt[],
+               const IAEA_Float x[], const IAEA_Float y[], const IAEA_Float z[],
+               const IAEA_Float u[], const IAEA_Float v[], const IAEA_Float w[],
+               const IAEA_Float extra_floats[], const IAEA_I32 extra_ints[])
+{ iaea_write_particles(id, n, n_written, n_stat, type, E, wt, x, y, z, u, v, w,
+                       extra_floats, extra_ints); }
+
 /***************************************************************************
 * Destroy a source
 *
 * This function de-initializes the source with Id id, closing all open
 * files, deallocating memory, etc. Nothing happens if a source with that
-* id does not exist. Header is updated.
+* id does not exist. Header is updated. The Id is given back, to be
+* assigned again by iaea_new_source.
 ****************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result)
 {
-   if(*source_ID > MAX_NUM_SOURCES) { *result = -98 ; return;} // Too big phsp ID
    if(*source_ID < 0)               { *result = -97 ; return;} // wrong ID number
+   if(!iaea_sources.in_use(*source_ID)) { *result = -98 ; return;} // no such phsp ID
 
-   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
-
-  /* Write an IAEA header */
-   // For read-only files nothing happens
-   p_iaea_header[*source_ID]->write_header();
-
-   // Closing header file
-   fclose(p_iaea_header[*source_ID]->fheader);
-   // Deallocating IAEA phsp header
-   free(p_iaea_header[*source_ID]);
+   iaea_read_source *s = p_iaea_read_source[*source_ID];
+   *result = 1; // Return OK
 
-   // Closing phsp file
-   fclose(p_iaea_record[*source_ID]->p_file);
-   // Deallocating IAEA record
-   free(p_iaea_record[*source_ID]);
+   if(s != NULL && s->suspended)
+   {
+      // Nothing is open
+   }
+   else if(p_iaea_header[*source_ID] == NULL ||
+           p_iaea_header[*source_ID]->fheader == NULL)
+   {
+      // The source failed to open: only its Id is given back
+      *result = -1;
+   }
+   else
+   {
+      /* Write an IAEA header */
+      // For read-only files nothing happens
+      p_iaea_header[*source_ID]->write_header();
+   }
 
-   __iaea_source_used[*source_ID] = false;
+   // Closing files and deallocating IAEA phsp header and record
+   close_source(*source_ID);
 
-   *result = 1; // Return OK
+   if(s != NULL)
+   {
+      if(!s->suspended) release_open_source();
+      if(s->history != NULL) s->history->release();
+      free(s->history);
+      if(s->zones != NULL) s->zones->release();
+      free(s->zones);
+      if(s->grid != NULL) s->grid->release();
+      free(s->grid);
+      free(s->region);
+      if(s->type_index != NULL) s->type_index->release();
+      free(s->type_index);
+      free(s->selection);
+      free(s);
+      p_iaea_read_source[*source_ID] = NULL;
+   }
+   iaea_sources.release(*source_ID);
 
    return;
 }
@@ -1513,6 +2124,133 @@ IAEA_EXTERN_C IAEA_EXPORT
 void IAEA_DESTROY_SOURCE__(const IAEA_I32 *source_ID, IAEA_I32 *result)
 { iaea_destroy_source(source_ID, result); }
 
+/***************************************************************************
+* Suspend a source opened for reading
+*
+* Closes the files of the source with Id id and releases its header,
+* keeping its Id, its file name, its position in the phsp file and the
+* counters of its header. The source cannot be used until it is resumed
+* with iaea_resume_source. This lets an application keep thousands of
+* sources without holding a header and two open files for each of them.
+*
+* result is set to 1 if the source is suspended (or already was), -1 if
+* it does not exist and -2 if it was not opened for reading (access = 1).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_suspend_source(const IAEA_I32 *id, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL) {*result = -2; return;}
+   if(s->suspended) {*result = 1; return;}
+   if(p_iaea_header[*id] == NULL || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   s->offset = p_iaea_record[*id]->tell_file();
+   s->counters.save(p_iaea_header[*id]);
+   close_source(*id);
+   s->suspended = 1;
+   release_open_source();
+
+   *result = 1;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_suspend_source_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_suspend_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_suspend_source__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_suspend_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SUSPEND_SOURCE(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_suspend_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SUSPEND_SOURCE_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_suspend_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SUSPEND_SOURCE__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_suspend_source(id, result); }
+
+/***************************************************************************
+* Resume a suspended source
+*
+* Opens again the files of the source with Id id, reads its header and
+* goes back to where it was suspended, with the counters it had. If a
+* limit was set with iaea_set_max_open_sources, waits until fewer sources
+* are open for reading.
+*
+* result is set as by iaea_new_source (IAEA index, or negative if the
+* files cannot be opened or read), to 1 if the source was not suspended,
+* and to -1 if it does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_resume_source(const IAEA_I32 *id, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || !s->suspended) {*result = 1; return;}
+
+   acquire_open_source();
+   s->suspended = 0;
+   *result = open_source_for_reading(*id, s->file_name);
+   if(*result < 0) return;
+
+   s->counters.restore(p_iaea_header[*id]);
+   p_iaea_record[*id]->seek_file(s->offset);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_resume_source_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_resume_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_resume_source__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_resume_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESUME_SOURCE(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_resume_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESUME_SOURCE_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_resume_source(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESUME_SOURCE__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_resume_source(id, result); }
+
+/***************************************************************************
+* Maximum number of sources open for reading
+*
+* Sets to max_open the number of sources opened for reading (access = 1)
+* that may be open at once; 0 (the default) sets no limit. Suspended
+* sources do not count. iaea_new_source and iaea_resume_source wait until
+* a source is suspended or destroyed by another thread when the limit is
+* reached, so a thread must not open more sources than max_open itself.
+* result is set to -1 if max_open is negative.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_max_open_sources(const IAEA_I32 *max_open, IAEA_I32 *result)
+{
+   if(*max_open < 0) {*result = -1; return;}
+   std::lock_guard<std::mutex> lock(iaea_open_mutex);
+   __iaea_max_open = *max_open;
+   iaea_open_freed.notify_all();
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_max_open_sources_(const IAEA_I32 *max_open, IAEA_I32 *result)
+{ iaea_set_max_open_sources(max_open, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_max_open_sources__(const IAEA_I32 *max_open, IAEA_I32 *result)
+{ iaea_set_max_open_sources(max_open, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_MAX_OPEN_SOURCES(const IAEA_I32 *max_open, IAEA_I32 *result)
+{ iaea_set_max_open_sources(max_open, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_MAX_OPEN_SOURCES_(const IAEA_I32 *max_open, IAEA_I32 *result)
+{ iaea_set_max_open_sources(max_open, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_MAX_OPEN_SOURCES__(const IAEA_I32 *max_open, IAEA_I32 *result)
+{ iaea_set_max_open_sources(max_open, result); }
+
 /***************************************************************************
 * Print the current header associated to source id
 *
@@ -1559,7 +2297,7 @@ void iaea_copy_header(const IAEA_I32 *source_ID,
    if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
    if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
 
-   // Selective copy of string variables
+   // Selective copy of variables; texts are shared, not copied
 
       p_iaea_header[*destiny_ID]->checksum =
             p_iaea_header[*source_ID]->checksum ;
@@ -1571,15 +2309,15 @@ void iaea_copy_header(const IAEA_I32 *source_ID,
 // ******************************************************************************
 // 2. Mandatory description of the phsp
 
-      strcpy(p_iaea_header[*destiny_ID]->coordinate_system_description,
-            p_iaea_header[*source_ID]->coordinate_system_description) ;
+      p_iaea_header[*destiny_ID]->share_text(HEADER_COORDINATE_SYSTEM_DESCRIPTION,
+            p_iaea_header[*source_ID]);
 
       int file_type = p_iaea_header[*source_ID]->file_type;
       if(file_type == 1)
       {
             // For event generators
-            strcpy(p_iaea_header[*destiny_ID]->input_file_for_event_generator,
-                  p_iaea_header[*source_ID]->input_file_for_event_generator) ;
+            p_iaea_header[*destiny_ID]->share_text(HEADER_INPUT_FILE_FOR_EVENT_GENERATOR,
+                  p_iaea_header[*source_ID]);
             *result = 1; // Return OK
             return;
       }
@@ -1590,11 +2328,11 @@ void iaea_copy_header(const IAEA_I32 *source_ID,
 // ******************************************************************************
 // 3. Mandatory additional information
       /*********************************************/
-      strcpy(p_iaea_header[*destiny_ID]->machine_type,
-            p_iaea_header[*source_ID]->machine_type);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_MACHINE_TYPE,
+            p_iaea_header[*source_ID]);
 
-      strcpy(p_iaea_header[*destiny_ID]->MC_code_and_version,
-            p_iaea_header[*source_ID]->MC_code_and_version);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_MC_CODE_AND_VERSION,
+            p_iaea_header[*source_ID]);
 
       p_iaea_header[*destiny_ID]->global_photon_energy_cutoff =
             p_iaea_header[*source_ID]->global_photon_energy_cutoff;
@@ -1602,36 +2340,36 @@ void iaea_copy_header(const IAEA_I32 *source_ID,
       p_iaea_header[*destiny_ID]->global_particle_energy_cutoff =
             p_iaea_header[*source_ID]->global_particle_energy_cutoff;
 
-      strcpy(p_iaea_header[*destiny_ID]->transport_parameters,
-            p_iaea_header[*source_ID]->transport_parameters);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_TRANSPORT_PARAMETERS,
+            p_iaea_header[*source_ID]);
 
 // ******************************************************************************
 // 4. Optional description
-      strcpy(p_iaea_header[*destiny_ID]->beam_name,
-            p_iaea_header[*source_ID]->beam_name);
-      strcpy(p_iaea_header[*destiny_ID]->field_size,
-            p_iaea_header[*source_ID]->field_size);
-      strcpy(p_iaea_header[*destiny_ID]->nominal_SSD,
-            p_iaea_header[*source_ID]->nominal_SSD);
-      strcpy(p_iaea_header[*destiny_ID]->variance_reduction_techniques,
-            p_iaea_header[*source_ID]->variance_reduction_techniques);
-      strcpy(p_iaea_header[*destiny_ID]->initial_source_description,
-            p_iaea_header[*source_ID]->initial_source_description);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_BEAM_NAME,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_FIELD_SIZE,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_NOMINAL_SSD,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_VARIANCE_REDUCTION_TECHNIQUES,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_INITIAL_SOURCE_DESCRIPTION,
+            p_iaea_header[*source_ID]);
 
       // Documentation sub-section
       /*********************************************/
-      strcpy(p_iaea_header[*destiny_ID]->MC_input_filename,
-            p_iaea_header[*source_ID]->MC_input_filename);
-      strcpy(p_iaea_header[*destiny_ID]->published_reference,
-            p_iaea_header[*source_ID]->published_reference);
-      strcpy(p_iaea_header[*destiny_ID]->authors,
-            p_iaea_header[*source_ID]->authors);
-      strcpy(p_iaea_header[*destiny_ID]->institution,
-            p_iaea_header[*source_ID]->institution);
-      strcpy(p_iaea_header[*destiny_ID]->link_validation,
-            p_iaea_header[*source_ID]->link_validation);
-      strcpy(p_iaea_header[*destiny_ID]->additional_notes,
-            p_iaea_header[*source_ID]->additional_notes);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_MC_INPUT_FILENAME,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_PUBLISHED_REFERENCE,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_AUTHORS,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_INSTITUTION,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_LINK_VALIDATION,
+            p_iaea_header[*source_ID]);
+      p_iaea_header[*destiny_ID]->share_text(HEADER_ADDITIONAL_NOTES,
+            p_iaea_header[*source_ID]);
 
     *result = 1; // Return OK
 
@@ -1698,3 +2436,3036 @@ void IAEA_UPDATE_HEADER_(const IAEA_I32 *source_ID, IAEA_I32 *result)
 IAEA_EXTERN_C IAEA_EXPORT
 void IAEA_UPDATE_HEADER__(const IAEA_I32 *source_ID, IAEA_I32 *result)
 { iaea_update_header(source_ID, result); }
+
+/***************************************************************************
+* Compare the record layouts of two sources
+*
+* result is set to 1 if the records of source_ID and destiny_ID are packed
+* identically (same RECORD_CONTENTS, RECORD_CONSTANT, extra variable types
+* and record length) in the byte order of the running machine, so that raw
+* records can be moved from one file to the other without decoding them.
+* result is set to 0 if the layouts differ and to negative if a source
+* does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compare_record_layout(const IAEA_I32 *source_ID,
+                                const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{
+   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *a = p_iaea_header[*source_ID];
+   iaea_header_type *b = p_iaea_header[*destiny_ID];
+
+   *result = 0;
+
+   int machine_byte_order = check_byte_order();
+   if(a->byte_order != machine_byte_order) return;
+   if(b->byte_order != machine_byte_order) return;
+   if(a->record_length != b->record_length) return;
+
+   int i;
+   for(i=0;i<9;i++)
+      if(a->record_contents[i] != b->record_contents[i]) return;
+   for(i=0;i<7;i++)
+      if(a->record_contents[i] == 0 &&
+         a->record_constant[i] != b->record_constant[i]) return;
+   for(i=0;i<a->record_contents[7];i++)
+      if(a->extrafloat_contents[i] != b->extrafloat_contents[i]) return;
+   for(i=0;i<a->record_contents[8];i++)
+      if(a->extralong_contents[i] != b->extralong_contents[i]) return;
+
+   *result = 1;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compare_record_layout_(const IAEA_I32 *source_ID,
+                                 const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_compare_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compare_record_layout__(const IAEA_I32 *source_ID,
+                                  const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_compare_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPARE_RECORD_LAYOUT(const IAEA_I32 *source_ID,
+                                const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_compare_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPARE_RECORD_LAYOUT_(const IAEA_I32 *source_ID,
+                                 const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_compare_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPARE_RECORD_LAYOUT__(const IAEA_I32 *source_ID,
+                                  const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_compare_record_layout(source_ID, destiny_ID, result); }
+
+/***************************************************************************
+* Copy the record layout of the source_id to the destiny_id
+*
+* RECORD_CONTENTS, RECORD_CONSTANT, the extra variable types and the byte
+* order are copied, so that records of source_ID can be written unchanged
+* to destiny_ID. Usually called before any particle is written.
+*
+* result is set to negative if phsp source or destiny do not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_record_layout(const IAEA_I32 *source_ID,
+                             const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{
+   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *a = p_iaea_header[*source_ID];
+   iaea_header_type *b = p_iaea_header[*destiny_ID];
+
+   int i;
+   for(i=0;i<9;i++) b->record_contents[i] = a->record_contents[i];
+   for(i=0;i<7;i++) b->record_constant[i] = a->record_constant[i];
+   for(i=0;i<NUM_EXTRA_FLOAT;i++)
+      b->extrafloat_contents[i] = a->extrafloat_contents[i];
+   for(i=0;i<NUM_EXTRA_LONG;i++)
+      b->extralong_contents[i] = a->extralong_contents[i];
+   b->byte_order = a->byte_order;
+
+   // Store read/write logical block changes in the PHSP header
+   if( b->get_record_contents(p_iaea_record[*destiny_ID]) == FAIL)
+      {*result = -2; return;}
+
+   *result = 1; // Return OK
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_record_layout_(const IAEA_I32 *source_ID,
+                              const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_copy_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_record_layout__(const IAEA_I32 *source_ID,
+                               const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_copy_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORD_LAYOUT(const IAEA_I32 *source_ID,
+                             const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_copy_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORD_LAYOUT_(const IAEA_I32 *source_ID,
+                              const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_copy_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORD_LAYOUT__(const IAEA_I32 *source_ID,
+                               const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_copy_record_layout(source_ID, destiny_ID, result); }
+
+/***************************************************************************
+* Widen the record layout of the destiny_id to hold records of source_id
+*
+* A variable becomes stored in destiny_ID if source_ID stores it, or keeps
+* it constant at another value. Extra variables of source_ID are matched
+* by type: the k-th extra float (long) of a given type in source_ID maps
+* to the k-th one of that type in destiny_ID, which is appended when
+* missing. Calling this for every input after iaea_copy_record_layout
+* with the first one gives a layout that all inputs can be converted to
+* (see iaea_copy_records).
+*
+* result is set to negative if a source does not exist (-1), if the
+* layout is wrongly defined (-2) or if there are more extra variables than
+* NUM_EXTRA_FLOAT or NUM_EXTRA_LONG (-3).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_record_layout(const IAEA_I32 *source_ID,
+                              const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{
+   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *a = p_iaea_header[*source_ID];
+   iaea_header_type *b = p_iaea_header[*destiny_ID];
+
+   int i, j, k;
+   for(i=0;i<7;i++)
+   {
+      if(b->record_contents[i] != 0) continue;
+      if(a->record_contents[i] != 0 ||
+         a->record_constant[i] != b->record_constant[i]) b->record_contents[i] = 1;
+   }
+
+   for(j=0;j<a->record_contents[7];j++)
+   {
+      // Occurrences of this type so far in source and destiny
+      int na = 0, nb = 0;
+      for(k=0;k<=j;k++) if(a->extrafloat_contents[k] == a->extrafloat_contents[j]) na++;
+      for(k=0;k<b->record_contents[7];k++)
+         if(b->extrafloat_contents[k] == a->extrafloat_contents[j]) nb++;
+      if(nb >= na) continue;
+      if(b->record_contents[7] >= NUM_EXTRA_FLOAT) {*result = -3; return;}
+      b->extrafloat_contents[b->record_contents[7]++] = a->extrafloat_contents[j];
+   }
+
+   for(j=0;j<a->record_contents[8];j++)
+   {
+      int na = 0, nb = 0;
+      for(k=0;k<=j;k++) if(a->extralong_contents[k] == a->extralong_contents[j]) na++;
+      for(k=0;k<b->record_contents[8];k++)
+         if(b->extralong_contents[k] == a->extralong_contents[j]) nb++;
+      if(nb >= na) continue;
+      if(b->record_contents[8] >= NUM_EXTRA_LONG) {*result = -3; return;}
+      b->extralong_contents[b->record_contents[8]++] = a->extralong_contents[j];
+   }
+
+   // Store read/write logical block changes in the PHSP header
+   if( b->get_record_contents(p_iaea_record[*destiny_ID]) == FAIL)
+      {*result = -2; return;}
+
+   *result = 1; // Return OK
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_record_layout_(const IAEA_I32 *source_ID,
+                               const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_record_layout__(const IAEA_I32 *source_ID,
+                                const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_RECORD_LAYOUT(const IAEA_I32 *source_ID,
+                              const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_RECORD_LAYOUT_(const IAEA_I32 *source_ID,
+                               const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_record_layout(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_RECORD_LAYOUT__(const IAEA_I32 *source_ID,
+                                const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_record_layout(source_ID, destiny_ID, result); }
+
+/***************************************************************************
+* Decode n records packed with the layout of p/h (in buffer) and add them
+* to the statistics p_counters, as iaea_write_particle would count them.
+* p is used as scratch record.
+****************************************************************************/
+static void count_records(iaea_header_type *h, iaea_record_type *p,
+                          iaea_statistics *p_counters,
+                          const char *buffer, IAEA_I64 n)
+{
+   int record_length = h->record_length;
+
+   iaea_decoded_block block;
+   if(block.allocate(min(n, (IAEA_I64)DECODE_BLOCK_RECORDS)) == FAIL)
+   {
+      // One record after the other
+      for(IAEA_I64 i=0; i<n; i++)
+      {
+         p->decode_particle(buffer + i*record_length);
+         get_n_stat(h, p);
+         p_counters->add_particle(p);
+      }
+      return;
+   }
+
+   for(IAEA_I64 first=0; first<n; first+=DECODE_BLOCK_RECORDS)
+   {
+      IAEA_I64 m = min((IAEA_I64)DECODE_BLOCK_RECORDS, n - first);
+      iaea_decode_records(p, buffer + first*record_length, m, &block);
+      get_n_stats(h, p, &block, m);
+      p_counters->add_block(m, block.particle, block.energy, block.weight,
+                            block.x, block.y, block.z, block.new_history);
+   }
+   block.release();
+}
+
+/***************************************************************************
+* Copy records from the source_id to the destiny_id
+*
+* Up to n_records records are moved from the current position of
+* source_ID to the end of destiny_ID in blocks of COPY_BLOCK_SIZE bytes,
+* without the per-particle decode/encode of iaea_get_particle and
+* iaea_write_particle. Records of the same layout (see
+* iaea_compare_record_layout) are copied raw; otherwise they are converted
+* field by field to the layout of destiny_ID with a transcoding plan, and
+* extra variables are matched by type (see iaea_merge_record_layout).
+* The counters of destiny_ID are updated exactly as iaea_write_particle
+* would update them.
+*
+* n_copied is set to the number of records copied (less than n_records if
+* the end of the source file is reached), -1 if a source does not exist,
+* -2 if the records cannot be converted (byte order of a source differs
+* from the one of this machine), -3 if memory cannot be allocated and
+* -4 if writing fails.
+****************************************************************************/
+#define COPY_BLOCK_SIZE 4194304 // 4 MB of records per block
+
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                       const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{
+   IAEA_I32 same_layout;
+   iaea_compare_record_layout(source_ID, destiny_ID, &same_layout);
+   if(same_layout < 0) {*n_copied = -1; return;}
+
+   iaea_header_type *h_in  = p_iaea_header[*source_ID];
+   iaea_header_type *h_out = p_iaea_header[*destiny_ID];
+   iaea_record_type *p_in  = p_iaea_record[*source_ID];
+   iaea_record_type *p_out = p_iaea_record[*destiny_ID];
+
+   iaea_transcode_plan plan;
+   if(same_layout == 0 && plan.build(h_in, h_out) == FAIL) {*n_copied = -2; return;}
+
+   size_t in_length  = h_in->record_length;
+   size_t out_length = h_out->record_length;
+   IAEA_I64 records_per_block = COPY_BLOCK_SIZE/max(in_length, out_length);
+
+   char *in_buffer  = (char *) malloc(records_per_block*in_length);
+   char *out_buffer = in_buffer;
+   if(same_layout == 0) out_buffer = (char *) malloc(records_per_block*out_length);
+   if(in_buffer == NULL || out_buffer == NULL)
+   {
+      free(in_buffer); if(same_layout == 0) free(out_buffer);
+      *n_copied = -3; return;
+   }
+   iaea_statistics counters;
+   counters.initialize();
+
+   *n_copied = 0;
+   while(*n_copied < *n_records)
+   {
+      IAEA_I64 n_block = min(records_per_block, *n_records - *n_copied);
+      size_t n_read = (size_t)p_in->read_records(in_buffer, n_block);
+
+      if(same_layout == 0) plan.run(in_buffer, out_buffer, n_read);
+
+      // The records are still decoded (from memory) to keep the
+      // statistical information of the destiny header up to date
+      count_records(h_out, p_out, &counters, out_buffer, n_read);
+
+      if( fwrite(out_buffer, out_length, n_read, p_out->p_file) != n_read)
+      {
+         fprintf(stderr, "\n ERROR: iaea_copy_records: Failed to write records\n");
+         *n_copied = -4;
+         break;
+      }
+
+      *n_copied += n_read;
+      if( (IAEA_I64)n_read < n_block ) break; // end of the source file
+   }
+   h_out->add_statistics(&counters);
+
+   free(in_buffer); if(same_layout == 0) free(out_buffer);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                        const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{ iaea_copy_records(source_ID, destiny_ID, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{ iaea_copy_records(source_ID, destiny_ID, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                       const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{ iaea_copy_records(source_ID, destiny_ID, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                        const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{ iaea_copy_records(source_ID, destiny_ID, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         const IAEA_I64 *n_records, IAEA_I64 *n_copied)
+{ iaea_copy_records(source_ID, destiny_ID, n_records, n_copied); }
+
+/***************************************************************************
+* Get the length in bytes of one record of the source_id
+*
+* record_length is set to negative if phsp source does not exist.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_record_length(const IAEA_I32 *id, IAEA_I32 *record_length)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*record_length = -1; return;}
+
+   *record_length = p_iaea_header[*id]->record_length;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_record_length_(const IAEA_I32 *id, IAEA_I32 *record_length)
+{ iaea_get_record_length(id, record_length); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_record_length__(const IAEA_I32 *id, IAEA_I32 *record_length)
+{ iaea_get_record_length(id, record_length); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_RECORD_LENGTH(const IAEA_I32 *id, IAEA_I32 *record_length)
+{ iaea_get_record_length(id, record_length); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_RECORD_LENGTH_(const IAEA_I32 *id, IAEA_I32 *record_length)
+{ iaea_get_record_length(id, record_length); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_RECORD_LENGTH__(const IAEA_I32 *id, IAEA_I32 *record_length)
+{ iaea_get_record_length(id, record_length); }
+
+// Guards the counters of a destiny written by several threads at once
+static std::mutex iaea_counters_mutex;
+
+// Positioned reads and writes let several threads share one phsp file
+static IAEA_I64 tell_phsp(FILE *p_file)
+{
+#if (defined WIN32) || (defined WIN64)
+   return (IAEA_I64)_ftelli64(p_file);
+#else
+   return (IAEA_I64)ftello(p_file);
+#endif
+}
+
+static int seek_phsp(FILE *p_file, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   return _fseeki64(p_file, offset, SEEK_SET);
+#else
+   return fseeko(p_file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static IAEA_I64 read_phsp_at(FILE *p_file, char *buffer, IAEA_I64 n_bytes,
+                             IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+   if( seek_phsp(p_file, offset) != 0 ) return -1;
+   return (IAEA_I64)fread(buffer, 1, (size_t)n_bytes, p_file);
+#else
+   IAEA_I64 done = 0;
+   while(done < n_bytes)
+   {
+      ssize_t n = pread(fileno(p_file), buffer + done, (size_t)(n_bytes - done),
+                        (off_t)(offset + done));
+      if(n < 0) return -1;
+      if(n == 0) break; // end of file
+      done += n;
+   }
+   return done;
+#endif
+}
+
+static IAEA_I64 write_phsp_at(FILE *p_file, const char *buffer, IAEA_I64 n_bytes,
+                              IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+   if( seek_phsp(p_file, offset) != 0 ) return -1;
+   return (IAEA_I64)fwrite(buffer, 1, (size_t)n_bytes, p_file);
+#else
+   IAEA_I64 done = 0;
+   while(done < n_bytes)
+   {
+      ssize_t n = pwrite(fileno(p_file), buffer + done, (size_t)(n_bytes - done),
+                         (off_t)(offset + done));
+      if(n <= 0) return -1;
+      done += n;
+   }
+   return done;
+#endif
+}
+
+// As read_phsp_at, from the phsp file of a source opened for reading,
+// from the members of a virtual phsp or from the frames of a compressed one
+static IAEA_I64 read_source_at(iaea_record_type *p, char *buffer, IAEA_I64 n_bytes,
+                               IAEA_I64 offset)
+{
+   if(p->p_virtual != NULL) return p->p_virtual->read_at(p, buffer, n_bytes, offset);
+   if(p->p_compressed != NULL) return p->p_compressed->read_at(buffer, n_bytes, offset);
+   return read_phsp_at(p->p_file, buffer, n_bytes, offset);
+}
+
+// The file the indexes of a source opened for reading are built for: its
+// phsp file, the container of a compressed phsp, or the header of a
+// virtual phsp
+static FILE *indexed_file(const iaea_header_type *h, const iaea_record_type *p)
+{
+   if(p->p_virtual != NULL) return(h->fheader);
+   if(p->p_compressed != NULL) return(p->p_compressed->file);
+   return(p->p_file);
+}
+
+// The index (or map) of source id read from its file with extension next
+// to the phsp, looked for once: NULL unless that file was written for the
+// phsp as it is. A T has initialize(), release() and a file id.
+template <class T>
+static T *lookup_sidecar(IAEA_I32 id, T **sidecar, int *looked_up, const char *extension,
+                         short (*load)(const char *sidecar_file, T *index))
+{
+   iaea_read_source *s = p_iaea_read_source[id];
+   if(*sidecar != NULL || *looked_up) return(*sidecar);
+   *looked_up = 1;
+
+   const iaea_header_type *h = p_iaea_header[id];
+   iaea_phsp_file_id current;
+   char sidecar_file[MAX_STR_LEN];
+   T *index = (T *) malloc(sizeof(T));
+   if(index == NULL) return(NULL);
+   index->initialize();
+   if(current.identify(indexed_file(h, p_iaea_record[id]), h->record_length) == OK &&
+      iaea_sidecar_name(s->file_name, extension, sidecar_file) == OK &&
+      load(sidecar_file, index) == OK && index->file.same_file(&current))
+      *sidecar = index;
+   else
+   {
+      index->release();
+      free(index);
+   }
+   return(*sidecar);
+}
+
+// The histories a stored record starts, as get_n_stat finds them: the
+// incremental number of histories if one is stored, else 1 for a negative
+// energy (0 if the record does not start a history)
+static IAEA_I64 record_n_stat(const iaea_header_type *h, const iaea_record_type *p,
+                              const char *record, IAEA_I32 record_length)
+{
+   for(int j=0;j<p->iextralong;j++)
+   {
+      if(h->extralong_contents[j] != 1) continue;
+      IAEA_I32 n_stat;
+      memcpy(&n_stat, record + record_length - (p->iextralong - j)*sizeof(IAEA_I32),
+             sizeof(IAEA_I32));
+      return((n_stat > 0) ? n_stat : 0);
+   }
+   float energy;
+   memcpy(&energy, record + sizeof(char), sizeof(float));
+   return((energy < 0) ? 1 : 0);
+}
+
+static bool starts_history(const iaea_header_type *h, const iaea_record_type *p,
+                           const char *record, IAEA_I32 record_length)
+{
+   return(record_n_stat(h, p, record, record_length) > 0);
+}
+
+// Indexes every record of source id that starts a history, reading the
+// source with positioned reads. FAIL if it cannot be read.
+static short build_history_index(IAEA_I32 id, iaea_history_index *index)
+{
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   IAEA_I32 record_length = h->record_length;
+   index->initialize();
+   FILE *file = indexed_file(h, p);
+   if(record_length <= 0 || index->file.identify(file, record_length) != OK) return(FAIL);
+
+   IAEA_I64 records_per_block = COPY_BLOCK_SIZE/record_length;
+   if(records_per_block < 1) records_per_block = 1;
+   char *buffer = (char *) malloc((size_t)(records_per_block*record_length));
+   if(buffer == NULL) return(FAIL);
+
+   short rvalue = OK;
+   for(;;)
+   {
+      IAEA_I64 n_bytes = read_source_at(p, buffer, records_per_block*record_length,
+                                        index->n_records*record_length);
+      if(n_bytes < 0) {rvalue = FAIL; break;}
+      IAEA_I64 n = n_bytes/record_length;
+      for(IAEA_I64 i = 0; i < n && rvalue == OK; i++)
+      {
+         IAEA_I64 n_stat = record_n_stat(h, p, buffer + i*record_length, record_length);
+         if(n_stat > 0) rvalue = index->add_start(index->n_records + i, n_stat);
+      }
+      index->n_records += n;
+      if(rvalue != OK || n < records_per_block) break;
+   }
+   free(buffer);
+   if(rvalue != OK) index->release();
+   return(rvalue);
+}
+
+// The history index of source id (opened for reading): the one read from
+// its index file if that was written for the phsp as it is, else, if build
+// is set, one built now and kept with the source. NULL if there is none.
+static iaea_history_index *source_history_index(IAEA_I32 id, bool build)
+{
+   iaea_read_source *s = p_iaea_read_source[id];
+   if(s == NULL) return(NULL);
+   lookup_sidecar(id, &s->history, &s->history_looked_up, HISTORY_INDEX_EXTENSION,
+                  iaea_load_history_index);
+
+   if(s->history == NULL && build)
+   {
+      iaea_history_index *index = (iaea_history_index *) malloc(sizeof(iaea_history_index));
+      if(index != NULL && build_history_index(id, index) == OK) s->history = index;
+      else free(index);
+   }
+   return(s->history);
+}
+
+// Start of history (1 to n_histories of index) in the index, n_starts for
+// a later history, -1 if the source cannot be read. Starts between two
+// checkpoints add one history each unless the checkpoints differ by more,
+// and then the n_stat of those starts is read.
+static IAEA_I64 history_start(IAEA_I32 id, const iaea_history_index *index, IAEA_I64 history)
+{
+   if(history > index->n_histories) return(index->n_starts);
+   if(history < 1) return(0);
+
+   IAEA_I64 before, after;
+   IAEA_I64 k = index->find_checkpoint(history, &before, &after);
+   IAEA_I64 first = k*HISTORY_INDEX_STRIDE;
+   IAEA_I64 last = min(first + HISTORY_INDEX_STRIDE, index->n_starts);
+   if(after - before == last - first) return(first + history - before - 1);
+
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   IAEA_I32 record_length = h->record_length;
+   char *record = (char *) malloc((size_t) record_length);
+   IAEA_I64 found = -1;
+   for(IAEA_I64 s = first; record != NULL && s < last; s++)
+   {
+      if(read_source_at(p, record, record_length, index->starts[s]*record_length) !=
+         record_length) break;
+      before += record_n_stat(h, p, record, record_length);
+      if(before >= history) {found = s; break;}
+   }
+   free(record);
+   return(found);
+}
+
+// The record nearest to nominal (the earlier one on ties) that starts a
+// history, looked for at most max_distance records away, in index if
+// there is one. Otherwise windows around nominal are read with positioned
+// reads, so the position of the source is kept. If no history starts near
+// nominal, the next record that starts one is taken however far it is
+// (n_records if none is left), so that no history is split; 0 and
+// n_records are boundaries already. Returns -1 if the records cannot be
+// read.
+static IAEA_I64 history_boundary(const iaea_header_type *h, iaea_record_type *p,
+                                 const iaea_history_index *index,
+                                 IAEA_I64 nominal, IAEA_I64 n_records,
+                                 IAEA_I64 max_distance)
+{
+   if(nominal <= 0 || nominal >= n_records) return(nominal);
+   if(max_distance < 0) max_distance = 0;
+
+   if(index != NULL)
+   {
+      IAEA_I64 s = index->find_start(nominal);
+      IAEA_I64 later = (s < index->n_starts) ? index->starts[s] - nominal : max_distance + 1;
+      IAEA_I64 earlier = (s > 0) ? nominal - index->starts[s-1] : max_distance + 1;
+      if(earlier <= later && earlier <= max_distance) return(nominal - earlier);
+      if(later <= max_distance) return(nominal + later);
+      return((s < index->n_starts) ? index->starts[s] : n_records);
+   }
+
+   IAEA_I32 record_length = h->record_length;
+   IAEA_I64 window = 1024;
+   IAEA_I64 next = nominal; // first record after nominal not looked at
+   char *buffer = NULL;
+   for(;;)
+   {
+      if(window > max_distance) window = max_distance;
+      IAEA_I64 first = nominal - window;
+      if(first < 0) first = 0;
+      IAEA_I64 last = nominal + window + 1; // one past the window
+      if(last > n_records) last = n_records;
+
+      char *grown = (char *) realloc(buffer, (size_t)((last - first)*record_length));
+      if(grown == NULL) {free(buffer); return(-1);}
+      buffer = grown;
+      IAEA_I64 n_bytes = read_source_at(p, buffer, (last - first)*record_length,
+                                        first*record_length);
+      if(n_bytes < 0) {free(buffer); return(-1);}
+      last = first + n_bytes/record_length;
+      if(last > next) next = last;
+
+      // Outwards from nominal, earlier records first
+      for(IAEA_I64 d = 0; d <= window; d++)
+      {
+         IAEA_I64 i = nominal - d;
+         if(i >= first && i < last &&
+            starts_history(h, p, buffer + (i - first)*record_length, record_length))
+            {free(buffer); return(i);}
+         i = nominal + d;
+         if(d > 0 && i < last &&
+            starts_history(h, p, buffer + (i - first)*record_length, record_length))
+            {free(buffer); return(i);}
+      }
+      if(window >= max_distance || (first == 0 && last >= n_records)) break;
+      window *= 2;
+   }
+
+   // None near nominal: on to the next history, block by block
+   IAEA_I64 records_per_block = max((IAEA_I64)(COPY_BLOCK_SIZE/record_length), (IAEA_I64) 1);
+   char *grown = (char *) realloc(buffer, (size_t)(records_per_block*record_length));
+   if(grown == NULL) {free(buffer); return(-1);}
+   buffer = grown;
+   while(next < n_records)
+   {
+      IAEA_I64 n = min(records_per_block, n_records - next);
+      IAEA_I64 n_bytes = read_source_at(p, buffer, n*record_length, next*record_length);
+      if(n_bytes < 0) {free(buffer); return(-1);}
+      n = n_bytes/record_length;
+      if(n == 0) break;
+      for(IAEA_I64 i = 0; i < n; i++)
+         if(starts_history(h, p, buffer + i*record_length, record_length))
+            {free(buffer); return(next + i);}
+      next += n;
+   }
+   free(buffer);
+   return(n_records);
+}
+
+// First record and number of records of chunk i_chunk (1 to n_chunk) of a
+// source read in n_chunk chunks. The nominal boundaries split the records
+// evenly, the last chunk taking the remainder; each is moved to the nearest
+// record that starts a history within half a chunk, or else to the next
+// one however far, so that no history is split between chunks (a chunk
+// may then be empty). The records are those the header announces
+// (nParticles counts the particles read as well). An index file of the
+// source, if there is one, replaces the reads around the boundaries.
+// Returns FAIL if the records cannot be read.
+static short parallel_chunk(IAEA_I32 id, IAEA_I32 i_chunk, IAEA_I32 n_chunk,
+                            IAEA_I64 *first_record, IAEA_I64 *n_records)
+{
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   const iaea_history_index *index = source_history_index(id, false);
+   IAEA_I64 nrecords = (h->checksum > 0) ? h->checksum/h->record_length : h->nParticles;
+   IAEA_I64 number_record_per_chunk = nrecords/n_chunk;
+
+   IAEA_I64 begin = (i_chunk - 1)*number_record_per_chunk;
+   IAEA_I64 end = (i_chunk < n_chunk) ? i_chunk*number_record_per_chunk : nrecords;
+   begin = history_boundary(h, p, index, begin, nrecords, number_record_per_chunk/2);
+   end = history_boundary(h, p, index, end, nrecords, number_record_per_chunk/2);
+   if(begin < 0 || end < 0) return(FAIL);
+   if(end < begin) end = begin;
+   *first_record = begin;
+   *n_records = end - begin;
+   return(OK);
+}
+
+// Zones of the blocks of source id, counted as iaea_copy_records counts
+// the records it copies. The source is read with positioned reads.
+static short build_zone_map(IAEA_I32 id, iaea_zone_map *map)
+{
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   IAEA_I32 record_length = h->record_length;
+   map->initialize();
+   FILE *file = indexed_file(h, p);
+   if(record_length <= 0 || map->file.identify(file, record_length) != OK) return(FAIL);
+
+   char *buffer = (char *) malloc((size_t)(map->block_records*record_length));
+   if(buffer == NULL) return(FAIL);
+
+   // Decoded in a copy, so that the record of the source is left as it is
+   iaea_record_type p_zone = *p;
+   short rvalue = OK;
+   for(;;)
+   {
+      IAEA_I64 n_bytes = read_source_at(p, buffer, map->block_records*record_length,
+                                        map->n_records*record_length);
+      if(n_bytes < 0) {rvalue = FAIL; break;}
+      IAEA_I64 n = n_bytes/record_length;
+      if(n == 0) break;
+
+      iaea_zone zone;
+      zone.counters.initialize();
+      count_records(h, &p_zone, &zone.counters, buffer, n);
+      zone.types = 0;
+      for(int i=0;i<MAX_NUM_PARTICLES;i++)
+         if(zone.counters.particle_number[i] > 0) zone.types |= 1 << i;
+      if(map->add_zone(&zone) != OK) {rvalue = FAIL; break;}
+      if(n < map->block_records) break;
+   }
+   free(buffer);
+   if(rvalue != OK) map->release();
+   return(rvalue);
+}
+
+// The zone map of source id (opened for reading) read from its zone map
+// file, if that was written for the phsp as it is; NULL otherwise
+static iaea_zone_map *source_zone_map(IAEA_I32 id)
+{
+   iaea_read_source *s = p_iaea_read_source[id];
+   if(s == NULL) return(NULL);
+   return(lookup_sidecar(id, &s->zones, &s->zones_looked_up, ZONE_MAP_EXTENSION,
+                         iaea_load_zone_map));
+}
+
+// Grid index of source id over the x and y ranges of its header, with n_x
+// by n_y cells (a single column or row if x or y is not stored); the
+// record numbers of the cells are set in *records. The source is read with
+// positioned reads, and the cell of every record is kept until the cells
+// are filled.
+static short build_grid_index(IAEA_I32 id, IAEA_I32 n_x, IAEA_I32 n_y,
+                              iaea_grid_index *index, IAEA_I64 **records)
+{
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   IAEA_I32 record_length = h->record_length;
+   index->initialize();
+   *records = NULL;
+   FILE *file = indexed_file(h, p);
+   if(record_length <= 0 || index->file.identify(file, record_length) != OK) return(FAIL);
+
+   index->n_x = (p->ix > 0) ? n_x : 1;
+   index->n_y = (p->iy > 0) ? n_y : 1;
+   if(h->minimumX <= h->maximumX) {index->minimum_x = h->minimumX; index->maximum_x = h->maximumX;}
+   if(h->minimumY <= h->maximumY) {index->minimum_y = h->minimumY; index->maximum_y = h->maximumY;}
+   IAEA_I64 n_cells = (IAEA_I64) index->n_x*index->n_y;
+
+   char *buffer = (char *) malloc((size_t)(DECODE_BLOCK_RECORDS*record_length));
+   index->cell_start = (IAEA_I64 *) calloc((size_t)(n_cells + 1), sizeof(IAEA_I64));
+   iaea_decoded_block block;
+   bool ok = block.allocate(DECODE_BLOCK_RECORDS) == OK &&
+             buffer != NULL && index->cell_start != NULL;
+
+   // Decoded in a copy, so that the record of the source is left as it is
+   iaea_record_type p_grid = *p;
+   IAEA_I32 *cells = NULL;
+   IAEA_I64 cells_size = 0;
+   while(ok)
+   {
+      IAEA_I64 n_bytes = read_source_at(p, buffer, DECODE_BLOCK_RECORDS*record_length,
+                                        index->n_records*record_length);
+      if(n_bytes < 0) {ok = false; break;}
+      IAEA_I64 n = n_bytes/record_length;
+      if(n == 0) break;
+
+      if(index->n_records + n > cells_size)
+      {
+         IAEA_I64 new_size = max(2*cells_size, (IAEA_I64)(1 << 20));
+         IAEA_I32 *grown = (IAEA_I32 *) realloc(cells, (size_t) new_size*sizeof(IAEA_I32));
+         if(grown == NULL) {ok = false; break;}
+         cells = grown; cells_size = new_size;
+      }
+      iaea_decode_records(&p_grid, buffer, n, &block);
+      for(IAEA_I64 i=0;i<n;i++)
+      {
+         IAEA_I32 c = index->column(block.x[i]) + index->n_x*index->row(block.y[i]);
+         cells[index->n_records + i] = c;
+         index->cell_start[c+1]++;
+      }
+      index->n_records += n;
+      if(n < DECODE_BLOCK_RECORDS) break;
+   }
+   block.release();
+   free(buffer);
+
+   // Cells one after the other, every one in increasing record order
+   if(ok)
+   {
+      for(IAEA_I64 c=0;c<n_cells;c++) index->cell_start[c+1] += index->cell_start[c];
+      *records = (IAEA_I64 *) malloc((size_t)(index->n_records + 1)*sizeof(IAEA_I64));
+      IAEA_I64 *next = (IAEA_I64 *) malloc((size_t) n_cells*sizeof(IAEA_I64));
+      ok = *records != NULL && next != NULL;
+      if(ok)
+      {
+         memcpy(next, index->cell_start, (size_t) n_cells*sizeof(IAEA_I64));
+         for(IAEA_I64 r=0;r<index->n_records;r++) (*records)[next[cells[r]]++] = r;
+      }
+      free(next);
+   }
+   free(cells);
+   if(!ok)
+   {
+      free(*records);
+      *records = NULL;
+      index->release();
+      return(FAIL);
+   }
+   return(OK);
+}
+
+// The grid index of source id (opened for reading), the cell starts read
+// from its grid index file, if that was written for the phsp as it is;
+// NULL otherwise
+static iaea_grid_index *source_grid_index(IAEA_I32 id)
+{
+   iaea_read_source *s = p_iaea_read_source[id];
+   if(s == NULL) return(NULL);
+   return(lookup_sidecar(id, &s->grid, &s->grid_looked_up, GRID_INDEX_EXTENSION,
+                         iaea_load_grid_index));
+}
+
+// Appends record to the runs of its slot, joining it to the last run if
+// that ends right before it
+static short add_type_record(iaea_record_run **runs, IAEA_I64 *n, IAEA_I64 *size,
+                             IAEA_I64 record)
+{
+   if(*n > 0 && (*runs)[*n-1].first + (*runs)[*n-1].n == record)
+   {
+      (*runs)[*n-1].n++;
+      return(OK);
+   }
+   if(*n == *size)
+   {
+      IAEA_I64 new_size = *size > 0 ? 2*(*size) : 1024;
+      iaea_record_run *grown = (iaea_record_run *) realloc(*runs, (size_t) new_size*sizeof(iaea_record_run));
+      if(grown == NULL) return(FAIL);
+      *runs = grown; *size = new_size;
+   }
+   (*runs)[*n].first = record;
+   (*runs)[*n].n = 1;
+   (*n)++;
+   return(OK);
+}
+
+// Type index of source id; the runs of its slots one after the other are
+// set in *runs. Only the particle type (the first byte) of the records is
+// looked at, and the source is read with positioned reads.
+static short build_type_index(IAEA_I32 id, iaea_type_index *index, iaea_record_run **runs)
+{
+   iaea_header_type *h = p_iaea_header[id];
+   iaea_record_type *p = p_iaea_record[id];
+   IAEA_I32 record_length = h->record_length;
+   index->initialize();
+   *runs = NULL;
+   FILE *file = indexed_file(h, p);
+   if(record_length <= 0 || index->file.identify(file, record_length) != OK) return(FAIL);
+
+   IAEA_I64 records_per_block = max((IAEA_I64)(COPY_BLOCK_SIZE/record_length), (IAEA_I64) 1);
+   char *buffer = (char *) malloc((size_t)(records_per_block*record_length));
+   iaea_record_run *slot_runs[TYPE_INDEX_SLOTS] = {NULL};
+   IAEA_I64 n_runs[TYPE_INDEX_SLOTS] = {0}, runs_size[TYPE_INDEX_SLOTS] = {0};
+   bool ok = buffer != NULL;
+   while(ok)
+   {
+      IAEA_I64 n_bytes = read_source_at(p, buffer, records_per_block*record_length,
+                                        index->n_records*record_length);
+      if(n_bytes < 0) {ok = false; break;}
+      IAEA_I64 n = n_bytes/record_length;
+      if(n == 0) break;
+
+      for(IAEA_I64 i=0; ok && i<n; i++)
+      {
+         // The sign of the type is that of w
+         IAEA_I32 type = (signed char) buffer[i*record_length];
+         int s = iaea_type_index::slot((type < 0) ? -type : type);
+         ok = add_type_record(&slot_runs[s], &n_runs[s], &runs_size[s],
+                              index->n_records + i) == OK;
+      }
+      index->n_records += n;
+      if(n < records_per_block) break;
+   }
+   free(buffer);
+
+   // The slots one after the other
+   if(ok)
+   {
+      for(int s=0;s<TYPE_INDEX_SLOTS;s++)
+         index->slot_start[s+1] = index->slot_start[s] + n_runs[s];
+      *runs = (iaea_record_run *) malloc((size_t)(index->slot_start[TYPE_INDEX_SLOTS] + 1)*
+                                         sizeof(iaea_record_run));
+      ok = *runs != NULL;
+      for(int s=0; ok && s<TYPE_INDEX_SLOTS; s++)
+         if(n_runs[s] > 0)
+            memcpy(*runs + index->slot_start[s], slot_runs[s],
+                   (size_t) n_runs[s]*sizeof(iaea_record_run));
+   }
+   for(int s=0;s<TYPE_INDEX_SLOTS;s++) free(slot_runs[s]);
+   if(!ok)
+   {
+      free(*runs);
+      *runs = NULL;
+      index->initialize();
+      return(FAIL);
+   }
+   return(OK);
+}
+
+// The type index of source id (opened for reading), the run starts read
+// from its type index file, if that was written for the phsp as it is;
+// NULL otherwise
+static iaea_type_index *source_type_index(IAEA_I32 id)
+{
+   iaea_read_source *s = p_iaea_read_source[id];
+   if(s == NULL) return(NULL);
+   return(lookup_sidecar(id, &s->type_index, &s->type_index_looked_up, TYPE_INDEX_EXTENSION,
+                         iaea_load_type_index));
+}
+
+/***************************************************************************
+* Reserve room for n_records records at the beginning of the destiny_id
+*
+* The phsp file is preallocated to n_records records, so that
+* iaea_copy_records_at can fill it from several threads. Particles written
+* afterwards with iaea_write_particle are appended after the reserved room.
+*
+* result is set to negative if phsp source does not exist (-1) or the
+* file cannot be extended (-2).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_reserve_records(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                          IAEA_I32 *result)
+{
+   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+
+   FILE *p_file = p_iaea_record[*destiny_ID]->p_file;
+   IAEA_I64 size = (*n_records) * p_iaea_header[*destiny_ID]->record_length;
+
+   fflush(p_file);
+#if (defined WIN32) || (defined WIN64)
+   if( _chsize_s(fileno(p_file), size) != 0 ) {*result = -2; return;}
+#else
+   // Not every file system supports preallocation, so fall back to
+   // simply growing the file
+   if( posix_fallocate(fileno(p_file), 0, (off_t)size) != 0 &&
+       ftruncate(fileno(p_file), (off_t)size) != 0 ) {*result = -2; return;}
+#endif
+   if( seek_phsp(p_file, size) != 0 ) {*result = -2; return;}
+
+   *result = 1; // Return OK
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_reserve_records_(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                           IAEA_I32 *result)
+{ iaea_reserve_records(destiny_ID, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_reserve_records__(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{ iaea_reserve_records(destiny_ID, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESERVE_RECORDS(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                          IAEA_I32 *result)
+{ iaea_reserve_records(destiny_ID, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESERVE_RECORDS_(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                           IAEA_I32 *result)
+{ iaea_reserve_records(destiny_ID, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RESERVE_RECORDS__(const IAEA_I32 *destiny_ID, const IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{ iaea_reserve_records(destiny_ID, n_records, result); }
+
+// Copies records of source_ID into records first_record onwards of
+// destiny_ID with positioned reads and writes, converting them if the
+// layouts differ; the counters of destiny_ID are updated if count is set
+static void copy_records_range(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               bool count, IAEA_I64 *n_copied)
+{
+   IAEA_I32 same_layout;
+   iaea_compare_record_layout(source_ID, destiny_ID, &same_layout);
+   if(same_layout < 0) {*n_copied = -1; return;}
+
+   iaea_header_type *h_in  = p_iaea_header[*source_ID];
+   iaea_header_type *h_out = p_iaea_header[*destiny_ID];
+
+   iaea_transcode_plan plan;
+   if(same_layout == 0 && plan.build(h_in, h_out) == FAIL) {*n_copied = -2; return;}
+
+   // Private copies of the records, other threads use the shared ones
+   iaea_record_type p_in  = *p_iaea_record[*source_ID];
+   iaea_record_type p_out = *p_iaea_record[*destiny_ID];
+
+   IAEA_I64 in_length  = h_in->record_length;
+   IAEA_I64 out_length = h_out->record_length;
+   IAEA_I64 records_per_block = COPY_BLOCK_SIZE/max(in_length, out_length);
+
+   char *in_buffer  = (char *) malloc(records_per_block*in_length);
+   char *out_buffer = in_buffer;
+   if(same_layout == 0) out_buffer = (char *) malloc(records_per_block*out_length);
+   if(in_buffer == NULL || out_buffer == NULL)
+   {
+      free(in_buffer); if(same_layout == 0) free(out_buffer);
+      *n_copied = -3; return;
+   }
+   iaea_statistics counters;
+   counters.initialize();
+
+   IAEA_I64 in_offset  = p_iaea_record[*source_ID]->tell_file();
+   IAEA_I64 out_offset = (*first_record) * out_length;
+
+   *n_copied = 0;
+   while(*n_copied < *n_records)
+   {
+      IAEA_I64 n_block = min(records_per_block, *n_records - *n_copied);
+      IAEA_I64 n_bytes = read_source_at(&p_in, in_buffer,
+                                        n_block*in_length, in_offset);
+      if(n_bytes < 0) {*n_copied = -4; break;}
+      IAEA_I64 n_read = n_bytes/in_length;
+
+      if(same_layout == 0) plan.run(in_buffer, out_buffer, n_read);
+      if(count) count_records(h_out, &p_out, &counters, out_buffer, n_read);
+
+      if( write_phsp_at(p_out.p_file, out_buffer, n_read*out_length,
+                        out_offset) != n_read*out_length )
+      {
+         fprintf(stderr, "\n ERROR: iaea_copy_records_at: Failed to write records\n");
+         *n_copied = -4;
+         break;
+      }
+
+      in_offset  += n_read*in_length;
+      out_offset += n_read*out_length;
+      *n_copied += n_read;
+      if( n_read < n_block ) break; // end of the source file
+   }
+
+   // Leave the source after the records that were copied
+   p_iaea_record[*source_ID]->seek_file(in_offset);
+
+   if(count && *n_copied >= 0)
+   {
+      std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+      h_out->add_statistics(&counters);
+   }
+
+   free(in_buffer); if(same_layout == 0) free(out_buffer);
+   return;
+}
+
+/***************************************************************************
+* Copy records from the source_id into a given place of the destiny_id
+*
+* Up to n_records records are read from the current position of source_ID
+* and written to destiny_ID starting at record first_record (counted from
+* zero) of the room reserved with iaea_reserve_records. Records are copied
+* raw when both record layouts are the same and converted to the layout of
+* destiny_ID otherwise, as iaea_copy_records does.
+*
+* Several threads may call this function at once, as long as each uses a
+* different source and they write to disjoint ranges of records. The
+* counters of destiny_ID are updated once per call.
+*
+* n_copied is set to the number of records copied, -1 if a source does not
+* exist, -2 if the records cannot be converted, -3 if memory cannot be
+* allocated and -4 if reading or writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_at(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                          const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                          IAEA_I64 *n_copied)
+{
+   copy_records_range(source_ID, destiny_ID, first_record, n_records, true, n_copied);
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_at_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                           const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                           IAEA_I64 *n_copied)
+{ iaea_copy_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_at__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                            const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                            IAEA_I64 *n_copied)
+{ iaea_copy_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_AT(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                          const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                          IAEA_I64 *n_copied)
+{ iaea_copy_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_AT_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                           const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                           IAEA_I64 *n_copied)
+{ iaea_copy_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_AT__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                            const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                            IAEA_I64 *n_copied)
+{ iaea_copy_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+
+/***************************************************************************
+* Copy raw records from the source_id into a given place of the destiny_id
+* without passing them through user space
+*
+* Works as iaea_copy_records_at for sources with the same record layout,
+* but the bytes are moved by the kernel with copy_file_range (a server side
+* or reflink copy on file systems that support it). Where copy_file_range
+* is not available the records are copied with pread and pwrite; sendfile
+* and splice are not used because they write at the file offset of the
+* destiny, which several threads would share.
+*
+* The counters of destiny_ID are NOT updated (use iaea_recount_records).
+*
+* n_copied is set to the number of records copied, -1 if a source does not
+* exist, -2 if the record layouts differ, -3 if memory cannot be allocated
+* and -4 if reading or writing fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_splice_records(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                         IAEA_I64 *n_copied)
+{
+   IAEA_I32 same_layout;
+   iaea_compare_record_layout(source_ID, destiny_ID, &same_layout);
+   if(same_layout < 0) {*n_copied = -1; return;}
+   if(same_layout == 0) {*n_copied = -2; return;}
+
+   FILE *p_in  = p_iaea_record[*source_ID]->p_file;
+   FILE *p_out = p_iaea_record[*destiny_ID]->p_file;
+   IAEA_I64 record_length = p_iaea_header[*destiny_ID]->record_length;
+
+   IAEA_I64 in_offset  = p_iaea_record[*source_ID]->tell_file();
+   IAEA_I64 out_offset = (*first_record) * record_length;
+   IAEA_I64 n_bytes = (*n_records) * record_length;
+   IAEA_I64 done = 0;
+
+#if !(defined WIN32) && !(defined WIN64) && (defined __linux__)
+   // The members of a virtual phsp, and compressed records, are read below
+   bool in_kernel = (p_iaea_record[*source_ID]->p_file != NULL);
+   while(in_kernel && done < n_bytes)
+   {
+      loff_t off_in  = in_offset + done;
+      loff_t off_out = out_offset + done;
+      ssize_t n = copy_file_range(fileno(p_in), &off_in, fileno(p_out), &off_out,
+                                  (size_t)(n_bytes - done), 0);
+      if(n <= 0) break; // end of file, or no kernel support: finish below
+      done += n;
+   }
+#endif
+
+   if(done < n_bytes)
+   {
+      char *buffer = (char *) malloc(COPY_BLOCK_SIZE);
+      if(buffer == NULL) {*n_copied = -3; return;}
+
+      while(done < n_bytes)
+      {
+         IAEA_I64 n_block = min((IAEA_I64)COPY_BLOCK_SIZE, n_bytes - done);
+         IAEA_I64 n_read = read_source_at(p_iaea_record[*source_ID], buffer, n_block,
+                                          in_offset + done);
+         if(n_read < 0) {free(buffer); *n_copied = -4; return;}
+         if(n_read == 0) break; // end of the source file
+         if( write_phsp_at(p_out, buffer, n_read, out_offset + done) != n_read )
+         {
+            fprintf(stderr, "\n ERROR: iaea_splice_records: Failed to write records\n");
+            free(buffer);
+            *n_copied = -4;
+            return;
+         }
+         done += n_read;
+      }
+      free(buffer);
+   }
+
+   // Only whole records count; leave the source after them
+   *n_copied = done/record_length;
+   p_iaea_record[*source_ID]->seek_file(in_offset + (*n_copied)*record_length);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_splice_records_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                          const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                          IAEA_I64 *n_copied)
+{ iaea_splice_records(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_splice_records__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                           const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                           IAEA_I64 *n_copied)
+{ iaea_splice_records(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLICE_RECORDS(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                         const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                         IAEA_I64 *n_copied)
+{ iaea_splice_records(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLICE_RECORDS_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                          const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                          IAEA_I64 *n_copied)
+{ iaea_splice_records(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SPLICE_RECORDS__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                           const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                           IAEA_I64 *n_copied)
+{ iaea_splice_records(source_ID, destiny_ID, first_record, n_records, n_copied); }
+
+/***************************************************************************
+* Add records already stored in the phsp file of the id to its counters
+*
+* Records first_record to first_record+n_records-1 (counted from zero) are
+* read back and decoded only to update the statistical information of the
+* header, e.g. after iaea_splice_records. Several threads may call this
+* function at once for disjoint ranges.
+*
+* n_counted is set to the number of records counted, -1 if the phsp source
+* does not exist, -3 if memory cannot be allocated and -4 if reading fails.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_recount_records(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                          const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*n_counted = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type p_rec = *p_iaea_record[*id];
+
+   IAEA_I64 record_length = h->record_length;
+   IAEA_I64 records_per_block = COPY_BLOCK_SIZE/record_length;
+
+   char *buffer = (char *) malloc(records_per_block*record_length);
+   if(buffer == NULL) {*n_counted = -3; return;}
+   iaea_statistics counters;
+   counters.initialize();
+
+   fflush(p_rec.p_file);
+   IAEA_I64 offset = (*first_record) * record_length;
+
+   *n_counted = 0;
+   while(*n_counted < *n_records)
+   {
+      IAEA_I64 n_block = min(records_per_block, *n_records - *n_counted);
+      IAEA_I64 n_bytes = read_phsp_at(p_rec.p_file, buffer,
+                                      n_block*record_length, offset);
+      if(n_bytes < 0) {*n_counted = -4; break;}
+      IAEA_I64 n_read = n_bytes/record_length;
+
+      count_records(h, &p_rec, &counters, buffer, n_read);
+
+      offset += n_read*record_length;
+      *n_counted += n_read;
+      if( n_read < n_block ) break; // end of the file
+   }
+
+   if(*n_counted >= 0)
+   {
+      std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+      h->add_statistics(&counters);
+   }
+
+   free(buffer);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_recount_records_(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                           const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{ iaea_recount_records(id, first_record, n_records, n_counted); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_recount_records__(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                            const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{ iaea_recount_records(id, first_record, n_records, n_counted); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RECOUNT_RECORDS(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                          const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{ iaea_recount_records(id, first_record, n_records, n_counted); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RECOUNT_RECORDS_(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                           const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{ iaea_recount_records(id, first_record, n_records, n_counted); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_RECOUNT_RECORDS__(const IAEA_I32 *id, const IAEA_I64 *first_record,
+                            const IAEA_I64 *n_records, IAEA_I64 *n_counted)
+{ iaea_recount_records(id, first_record, n_records, n_counted); }
+
+/***************************************************************************
+* Add the statistics of the source_id header to the counters of destiny_id
+*
+* The statistical information read from the header of source_ID (particle
+* numbers, weights, energies and the bounding box) is reduced into the
+* counters of destiny_ID, as if every particle of source_ID had been
+* written to it. This avoids decoding the records when they are copied
+* with iaea_splice_records. Note that the header values are stored with
+* about six significant digits.
+*
+* result is set to negative if a source does not exist (-1) or if the
+* header of source_ID does not provide statistical information (-2).
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_header_statistics(const IAEA_I32 *source_ID,
+                                  const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{
+   if(p_iaea_header[*source_ID]->fheader == NULL ||
+      p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+
+   std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+   if( p_iaea_header[*destiny_ID]->merge_statistics(p_iaea_header[*source_ID])
+       == FAIL ) {*result = -2; return;}
+
+   *result = 1; // Return OK
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_header_statistics_(const IAEA_I32 *source_ID,
+                                   const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_header_statistics(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_merge_header_statistics__(const IAEA_I32 *source_ID,
+                                    const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_header_statistics(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_HEADER_STATISTICS(const IAEA_I32 *source_ID,
+                                  const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_header_statistics(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_HEADER_STATISTICS_(const IAEA_I32 *source_ID,
+                                   const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_header_statistics(source_ID, destiny_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_MERGE_HEADER_STATISTICS__(const IAEA_I32 *source_ID,
+                                    const IAEA_I32 *destiny_ID, IAEA_I32 *result)
+{ iaea_merge_header_statistics(source_ID, destiny_ID, result); }
+
+/***************************************************************************
+* Convert records from the source_id into a given place of the destiny_id
+* without updating the counters
+*
+* As iaea_copy_records_at, but the counters of destiny_ID are NOT updated,
+* e.g. because they are taken from the header of source_ID with
+* iaea_merge_header_statistics. Same return codes as iaea_copy_records_at.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_transcode_records_at(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               IAEA_I64 *n_copied)
+{
+   copy_records_range(source_ID, destiny_ID, first_record, n_records, false, n_copied);
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_transcode_records_at_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                                const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                                IAEA_I64 *n_copied)
+{ iaea_transcode_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_transcode_records_at__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                                 const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                                 IAEA_I64 *n_copied)
+{ iaea_transcode_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_TRANSCODE_RECORDS_AT(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               IAEA_I64 *n_copied)
+{ iaea_transcode_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_TRANSCODE_RECORDS_AT_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                                const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                                IAEA_I64 *n_copied)
+{ iaea_transcode_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_TRANSCODE_RECORDS_AT__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                                 const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                                 IAEA_I64 *n_copied)
+{ iaea_transcode_records_at(source_ID, destiny_ID, first_record, n_records, n_copied); }
+
+// One block of records travelling through the stages of
+// iaea_copy_records_pipelined
+struct iaea_pipeline_block
+{
+   IAEA_I64 sequence;   // place of the block in the output
+   int source;          // index in the list of sources
+   IAEA_I64 n_records;  // records read, -1 if reading failed
+   char *in;            // records as read
+   char *out;           // records in the destiny layout (in if same layout)
+   int in_index;        // indices of in and out among the registered buffers
+   int out_index;
+   IAEA_I64 n_bytes;    // size and file offset of the read or write in flight
+   IAEA_I64 offset;
+};
+
+// Large buffers are page aligned, which suits direct and kernel i/o
+static char *alloc_block_buffer(size_t size)
+{
+#if (defined WIN32) || (defined WIN64)
+   return (char *) _aligned_malloc(size, 4096);
+#else
+   void *p = NULL;
+   if( posix_memalign(&p, 4096, size) != 0 ) return NULL;
+   return (char *) p;
+#endif
+}
+
+static void free_block_buffer(char *p)
+{
+#if (defined WIN32) || (defined WIN64)
+   _aligned_free(p);
+#else
+   free(p);
+#endif
+}
+
+/***************************************************************************
+* Copy records of several sources to the end of the destiny_id in a
+* pipeline of concurrent stages
+*
+* For every source k, up to n_records[k] records are copied from its
+* current position, as iaea_copy_records would do for the sources one
+* after the other, and the output is the same. Reader threads (n_readers)
+* read blocks of COPY_BLOCK_SIZE bytes into aligned buffers, worker
+* threads (n_workers) convert them to the layout of destiny_ID and gather
+* their statistics, and the calling thread writes them in order. The
+* stages are connected by bounded lock-free queues; a reorder buffer puts
+* the blocks back in order before writing, and a fixed pool of buffers
+* bounds the memory used.
+*
+* Where io_uring is available (Linux), each reader and the writer keep
+* many block reads or writes in flight through their own ring, from and
+* to the registered pool buffers. Otherwise one pread (fwrite) is done at
+* a time per thread.
+*
+* n_copied[k] is set to the number of records copied from source k, -1 if
+* the source does not exist, -2 if its records cannot be converted and -4
+* if reading or writing fails. -3 is set for every source if memory cannot
+* be allocated.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_pipelined(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                 const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                 const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                 IAEA_I64 n_copied[])
+{
+   int n = *n_sources, k;
+   iaea_header_type *h_out = p_iaea_header[*destiny_ID];
+   for(k=0;k<n;k++) n_copied[k] = 0;
+   if(h_out->fheader == NULL) {for(k=0;k<n;k++) n_copied[k] = -1; return;}
+
+   IAEA_I64 out_length = h_out->record_length;
+
+   // One conversion plan per source; blocks of a source that cannot be
+   // converted are not scheduled
+   std::vector<iaea_transcode_plan> plans(n);
+   std::vector<char> same_layout(n, 0);
+   std::vector<IAEA_I64> in_offset(n, 0);
+   IAEA_I64 max_length = out_length;
+   for(k=0;k<n;k++)
+   {
+      IAEA_I32 same;
+      iaea_compare_record_layout(&source_ID[k], destiny_ID, &same);
+      if(same < 0) {n_copied[k] = -1; continue;}
+      same_layout[k] = (same == 1);
+      if(!same_layout[k] &&
+         plans[k].build(p_iaea_header[source_ID[k]], h_out) == FAIL) {n_copied[k] = -2; continue;}
+      in_offset[k] = p_iaea_record[source_ID[k]]->tell_file();
+      max_length = max(max_length, (IAEA_I64)p_iaea_header[source_ID[k]]->record_length);
+   }
+   IAEA_I64 records_per_block = COPY_BLOCK_SIZE/max_length;
+
+   // Schedule: blocks in output order
+   struct scheduled_block { int source; IAEA_I64 first, n_records; };
+   std::vector<scheduled_block> schedule;
+   for(k=0;k<n;k++)
+   {
+      if(n_copied[k] < 0) continue;
+      for(IAEA_I64 first=0; first<n_records[k]; first+=records_per_block)
+      {
+         scheduled_block b = {k, first, min(records_per_block, n_records[k] - first)};
+         schedule.push_back(b);
+      }
+   }
+   size_t n_blocks = schedule.size();
+
+   int readers = max(1, (int)*n_readers);
+   int workers = max(1, (int)*n_workers);
+   size_t pool_size = 2*(size_t)(readers + workers) + 2;
+
+   std::vector<iaea_pipeline_block> pool(pool_size);
+   std::vector<iaea_statistics> counters(workers);
+   bool memory_ok = true;
+   size_t i;
+   for(i=0;i<pool_size;i++)
+   {
+      pool[i].in  = alloc_block_buffer(COPY_BLOCK_SIZE);
+      pool[i].out = alloc_block_buffer(COPY_BLOCK_SIZE);
+      pool[i].in_index  = (int)(2*i);
+      pool[i].out_index = (int)(2*i + 1);
+      if(pool[i].in == NULL || pool[i].out == NULL) memory_ok = false;
+   }
+   std::vector<char *> buffers(2*pool_size);
+   for(i=0;i<pool_size;i++) {buffers[2*i] = pool[i].in; buffers[2*i+1] = pool[i].out;}
+   unsigned ring_entries = 1;
+   while(ring_entries < pool_size) ring_entries *= 2;
+   for(int w=0;w<workers;w++) counters[w].initialize();
+
+   if(memory_ok && n_blocks > 0)
+   {
+      iaea_bounded_queue<iaea_pipeline_block *> free_queue(pool_size);
+      iaea_bounded_queue<iaea_pipeline_block *> work_queue(pool_size + workers);
+      iaea_bounded_queue<iaea_pipeline_block *> write_queue(pool_size);
+      for(i=0;i<pool_size;i++) free_queue.push(&pool[i]);
+
+      std::atomic<size_t> next_block(0);
+      std::atomic<int> readers_left(readers);
+
+      // Readers take a free buffer first and then the next block, so the
+      // blocks in flight are always the oldest ones not yet written
+      auto reader = [&]()
+      {
+         // Reads the rest of a block from done bytes on, and passes it on
+         auto finish_read = [&](iaea_pipeline_block *block, IAEA_I64 done)
+         {
+            const scheduled_block &s = schedule[block->sequence];
+            IAEA_I64 in_length = p_iaea_header[source_ID[s.source]]->record_length;
+            if(done >= 0 && done < block->n_bytes)
+            {
+               IAEA_I64 rest = read_source_at(p_iaea_record[source_ID[s.source]],
+                                              block->in + done, block->n_bytes - done,
+                                              block->offset + done);
+               done = (rest < 0) ? -1 : done + rest;
+            }
+            block->n_records = (done < 0) ? -1 : done/in_length;
+            work_queue.push(block);
+         };
+         // Takes the next block into a free buffer; false if none is left
+         bool done = false;
+         auto next_read = [&](iaea_pipeline_block *block)
+         {
+            size_t b = next_block++;
+            if(b >= n_blocks) {free_queue.push(block); done = true; return false;}
+
+            const scheduled_block &s = schedule[b];
+            IAEA_I64 in_length = p_iaea_header[source_ID[s.source]]->record_length;
+            block->sequence = (IAEA_I64)b;
+            block->source   = s.source;
+            block->n_bytes  = s.n_records*in_length;
+            block->offset   = in_offset[s.source] + s.first*in_length;
+            return true;
+         };
+
+         iaea_uring ring;
+         if(ring.initialize(ring_entries) == OK)
+         {
+            ring.register_buffers(&buffers[0], (unsigned)buffers.size(), COPY_BLOCK_SIZE);
+            std::vector<iaea_pipeline_block *> in_flight;
+            while(!done || !in_flight.empty())
+            {
+               // Queue a read for every free buffer; wait for one only if
+               // nothing is in flight
+               while(!done && in_flight.size() < ring_entries)
+               {
+                  iaea_pipeline_block *block;
+                  if(in_flight.empty()) free_queue.pop(block);
+                  else if(!free_queue.try_pop(block)) break;
+                  if(!next_read(block)) break;
+
+                  // Virtual and compressed sources have no file to read from
+                  if(p_iaea_record[source_ID[block->source]]->p_file == NULL)
+                     {finish_read(block, 0); continue;}
+                  ring.queue_read(fileno(p_iaea_record[source_ID[block->source]]->p_file),
+                                  block->in, block->in_index, (unsigned)block->n_bytes,
+                                  block->offset, (IAEA_I64)(block - &pool[0]));
+                  in_flight.push_back(block);
+               }
+               if(in_flight.empty()) continue;
+               if(ring.submit(true) == FAIL)
+               {
+                  // Give up the ring and read what was in flight again
+                  ring.destroy();
+                  for(size_t j=0;j<in_flight.size();j++) finish_read(in_flight[j], 0);
+                  in_flight.clear();
+                  break;
+               }
+
+               IAEA_I64 user_data;
+               IAEA_I32 res;
+               while(ring.get_completion(&user_data, &res))
+               {
+                  iaea_pipeline_block *block = &pool[user_data];
+                  in_flight.erase(std::find(in_flight.begin(), in_flight.end(), block));
+                  finish_read(block, res);
+               }
+            }
+         }
+
+         while(!done)
+         {
+            iaea_pipeline_block *block;
+            free_queue.pop(block);
+            if(next_read(block)) finish_read(block, 0);
+         }
+         // The last reader tells every worker to stop
+         if(--readers_left == 0)
+            for(int w=0;w<workers;w++) work_queue.push((iaea_pipeline_block *) NULL);
+      };
+      auto worker = [&](int w)
+      {
+         iaea_record_type p_out = *p_iaea_record[*destiny_ID];
+         for(;;)
+         {
+            iaea_pipeline_block *block;
+            work_queue.pop(block);
+            if(block == NULL) break;
+
+            char *out = block->in;
+            if(!same_layout[block->source] && block->n_records > 0)
+            {
+               plans[block->source].run(block->in, block->out, block->n_records);
+               out = block->out;
+            }
+            if(block->n_records > 0)
+               count_records(h_out, &p_out, &counters[w], out, block->n_records);
+            if(out != block->in)
+               {std::swap(block->in, block->out); std::swap(block->in_index, block->out_index);}
+            write_queue.push(block);
+         }
+      };
+
+      std::vector<std::thread> threads;
+      for(int r=0;r<readers;r++) threads.push_back(std::thread(reader));
+      for(int w=0;w<workers;w++) threads.push_back(std::thread(worker, w));
+
+      // The writer: blocks arrive in any order and leave in sequence
+      std::vector<iaea_pipeline_block *> reorder(pool_size, (iaea_pipeline_block *) NULL);
+      FILE *p_file = p_iaea_record[*destiny_ID]->p_file;
+      size_t next_write = 0;
+
+      // Writes the rest of a block from done bytes on, and frees it
+      auto finish_write = [&](iaea_pipeline_block *block, IAEA_I64 done)
+      {
+         if(done >= 0 && done < block->n_bytes &&
+            write_phsp_at(p_file, block->in + done, block->n_bytes - done,
+                          block->offset + done) != block->n_bytes - done) done = -1;
+         if(done < 0)
+         {
+            fprintf(stderr,
+               "\n ERROR: iaea_copy_records_pipelined: Failed to write records\n");
+            n_copied[block->source] = -4;
+         }
+         free_queue.push(block);
+      };
+
+      iaea_uring ring;
+      fflush(p_file);
+      IAEA_I64 out_offset = tell_phsp(p_file);
+      if(out_offset >= 0 && ring.initialize(ring_entries) == OK)
+      {
+         ring.register_buffers(&buffers[0], (unsigned)buffers.size(), COPY_BLOCK_SIZE);
+         std::vector<iaea_pipeline_block *> in_flight;
+         while(next_write < n_blocks || !in_flight.empty())
+         {
+            // Buffers are only given back once their write completed
+            IAEA_I64 user_data;
+            IAEA_I32 res;
+            while(ring.get_completion(&user_data, &res))
+            {
+               iaea_pipeline_block *block = &pool[user_data];
+               in_flight.erase(std::find(in_flight.begin(), in_flight.end(), block));
+               finish_write(block, res);
+            }
+
+            iaea_pipeline_block *block;
+            if(next_write >= n_blocks || !write_queue.try_pop(block))
+            {
+               if(!in_flight.empty())
+               {
+                  if(ring.submit(true) == OK) continue;
+                  // Give up the ring and write what was in flight again
+                  ring.destroy();
+                  for(size_t j=0;j<in_flight.size();j++) finish_write(in_flight[j], 0);
+                  in_flight.clear();
+                  break;
+               }
+               if(next_write >= n_blocks) break;
+               write_queue.pop(block);
+            }
+            reorder[block->sequence % pool_size] = block;
+
+            while(next_write < n_blocks && reorder[next_write % pool_size] != NULL)
+            {
+               block = reorder[next_write % pool_size];
+               reorder[next_write % pool_size] = NULL;
+               IAEA_I64 *copied = &n_copied[block->source];
+               next_write++;
+
+               if(block->n_records < 0) *copied = -4;
+               if(*copied < 0 || block->n_records == 0) {free_queue.push(block); continue;}
+
+               block->n_bytes = block->n_records*out_length;
+               block->offset  = out_offset;
+               ring.queue_write(fileno(p_file), block->in, block->in_index,
+                                (unsigned)block->n_bytes, block->offset,
+                                (IAEA_I64)(block - &pool[0]));
+               in_flight.push_back(block);
+               out_offset += block->n_bytes;
+               *copied += block->n_records;
+            }
+            if(!in_flight.empty() && ring.submit(false) == FAIL)
+            {
+               ring.destroy();
+               for(size_t j=0;j<in_flight.size();j++) finish_write(in_flight[j], 0);
+               in_flight.clear();
+               break;
+            }
+         }
+         seek_phsp(p_file, out_offset);
+      }
+
+      while(next_write < n_blocks)
+      {
+         iaea_pipeline_block *block;
+         write_queue.pop(block);
+         reorder[block->sequence % pool_size] = block;
+
+         while(next_write < n_blocks && reorder[next_write % pool_size] != NULL)
+         {
+            block = reorder[next_write % pool_size];
+            reorder[next_write % pool_size] = NULL;
+            IAEA_I64 *copied = &n_copied[block->source];
+
+            if(block->n_records < 0) *copied = -4;
+            else if(*copied >= 0 && block->n_records > 0)
+            {
+               if( fwrite(block->in, (size_t)out_length, (size_t)block->n_records, p_file)
+                   != (size_t)block->n_records )
+               {
+                  fprintf(stderr,
+                     "\n ERROR: iaea_copy_records_pipelined: Failed to write records\n");
+                  *copied = -4;
+               }
+               else *copied += block->n_records;
+            }
+            free_queue.push(block);
+            next_write++;
+         }
+      }
+
+      for(i=0;i<threads.size();i++) threads[i].join();
+
+      // Leave every source after the records that were copied
+      for(k=0;k<n;k++)
+      {
+         if(n_copied[k] < 0) continue;
+         p_iaea_record[source_ID[k]]->seek_file(
+            in_offset[k] + n_copied[k]*p_iaea_header[source_ID[k]]->record_length);
+      }
+
+      std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+      for(int w=0;w<workers;w++) h_out->add_statistics(&counters[w]);
+   }
+   else if(!memory_ok) for(k=0;k<n;k++) n_copied[k] = -3;
+
+   for(i=0;i<pool_size;i++) {free_block_buffer(pool[i].in); free_block_buffer(pool[i].out);}
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_pipelined_(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                  const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                  const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                  IAEA_I64 n_copied[])
+{ iaea_copy_records_pipelined(source_ID, n_sources, destiny_ID, n_records,
+                              n_readers, n_workers, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_copy_records_pipelined__(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                   const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                   const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                   IAEA_I64 n_copied[])
+{ iaea_copy_records_pipelined(source_ID, n_sources, destiny_ID, n_records,
+                              n_readers, n_workers, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_PIPELINED(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                 const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                 const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                 IAEA_I64 n_copied[])
+{ iaea_copy_records_pipelined(source_ID, n_sources, destiny_ID, n_records,
+                              n_readers, n_workers, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_PIPELINED_(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                  const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                  const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                  IAEA_I64 n_copied[])
+{ iaea_copy_records_pipelined(source_ID, n_sources, destiny_ID, n_records,
+                              n_readers, n_workers, n_copied); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COPY_RECORDS_PIPELINED__(const IAEA_I32 source_ID[], const IAEA_I32 *n_sources,
+                                   const IAEA_I32 *destiny_ID, const IAEA_I64 n_records[],
+                                   const IAEA_I32 *n_readers, const IAEA_I32 *n_workers,
+                                   IAEA_I64 n_copied[])
+{ iaea_copy_records_pipelined(source_ID, n_sources, destiny_ID, n_records,
+                              n_readers, n_workers, n_copied); }
+
+/***************************************************************************
+* Add records of the source_id to the virtual phsp destiny_id
+*
+* Records first_record to first_record+n_records-1 (counted from zero) of
+* source_ID, which must be opened for reading, are added to destiny_ID by
+* reference: nothing is copied, and the header of destiny_ID lists the
+* phsp file of source_ID (by its absolute path) with that range in a
+* $VIRTUAL_MEMBERS: block; the members of a virtual source_ID are listed
+* themselves. iaea_new_source then reads destiny_ID as one phsp, opening
+* one member at a time, and iaea_get_particle, iaea_set_record and
+* iaea_set_parallel work across the members. destiny_ID must hold no
+* records of its own: its phsp file stays empty (and may be removed) and
+* no particle may be written to it.
+*
+* If count is set, the records are read once (not copied) to update the
+* counters of destiny_ID, as iaea_recount_records does; otherwise the
+* counters are left as they are, e.g. to be set with
+* iaea_merge_header_statistics. Several threads may add members at once;
+* they are listed in the order they are added.
+*
+* n_added is set to the number of records added (less than n_records if
+* source_ID holds fewer), -1 if a source does not exist, source_ID is not
+* opened for reading or destiny_ID holds records, -2 if the record layouts
+* differ, -3 if memory cannot be allocated, -4 if reading fails, -5 if
+* the file name cannot be listed in a header and -6 if source_ID is a
+* compressed phsp (members are read from their phsp files).
+****************************************************************************/
+
+// The base name of a phsp file (without .IAEAheader or .IAEAphsp) as an
+// absolute path that fits in a header line and cannot be taken for a
+// comment; FAIL otherwise
+static short virtual_member_name(const char *file, char *name)
+{
+   char base[MAX_STR_LEN];
+   size_t len = strlen(file);
+   const char *dot = strrchr(file, '.');
+   if(dot != NULL && (strcmp(dot, ".IAEAheader") == 0 || strcmp(dot, ".IAEAphsp") == 0))
+      len = dot - file;
+   if(len >= MAX_STR_LEN) return(FAIL);
+   memcpy(base, file, len);
+   base[len] = '\0';
+
+#if (defined WIN32) || (defined WIN64)
+   if(_fullpath(name, base, MAX_STR_LEN) == NULL) return(FAIL);
+#else
+   if(base[0] == '/') strcpy(name, base);
+   else
+   {
+      char cwd[MAX_STR_LEN];
+      if(getcwd(cwd, sizeof(cwd)) == NULL) return(FAIL);
+      size_t cwd_len = strlen(cwd);
+      if(cwd_len + 1 + len >= MAX_STR_LEN) return(FAIL);
+      sprintf(name, "%s%s%s", cwd, (cwd_len > 0 && cwd[cwd_len-1] == '/') ? "" : "/", base);
+   }
+#endif
+
+   // Room for the record range and the extension
+   if(strlen(name) + 64 >= MAX_STR_LEN) return(FAIL);
+   if(strstr(name, "//") != NULL || strstr(name, "/*") != NULL || strstr(name, "*/") != NULL)
+      return(FAIL);
+   return(OK);
+}
+
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_add_virtual_member(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                             const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                             const IAEA_I32 *count, IAEA_I64 *n_added)
+{
+   IAEA_I32 same_layout;
+   iaea_compare_record_layout(source_ID, destiny_ID, &same_layout);
+   if(same_layout < 0 || p_iaea_read_source[*source_ID] == NULL ||
+      *first_record < 0 || *n_records < 0) {*n_added = -1; return;}
+   if(same_layout == 0) {*n_added = -2; return;}
+   if(p_iaea_record[*source_ID]->p_compressed != NULL) {*n_added = -6; return;}
+
+   iaea_header_type *h_in  = p_iaea_header[*source_ID];
+   iaea_header_type *h_out = p_iaea_header[*destiny_ID];
+   iaea_record_type *p_in  = p_iaea_record[*source_ID];
+   iaea_virtual_reader *v  = p_in->p_virtual;
+   IAEA_I64 record_length = h_in->record_length;
+   if(p_iaea_record[*destiny_ID]->p_file == NULL ||
+      p_iaea_record[*destiny_ID]->tell_file() > 0) {*n_added = -1; return;}
+
+   // Only records the source really holds
+   IAEA_I64 in_source;
+   if(v != NULL) in_source = v->start[v->n_members];
+   else
+   {
+   #if (defined WIN32) || (defined WIN64)
+     struct _stati64 fileStatus;
+     if(_fstati64(fileno(p_in->p_file),&fileStatus) != 0) {*n_added = -4; return;}
+   #else
+     struct stat fileStatus;
+     if(fstat(fileno(p_in->p_file),&fileStatus) != 0) {*n_added = -4; return;}
+   #endif
+     in_source = (IAEA_I64)fileStatus.st_size/record_length;
+   }
+   IAEA_I64 first = *first_record;
+   IAEA_I64 n = min(*n_records, max(in_source - first, (IAEA_I64)0));
+
+   // The members to list: the source, or the members of a virtual source
+   // that overlap the range
+   std::vector<iaea_virtual_member> added;
+   char name[MAX_STR_LEN];
+   bool names_ok = true;
+   if(v == NULL)
+   {
+      names_ok = virtual_member_name(p_iaea_read_source[*source_ID]->file_name, name) == OK;
+      iaea_virtual_member m = {NULL, first, n};
+      if(names_ok && n > 0) {m.file = strdup(name); added.push_back(m);}
+   }
+   else
+   {
+      for(IAEA_I32 k=0; names_ok && k<v->n_members; k++)
+      {
+         IAEA_I64 lo = max(v->start[k], first), hi = min(v->start[k+1], first + n);
+         if(hi <= lo) continue;
+         char file_name[MAX_STR_LEN];
+         v->member_file(k, file_name);
+         names_ok = virtual_member_name(file_name, name) == OK;
+         iaea_virtual_member m = {NULL, h_in->members[k].first_record + lo - v->start[k], hi - lo};
+         if(names_ok) {m.file = strdup(name); added.push_back(m);}
+      }
+   }
+   bool memory_ok = true;
+   for(size_t i=0;i<added.size();i++) if(added[i].file == NULL) memory_ok = false;
+   if(!names_ok || !memory_ok)
+   {
+      for(size_t i=0;i<added.size();i++) free(added[i].file);
+      *n_added = names_ok ? -3 : -5;
+      return;
+   }
+
+   // The records are read once for the counters, without moving the source
+   iaea_statistics counters;
+   counters.initialize();
+   *n_added = n;
+   if(*count && n > 0)
+   {
+      IAEA_I64 records_per_block = min((IAEA_I64)(COPY_BLOCK_SIZE/record_length), n);
+      char *buffer = (char *) malloc((size_t)(records_per_block*record_length));
+      if(buffer == NULL) *n_added = -3;
+      iaea_record_type p_out = *p_iaea_record[*destiny_ID];
+      for(IAEA_I64 done = 0; buffer != NULL && done < n; )
+      {
+         IAEA_I64 n_block = min(records_per_block, n - done);
+         IAEA_I64 n_bytes = read_source_at(p_in, buffer, n_block*record_length,
+                                           (first + done)*record_length);
+         if(n_bytes != n_block*record_length) {*n_added = -4; break;}
+         count_records(h_out, &p_out, &counters, buffer, n_block);
+         done += n_block;
+      }
+      free(buffer);
+   }
+
+   std::lock_guard<std::mutex> lock(iaea_counters_mutex);
+   for(size_t i=0;i<added.size();i++)
+   {
+      if(*n_added >= 0 &&
+         h_out->add_member(added[i].file, added[i].first_record, added[i].n_records) != OK)
+         *n_added = -3;
+      free(added[i].file);
+   }
+   if(*n_added >= 0 && *count) h_out->add_statistics(&counters);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_add_virtual_member_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                              const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                              const IAEA_I32 *count, IAEA_I64 *n_added)
+{ iaea_add_virtual_member(source_ID, destiny_ID, first_record, n_records, count, n_added); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_add_virtual_member__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               const IAEA_I32 *count, IAEA_I64 *n_added)
+{ iaea_add_virtual_member(source_ID, destiny_ID, first_record, n_records, count, n_added); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_ADD_VIRTUAL_MEMBER(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                             const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                             const IAEA_I32 *count, IAEA_I64 *n_added)
+{ iaea_add_virtual_member(source_ID, destiny_ID, first_record, n_records, count, n_added); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_ADD_VIRTUAL_MEMBER_(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                              const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                              const IAEA_I32 *count, IAEA_I64 *n_added)
+{ iaea_add_virtual_member(source_ID, destiny_ID, first_record, n_records, count, n_added); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_ADD_VIRTUAL_MEMBER__(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID,
+                               const IAEA_I64 *first_record, const IAEA_I64 *n_records,
+                               const IAEA_I32 *count, IAEA_I64 *n_added)
+{ iaea_add_virtual_member(source_ID, destiny_ID, first_record, n_records, count, n_added); }
+
+/***************************************************************************
+* Write the history index of a source
+*
+* Writes the index file (the base name of the source with .IAEAidx) of
+* the source with Id id, opened for reading: the records that start a
+* history (a negative energy, or the incremental number of histories if
+* one is stored) and the number of histories before every 1024th of them.
+* The index is valid as long as the phsp file (the header, for a virtual
+* phsp) keeps its size and modification time. With it, iaea_set_history,
+* iaea_get_history_records and iaea_set_parallel find history boundaries
+* by binary search instead of reading the records.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* and -3 if the index file cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_history_index(const IAEA_I32 *id, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_history_index *index = source_history_index(*id, true);
+   if(index == NULL) {*result = -2; return;}
+
+   char index_file[MAX_STR_LEN];
+   if(iaea_sidecar_name(s->file_name, HISTORY_INDEX_EXTENSION, index_file) != OK ||
+      iaea_save_history_index(index_file, index) != OK)
+   {
+      printf("\n ERROR: Failed to write the history index of %s\n", s->file_name);
+      *result = -3;
+      return;
+   }
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_history_index_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_history_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_history_index__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_history_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_HISTORY_INDEX(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_history_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_HISTORY_INDEX_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_history_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_HISTORY_INDEX__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_history_index(id, result); }
+
+/***************************************************************************
+* Records of histories
+*
+* Sets first_record (counted from 0) and n_records to the records of the
+* n_histories histories from history first_history on (counted from 1, as
+* iaea_get_used_original_particles counts them) of the source with
+* Id id, opened for reading. Histories without particles are part of the
+* next history with particles. Records before the first history, if the
+* phsp does not begin with one, belong to no history.
+*
+* The histories are found in the index file of the source (see
+* iaea_write_history_index); a source without a valid index is read once
+* to build one, kept until the source is destroyed.
+*
+* result is set to 0 if everything went smoothly, -1 if the source does
+* not exist or was not opened for reading, -2 if first_history is not
+* between 1 and the number of histories or n_histories is negative, and
+* -3 if the records cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                              const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                              IAEA_I64 *n_records, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_history_index *index = source_history_index(*id, true);
+   if(index == NULL) {*result = -3; return;}
+   if(*first_history < 1 || *first_history > index->n_histories || *n_histories < 0)
+      {*result = -2; return;}
+
+   IAEA_I64 first = history_start(*id, index, *first_history);
+   IAEA_I64 last = history_start(*id, index, *first_history + *n_histories);
+   if(first < 0 || last < 0) {*result = -3; return;}
+   *first_record = index->start_record(first);
+   *n_records = index->start_record(last) - *first_record;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records_(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                               const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                               IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_history_records(id, first_history, n_histories, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_history_records__(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                                const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                                IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_history_records(id, first_history, n_histories, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                              const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                              IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_history_records(id, first_history, n_histories, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS_(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                               const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                               IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_history_records(id, first_history, n_histories, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_HISTORY_RECORDS__(const IAEA_I32 *id, const IAEA_I64 *first_history,
+                                const IAEA_I64 *n_histories, IAEA_I64 *first_record,
+                                IAEA_I64 *n_records, IAEA_I32 *result)
+{ iaea_get_history_records(id, first_history, n_histories, first_record, n_records, result); }
+
+/***************************************************************************
+* Setting the pointer to a history
+*
+* The next particle read from the source with Id id (opened for reading)
+* is the first of history history_num (counted from 1, as
+* iaea_get_used_original_particles counts them); see
+* iaea_get_history_records. The counters of the source are not changed.
+*
+* result is set to 0 if everything went smoothly, to the error codes of
+* iaea_get_history_records, or to -4 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{
+   IAEA_I64 first_record, n_records, one = 1;
+   iaea_get_history_records(id, history_num, &one, &first_record, &n_records, result);
+   if(*result != 0) return;
+
+   if(p_iaea_record[*id]->seek_file(first_record*p_iaea_header[*id]->record_length) != OK)
+      *result = -4;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history_(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history__(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY_(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY__(const IAEA_I32 *id, const IAEA_I64 *history_num, IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+
+/***************************************************************************
+* Write the zone map of a source
+*
+* Writes the zone map file (the base name of the source with .IAEAzone) of
+* the source with Id id, opened for reading: for every block of 65536
+* records, the counters the header keeps for the whole phsp (particles
+* and histories, per type counts, weights and energy ranges, position
+* ranges) and the particle types present. The map is valid as long as the
+* phsp file (the header, for a virtual phsp) keeps its size and
+* modification time. With it, iaea_next_zone skips the blocks that cannot
+* hold particles passing the filter of iaea_set_zone_filter.
+*
+* result is set to 0 if the map is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* and -3 if the map file cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_zone_map(const IAEA_I32 *id, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   // A valid map read from the file is written as it is
+   iaea_zone_map *map = source_zone_map(*id);
+   if(map == NULL)
+   {
+      map = (iaea_zone_map *) malloc(sizeof(iaea_zone_map));
+      if(map == NULL || build_zone_map(*id, map) != OK) {free(map); *result = -2; return;}
+      s->zones = map;
+   }
+
+   char map_file[MAX_STR_LEN];
+   if(iaea_sidecar_name(s->file_name, ZONE_MAP_EXTENSION, map_file) != OK ||
+      iaea_save_zone_map(map_file, map) != OK)
+   {
+      printf("\n ERROR: Failed to write the zone map of %s\n", s->file_name);
+      *result = -3;
+      return;
+   }
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_zone_map_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_zone_map(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_zone_map__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_zone_map(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_ZONE_MAP(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_zone_map(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_ZONE_MAP_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_zone_map(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_ZONE_MAP__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_zone_map(id, result); }
+
+/***************************************************************************
+* Filter of the zones
+*
+* Sets what iaea_next_zone looks for in the source with Id id (opened for
+* reading): particles of type type (0 for any type) with a kinetic energy
+* between E_min and E_max and a position between x_min and x_max, y_min
+* and y_max and z_min and z_max (ends included). Positions that the
+* records do not store are checked here against their constant value.
+*
+* result is set to 0 if everything went smoothly and to -1 if the source
+* does not exist or was not opened for reading.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_zone_filter(const IAEA_I32 *id, const IAEA_I32 *type,
+                          const IAEA_Float *E_min, const IAEA_Float *E_max,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          const IAEA_Float *z_min, const IAEA_Float *z_max,
+                          IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_zone_filter *f = &s->filter;
+   f->type = *type;
+   f->minimum_energy = *E_min; f->maximum_energy = *E_max;
+   f->minimum_x = *x_min;      f->maximum_x = *x_max;
+   f->minimum_y = *y_min;      f->maximum_y = *y_max;
+   f->minimum_z = *z_min;      f->maximum_z = *z_max;
+   f->empty = f->minimum_energy > f->maximum_energy || f->minimum_x > f->maximum_x ||
+              f->minimum_y > f->maximum_y || f->minimum_z > f->maximum_z;
+
+   // A constant position passes for every block or for none
+   iaea_record_type *p = p_iaea_record[*id];
+   const float *constant = p_iaea_header[*id]->record_constant;
+   double *ranges[3][2] = {{&f->minimum_x, &f->maximum_x}, {&f->minimum_y, &f->maximum_y},
+                           {&f->minimum_z, &f->maximum_z}};
+   int stored[3] = {p->ix, p->iy, p->iz};
+   for(int k=0;k<3;k++)
+   {
+      if(stored[k] > 0) continue;
+      if(constant[k] < *ranges[k][0] || constant[k] > *ranges[k][1]) f->empty = true;
+      *ranges[k][0] = -HUGE_VAL;
+      *ranges[k][1] = HUGE_VAL;
+   }
+   s->filtered = 1;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_zone_filter_(const IAEA_I32 *id, const IAEA_I32 *type,
+                           const IAEA_Float *E_min, const IAEA_Float *E_max,
+                           const IAEA_Float *x_min, const IAEA_Float *x_max,
+                           const IAEA_Float *y_min, const IAEA_Float *y_max,
+                           const IAEA_Float *z_min, const IAEA_Float *z_max,
+                           IAEA_I32 *result)
+{ iaea_set_zone_filter(id, type, E_min, E_max, x_min, x_max, y_min, y_max, z_min, z_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_zone_filter__(const IAEA_I32 *id, const IAEA_I32 *type,
+                            const IAEA_Float *E_min, const IAEA_Float *E_max,
+                            const IAEA_Float *x_min, const IAEA_Float *x_max,
+                            const IAEA_Float *y_min, const IAEA_Float *y_max,
+                            const IAEA_Float *z_min, const IAEA_Float *z_max,
+                            IAEA_I32 *result)
+{ iaea_set_zone_filter(id, type, E_min, E_max, x_min, x_max, y_min, y_max, z_min, z_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_ZONE_FILTER(const IAEA_I32 *id, const IAEA_I32 *type,
+                          const IAEA_Float *E_min, const IAEA_Float *E_max,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          const IAEA_Float *z_min, const IAEA_Float *z_max,
+                          IAEA_I32 *result)
+{ iaea_set_zone_filter(id, type, E_min, E_max, x_min, x_max, y_min, y_max, z_min, z_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_ZONE_FILTER_(const IAEA_I32 *id, const IAEA_I32 *type,
+                           const IAEA_Float *E_min, const IAEA_Float *E_max,
+                           const IAEA_Float *x_min, const IAEA_Float *x_max,
+                           const IAEA_Float *y_min, const IAEA_Float *y_max,
+                           const IAEA_Float *z_min, const IAEA_Float *z_max,
+                           IAEA_I32 *result)
+{ iaea_set_zone_filter(id, type, E_min, E_max, x_min, x_max, y_min, y_max, z_min, z_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_ZONE_FILTER__(const IAEA_I32 *id, const IAEA_I32 *type,
+                            const IAEA_Float *E_min, const IAEA_Float *E_max,
+                            const IAEA_Float *x_min, const IAEA_Float *x_max,
+                            const IAEA_Float *y_min, const IAEA_Float *y_max,
+                            const IAEA_Float *z_min, const IAEA_Float *z_max,
+                            IAEA_I32 *result)
+{ iaea_set_zone_filter(id, type, E_min, E_max, x_min, x_max, y_min, y_max, z_min, z_max, result); }
+
+/***************************************************************************
+* Next zone that may hold particles passing the filter
+*
+* From the current position of the source with Id id (opened for
+* reading) on, looks in its zone map (see iaea_write_zone_map) for the
+* first blocks of records that may hold particles passing the filter of
+* iaea_set_zone_filter, and moves the source to the first of them.
+* first_record (counted from 0) and n_records are set to the records of
+* those blocks, up to the next block that cannot hold such particles. The
+* records must still be checked one by one: a zone only tells that no
+* particle of its block passes. Without a valid zone map (or a filter)
+* all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record is left that may
+* pass the filter, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_zone(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                    IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   IAEA_I64 position = p->tell_file()/h->record_length;
+   const iaea_zone_map *map = s->filtered ? source_zone_map(*id) : NULL;
+
+   IAEA_I64 first, last;
+   if(map == NULL)
+   {
+      first = position;
+      last = (h->checksum > 0) ? h->checksum/h->record_length : h->nParticles;
+   }
+   else
+   {
+      // Candidate blocks next to each other are returned at once
+      IAEA_I64 z = position/map->block_records;
+      while(z < map->n_zones && !map->zones[z].may_hold(&s->filter)) z++;
+      IAEA_I64 end = z;
+      while(end < map->n_zones && map->zones[end].may_hold(&s->filter)) end++;
+      first = max(position, z*map->block_records);
+      last = min(end*map->block_records, map->n_records);
+   }
+   if(first >= last) {*result = -2; return;}
+
+   if(first != position && p->seek_file(first*h->record_length) != OK) {*result = -3; return;}
+   *first_record = first;
+   *n_records = last - first;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_zone_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                     IAEA_I32 *result)
+{ iaea_next_zone(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_zone__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                      IAEA_I32 *result)
+{ iaea_next_zone(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_ZONE(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                    IAEA_I32 *result)
+{ iaea_next_zone(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_ZONE_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                     IAEA_I32 *result)
+{ iaea_next_zone(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_ZONE__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                      IAEA_I32 *result)
+{ iaea_next_zone(id, first_record, n_records, result); }
+
+/***************************************************************************
+* Write the grid index of a source
+*
+* Writes the grid index file (the base name of the source with .IAEAgrid)
+* of the source with Id id, opened for reading: the records bucketed by
+* the cell they fall in of a grid of n_x by n_y cells (1 to 4096 each) over
+* the x and y ranges of the header, the records outside those ranges
+* bucketed in the nearest border cell. A coordinate that is not stored
+* gets a single cell. The record numbers of every cell are stored in
+* increasing order, 8 bytes per record. The index is valid as long as the
+* phsp file (the header, for a virtual phsp) keeps its size and
+* modification time. With it, iaea_set_grid_region and
+* iaea_next_grid_records read only the records of the cells of a region.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* (or the index does not fit in memory), -3 if the index file cannot be
+* written and -4 if n_x or n_y is out of range.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_grid_index(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                           IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+   if(*n_x < 1 || *n_x > GRID_INDEX_MAX_CELLS || *n_y < 1 || *n_y > GRID_INDEX_MAX_CELLS)
+      {*result = -4; return;}
+
+   iaea_grid_index *index = (iaea_grid_index *) malloc(sizeof(iaea_grid_index));
+   IAEA_I64 *records = NULL;
+   if(index == NULL || build_grid_index(*id, *n_x, *n_y, index, &records) != OK)
+      {free(index); *result = -2; return;}
+
+   char grid_file[MAX_STR_LEN];
+   short saved = (iaea_sidecar_name(s->file_name, GRID_INDEX_EXTENSION, grid_file) == OK) ?
+                 iaea_save_grid_index(grid_file, index, records) : FAIL;
+   free(records);
+   if(saved != OK)
+   {
+      printf("\n ERROR: Failed to write the grid index of %s\n", s->file_name);
+      index->release();
+      free(index);
+      *result = -3;
+      return;
+   }
+
+   // Regions set from now on use the new index
+   if(s->grid != NULL) s->grid->release();
+   free(s->grid);
+   s->grid = index;
+   s->grid_looked_up = 1;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_grid_index_(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                            IAEA_I32 *result)
+{ iaea_write_grid_index(id, n_x, n_y, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_grid_index__(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                             IAEA_I32 *result)
+{ iaea_write_grid_index(id, n_x, n_y, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_GRID_INDEX(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                           IAEA_I32 *result)
+{ iaea_write_grid_index(id, n_x, n_y, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_GRID_INDEX_(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                            IAEA_I32 *result)
+{ iaea_write_grid_index(id, n_x, n_y, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_GRID_INDEX__(const IAEA_I32 *id, const IAEA_I32 *n_x, const IAEA_I32 *n_y,
+                             IAEA_I32 *result)
+{ iaea_write_grid_index(id, n_x, n_y, result); }
+
+/***************************************************************************
+* Region of the grid index
+*
+* Sets the region iaea_next_grid_records looks in for the source with Id
+* id (opened for reading): the records of the cells of its grid index (see
+* iaea_write_grid_index) that overlap x_min to x_max and y_min to y_max
+* (ends included). Their record numbers are read from the grid index file
+* here, so the work is proportional to the records of those cells and not
+* to the size of the phsp. Positions that the records do not store are
+* checked here against their constant value. Without a valid grid index,
+* iaea_next_grid_records returns all the records left.
+*
+* result is set to 0 if everything went smoothly, -1 if the source does
+* not exist or was not opened for reading and -2 if the grid index file
+* cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_grid_region(const IAEA_I32 *id,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   free(s->region);
+   s->region = NULL;
+   s->n_region = 0;
+   s->regioned = 1;
+
+   // A constant position is in the region for every record or for none
+   iaea_record_type *p = p_iaea_record[*id];
+   const float *constant = p_iaea_header[*id]->record_constant;
+   bool empty = *x_min > *x_max || *y_min > *y_max ||
+                (p->ix == 0 && (constant[0] < *x_min || constant[0] > *x_max)) ||
+                (p->iy == 0 && (constant[1] < *y_min || constant[1] > *y_max));
+   if(empty) {*result = 0; return;}
+
+   const iaea_grid_index *index = source_grid_index(*id);
+   if(index == NULL) {s->regioned = 2; *result = 0; return;}
+
+   char grid_file[MAX_STR_LEN];
+   if(iaea_sidecar_name(s->file_name, GRID_INDEX_EXTENSION, grid_file) != OK ||
+      iaea_read_grid_records(grid_file, index, index->column(*x_min), index->column(*x_max),
+                             index->row(*y_min), index->row(*y_max),
+                             &s->region, &s->n_region) != OK)
+   {
+      printf("\n ERROR: Failed to read the grid index of %s\n", s->file_name);
+      s->regioned = 0;
+      *result = -2;
+      return;
+   }
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_grid_region_(const IAEA_I32 *id,
+                           const IAEA_Float *x_min, const IAEA_Float *x_max,
+                           const IAEA_Float *y_min, const IAEA_Float *y_max,
+                           IAEA_I32 *result)
+{ iaea_set_grid_region(id, x_min, x_max, y_min, y_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_grid_region__(const IAEA_I32 *id,
+                            const IAEA_Float *x_min, const IAEA_Float *x_max,
+                            const IAEA_Float *y_min, const IAEA_Float *y_max,
+                            IAEA_I32 *result)
+{ iaea_set_grid_region(id, x_min, x_max, y_min, y_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_GRID_REGION(const IAEA_I32 *id,
+                          const IAEA_Float *x_min, const IAEA_Float *x_max,
+                          const IAEA_Float *y_min, const IAEA_Float *y_max,
+                          IAEA_I32 *result)
+{ iaea_set_grid_region(id, x_min, x_max, y_min, y_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_GRID_REGION_(const IAEA_I32 *id,
+                           const IAEA_Float *x_min, const IAEA_Float *x_max,
+                           const IAEA_Float *y_min, const IAEA_Float *y_max,
+                           IAEA_I32 *result)
+{ iaea_set_grid_region(id, x_min, x_max, y_min, y_max, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_GRID_REGION__(const IAEA_I32 *id,
+                            const IAEA_Float *x_min, const IAEA_Float *x_max,
+                            const IAEA_Float *y_min, const IAEA_Float *y_max,
+                            IAEA_I32 *result)
+{ iaea_set_grid_region(id, x_min, x_max, y_min, y_max, result); }
+
+/***************************************************************************
+* Next records of the region of the grid index
+*
+* From the current position of the source with Id id (opened for
+* reading) on, looks for the first record of the region set with
+* iaea_set_grid_region, and moves the source to it. first_record (counted
+* from 0) and n_records are set to the records of the region that follow
+* one another from there. The records must still be checked one by one:
+* the cells on the border of the region hold records outside it. Without
+* a region set, or a valid grid index, all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record of the region is
+* left, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_grid_records(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   IAEA_I64 position = p->tell_file()/h->record_length;
+
+   IAEA_I64 first, last;
+   if(s->regioned != 1)
+   {
+      first = position;
+      last = (h->checksum > 0) ? h->checksum/h->record_length : h->nParticles;
+   }
+   else
+   {
+      // Records of the region next to each other are returned at once
+      IAEA_I64 k = std::lower_bound(s->region, s->region + s->n_region, position) - s->region;
+      if(k == s->n_region) {*result = -2; return;}
+      first = s->region[k];
+      last = first + 1;
+      while(++k < s->n_region && s->region[k] == last) last++;
+   }
+   if(first >= last) {*result = -2; return;}
+
+   if(first != position && p->seek_file(first*h->record_length) != OK) {*result = -3; return;}
+   *first_record = first;
+   *n_records = last - first;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_grid_records_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                             IAEA_I32 *result)
+{ iaea_next_grid_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_grid_records__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I32 *result)
+{ iaea_next_grid_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_GRID_RECORDS(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{ iaea_next_grid_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_GRID_RECORDS_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                             IAEA_I32 *result)
+{ iaea_next_grid_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_GRID_RECORDS__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I32 *result)
+{ iaea_next_grid_records(id, first_record, n_records, result); }
+
+/***************************************************************************
+* Write the type index of a source
+*
+* Writes the type index file (the base name of the source with .IAEAtype)
+* of the source with Id id, opened for reading: for every particle type
+* (1 to MAX_NUM_PARTICLES, and the other types together) the runs of
+* records of that type that follow one another. Only the particle type of
+* the records is read to build it. The index is valid as long as the phsp
+* file (the header, for a virtual phsp) keeps its size and modification
+* time. With it, iaea_select_types and iaea_next_type_records reach the
+* particles of some types without reading the others.
+*
+* result is set to 0 if the index is written, -1 if the source does not
+* exist or was not opened for reading, -2 if its records cannot be read
+* (or the index does not fit in memory) and -3 if the index file cannot be
+* written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_type_index(const IAEA_I32 *id, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_type_index *index = (iaea_type_index *) malloc(sizeof(iaea_type_index));
+   iaea_record_run *runs = NULL;
+   if(index == NULL || build_type_index(*id, index, &runs) != OK)
+      {free(index); *result = -2; return;}
+
+   char type_file[MAX_STR_LEN];
+   short saved = (iaea_sidecar_name(s->file_name, TYPE_INDEX_EXTENSION, type_file) == OK) ?
+                 iaea_save_type_index(type_file, index, runs) : FAIL;
+   free(runs);
+   if(saved != OK)
+   {
+      printf("\n ERROR: Failed to write the type index of %s\n", s->file_name);
+      index->release();
+      free(index);
+      *result = -3;
+      return;
+   }
+
+   // Selections made from now on use the new index
+   if(s->type_index != NULL) s->type_index->release();
+   free(s->type_index);
+   s->type_index = index;
+   s->type_index_looked_up = 1;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_type_index_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_type_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_type_index__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_type_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_TYPE_INDEX(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_type_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_TYPE_INDEX_(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_type_index(id, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_TYPE_INDEX__(const IAEA_I32 *id, IAEA_I32 *result)
+{ iaea_write_type_index(id, result); }
+
+/***************************************************************************
+* Particle types of the type index
+*
+* Sets the particle types iaea_next_type_records looks for in the source
+* with Id id (opened for reading): the n_types types of types, where a
+* type out of 1 to MAX_NUM_PARTICLES stands for all the types without
+* counters. The runs of records of those types are read from the type
+* index file (see iaea_write_type_index) here. With n_types 0, or without
+* a valid type index, iaea_next_type_records returns all the records left.
+*
+* result is set to 0 if everything went smoothly, -1 if the source does
+* not exist or was not opened for reading and -2 if the type index file
+* cannot be read.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_select_types(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                       IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   free(s->selection);
+   s->selection = NULL;
+   s->n_selection = 0;
+   s->selected = 0;
+   if(*n_types <= 0) {*result = 0; return;}
+
+   const iaea_type_index *index = source_type_index(*id);
+   if(index == NULL) {s->selected = 2; *result = 0; return;}
+
+   bool slots[TYPE_INDEX_SLOTS] = {false};
+   for(IAEA_I32 i=0;i<*n_types;i++) slots[iaea_type_index::slot(types[i])] = true;
+
+   char type_file[MAX_STR_LEN];
+   if(iaea_sidecar_name(s->file_name, TYPE_INDEX_EXTENSION, type_file) != OK ||
+      iaea_read_type_runs(type_file, index, slots, &s->selection, &s->n_selection) != OK)
+   {
+      printf("\n ERROR: Failed to read the type index of %s\n", s->file_name);
+      *result = -2;
+      return;
+   }
+   s->selected = 1;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_select_types_(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                        IAEA_I32 *result)
+{ iaea_select_types(id, n_types, types, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_select_types__(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                         IAEA_I32 *result)
+{ iaea_select_types(id, n_types, types, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SELECT_TYPES(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                       IAEA_I32 *result)
+{ iaea_select_types(id, n_types, types, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SELECT_TYPES_(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                        IAEA_I32 *result)
+{ iaea_select_types(id, n_types, types, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SELECT_TYPES__(const IAEA_I32 *id, const IAEA_I32 *n_types, const IAEA_I32 *types,
+                         IAEA_I32 *result)
+{ iaea_select_types(id, n_types, types, result); }
+
+/***************************************************************************
+* Next records of the types selected
+*
+* From the current position of the source with Id id (opened for
+* reading) on, looks for the first record of the types selected with
+* iaea_select_types, and moves the source to it. first_record (counted
+* from 0) and n_records are set to the records of those types that follow
+* one another from there; all of them are of the types selected. Without
+* a selection, or a valid type index, all the records left are returned.
+*
+* result is set to 0 if records are found, -1 if the source does not
+* exist or was not opened for reading, -2 if no record of the types
+* selected is left, and -3 if the source cannot be positioned.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_type_records(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   if(s == NULL || s->suspended || p_iaea_header[*id]->fheader == NULL)
+      {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   IAEA_I64 position = p->tell_file()/h->record_length;
+
+   IAEA_I64 first, last;
+   if(s->selected != 1)
+   {
+      first = position;
+      last = (h->checksum > 0) ? h->checksum/h->record_length : h->nParticles;
+   }
+   else
+   {
+      // The first run that ends after the position
+      IAEA_I64 lo = 0, hi = s->n_selection;
+      while(lo < hi)
+      {
+         IAEA_I64 mid = (lo + hi)/2;
+         if(s->selection[mid].first + s->selection[mid].n <= position) lo = mid + 1;
+         else hi = mid;
+      }
+      if(lo == s->n_selection) {*result = -2; return;}
+      first = max(position, s->selection[lo].first);
+      last = s->selection[lo].first + s->selection[lo].n;
+   }
+   if(first >= last) {*result = -2; return;}
+
+   if(first != position && p->seek_file(first*h->record_length) != OK) {*result = -3; return;}
+   *first_record = first;
+   *n_records = last - first;
+   *result = 0;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_type_records_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                             IAEA_I32 *result)
+{ iaea_next_type_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_next_type_records__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I32 *result)
+{ iaea_next_type_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_TYPE_RECORDS(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                            IAEA_I32 *result)
+{ iaea_next_type_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_TYPE_RECORDS_(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                             IAEA_I32 *result)
+{ iaea_next_type_records(id, first_record, n_records, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_NEXT_TYPE_RECORDS__(const IAEA_I32 *id, IAEA_I64 *first_record, IAEA_I64 *n_records,
+                              IAEA_I32 *result)
+{ iaea_next_type_records(id, first_record, n_records, result); }
+
+
+/***************************************************************************
+* Compressing a phsp
+***************************************************************************/
+
+// A frame of iaea_compress_source on its way from the compressing threads
+// to the writer
+struct iaea_packed_frame
+{
+  IAEA_I64 number;
+  IAEA_I64 n_bytes;        // -1 if the frame could not be read or compressed
+  char *packed;
+};
+
+// Writes the frames of source p into writer, compressed by n_threads
+// threads; returns 0, -3 if the records cannot be read or compressed and
+// -4 if the container cannot be written
+static IAEA_I32 compress_frames(iaea_record_type *p, iaea_compressed_writer *writer,
+                                int n_threads)
+{
+   IAEA_I64 reclength = writer->reclength, frame_records = writer->frame_records;
+   IAEA_I64 frame_bytes = frame_records*reclength;
+   IAEA_I64 n_frames = writer->n_frames;
+   size_t pool_size = 2*(size_t) n_threads;
+
+   std::vector<iaea_packed_frame> pool(pool_size);
+   bool memory_ok = true;
+   size_t i;
+   for(i=0;i<pool_size;i++)
+   {
+      pool[i].packed = (char *) malloc((size_t) iaea_packed_bound(frame_bytes));
+      if(pool[i].packed == NULL) memory_ok = false;
+   }
+   if(!memory_ok)
+   {
+      for(i=0;i<pool_size;i++) free(pool[i].packed);
+      return(-3);
+   }
+
+   iaea_bounded_queue<iaea_packed_frame *> free_queue(pool_size);
+   iaea_bounded_queue<iaea_packed_frame *> done_queue(pool_size);
+   for(i=0;i<pool_size;i++) free_queue.push(&pool[i]);
+   std::atomic<IAEA_I64> next_frame(0);
+
+   // Threads take a free frame first and then the next frame number, so the
+   // frames in flight are always the oldest ones not yet written
+   auto compressor = [&]()
+   {
+      char *records = (char *) malloc((size_t) frame_bytes);
+      char *columns = (char *) malloc((size_t) frame_bytes);
+      for(;;)
+      {
+         iaea_packed_frame *frame;
+         free_queue.pop(frame);
+         IAEA_I64 f = next_frame++;
+         if(f >= n_frames) {free_queue.push(frame); break;}
+
+         IAEA_I64 n = min(frame_records, writer->n_records - f*frame_records);
+         frame->number = f;
+         if(records == NULL || columns == NULL ||
+            read_source_at(p, records, n*reclength, f*frame_bytes) != n*reclength ||
+            iaea_pack_frame(writer->compression, records, n, reclength, columns,
+                            frame->packed, &frame->n_bytes) != OK) frame->n_bytes = -1;
+         done_queue.push(frame);
+      }
+      free(records);
+      free(columns);
+   };
+   std::vector<std::thread> threads;
+   for(int t=0;t<n_threads;t++) threads.push_back(std::thread(compressor));
+
+   // The writer: frames arrive in any order and leave in sequence. Once one
+   // fails the others are still taken, but no longer written.
+   std::vector<iaea_packed_frame *> reorder(pool_size, (iaea_packed_frame *) NULL);
+   IAEA_I32 status = 0;
+   IAEA_I64 next_write = 0;
+   while(next_write < n_frames)
+   {
+      iaea_packed_frame *frame;
+      done_queue.pop(frame);
+      reorder[frame->number % pool_size] = frame;
+      while(next_write < n_frames && reorder[next_write % pool_size] != NULL)
+      {
+         frame = reorder[next_write % pool_size];
+         reorder[next_write % pool_size] = NULL;
+         if(status == 0 && frame->n_bytes < 0) status = -3;
+         if(status == 0 && writer->write_frame(frame->packed, frame->n_bytes) != OK) status = -4;
+         free_queue.push(frame);
+         next_write++;
+      }
+   }
+   for(i=0;i<threads.size();i++) threads[i].join();
+   for(i=0;i<pool_size;i++) free(pool[i].packed);
+   return(status);
+}
+
+/***************************************************************************
+* Compressed phsp
+*
+* Writes the records of the source with Id id, opened for reading, to a
+* compressed phsp (the base name of the source with .IAEAphspz): frames of
+* frame_records records (COMPRESSED_FRAME_RECORDS if frame_records is 0),
+* each compressed with zlib on its own, n_threads of them at once. The
+* header of the source is then given a $RECORD_COMPRESSION: block, and
+* from then on iaea_new_source reads the records from the compressed phsp,
+* decompressing the frames as they are reached (any record can still be
+* reached with iaea_set_record). The phsp file is left as it is; it is no
+* longer read and can be removed. Indexes are built for the file the
+* records are read from, so they are to be written after the compression.
+*
+* result is set to 0 if the phsp is compressed, -1 if the source does not
+* exist or was not opened for reading, -2 if it is virtual or compressed
+* already (or frame_records is negative), -3 if its records cannot be
+* read or compressed (or the library was built without zlib) and -4 if
+* the compressed phsp or the header cannot be written.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compress_source(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                          const IAEA_I32 *n_threads, IAEA_I32 *result)
+{
+   if(!iaea_sources.in_use(*id)) {*result = -1; return;}
+   iaea_read_source *s = p_iaea_read_source[*id];
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   if(s == NULL || s->suspended || h->fheader == NULL) {*result = -1; return;}
+   if(p->p_file == NULL || h->compression != COMPRESSION_NONE || *frame_records < 0)
+      {*result = -2; return;}
+#if !(defined IAEA_ZLIB)
+   printf("\n ERROR: Built without zlib, %s cannot be compressed\n", s->file_name);
+   *result = -3;
+   return;
+#endif
+
+   // All the records of the phsp file, whatever the header counts
+   iaea_phsp_file_id file;
+   if(h->record_length <= 0 || file.identify(p->p_file, h->record_length) != OK)
+      {*result = -3; return;}
+   IAEA_I64 n_records = file.size/h->record_length;
+   IAEA_I64 per_frame = (*frame_records > 0) ? *frame_records : COMPRESSED_FRAME_RECORDS;
+
+   char container_file[MAX_STR_LEN + 16];
+   snprintf(container_file, sizeof(container_file), "%s%s", s->file_name,
+            COMPRESSED_PHSP_EXTENSION);
+   iaea_compressed_writer writer;
+   if(writer.open(container_file, COMPRESSION_ZLIB, h->record_length, per_frame,
+                  n_records) != OK)
+   {
+      printf("\n ERROR: Failed to create %s\n", container_file);
+      *result = -4;
+      return;
+   }
+   *result = compress_frames(p, &writer, max((int)*n_threads, 1));
+   if(*result == 0 && writer.close() != OK) *result = -4;
+   if(*result != 0)
+   {
+      writer.discard();
+      printf("\n ERROR: Failed to compress %s\n", s->file_name);
+      return;
+   }
+
+   // The header is given its compression block where it ends
+   FILE *header_file = open_file(s->file_name, ".IAEAheader", "ab");
+   if(header_file == NULL) {*result = -4; return;}
+   FILE *kept = h->fheader;
+   h->fheader = header_file;
+   h->compression = COMPRESSION_ZLIB;
+   h->frame_records = per_frame;
+   h->write_compression();
+   h->fheader = kept;
+   if(fclose(header_file) != 0)
+   {
+      printf("\n ERROR: Failed to write the header of %s\n", s->file_name);
+      *result = -4;
+   }
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compress_source_(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                           const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_compress_source(id, frame_records, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_compress_source__(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                            const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_compress_source(id, frame_records, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPRESS_SOURCE(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                          const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_compress_source(id, frame_records, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPRESS_SOURCE_(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                           const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_compress_source(id, frame_records, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_COMPRESS_SOURCE__(const IAEA_I32 *id, const IAEA_I64 *frame_records,
+                            const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_compress_source(id, frame_records, n_threads, result); }
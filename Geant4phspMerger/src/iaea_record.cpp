@@ -49,16 +49,25 @@
 #endif
 #include <math.h>
 #include <cstdio>
+#include <cstring>
+#include <mutex>  // iaea_virtual.h, before the min and max of utilities.h
+
+#if !(defined WIN32) && !(defined WIN64)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #if !(defined WIN32) && !(defined WIN64)
 using namespace std;
 #endif
 
 #include "iaea_record.h"
+#include "iaea_virtual.h"
+#include "iaea_compressed.h"
 
 short iaea_record_type::initialize()
 {
-  if(p_file == NULL) {
+  if(p_file == NULL && p_virtual == NULL && p_compressed == NULL) {
      fprintf(stderr, "\n ERROR: Failed to open Phase Space file \n");
      return (FAIL);
   }
@@ -93,58 +102,21 @@ short iaea_record_type::initialize()
 
 short iaea_record_type::write_particle()
 {
-  float floatArray[NUM_EXTRA_FLOAT+7];
-  IAEA_I32 longArray[NUM_EXTRA_LONG];
-
-  char ishort = (char) particle;
-  if(w < 0) ishort = -ishort; // Sign of w is stored in particle type
-
-  if( fwrite(&ishort, sizeof(char),   1, p_file) != 1)
-  {
-    fprintf(stderr, "\n ERROR: write_particle: Failed to write particle type\n");
-    return (FAIL);;
-  }
-
-  int reclength = sizeof(char);
-
-  if(IsNewHistory > 0) energy *= (-1); // New history is signaled by negative energy
-
-  floatArray[0] = energy;
-
-  int i = 0;
+  char buffer[1+(NUM_EXTRA_FLOAT+7)*sizeof(float)+NUM_EXTRA_LONG*sizeof(IAEA_I32)];
 
-  if(ix > 0) floatArray[++i] = x;
-  if(iy > 0) floatArray[++i] = y;
-  if(iz > 0) floatArray[++i] = z;
-  if(iu > 0) floatArray[++i] = u;
-  if(iv > 0) floatArray[++i] = v;
-  if(iweight > 0) floatArray[++i] = weight;
-
-  int j;
-  for(j=0;j<iextrafloat;j++) floatArray[++i] = extrafloat[j];
+  // The record is packed in memory and written with a single fwrite
+  int reclength = encode_particle(buffer);
 
-  reclength += (i+1)*sizeof(float);
-
-  if( fwrite(floatArray, sizeof(float), (size_t)(i+1), p_file) != (size_t) (i+1))
+  if( fwrite(buffer, 1, (size_t)reclength, p_file) != (size_t)reclength)
   {
-     fprintf(stderr, "\n ERROR: write_particle: Failed to write FLOAT phsp data\n");
+     fprintf(stderr, "\n ERROR: write_particle: Failed to write particle record\n");
      return (FAIL);
   }
 
-  if(iextralong > 0)
-  {
-     for(j=0;j<iextralong;j++) longArray[j] = extralong[j];
-     reclength += iextralong*sizeof(IAEA_I32);
-     if( fwrite(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
-     {
-        fprintf(stderr, "\n ERROR: write_particle: Failed to write LONG phsp data\n");
-        return (FAIL);
-     }
-  }
-
   if(reclength == 0) return(FAIL);
 
   #ifdef DEBUG
+  int j;
   // charge defined
   int iaea_charge[MAX_NUM_PARTICLES]={0,-1,+1,0,+1};
   int charge = iaea_charge[particle - 1];
@@ -164,18 +136,180 @@ short iaea_record_type::write_particle()
 
 short iaea_record_type::read_particle()
 {
-  float floatArray[NUM_EXTRA_FLOAT+7];
-  IAEA_I32 longArray[NUM_EXTRA_LONG+7];
-  int i,j,is,reclength;
-  char ctmp;
+  char buffer[1+(NUM_EXTRA_FLOAT+7)*sizeof(float)+NUM_EXTRA_LONG*sizeof(IAEA_I32)];
 
   // IAEA_I32 pos = ftell(p_file); // To check file position
 
-  if( fread(&ctmp, sizeof(char),   1, p_file) != 1) // particle type is always read
+  size_t reclength = get_record_length();
+
+  // Mapped files are decoded in place, without any copy or system call
+  if(p_map != NULL)
+  {
+    if(map_pos < 0 || map_pos + (IAEA_I64)reclength > map_size)
+    {
+      map_eof = true;
+      fprintf(stderr, "\n ERROR: read_particle: Failed to read particle record\n");
+      return (FAIL);
+    }
+    short result = decode_particle(p_map + map_pos);
+    map_pos += reclength;
+    return(result);
+  }
+
+  if(p_virtual != NULL || p_compressed != NULL)
+  {
+    IAEA_I64 n = 1;
+    const char *record = (p_virtual != NULL) ? p_virtual->fetch_records(this, buffer, &n) :
+                                               p_compressed->fetch_records(buffer, &n);
+    if(n != 1)
+    {
+      fprintf(stderr, "\n ERROR: read_particle: Failed to read particle record\n");
+      return (FAIL);
+    }
+    return(decode_particle(record));
+  }
+
+  // The whole record is fetched at once and decoded from memory
+  if( fread(buffer, 1, reclength, p_file) != reclength)
+  {
+    fprintf(stderr, "\n ERROR: read_particle: Failed to read particle record\n");
+    return (FAIL);
+  }
+
+  return(decode_particle(buffer));
+}
+
+IAEA_I64 iaea_record_type::read_records(char *buffer, IAEA_I64 n)
+{
+  const char *records = fetch_records(buffer, &n);
+  if(records != buffer) memcpy(buffer, records, (size_t)(n*get_record_length()));
+  return(n);
+}
+
+const char *iaea_record_type::fetch_records(char *buffer, IAEA_I64 *n)
+{
+  IAEA_I64 reclength = get_record_length();
+
+  if(p_map != NULL)
   {
-    fprintf(stderr, "\n ERROR: read_particle: Failed to read particle type\n");
-    return (FAIL);;
+    IAEA_I64 available = (map_pos < map_size) ? (map_size - map_pos)/reclength : 0;
+    if(*n > available) {*n = available; map_eof = true;}
+    const char *records = p_map + map_pos;
+    map_pos += (*n)*reclength;
+    return(records);
   }
+  if(p_virtual != NULL) return(p_virtual->fetch_records(this, buffer, n));
+  if(p_compressed != NULL) return(p_compressed->fetch_records(buffer, n));
+
+  *n = (IAEA_I64)fread(buffer, (size_t)reclength, (size_t)*n, p_file);
+  return(buffer);
+}
+
+short iaea_record_type::map_file(bool populate)
+{
+#if !(defined WIN32) && !(defined WIN64)
+  struct stat file_status;
+  if(p_file == NULL || fstat(fileno(p_file), &file_status) != 0) return(FAIL);
+  if(file_status.st_size <= 0) return(FAIL); // nothing to map
+
+  int flags = MAP_SHARED;
+  #ifdef MAP_POPULATE
+  if(populate) flags |= MAP_POPULATE;
+  #endif
+  void *p = mmap(NULL, (size_t)file_status.st_size, PROT_READ, flags, fileno(p_file), 0);
+  if(p == MAP_FAILED) return(FAIL);
+
+  // Records are mostly read in order; start reading ahead right away
+  madvise(p, (size_t)file_status.st_size, MADV_SEQUENTIAL);
+  madvise(p, (size_t)file_status.st_size, MADV_WILLNEED);
+
+  p_map = (const char *) p;
+  map_size = (IAEA_I64) file_status.st_size;
+  map_pos = 0;
+  map_eof = false;
+  return(OK);
+#else
+  return(FAIL);
+#endif
+}
+
+void iaea_record_type::unmap_file()
+{
+#if !(defined WIN32) && !(defined WIN64)
+  if(p_map != NULL) munmap((void *) p_map, (size_t) map_size);
+#endif
+  p_map = NULL;
+}
+
+IAEA_I64 iaea_record_type::tell_file()
+{
+  if(p_map != NULL) return(map_pos);
+  if(p_virtual != NULL) return(p_virtual->tell_file());
+  if(p_compressed != NULL) return(p_compressed->tell_file());
+#if (defined WIN32) || (defined WIN64)
+  return (IAEA_I64)_ftelli64(p_file);
+#else
+  return (IAEA_I64)ftello(p_file);
+#endif
+}
+
+short iaea_record_type::seek_file(IAEA_I64 offset)
+{
+  if(p_map != NULL)
+  {
+    if(offset < 0) return(FAIL);
+    map_pos = offset;
+    map_eof = false;
+    return(OK);
+  }
+  if(p_virtual != NULL) return(p_virtual->seek_file(offset));
+  if(p_compressed != NULL) return(p_compressed->seek_file(offset));
+#if (defined WIN32) || (defined WIN64)
+  return (_fseeki64(p_file, offset, SEEK_SET) == 0) ? OK : FAIL;
+#else
+  return (fseeko(p_file, (off_t)offset, SEEK_SET) == 0) ? OK : FAIL;
+#endif
+}
+
+bool iaea_record_type::end_of_file()
+{
+  if(p_map != NULL) return(map_eof);
+  if(p_virtual != NULL) return(p_virtual->end_of_file());
+  if(p_compressed != NULL) return(p_compressed->end_of_file());
+  return(feof(p_file) != 0);
+}
+
+void iaea_record_type::rewind_file()
+{
+  if(p_map != NULL) {map_pos = 0; map_eof = false; return;}
+  if(p_virtual != NULL) {p_virtual->rewind_file(); return;}
+  if(p_compressed != NULL) {p_compressed->rewind_file(); return;}
+  rewind(p_file);
+}
+
+short iaea_record_type::get_record_length()
+{
+  short reclength = sizeof(char) + sizeof(float); // particle type and energy
+  if(ix > 0) reclength += sizeof(float);
+  if(iy > 0) reclength += sizeof(float);
+  if(iz > 0) reclength += sizeof(float);
+  if(iu > 0) reclength += sizeof(float);
+  if(iv > 0) reclength += sizeof(float);
+  if(iweight > 0) reclength += sizeof(float);
+  if(iextrafloat > 0) reclength += iextrafloat*sizeof(float);
+  if(iextralong > 0) reclength += iextralong*sizeof(IAEA_I32);
+  return(reclength);
+}
+
+short iaea_record_type::decode_particle(const char *buffer)
+{
+  float floatArray[NUM_EXTRA_FLOAT+7];
+  IAEA_I32 longArray[NUM_EXTRA_LONG+7];
+  int i,j,is,reclength;
+  char ctmp;
+
+  // Records are packed without alignment, so every field is copied out
+  memcpy(&ctmp, buffer, sizeof(char));
 
   particle = (short) ctmp;
 
@@ -193,11 +327,7 @@ short iaea_record_type::read_particle()
   if(iweight > 0) rec_to_read++;
   if(iextrafloat>0) rec_to_read += iextrafloat;
 
-  if( fread(floatArray, sizeof(float), rec_to_read, p_file) != rec_to_read)
-  {
-    fprintf(stderr, "\n ERROR: read_particle: Failed to read FLOATs \n");
-    return (FAIL);;
-  }
+  memcpy(floatArray, buffer + reclength, rec_to_read*sizeof(float));
 
   reclength += rec_to_read*sizeof(float);
 
@@ -230,11 +360,7 @@ short iaea_record_type::read_particle()
 
   if(iextralong > 0)
   {
-     if( fread(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
-     {
-       fprintf(stderr, "\n ERROR: read_particle: Failed to read LONGS\n");
-       return (FAIL);
-     }
+     memcpy(longArray, buffer + reclength, iextralong*sizeof(IAEA_I32));
      for(int l=0,j=0;j<iextralong;j++) extralong[j] = longArray[l++];
      reclength += (iextralong)*sizeof(IAEA_I32);
   }
@@ -256,3 +382,40 @@ short iaea_record_type::read_particle()
   #endif
   return(reclength);
 }
+
+short iaea_record_type::encode_particle(char *buffer)
+{
+  float floatArray[NUM_EXTRA_FLOAT+7];
+
+  char ishort = (char) particle;
+  if(w < 0) ishort = -ishort; // Sign of w is stored in particle type
+
+  memcpy(buffer, &ishort, sizeof(char));
+  int reclength = sizeof(char);
+
+  floatArray[0] = energy;
+  if(IsNewHistory > 0) floatArray[0] = -energy; // New history is signaled by negative energy
+
+  int i = 0;
+
+  if(ix > 0) floatArray[++i] = x;
+  if(iy > 0) floatArray[++i] = y;
+  if(iz > 0) floatArray[++i] = z;
+  if(iu > 0) floatArray[++i] = u;
+  if(iv > 0) floatArray[++i] = v;
+  if(iweight > 0) floatArray[++i] = weight;
+
+  int j;
+  for(j=0;j<iextrafloat;j++) floatArray[++i] = extrafloat[j];
+
+  memcpy(buffer + reclength, floatArray, (i+1)*sizeof(float));
+  reclength += (i+1)*sizeof(float);
+
+  if(iextralong > 0)
+  {
+     memcpy(buffer + reclength, extralong, iextralong*sizeof(IAEA_I32));
+     reclength += iextralong*sizeof(IAEA_I32);
+  }
+
+  return(reclength);
+}
@@ -0,0 +1,41 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include "iaea_registry.h"
+
+IAEA_I32 iaea_source_ids::acquire()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  IAEA_I32 id;
+  if(!free_ids.empty())
+  {
+      std::pop_heap(free_ids.begin(), free_ids.end(), std::greater<IAEA_I32>());
+      id = free_ids.back();
+      free_ids.pop_back();
+  }
+  else
+  {
+      if(used.size() >= (size_t) (std::numeric_limits<IAEA_I32>::max)()) return(-1);
+      id = (IAEA_I32) used.size();
+      used.push_back(0);
+  }
+  used[id] = 1;
+  return(id);
+}
+
+short iaea_source_ids::release(IAEA_I32 id)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if(id < 0 || id >= (IAEA_I32)used.size() || !used[id]) return(FAIL);
+  used[id] = 0;
+  free_ids.push_back(id);
+  std::push_heap(free_ids.begin(), free_ids.end(), std::greater<IAEA_I32>());
+  return(OK);
+}
+
+bool iaea_source_ids::in_use(IAEA_I32 id)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return(id >= 0 && id < (IAEA_I32)used.size() && used[id]);
+}
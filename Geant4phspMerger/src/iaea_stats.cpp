@@ -0,0 +1,317 @@
+#include <math.h>
+
+#if !(defined WIN32) && !(defined WIN64)
+using namespace std;
+#endif
+
+#include "iaea_stats.h"
+#include "iaea_decode.h"
+
+#if (defined __GNUC__) && ((defined __x86_64__) || (defined __i386__))
+#define IAEA_STATS_X86
+#include <immintrin.h>
+#endif
+
+void iaea_statistics::initialize()
+{
+  n_particles = histories = 0;
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      particle_number[i] = 0;
+      sum_weight[i] = sum_weighted_energy[i] = 0.;
+      minimum_weight[i] = minimum_energy[i] = HUGE_VAL;
+      maximum_weight[i] = maximum_energy[i] = -HUGE_VAL;
+  }
+  minimum_x = minimum_y = minimum_z = HUGE_VAL;
+  maximum_x = maximum_y = maximum_z = -HUGE_VAL;
+}
+
+void iaea_statistics::add_particle(const iaea_record_type *p)
+{
+  if (p->x > maximum_x )  maximum_x = p->x;
+  if (p->x < minimum_x )  minimum_x = p->x;
+  if (p->y > maximum_y )  maximum_y = p->y;
+  if (p->y < minimum_y )  minimum_y = p->y;
+  if (p->z > maximum_z )  maximum_z = p->z;
+  if (p->z < minimum_z )  minimum_z = p->z;
+
+  n_particles++;
+  if ( p->IsNewHistory > 0 ) histories += p->IsNewHistory;
+
+  int i = p->particle-1;
+  if( i < 0 || i >= MAX_NUM_PARTICLES ) return;
+  particle_number[i]++;
+  sum_weight[i] += p->weight;
+  sum_weighted_energy[i] += p->weight*fabs(p->energy);
+  if (p->weight > maximum_weight[i] ) maximum_weight[i] = p->weight;
+  if (p->weight < minimum_weight[i] ) minimum_weight[i] = p->weight;
+  if (fabs(p->energy) > maximum_energy[i] ) maximum_energy[i] = fabs(p->energy);
+  if (fabs(p->energy) < minimum_energy[i] ) minimum_energy[i] = fabs(p->energy);
+}
+
+void iaea_statistics::merge(const iaea_statistics *s)
+{
+  if (s->maximum_x > maximum_x )  maximum_x = s->maximum_x;
+  if (s->minimum_x < minimum_x )  minimum_x = s->minimum_x;
+  if (s->maximum_y > maximum_y )  maximum_y = s->maximum_y;
+  if (s->minimum_y < minimum_y )  minimum_y = s->minimum_y;
+  if (s->maximum_z > maximum_z )  maximum_z = s->maximum_z;
+  if (s->minimum_z < minimum_z )  minimum_z = s->minimum_z;
+
+  n_particles += s->n_particles;
+  histories += s->histories;
+
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      if( s->particle_number[i] == 0 ) continue;
+      particle_number[i] += s->particle_number[i];
+      sum_weight[i] += s->sum_weight[i];
+      sum_weighted_energy[i] += s->sum_weighted_energy[i];
+      if (s->maximum_weight[i] > maximum_weight[i]) maximum_weight[i] = s->maximum_weight[i];
+      if (s->minimum_weight[i] < minimum_weight[i]) minimum_weight[i] = s->minimum_weight[i];
+      if (s->maximum_energy[i] > maximum_energy[i]) maximum_energy[i] = s->maximum_energy[i];
+      if (s->minimum_energy[i] < minimum_energy[i]) minimum_energy[i] = s->minimum_energy[i];
+  }
+}
+
+/* *********************************************************************** */
+// Kernels. For every particle type one masked pass over the block gives
+// the count, the sums (in double, of the same single precision terms
+// update_counters adds) and the extrema; another pass per coordinate
+// gives the bounding box. NaNs are skipped by the extrema as by the
+// comparisons of update_counters. The vector kernels add in a different
+// order than the records come, so the sums may differ from the ones of
+// update_counters in the last bits.
+
+struct type_sums
+{
+  IAEA_I64 count;
+  double sum_weight, sum_weighted_energy;
+  float minimum_weight, maximum_weight, minimum_energy, maximum_energy;
+};
+
+typedef void (*type_function)(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                              const float weight[], IAEA_I32 type, type_sums *s);
+typedef void (*box_function)(IAEA_I64 n, const float c[], float *minimum, float *maximum);
+
+static void type_scalar(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                        const float weight[], IAEA_I32 type, type_sums *s)
+{
+  for(IAEA_I64 i=0; i<n; i++)
+  {
+      if(particle[i] != type) continue;
+      float w = weight[i], e = fabs(energy[i]);
+      s->count++;
+      s->sum_weight += w;
+      s->sum_weighted_energy += w*e;
+      if (w > s->maximum_weight ) s->maximum_weight = w;
+      if (w < s->minimum_weight ) s->minimum_weight = w;
+      if (e > s->maximum_energy ) s->maximum_energy = e;
+      if (e < s->minimum_energy ) s->minimum_energy = e;
+  }
+}
+
+static void box_scalar(IAEA_I64 n, const float c[], float *minimum, float *maximum)
+{
+  float lo = *minimum, hi = *maximum;
+  for(IAEA_I64 i=0; i<n; i++)
+  {
+      lo = (c[i] < lo) ? c[i] : lo;
+      hi = (c[i] > hi) ? c[i] : hi;
+  }
+  *minimum = lo; *maximum = hi;
+}
+
+#ifdef IAEA_STATS_X86
+
+__attribute__((target("avx2")))
+static void type_avx2(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                      const float weight[], IAEA_I32 type, type_sums *s)
+{
+  const __m256i wanted = _mm256_set1_epi32(type);
+  const __m256 sign_bit = _mm256_set1_ps(-0.f);
+  const __m256 plus_inf = _mm256_set1_ps(HUGE_VALF), minus_inf = _mm256_set1_ps(-HUGE_VALF);
+  __m256i count = _mm256_setzero_si256();
+  __m256d sw_lo = _mm256_setzero_pd(), sw_hi = _mm256_setzero_pd();
+  __m256d swe_lo = _mm256_setzero_pd(), swe_hi = _mm256_setzero_pd();
+  __m256 min_w = plus_inf, max_w = minus_inf, min_e = plus_inf, max_e = minus_inf;
+
+  IAEA_I64 i = 0;
+  for(; i+8<=n; i+=8)
+  {
+     __m256i t = _mm256_loadu_si256((const __m256i *)(particle + i));
+     __m256 m = _mm256_castsi256_ps(_mm256_cmpeq_epi32(t, wanted));
+     __m256 w = _mm256_loadu_ps(weight + i);
+     __m256 e = _mm256_andnot_ps(sign_bit, _mm256_loadu_ps(energy + i));
+     __m256 wm = _mm256_and_ps(w, m);
+     __m256 wem = _mm256_and_ps(_mm256_mul_ps(w, e), m);
+
+     count = _mm256_sub_epi32(count, _mm256_castps_si256(m));
+     sw_lo  = _mm256_add_pd(sw_lo,  _mm256_cvtps_pd(_mm256_castps256_ps128(wm)));
+     sw_hi  = _mm256_add_pd(sw_hi,  _mm256_cvtps_pd(_mm256_extractf128_ps(wm, 1)));
+     swe_lo = _mm256_add_pd(swe_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(wem)));
+     swe_hi = _mm256_add_pd(swe_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(wem, 1)));
+     // The new value first: a NaN keeps the previous extremum
+     min_w = _mm256_min_ps(_mm256_blendv_ps(plus_inf, w, m), min_w);
+     max_w = _mm256_max_ps(_mm256_blendv_ps(minus_inf, w, m), max_w);
+     min_e = _mm256_min_ps(_mm256_blendv_ps(plus_inf, e, m), min_e);
+     max_e = _mm256_max_ps(_mm256_blendv_ps(minus_inf, e, m), max_e);
+  }
+
+  IAEA_I32 c[8];
+  double a[4], b[4];
+  float lo_w[8], hi_w[8], lo_e[8], hi_e[8];
+  _mm256_storeu_si256((__m256i *) c, count);
+  _mm256_storeu_ps(lo_w, min_w);  _mm256_storeu_ps(hi_w, max_w);
+  _mm256_storeu_ps(lo_e, min_e);  _mm256_storeu_ps(hi_e, max_e);
+  _mm256_storeu_pd(a, _mm256_add_pd(sw_lo, sw_hi));
+  _mm256_storeu_pd(b, _mm256_add_pd(swe_lo, swe_hi));
+  for(int k=0;k<8;k++)
+  {
+     s->count += c[k];
+     if (lo_w[k] < s->minimum_weight ) s->minimum_weight = lo_w[k];
+     if (hi_w[k] > s->maximum_weight ) s->maximum_weight = hi_w[k];
+     if (lo_e[k] < s->minimum_energy ) s->minimum_energy = lo_e[k];
+     if (hi_e[k] > s->maximum_energy ) s->maximum_energy = hi_e[k];
+  }
+  for(int k=0;k<4;k++) {s->sum_weight += a[k]; s->sum_weighted_energy += b[k];}
+
+  type_scalar(n - i, particle + i, energy + i, weight + i, type, s);
+}
+
+__attribute__((target("avx2")))
+static void box_avx2(IAEA_I64 n, const float c[], float *minimum, float *maximum)
+{
+  __m256 lo = _mm256_set1_ps(*minimum), hi = _mm256_set1_ps(*maximum);
+  IAEA_I64 i = 0;
+  for(; i+8<=n; i+=8)
+  {
+     __m256 x = _mm256_loadu_ps(c + i);
+     lo = _mm256_min_ps(x, lo);
+     hi = _mm256_max_ps(x, hi);
+  }
+  float l[8], h[8];
+  _mm256_storeu_ps(l, lo);  _mm256_storeu_ps(h, hi);
+  for(int k=0;k<8;k++)
+  {
+     if(l[k] < *minimum) *minimum = l[k];
+     if(h[k] > *maximum) *maximum = h[k];
+  }
+  box_scalar(n - i, c + i, minimum, maximum);
+}
+
+// Upper 8 floats of a 512 bit vector (without the avx512dq extract)
+__attribute__((target("avx512f")))
+static inline __m256 high_half(__m512 x)
+{
+  return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+}
+
+__attribute__((target("avx512f")))
+static void type_avx512(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                        const float weight[], IAEA_I32 type, type_sums *s)
+{
+  const __m512i wanted = _mm512_set1_epi32(type);
+  __m512d sw_lo = _mm512_setzero_pd(), sw_hi = _mm512_setzero_pd();
+  __m512d swe_lo = _mm512_setzero_pd(), swe_hi = _mm512_setzero_pd();
+  __m512 min_w = _mm512_set1_ps(HUGE_VALF), max_w = _mm512_set1_ps(-HUGE_VALF);
+  __m512 min_e = min_w, max_e = max_w;
+  IAEA_I64 count = 0;
+
+  IAEA_I64 i = 0;
+  for(; i+16<=n; i+=16)
+  {
+     __m512i t = _mm512_loadu_si512((const void *)(particle + i));
+     __mmask16 m = _mm512_cmpeq_epi32_mask(t, wanted);
+     if(m == 0) continue;
+     __m512 w = _mm512_loadu_ps(weight + i);
+     __m512 e = _mm512_abs_ps(_mm512_loadu_ps(energy + i));
+     __m512 wm = _mm512_maskz_mov_ps(m, w);
+     __m512 wem = _mm512_maskz_mov_ps(m, _mm512_mul_ps(w, e));
+
+     count += __builtin_popcount((unsigned) m);
+     sw_lo  = _mm512_add_pd(sw_lo,  _mm512_cvtps_pd(_mm512_castps512_ps256(wm)));
+     sw_hi  = _mm512_add_pd(sw_hi,  _mm512_cvtps_pd(high_half(wm)));
+     swe_lo = _mm512_add_pd(swe_lo, _mm512_cvtps_pd(_mm512_castps512_ps256(wem)));
+     swe_hi = _mm512_add_pd(swe_hi, _mm512_cvtps_pd(high_half(wem)));
+     min_w = _mm512_mask_min_ps(min_w, m, w, min_w);
+     max_w = _mm512_mask_max_ps(max_w, m, w, max_w);
+     min_e = _mm512_mask_min_ps(min_e, m, e, min_e);
+     max_e = _mm512_mask_max_ps(max_e, m, e, max_e);
+  }
+
+  s->count += count;
+  s->sum_weight += _mm512_reduce_add_pd(_mm512_add_pd(sw_lo, sw_hi));
+  s->sum_weighted_energy += _mm512_reduce_add_pd(_mm512_add_pd(swe_lo, swe_hi));
+  float lo_w = _mm512_reduce_min_ps(min_w), hi_w = _mm512_reduce_max_ps(max_w);
+  float lo_e = _mm512_reduce_min_ps(min_e), hi_e = _mm512_reduce_max_ps(max_e);
+  if (lo_w < s->minimum_weight ) s->minimum_weight = lo_w;
+  if (hi_w > s->maximum_weight ) s->maximum_weight = hi_w;
+  if (lo_e < s->minimum_energy ) s->minimum_energy = lo_e;
+  if (hi_e > s->maximum_energy ) s->maximum_energy = hi_e;
+
+  type_scalar(n - i, particle + i, energy + i, weight + i, type, s);
+}
+
+__attribute__((target("avx512f")))
+static void box_avx512(IAEA_I64 n, const float c[], float *minimum, float *maximum)
+{
+  __m512 lo = _mm512_set1_ps(*minimum), hi = _mm512_set1_ps(*maximum);
+  IAEA_I64 i = 0;
+  for(; i+16<=n; i+=16)
+  {
+     __m512 x = _mm512_loadu_ps(c + i);
+     lo = _mm512_min_ps(x, lo);
+     hi = _mm512_max_ps(x, hi);
+  }
+  *minimum = _mm512_reduce_min_ps(lo);
+  *maximum = _mm512_reduce_max_ps(hi);
+  box_scalar(n - i, c + i, minimum, maximum);
+}
+
+#endif // IAEA_STATS_X86
+
+void iaea_statistics::add_block(IAEA_I64 n, const IAEA_I32 particle[], const float energy[],
+                                const float weight[], const float x[], const float y[],
+                                const float z[], const IAEA_I32 new_history[])
+{
+  if(n <= 0) return;
+
+  type_function type_sums_of = type_scalar;
+  box_function box = box_scalar;
+#ifdef IAEA_STATS_X86
+  int kernel = iaea_decode_kernel();
+  if(kernel == IAEA_DECODE_AVX2)   {type_sums_of = type_avx2;   box = box_avx2;}
+  if(kernel == IAEA_DECODE_AVX512) {type_sums_of = type_avx512; box = box_avx512;}
+#endif
+
+  float lo, hi;
+  lo = HUGE_VALF; hi = -HUGE_VALF; box(n, x, &lo, &hi);
+  if (hi > maximum_x )  maximum_x = hi;
+  if (lo < minimum_x )  minimum_x = lo;
+  lo = HUGE_VALF; hi = -HUGE_VALF; box(n, y, &lo, &hi);
+  if (hi > maximum_y )  maximum_y = hi;
+  if (lo < minimum_y )  minimum_y = lo;
+  lo = HUGE_VALF; hi = -HUGE_VALF; box(n, z, &lo, &hi);
+  if (hi > maximum_z )  maximum_z = hi;
+  if (lo < minimum_z )  minimum_z = lo;
+
+  n_particles += n;
+  IAEA_I64 h = 0;
+  for(IAEA_I64 i=0; i<n; i++) h += (new_history[i] > 0) ? new_history[i] : 0;
+  histories += h;
+
+  for(int k=0;k<MAX_NUM_PARTICLES;k++)
+  {
+      type_sums s = {0, 0., 0., HUGE_VALF, -HUGE_VALF, HUGE_VALF, -HUGE_VALF};
+      type_sums_of(n, particle, energy, weight, k+1, &s);
+      if(s.count == 0) continue;
+      particle_number[k] += s.count;
+      sum_weight[k] += s.sum_weight;
+      sum_weighted_energy[k] += s.sum_weighted_energy;
+      if (s.maximum_weight > maximum_weight[k] ) maximum_weight[k] = s.maximum_weight;
+      if (s.minimum_weight < minimum_weight[k] ) minimum_weight[k] = s.minimum_weight;
+      if (s.maximum_energy > maximum_energy[k] ) maximum_energy[k] = s.maximum_energy;
+      if (s.minimum_energy < minimum_energy[k] ) minimum_energy[k] = s.minimum_energy;
+  }
+}
@@ -0,0 +1,187 @@
+#include <cmath>
+#include <cstring>
+
+#include "iaea_transcode.h"
+
+// Offsets of the fields of a record in the order they are packed;
+// -1 for fields that are not stored
+static void get_field_offsets(const iaea_header_type *p, short offset[8],
+                              short float_offset[], short long_offset[])
+{
+  // Particle type and energy are always stored
+  offset[0] = 0;
+  offset[1] = 1;
+  short next = 5;
+
+  // x, y, z, u, v and then the weight (w is coded as sign of type)
+  static const int contents_index[6] = {0, 1, 2, 3, 4, 6};
+  for(int i=0;i<6;i++)
+  {
+      offset[2+i] = -1;
+      if(p->record_contents[contents_index[i]] == 0) continue;
+      offset[2+i] = next; next += sizeof(float);
+  }
+
+  for(int j=0;j<p->record_contents[7];j++)
+      {float_offset[j] = next; next += sizeof(float);}
+  for(int j=0;j<p->record_contents[8];j++)
+      {long_offset[j] = next; next += sizeof(IAEA_I32);}
+}
+
+// Index of the extra variable of given type and occurrence, -1 if absent
+static int find_extra_type(const IAEA_I32 contents[], int n, IAEA_I32 type,
+                           int occurrence)
+{
+  for(int j=0;j<n;j++)
+  {
+      if(contents[j] != type) continue;
+      if(occurrence-- == 0) return j;
+  }
+  return -1;
+}
+
+short iaea_transcode_plan::build(const iaea_header_type *p_in,
+                                 const iaea_header_type *p_out)
+{
+  // Fields are moved as raw bytes, so both must be in the machine order
+  int machine_byte_order = check_byte_order();
+  if(p_in->byte_order != machine_byte_order) return(FAIL);
+  if(p_out->byte_order != machine_byte_order) return(FAIL);
+
+  in_length = p_in->record_length;
+  out_length = p_out->record_length;
+  n_moves = n_fills = 0;
+  history_fill = -1;
+
+  short in_offset[8], in_float[NUM_EXTRA_FLOAT], in_long[NUM_EXTRA_LONG];
+  short out_offset[8], out_float[NUM_EXTRA_FLOAT], out_long[NUM_EXTRA_LONG];
+  get_field_offsets(p_in, in_offset, in_float, in_long);
+  get_field_offsets(p_out, out_offset, out_float, out_long);
+
+  // Every output field: where it comes from (-1 for a fill) and its size
+  short from[MAX_NUM_FIELDS_RECORD], to[MAX_NUM_FIELDS_RECORD];
+  short size[MAX_NUM_FIELDS_RECORD];
+  float value[MAX_NUM_FIELDS_RECORD];
+  int n = 0, i, j;
+
+  static const int contents_index[8] = {-1, -1, 0, 1, 2, 3, 4, 6};
+  for(i=0;i<8;i++)
+  {
+      if(out_offset[i] < 0) continue;
+      from[n] = in_offset[i]; to[n] = out_offset[i];
+      size[n] = (i == 0) ? sizeof(char) : sizeof(float);
+      value[n] = (in_offset[i] < 0) ?
+                  p_in->record_constant[contents_index[i]] : 0.f;
+      n++;
+  }
+
+  // The k-th extra variable of a type goes to the k-th one of that type
+  for(j=0;j<p_out->record_contents[7];j++)
+  {
+      IAEA_I32 type = p_out->extrafloat_contents[j];
+      int k, occurrence = 0;
+      for(k=0;k<j;k++) if(p_out->extrafloat_contents[k] == type) occurrence++;
+      k = find_extra_type(p_in->extrafloat_contents, p_in->record_contents[7],
+                          type, occurrence);
+      from[n] = (k < 0) ? -1 : in_float[k]; to[n] = out_float[j];
+      size[n] = sizeof(float); value[n] = 0.f;
+      n++;
+  }
+  for(j=0;j<p_out->record_contents[8];j++)
+  {
+      IAEA_I32 type = p_out->extralong_contents[j];
+      int k, occurrence = 0;
+      for(k=0;k<j;k++) if(p_out->extralong_contents[k] == type) occurrence++;
+      k = find_extra_type(p_in->extralong_contents, p_in->record_contents[8],
+                          type, occurrence);
+      // A history counter takes precedence over the sign of energy, so one
+      // the input lacks is made from it rather than filled with zero
+      if(k < 0 && type == 1 && occurrence == 0) {history_fill = out_long[j]; continue;}
+      from[n] = (k < 0) ? -1 : in_long[k]; to[n] = out_long[j];
+      size[n] = sizeof(IAEA_I32); value[n] = 0.f; // all bits zero as well
+      n++;
+  }
+
+  for(i=0;i<n;i++)
+  {
+      if(from[i] < 0)
+      {
+          fill_to[n_fills] = to[i]; fill_value[n_fills] = value[i];
+          n_fills++;
+          continue;
+      }
+      if(n_moves > 0 &&
+         move_from[n_moves-1] + move_size[n_moves-1] == from[i] &&
+         move_to[n_moves-1] + move_size[n_moves-1] == to[i])
+      {
+          move_size[n_moves-1] += size[i];
+          continue;
+      }
+      move_from[n_moves] = from[i]; move_to[n_moves] = to[i];
+      move_size[n_moves] = size[i];
+      n_moves++;
+  }
+
+  // The sign of the particle type is the sign of w: it is only copied if
+  // both layouts store w, otherwise it follows the constant w
+  w_sign = 0;
+  if(p_out->record_contents[5] == 0)
+      w_sign = (p_out->record_constant[5] < 0) ? -1 : 1;
+  else if(p_in->record_contents[5] == 0)
+      w_sign = (p_in->record_constant[5] < 0) ? -1 : 1;
+
+  // A history counter takes precedence over the sign of energy; when the
+  // output keeps the counter it still does, so energy is left as it is
+  history_long = -1;
+  for(j=0;j<p_in->record_contents[8];j++)
+      if(p_in->extralong_contents[j] == 1) history_long = in_long[j];
+  for(j=0;j<p_out->record_contents[8];j++)
+      if(p_out->extralong_contents[j] == 1) history_long = -1;
+
+  return(OK);
+}
+
+void iaea_transcode_plan::run(const char *in, char *out, IAEA_I64 n_records) const
+{
+  for(IAEA_I64 r=0;r<n_records;r++)
+  {
+      const char *a = in + r*in_length;
+      char *b = out + r*out_length;
+
+      int i;
+      for(i=0;i<n_moves;i++) memcpy(b + move_to[i], a + move_from[i], move_size[i]);
+      for(i=0;i<n_fills;i++) memcpy(b + fill_to[i], &fill_value[i], sizeof(float));
+
+      if(w_sign != 0)
+      {
+          char type = (char) abs(a[0]);
+          b[0] = (w_sign < 0) ? -type : type;
+      }
+
+      if(history_long >= 0)
+      {
+          IAEA_I32 n_stat;
+          float energy;
+          memcpy(&n_stat, a + history_long, sizeof(IAEA_I32));
+          memcpy(&energy, b + 1, sizeof(float));
+          energy = fabs(energy);
+          if(n_stat > 0) energy = -energy;
+          memcpy(b + 1, &energy, sizeof(float));
+      }
+
+      if(history_fill >= 0)
+      {
+          float energy;
+          memcpy(&energy, a + 1, sizeof(float));
+          IAEA_I32 n_stat = (energy < 0) ? 1 : 0;
+          memcpy(b + history_fill, &n_stat, sizeof(IAEA_I32));
+      }
+  }
+}
+
+bool iaea_transcode_plan::is_identity() const
+{
+  return in_length == out_length && n_fills == 0 && w_sign == 0 &&
+         history_long < 0 && history_fill < 0 && n_moves == 1 && move_from[0] == 0 &&
+         move_to[0] == 0 && move_size[0] == out_length;
+}
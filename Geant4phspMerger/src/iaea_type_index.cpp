@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "iaea_type_index.h"
+
+static const char type_magic[8] = {'I','A','E','A','t','y','p','e'};
+
+// Where the runs start in a type index file
+static IAEA_I64 runs_offset()
+{
+   return((IAEA_I64)(sizeof(iaea_sidecar_tag) + 5*sizeof(IAEA_I64) +
+                     (TYPE_INDEX_SLOTS + 1)*sizeof(IAEA_I64)));
+}
+
+static int seek_type(FILE *file, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+   return _fseeki64(file, offset, SEEK_SET);
+#else
+   return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static bool run_before(const iaea_record_run &a, const iaea_record_run &b)
+{
+   return(a.first < b.first);
+}
+
+/* *********************************************************************** */
+void iaea_type_index::initialize()
+{
+   memset(this, 0, sizeof(*this));
+   file.size = -1;
+}
+
+// The runs stay in the file, so there is nothing to free
+void iaea_type_index::release()
+{
+   initialize();
+}
+
+/* *********************************************************************** */
+short iaea_load_type_index(const char *type_file, iaea_type_index *index)
+{
+   index->initialize();
+   FILE *in = fopen(type_file, "rb");
+   if(in == NULL) return(FAIL);
+
+   // Tag, file indexed and records, then the run starts (the runs after
+   // them are read by iaea_read_type_runs)
+   iaea_sidecar_tag expected;
+   expected.make(type_magic, TYPE_INDEX_VERSION, TYPE_INDEX_SLOTS);
+   IAEA_I64 fields[5] = {0};
+   bool ok = expected.read_matches(in) &&
+             fread(fields, sizeof(fields), 1, in) == 1 &&
+             fread(index->slot_start, sizeof(index->slot_start), 1, in) == 1 &&
+             index->slot_start[0] == 0;
+   for(int s = 0; ok && s < TYPE_INDEX_SLOTS; s++)
+      ok = index->slot_start[s] <= index->slot_start[s+1];
+
+   // The runs must all be there, and nothing after them
+   IAEA_I64 n_runs = index->slot_start[TYPE_INDEX_SLOTS];
+   char extra;
+   ok = ok && (n_runs == 0 ||
+               (seek_type(in, runs_offset() + n_runs*(IAEA_I64) sizeof(iaea_record_run) - 1) == 0 &&
+                fread(&extra, 1, 1, in) == 1)) &&
+        fread(&extra, 1, 1, in) == 0;
+   fclose(in);
+   if(!ok) {index->release(); return(FAIL);}
+
+   index->file.size = fields[0];
+   index->file.mtime_sec = fields[1];
+   index->file.mtime_nsec = fields[2];
+   index->file.record_length = fields[3];
+   index->n_records = fields[4];
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_save_type_index(const char *type_file, const iaea_type_index *index,
+                           const iaea_record_run *runs)
+{
+   char temp_file[MAX_STR_LEN + 32];
+   FILE *out = iaea_open_sidecar(type_file, temp_file);
+   if(out == NULL) return(FAIL);
+
+   iaea_sidecar_tag tag;
+   tag.make(type_magic, TYPE_INDEX_VERSION, TYPE_INDEX_SLOTS);
+   IAEA_I64 n_runs = index->slot_start[TYPE_INDEX_SLOTS];
+   IAEA_I64 fields[5] = {index->file.size, index->file.mtime_sec, index->file.mtime_nsec,
+                         index->file.record_length, index->n_records};
+   bool ok = tag.write(out) &&
+             fwrite(fields, sizeof(fields), 1, out) == 1 &&
+             fwrite(index->slot_start, sizeof(index->slot_start), 1, out) == 1 &&
+             fwrite(runs, sizeof(iaea_record_run), (size_t) n_runs, out) == (size_t) n_runs;
+   return(iaea_commit_sidecar(out, ok, temp_file, type_file));
+}
+
+/* *********************************************************************** */
+short iaea_read_type_runs(const char *type_file, const iaea_type_index *index,
+                          const bool *selected, iaea_record_run **runs, IAEA_I64 *n)
+{
+   *runs = NULL;
+   *n = 0;
+   IAEA_I64 total = 0;
+   int n_slots = 0;
+   for(int s = 0; s < TYPE_INDEX_SLOTS; s++)
+   {
+      if(!selected[s]) continue;
+      total += index->slot_start[s+1] - index->slot_start[s];
+      n_slots++;
+   }
+   if(total == 0) return(OK);
+
+   FILE *in = fopen(type_file, "rb");
+   iaea_record_run *found = (iaea_record_run *) malloc((size_t) total*sizeof(iaea_record_run));
+   bool ok = in != NULL && found != NULL;
+   IAEA_I64 done = 0;
+   for(int s = 0; ok && s < TYPE_INDEX_SLOTS; s++)
+   {
+      IAEA_I64 m = index->slot_start[s+1] - index->slot_start[s];
+      if(!selected[s] || m == 0) continue;
+      ok = seek_type(in, runs_offset() +
+                         index->slot_start[s]*(IAEA_I64) sizeof(iaea_record_run)) == 0 &&
+           fread(found + done, sizeof(iaea_record_run), (size_t) m, in) == (size_t) m;
+      done += m;
+   }
+   if(in != NULL) fclose(in);
+   if(!ok) {free(found); return(FAIL);}
+
+   // Every slot is in order already; several slots are merged and their
+   // runs joined where they meet
+   if(n_slots > 1)
+   {
+      std::sort(found, found + total, run_before);
+      IAEA_I64 joined = 0;
+      for(IAEA_I64 i = 1; i < total; i++)
+      {
+         if(found[joined].first + found[joined].n == found[i].first) found[joined].n += found[i].n;
+         else found[++joined] = found[i];
+      }
+      total = joined + 1;
+   }
+   *runs = found;
+   *n = total;
+   return(OK);
+}
@@ -0,0 +1,176 @@
+#include <cstring>
+
+#include "iaea_uring.h"
+
+#if (defined __linux__)
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#endif
+
+iaea_uring::iaea_uring()
+{
+  ring_fd = -1;
+  entries = to_submit = 0;
+  sq_ring = cq_ring = sqes = cqes = NULL;
+  sq_ring_size = cq_ring_size = sqes_size = 0;
+  fixed_buffers = false;
+}
+
+iaea_uring::~iaea_uring()
+{
+  destroy();
+}
+
+#if (defined __linux__) && (defined __NR_io_uring_setup)
+
+short iaea_uring::initialize(unsigned n_entries)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  ring_fd = (int) syscall(__NR_io_uring_setup, n_entries, &p);
+  if(ring_fd < 0) {ring_fd = -1; return(FAIL);}
+  entries = p.sq_entries;
+
+  sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if(single_mmap && cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+
+  sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                 ring_fd, IORING_OFF_SQ_RING);
+  if(sq_ring == MAP_FAILED) {sq_ring = NULL; destroy(); return(FAIL);}
+
+  if(single_mmap) cq_ring = sq_ring;
+  else
+  {
+     cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                    ring_fd, IORING_OFF_CQ_RING);
+     if(cq_ring == MAP_FAILED) {cq_ring = NULL; destroy(); return(FAIL);}
+  }
+
+  sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+  sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+              ring_fd, IORING_OFF_SQES);
+  if(sqes == MAP_FAILED) {sqes = NULL; destroy(); return(FAIL);}
+
+  char *sq = (char *) sq_ring, *cq = (char *) cq_ring;
+  sq_head  = (unsigned *)(sq + p.sq_off.head);
+  sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + p.sq_off.array);
+  cq_head  = (unsigned *)(cq + p.cq_off.head);
+  cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes     = cq + p.cq_off.cqes;
+
+  return(OK);
+}
+
+void iaea_uring::register_buffers(char *const buffers[], unsigned n_buffers, size_t size)
+{
+  if(ring_fd < 0) return;
+
+  struct iovec *iov = new struct iovec[n_buffers];
+  for(unsigned i=0;i<n_buffers;i++) {iov[i].iov_base = buffers[i]; iov[i].iov_len = size;}
+
+  // Pinning may exceed RLIMIT_MEMLOCK; plain reads and writes still work
+  fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                          iov, n_buffers) == 0;
+  delete[] iov;
+}
+
+// Fills the next submission queue entry
+static short queue_rw(iaea_uring *ring, int opcode, int fd, const char *buf,
+                      int buffer, unsigned len, IAEA_I64 offset, IAEA_I64 user_data)
+{
+  unsigned tail = *ring->sq_tail;
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if(tail - head >= ring->entries) return(FAIL); // queue full
+
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *) ring->sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = (__u64) offset;
+  sqe->addr = (__u64)(unsigned long) buf;
+  sqe->len = len;
+  sqe->user_data = (__u64) user_data;
+  if(opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED)
+     sqe->buf_index = (__u16) buffer;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+  return(OK);
+}
+
+short iaea_uring::queue_read(int fd, char *buf, int buffer, unsigned len,
+                             IAEA_I64 offset, IAEA_I64 user_data)
+{
+  int opcode = (fixed_buffers && buffer >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  return queue_rw(this, opcode, fd, buf, buffer, len, offset, user_data);
+}
+
+short iaea_uring::queue_write(int fd, const char *buf, int buffer, unsigned len,
+                              IAEA_I64 offset, IAEA_I64 user_data)
+{
+  int opcode = (fixed_buffers && buffer >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  return queue_rw(this, opcode, fd, buf, buffer, len, offset, user_data);
+}
+
+short iaea_uring::submit(bool wait)
+{
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  for(;;)
+  {
+     int n = (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, wait ? 1 : 0,
+                           flags, NULL, 0);
+     if(n >= 0) {to_submit -= ((unsigned) n < to_submit) ? (unsigned) n : to_submit; return(OK);}
+     // Busy: the completions must be reaped before more are taken
+     if(errno == EAGAIN || errno == EBUSY) return(wait ? FAIL : OK);
+     if(errno != EINTR) return(FAIL);
+  }
+}
+
+bool iaea_uring::get_completion(IAEA_I64 *user_data, IAEA_I32 *result)
+{
+  unsigned head = *cq_head;
+  if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+
+  struct io_uring_cqe *cqe = (struct io_uring_cqe *) cqes + (head & *cq_mask);
+  *user_data = (IAEA_I64) cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void iaea_uring::destroy()
+{
+  if(sqes != NULL) munmap(sqes, sqes_size);
+  if(cq_ring != NULL && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+  if(sq_ring != NULL) munmap(sq_ring, sq_ring_size);
+  if(ring_fd >= 0) close(ring_fd);
+  sq_ring = cq_ring = sqes = NULL;
+  ring_fd = -1;
+  fixed_buffers = false;
+}
+
+#else // io_uring is not available: every call fails
+
+short iaea_uring::initialize(unsigned) { return(FAIL); }
+void iaea_uring::register_buffers(char *const [], unsigned, size_t) {}
+short iaea_uring::queue_read(int, char *, int, unsigned, IAEA_I64, IAEA_I64)
+{ return(FAIL); }
+short iaea_uring::queue_write(int, const char *, int, unsigned, IAEA_I64, IAEA_I64)
+{ return(FAIL); }
+short iaea_uring::submit(bool) { return(FAIL); }
+bool iaea_uring::get_completion(IAEA_I64 *, IAEA_I32 *) { return false; }
+void iaea_uring::destroy() {}
+
+#endif
@@ -0,0 +1,232 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "iaea_virtual.h"
+
+#define PHSP_EXTENSION ".IAEAphsp"
+
+iaea_virtual_reader::iaea_virtual_reader()
+{
+   members = NULL;
+   n_members = 0;
+   start = NULL;
+   directory[0] = '\0';
+   mapping = 0;
+   current = -1;
+   moved = true;
+   memset(&record, 0, sizeof(record));
+   reclength = 0;
+   position = 0;
+   eof = false;
+}
+
+iaea_virtual_reader::~iaea_virtual_reader()
+{
+   close_member();
+   free(start);
+}
+
+short iaea_virtual_reader::initialize(const iaea_header_type *h, const char *header_file,
+                                      int read_mapping)
+{
+   members = h->members;
+   n_members = h->n_members;
+   reclength = h->record_length;
+   mapping = read_mapping;
+   if(reclength <= 0) return(FAIL);
+
+   start = (IAEA_I64 *) malloc((n_members + 1)*sizeof(IAEA_I64));
+   if(start == NULL) return(FAIL);
+   start[0] = 0;
+   for(IAEA_I32 m=0;m<n_members;m++) start[m+1] = start[m] + members[m].n_records;
+
+   // Relative member names are relative to the header
+   const char *slash = strrchr(header_file, '/');
+#if (defined WIN32) || (defined WIN64)
+   const char *backslash = strrchr(header_file, '\\');
+   if(backslash != NULL && (slash == NULL || backslash > slash)) slash = backslash;
+#endif
+   size_t length = (slash != NULL) ? (size_t)(slash - header_file) + 1 : 0;
+   if(length >= MAX_STR_LEN) return(FAIL);
+   memcpy(directory, header_file, length);
+   directory[length] = '\0';
+   return(OK);
+}
+
+void iaea_virtual_reader::member_file(IAEA_I32 m, char *file_name)
+{
+   const char *name = members[m].file;
+   bool absolute = (name[0] == '/');
+#if (defined WIN32) || (defined WIN64)
+   absolute = absolute || name[0] == '\\' || (name[0] != '\0' && name[1] == ':');
+#endif
+   size_t length = strlen(name);
+   bool extension = length >= strlen(PHSP_EXTENSION) &&
+                    strcmp(name + length - strlen(PHSP_EXTENSION), PHSP_EXTENSION) == 0;
+   snprintf(file_name, MAX_STR_LEN, "%s%s%s", absolute ? "" : directory, name,
+            extension ? "" : PHSP_EXTENSION);
+}
+
+void iaea_virtual_reader::close_member()
+{
+   if(current < 0) return;
+   record.unmap_file();
+   fclose(record.p_file);
+   record.p_file = NULL;
+   current = -1;
+}
+
+short iaea_virtual_reader::select_member(const iaea_record_type *layout)
+{
+   IAEA_I32 m = current;
+   if(m < 0 || position < start[m] || position >= start[m+1])
+   {
+      // The member with start[m] <= position < start[m+1]; empty members
+      // are never found
+      IAEA_I32 lo = 0, hi = n_members;
+      while(hi - lo > 1)
+      {
+         IAEA_I32 mid = (lo + hi)/2;
+         if(start[mid] <= position) lo = mid;
+         else hi = mid;
+      }
+      m = lo;
+   }
+
+   if(m != current)
+   {
+      close_member();
+      char file_name[MAX_STR_LEN];
+      member_file(m, file_name);
+      FILE *p_file = fopen(file_name, "rb");
+      if(p_file == NULL)
+      {
+         fprintf(stderr, "\n ERROR: Failed to open virtual member %s\n", file_name);
+         return(FAIL);
+      }
+
+      // The member must hold the records listed
+#if (defined WIN32) || (defined WIN64)
+      struct _stati64 file_status;
+      int status = _fstati64(_fileno(p_file), &file_status);
+#else
+      struct stat file_status;
+      int status = fstat(fileno(p_file), &file_status);
+#endif
+      IAEA_I64 needed = (members[m].first_record + members[m].n_records)*reclength;
+      if(status != 0 || (IAEA_I64) file_status.st_size < needed)
+      {
+         fprintf(stderr, "\n ERROR: Virtual member %s holds fewer records than listed\n",
+                 file_name);
+         fclose(p_file);
+         return(FAIL);
+      }
+
+      // Same layout as the source, own file
+      record = *layout;
+      record.p_virtual = NULL;
+      record.p_map = NULL;
+      record.p_file = p_file;
+      if(mapping > 0) record.map_file(mapping == 2);
+      current = m;
+      moved = true;
+   }
+
+   if(moved)
+   {
+      IAEA_I64 offset = (members[m].first_record + position - start[m])*reclength;
+      if(record.seek_file(offset) != OK) return(FAIL);
+      moved = false;
+   }
+   return(OK);
+}
+
+const char *iaea_virtual_reader::fetch_records(const iaea_record_type *layout, char *buffer,
+                                               IAEA_I64 *n)
+{
+   IAEA_I64 wanted = *n, done = 0;
+   while(done < wanted)
+   {
+      if(position >= start[n_members] || select_member(layout) != OK) {eof = true; break;}
+
+      IAEA_I64 in_member = start[current+1] - position;
+      IAEA_I64 asked = (wanted - done < in_member) ? wanted - done : in_member;
+      IAEA_I64 got = asked;
+      char *to = buffer + done*reclength;
+      const char *records = record.fetch_records(to, &got);
+      position += got;
+
+      // Records of one member are not copied out of its mapping
+      if(done == 0 && got == wanted) {*n = got; return(records);}
+      if(records != to) memcpy(to, records, (size_t)(got*reclength));
+      done += got;
+
+      if(got < asked)
+      {
+         fprintf(stderr, "\n ERROR: Failed to read virtual member %s\n",
+                 members[current].file);
+         moved = true;
+         eof = true;
+         break;
+      }
+   }
+   *n = done;
+   return(buffer);
+}
+
+IAEA_I64 iaea_virtual_reader::tell_file()
+{
+   return(position*reclength);
+}
+
+short iaea_virtual_reader::seek_file(IAEA_I64 offset)
+{
+   if(offset < 0 || offset % reclength != 0) return(FAIL);
+   position = offset/reclength;
+   eof = false;
+   moved = true;
+   return(OK);
+}
+
+IAEA_I64 iaea_virtual_reader::read_at(const iaea_record_type *layout, char *buffer,
+                                      IAEA_I64 n_bytes, IAEA_I64 offset)
+{
+   std::lock_guard<std::mutex> lock(positioned);
+   IAEA_I64 old_position = position;
+   bool old_eof = eof;
+   if(seek_file(offset) != OK) return(-1);
+
+   IAEA_I64 n = n_bytes/reclength;
+   const char *records = fetch_records(layout, buffer, &n);
+   if(records != buffer) memcpy(buffer, records, (size_t)(n*reclength));
+
+   position = old_position;
+   eof = old_eof;
+   moved = true;
+   return(n*reclength);
+}
+
+IAEA_I64 iaea_virtual_reader::size()
+{
+   IAEA_I64 bytes = 0;
+   for(IAEA_I32 m=0;m<n_members;m++)
+   {
+      char file_name[MAX_STR_LEN];
+      member_file(m, file_name);
+#if (defined WIN32) || (defined WIN64)
+      struct _stati64 file_status;
+      if(_stati64(file_name, &file_status) != 0) return(-1);
+#else
+      struct stat file_status;
+      if(stat(file_name, &file_status) != 0) return(-1);
+#endif
+      IAEA_I64 held = (IAEA_I64) file_status.st_size/reclength - members[m].first_record;
+      if(held > members[m].n_records) held = members[m].n_records;
+      if(held > 0) bytes += held*reclength;
+   }
+   return(bytes);
+}
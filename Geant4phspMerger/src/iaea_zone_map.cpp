@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "iaea_zone_map.h"
+
+static const char zone_magic[8] = {'I','A','E','A','z','o','n','e'};
+
+/* *********************************************************************** */
+bool iaea_zone::may_hold(const iaea_zone_filter *f) const
+{
+   const iaea_statistics *s = &counters;
+   if(f->empty || s->n_particles == 0) return(false);
+   if(s->maximum_x < f->minimum_x || s->minimum_x > f->maximum_x) return(false);
+   if(s->maximum_y < f->minimum_y || s->minimum_y > f->maximum_y) return(false);
+   if(s->maximum_z < f->minimum_z || s->minimum_z > f->maximum_z) return(false);
+
+   // Particles of types without counters may be anything
+   IAEA_I64 counted = 0;
+   for(int i=0;i<MAX_NUM_PARTICLES;i++) counted += s->particle_number[i];
+   bool others = counted < s->n_particles;
+   if(f->type > MAX_NUM_PARTICLES || f->type < 0) return(others);
+
+   for(int i=0;i<MAX_NUM_PARTICLES;i++)
+   {
+      if(f->type != 0 && f->type != i+1) continue;
+      if((types & (1 << i)) && s->maximum_energy[i] >= f->minimum_energy &&
+         s->minimum_energy[i] <= f->maximum_energy) return(true);
+   }
+   return(f->type == 0 && others);
+}
+
+/* *********************************************************************** */
+void iaea_zone_map::initialize()
+{
+   memset(this, 0, sizeof(*this));
+   file.size = -1;
+   block_records = ZONE_BLOCK_RECORDS;
+}
+
+void iaea_zone_map::release()
+{
+   free(zones);
+   initialize();
+}
+
+short iaea_zone_map::add_zone(const iaea_zone *zone)
+{
+   if(n_zones == zones_size)
+   {
+      IAEA_I64 new_size = zones_size > 0 ? 2*zones_size : 256;
+      iaea_zone *grown = (iaea_zone *) realloc(zones, (size_t) new_size*sizeof(iaea_zone));
+      if(grown == NULL) return(FAIL);
+      zones = grown; zones_size = new_size;
+   }
+   zones[n_zones++] = *zone;
+   n_records += zone->counters.n_particles;
+   return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_load_zone_map(const char *map_file, iaea_zone_map *map)
+{
+   map->initialize();
+   FILE *in = fopen(map_file, "rb");
+   if(in == NULL) return(FAIL);
+
+   // Tag, file summarized and counts, then the zones
+   iaea_sidecar_tag expected;
+   expected.make(zone_magic, ZONE_MAP_VERSION, (IAEA_I32) sizeof(iaea_zone));
+   IAEA_I64 fields[7] = {0};
+   bool ok = expected.read_matches(in) && fread(fields, sizeof(fields), 1, in) == 1;
+   IAEA_I64 block_records = fields[5], n_zones = fields[6];
+   ok = ok && block_records > 0 && n_zones >= 0 &&
+        n_zones == (fields[4] + block_records - 1)/block_records;
+   if(ok)
+   {
+      map->zones = (iaea_zone *) malloc((size_t)(n_zones + 1)*sizeof(iaea_zone));
+      ok = map->zones != NULL &&
+           fread(map->zones, sizeof(iaea_zone), (size_t) n_zones, in) == (size_t) n_zones;
+   }
+   char extra;
+   ok = ok && fread(&extra, 1, 1, in) == 0;   // nothing after the zones
+   fclose(in);
+   if(!ok) {map->release(); return(FAIL);}
+
+   map->file.size = fields[0];
+   map->file.mtime_sec = fields[1];
+   map->file.mtime_nsec = fields[2];
+   map->file.record_length = fields[3];
+   map->n_records = fields[4];
+   map->block_records = block_records;
+   map->n_zones = map->zones_size = n_zones;
+   return(OK);
+}
+
+/* *********************************************************************** */
+static bool write_zone_map(FILE *out, const void *data)
+{
+   const iaea_zone_map *map = (const iaea_zone_map *) data;
+   iaea_sidecar_tag tag;
+   tag.make(zone_magic, ZONE_MAP_VERSION, (IAEA_I32) sizeof(iaea_zone));
+   IAEA_I64 fields[7] = {map->file.size, map->file.mtime_sec, map->file.mtime_nsec,
+                         map->file.record_length, map->n_records, map->block_records,
+                         map->n_zones};
+   return(tag.write(out) &&
+          fwrite(fields, sizeof(fields), 1, out) == 1 &&
+          fwrite(map->zones, sizeof(iaea_zone), (size_t) map->n_zones, out) ==
+             (size_t) map->n_zones);
+}
+
+short iaea_save_zone_map(const char *map_file, const iaea_zone_map *map)
+{
+   return(iaea_save_sidecar(map_file, write_zone_map, map));
+}
@@ -664,7 +664,33 @@ int get_string(FILE *fspec, char *string)
 }
 #define REWIND_STREAM 100
 /* ************************************************************************** */
-int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
+// Reads a line as fgets does, from a file or from a text held in memory
+typedef char *(*line_reader)(char *s, int n, void *stream);
+
+static char *file_gets(char *s, int n, void *stream)
+{
+   return(fgets(s, n, (FILE *) stream));
+}
+
+static char *text_gets(char *s, int n, void *stream)
+{
+   text_stream *text = (text_stream *) stream;
+   if(text->pos >= text->end || n <= 0) return(NULL);
+   int len = 0;
+   while(len < n - 1 && text->pos < text->end)
+   {
+      char c = *text->pos++;
+      s[len++] = c;
+      if(c == '\n') break;
+   }
+   s[len] = '\0';
+   return(s);
+}
+
+/* ************************************************************************** */
+// Body of fget_c_string, reading with read_line into istring (Max_Str_Len chars)
+static int get_c_string(char *string, int Max_Str_Len, char *istring,
+                        line_reader read_line, void *stream)
 {
    /* gets a string from the input and removes comments from it */
    /* allows comments in standard "c" syntax,
@@ -677,20 +703,12 @@ int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
    char comment_stop[4]="*/";   /* signals end of comment   */
    int clen; /* length of string for start/stop*/
    int ilen; /* length of input string */
-   char *istring; /* input string */
    int olen; /* location on output string */
    int icnt; /* location on string */
 
    //   int n_pass = 0; /* Number of passes through the file looking for a value */
 
    olen = 0;
-   /* allocate memory for input string */
-   istring = (char *)calloc(Max_Str_Len,sizeof(char));
-   if(istring == NULL)
-   {
-      printf("\n ERROR: Allocating memory for input string if fget_c_string");
-      return(FAIL);
-   }
    strnset(string,'\0',Max_Str_Len); /* null entire output string */
    strnset(istring,'\0',Max_Str_Len); /* null entire input string */
 
@@ -701,7 +719,7 @@ int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
    /* read in the line, verify that it exists */
    do{
       /* read in a line from the file */
-      while(fgets(istring, Max_Str_Len, fspec) == NULL) /* output warning if not a valid read */
+      while(read_line(istring, Max_Str_Len, stream) == NULL) /* output warning if not a valid read */
       {
 #ifdef DEBUG
         printf("\n istring: %s", istring);
@@ -715,13 +733,11 @@ int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
 #endif
            //  printf ("\nERROR: Reading File : End of File On Read ");
            // fclose(fspec);
-           free(istring);
            return(FAIL);
         }
 #ifdef ALLOW_REWIND
         n_pass++;      /* increment the number of times through the file */
-        rewind(fspec); /* rewind to the beginning of the file */
-        free(istring);
+        rewind((FILE *) stream); /* rewind to the beginning of the file */
         return(REWIND_STREAM);
 #endif
       }
@@ -758,11 +774,10 @@ int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
                   icnt++; /* increment location on string */
                   if(icnt>ilen) /* if advance past end of string, get a new one */
                   {
-                     if(fgets(istring, Max_Str_Len, fspec) == NULL) /* output warning if not a valid read */
+                     if(read_line(istring, Max_Str_Len, stream) == NULL) /* output warning if not a valid read */
                      {
                         printf ("\nERROR: Reading File, looking for end of comment %s",comment_stop);
                         // fclose(fspec);
-                        free(istring);
                         return(FAIL);
                      }
                      ilen = strlen(istring); /* get length of this new string */
@@ -803,9 +818,45 @@ int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
    {
       printf ("\nERROR: Input line too long");
       // fclose(fspec);
-      free(istring);
       return(FAIL);
    }
-   free(istring);
    return(OK);
 }
+/* ************************************************************************** */
+int fget_c_string(char *string, int Max_Str_Len, FILE *fspec)
+{
+   // Lines of the usual length are read into the stack
+   char line[MAX_STR_LEN];
+   char *istring = line;
+   if(Max_Str_Len > MAX_STR_LEN)
+   {
+      /* allocate memory for input string */
+      istring = (char *)calloc(Max_Str_Len,sizeof(char));
+      if(istring == NULL)
+      {
+         printf("\n ERROR: Allocating memory for input string if fget_c_string");
+         return(FAIL);
+      }
+   }
+   int rvalue = get_c_string(string, Max_Str_Len, istring, file_gets, fspec);
+   if(istring != line) free(istring);
+   return(rvalue);
+}
+/* ************************************************************************** */
+int sget_c_string(char *string, int Max_Str_Len, text_stream *text)
+{
+   char line[MAX_STR_LEN];
+   char *istring = line;
+   if(Max_Str_Len > MAX_STR_LEN)
+   {
+      istring = (char *)calloc(Max_Str_Len,sizeof(char));
+      if(istring == NULL)
+      {
+         printf("\n ERROR: Allocating memory for input string if sget_c_string");
+         return(FAIL);
+      }
+   }
+   int rvalue = get_c_string(string, Max_Str_Len, istring, text_gets, text);
+   if(istring != line) free(istring);
+   return(rvalue);
+}
@@ -0,0 +1,214 @@
+// Decodes packed records of several layouts with every kernel the
+// processor supports, and checks that every column is, bit for bit, what
+// decode_particle gives one record after the other.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "iaea_decode.h"
+
+static const char *kernel_name[] = {"scalar", "SSE4.1", "AVX2", "AVX-512"};
+
+// Fields stored in the records (1) or constant (0), as in iaea_record_type
+struct test_layout
+{
+  const char *name;
+  int ix, iy, iz, iu, iv, iw, iweight;
+  short iextrafloat, iextralong;
+};
+
+static const test_layout layouts[] = {
+  {"all stored",          1, 1, 1, 1, 1, 1, 1, 0, 1},
+  {"extra floats, longs", 1, 1, 1, 1, 1, 1, 1, 3, 2},
+  {"constant u",          1, 1, 1, 0, 1, 1, 1, 0, 0},
+  {"constant v",          1, 1, 1, 1, 0, 1, 1, 1, 0},
+  {"constant w",          1, 1, 1, 1, 1, 0, 1, 1, 1},
+  {"constant z, weight",  1, 1, 0, 1, 1, 1, 0, 2, 1},
+  {"energy only",         0, 0, 0, 0, 0, 0, 0, 0, 0}};
+
+// Records decoded at once: short ones leave only the tails of the vector
+// kernels, long ones several full steps and a tail
+static const IAEA_I64 sizes[] = {1, 3, 7, 8, 15, 16, 17, 33, 1013};
+
+static unsigned int seed = 12345;
+
+static float uniform(float a, float b)
+{
+  seed = seed*1103515245u + 12345u;
+  return(a + (b - a)*(float)((seed >> 8) & 0xffffff)/(float) 0x1000000);
+}
+
+// A record with the sign of w, new histories, directions with u^2+v^2 > 1
+// and special energies (NaN, -NaN, -0, 0, infinities) among ordinary ones
+static void make_record(const iaea_record_type *p, IAEA_I64 i, char *record)
+{
+  static const float special[] = {
+     std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(),
+     -0.f, 0.f, std::numeric_limits<float>::infinity(),
+     -std::numeric_limits<float>::infinity(), -1.5f, 2.5f};
+
+  char type = (char)(1 + i % MAX_NUM_PARTICLES);
+  if(uniform(0.f, 1.f) < 0.5f) type = -type;
+  memcpy(record, &type, 1);
+  int offset = 1;
+
+  float energy = (i % 5 == 0) ? special[(i/5) % 8] : uniform(-10.f, 10.f);
+  memcpy(record + offset, &energy, 4);
+  offset += 4;
+
+  // u and v over [-1.2, 1.2]: some outside the unit circle, and a few on it
+  float u = uniform(-1.2f, 1.2f), v = uniform(-1.2f, 1.2f);
+  if(i % 11 == 0) {u = 0.6f; v = -0.8f;}
+  if(i % 13 == 0) {u = 0.f; v = 1.f;}
+  float values[6] = {uniform(-50.f, 50.f), uniform(-50.f, 50.f), uniform(-50.f, 50.f),
+                     u, v, uniform(0.f, 2.f)};
+  int stored[6] = {p->ix, p->iy, p->iz, p->iu, p->iv, p->iweight};
+  for(int f = 0; f < 6; f++)
+  {
+     if(stored[f] <= 0) continue;
+     memcpy(record + offset, &values[f], 4);
+     offset += 4;
+  }
+  for(int k = 0; k < p->iextrafloat; k++, offset += 4)
+  {
+     float e = uniform(-1e3f, 1e3f);
+     memcpy(record + offset, &e, 4);
+  }
+  for(int j = 0; j < p->iextralong; j++, offset += 4)
+  {
+     IAEA_I32 l = (IAEA_I32)(seed ^ (unsigned int)(i*7 + j));
+     memcpy(record + offset, &l, 4);
+  }
+}
+
+// Record of layout l with its constants, not reading any file
+static void set_layout(iaea_record_type *p, const test_layout *l)
+{
+  memset(p, 0, sizeof(*p));
+  p->ix = l->ix; p->iy = l->iy; p->iz = l->iz;
+  p->iu = l->iu; p->iv = l->iv; p->iw = l->iw; p->iweight = l->iweight;
+  p->iextrafloat = l->iextrafloat;
+  p->iextralong = l->iextralong;
+  p->x = 1.f; p->y = -2.f; p->z = 3.f;
+  p->u = 0.9f; p->v = 0.7f;    // constant u or v renormalized now and then
+  p->w = -1.f;
+  p->weight = 0.25f;
+  for(int k = 0; k < NUM_EXTRA_FLOAT; k++) p->extrafloat[k] = (float) k;
+  for(int j = 0; j < NUM_EXTRA_LONG; j++) p->extralong[j] = j;
+}
+
+static bool same_float(float a, float b)
+{
+  return(memcmp(&a, &b, sizeof(float)) == 0);
+}
+
+// Number of differences between column i of block and the record ref
+static int compare(const iaea_decoded_block *block, IAEA_I64 i, const iaea_record_type *ref)
+{
+  IAEA_I64 c = block->capacity;
+  int bad = 0;
+  bad += block->particle[i] != ref->particle;
+  bad += block->new_history[i] != ref->IsNewHistory;
+  bad += !same_float(block->energy[i], ref->energy);
+  bad += !same_float(block->x[i], ref->x);
+  bad += !same_float(block->y[i], ref->y);
+  bad += !same_float(block->z[i], ref->z);
+  bad += !same_float(block->u[i], ref->u);
+  bad += !same_float(block->v[i], ref->v);
+  bad += !same_float(block->w[i], ref->w);
+  bad += !same_float(block->weight[i], ref->weight);
+  for(int k = 0; k < ref->iextrafloat; k++)
+     bad += !same_float(block->extrafloat[k*c + i], ref->extrafloat[k]);
+  for(int j = 0; j < ref->iextralong; j++)
+     bad += block->extralong[j*c + i] != ref->extralong[j];
+  return(bad);
+}
+
+// Number of differences between what decode_particle leaves in p and ref
+static int compare_state(const iaea_record_type *p, const iaea_record_type *ref)
+{
+  int bad = 0;
+  bad += p->particle != ref->particle;
+  bad += p->IsNewHistory != ref->IsNewHistory;
+  bad += !same_float(p->energy, ref->energy);
+  bad += !same_float(p->x, ref->x) + !same_float(p->y, ref->y) + !same_float(p->z, ref->z);
+  bad += !same_float(p->u, ref->u) + !same_float(p->v, ref->v) + !same_float(p->w, ref->w);
+  bad += !same_float(p->weight, ref->weight);
+  for(int k = 0; k < ref->iextrafloat; k++) bad += !same_float(p->extrafloat[k], ref->extrafloat[k]);
+  for(int j = 0; j < ref->iextralong; j++) bad += p->extralong[j] != ref->extralong[j];
+  return(bad);
+}
+
+int main()
+{
+  int widest = iaea_decode_kernel();
+  int failures = 0;
+  printf("Kernels supported: scalar");
+  for(int kernel = IAEA_DECODE_SSE4; kernel <= widest; kernel++)
+     printf(", %s", kernel_name[kernel]);
+  printf("\n");
+
+  const int n_layouts = (int)(sizeof(layouts)/sizeof(layouts[0]));
+  const int n_sizes = (int)(sizeof(sizes)/sizeof(sizes[0]));
+  for(int l = 0; l < n_layouts; l++)
+  {
+     iaea_record_type start;
+     set_layout(&start, &layouts[l]);
+     IAEA_I64 length = start.get_record_length();
+
+     for(int s = 0; s < n_sizes; s++)
+     {
+        IAEA_I64 n = sizes[s];
+        char *records = (char *) malloc((size_t)(n*length));
+        for(IAEA_I64 i = 0; i < n; i++) make_record(&start, i, records + i*length);
+
+        // Reference: decode_particle, keeping every record
+        iaea_record_type *expected =
+           (iaea_record_type *) malloc((size_t) n*sizeof(iaea_record_type));
+        iaea_record_type ref = start;
+        for(IAEA_I64 i = 0; i < n; i++)
+        {
+           ref.decode_particle(records + i*length);
+           expected[i] = ref;
+        }
+
+        iaea_decoded_block block;
+        if(block.allocate(n) != OK)
+        {
+           printf("FAIL: cannot allocate %lld records\n", (long long) n);
+           return(1);
+        }
+        for(int kernel = IAEA_DECODE_SCALAR; kernel <= widest; kernel++)
+        {
+           iaea_record_type p = start;
+           iaea_decode_records(&p, records, n, &block, kernel);
+           int bad = 0;
+           IAEA_I64 first_bad = -1;
+           for(IAEA_I64 i = 0; i < n; i++)
+           {
+              int b = compare(&block, i, &expected[i]);
+              if(b > 0 && first_bad < 0) first_bad = i;
+              bad += b;
+           }
+           bad += compare_state(&p, &expected[n - 1]);
+           if(bad > 0)
+           {
+              printf("FAIL: %s kernel, layout \"%s\", %lld records: %d differences "
+                     "(first in record %lld)\n", kernel_name[kernel], layouts[l].name,
+                     (long long) n, bad, (long long) first_bad);
+              failures++;
+           }
+        }
+        block.release();
+        free(expected);
+        free(records);
+     }
+  }
+
+  if(failures > 0) return(1);
+  printf("All kernels decode as decode_particle (%d layouts, %d sizes)\n", n_layouts, n_sizes);
+  return(0);
+}
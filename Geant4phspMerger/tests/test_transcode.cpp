@@ -0,0 +1,238 @@
+// Converts packed records between pairs of layouts with an
+// iaea_transcode_plan and checks every output record against what a
+// particle by particle copy writes: decode_particle with the input layout,
+// the history counter and the extra variables carried over as the merger
+// does, and encode_particle with the output layout.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "iaea_transcode.h"
+
+// A layout: fields stored (1) or constant (0, with the constant given),
+// and the types of the extra floats and longs
+struct test_layout
+{
+  int ix, iy, iz, iu, iv, iw, iweight;
+  float x, y, z, w, weight;
+  int n_float, float_types[4];
+  int n_long, long_types[4];
+};
+
+// All stored, the history counter (extra long type 1) and a latch
+static const test_layout counter_latch =
+   {1, 1, 1, 1, 1, 1, 1,  0.f, 0.f, 0.f, 0.f, 0.f,  1, {0},  2, {1, 2}};
+// The same variables, in another order
+static const test_layout latch_counter =
+   {1, 1, 1, 1, 1, 1, 1,  0.f, 0.f, 0.f, 0.f, 0.f,  1, {0},  2, {2, 1}};
+// No history counter: new histories only as the sign of energy
+static const test_layout latch_only =
+   {1, 1, 1, 1, 1, 1, 1,  0.f, 0.f, 0.f, 0.f, 0.f,  1, {0},  1, {2}};
+// w constant (negative), x stored constant
+static const test_layout constant_w =
+   {0, 1, 1, 1, 1, 0, 1,  1.5f, 0.f, 0.f, -1.f, 0.f,  0, {0},  2, {1, 2}};
+// w constant (positive), z and the weight constant
+static const test_layout constant_w_z =
+   {1, 1, 0, 1, 1, 0, 0,  0.f, 0.f, 7.f, 1.f, 0.5f,  1, {0},  0, {0}};
+// Extra variables of the same type more than once
+static const test_layout repeated_in =
+   {1, 1, 1, 1, 1, 1, 1,  0.f, 0.f, 0.f, 0.f, 0.f,  3, {0, 0, 2},  3, {1, 3, 3}};
+static const test_layout repeated_out =
+   {1, 1, 1, 1, 1, 1, 1,  0.f, 0.f, 0.f, 0.f, 0.f,  4, {2, 0, 0, 0},  4, {3, 3, 3, 1}};
+
+struct test_pair
+{
+  const char *name;
+  const test_layout *in, *out;
+};
+
+static const test_pair pairs[] = {
+  {"same layout",                   &counter_latch, &counter_latch},
+  {"counter kept, reordered",       &counter_latch, &latch_counter},
+  {"counter dropped",               &counter_latch, &latch_only},
+  {"counter added",                 &latch_only,    &counter_latch},
+  {"stored w to constant w",        &counter_latch, &constant_w},
+  {"constant w to stored w",        &constant_w,    &counter_latch},
+  {"constant w to constant w",      &constant_w,    &constant_w_z},
+  {"constants to stored, no counter", &constant_w_z, &latch_only},
+  {"repeated extra types",          &repeated_in,   &repeated_out},
+  {"repeated extra types, back",    &repeated_out,  &repeated_in}};
+
+#define N_RECORDS 500
+
+static unsigned int seed = 2024;
+
+static float uniform(float a, float b)
+{
+  seed = seed*1103515245u + 12345u;
+  return(a + (b - a)*(float)((seed >> 8) & 0xffffff)/(float) 0x1000000);
+}
+
+// Header and record of layout l, as a phsp of that layout is opened
+static void set_layout(const test_layout *l, iaea_header_type *h, iaea_record_type *p)
+{
+  memset(h, 0, sizeof(*h));
+  memset(p, 0, sizeof(*p));
+  p->ix = l->ix; p->iy = l->iy; p->iz = l->iz;
+  p->iu = l->iu; p->iv = l->iv; p->iw = l->iw; p->iweight = l->iweight;
+  p->x = l->x; p->y = l->y; p->z = l->z; p->w = l->w; p->weight = l->weight;
+  p->iextrafloat = (short) l->n_float;
+  p->iextralong = (short) l->n_long;
+  h->set_record_contents(p);
+  h->record_length = p->get_record_length();
+  h->byte_order = check_byte_order();
+  for(int k = 0; k < l->n_float; k++) h->extrafloat_contents[k] = l->float_types[k];
+  for(int j = 0; j < l->n_long; j++) h->extralong_contents[j] = l->long_types[j];
+}
+
+// Valid input records: directions inside the unit circle, and the sign of
+// energy set by the history counter (when the layout has one)
+static void make_records(const iaea_header_type *h, const iaea_record_type *start,
+                         char *records)
+{
+  for(int i = 0; i < N_RECORDS; i++)
+  {
+     iaea_record_type r = *start;
+     IAEA_I32 n_stat = (i % 3 == 0) ? 1 + i % 4 : 0;
+     r.particle = (short)(1 + i % MAX_NUM_PARTICLES);
+     r.IsNewHistory = n_stat;
+     r.energy = uniform(0.01f, 10.f);
+     if(r.ix > 0) r.x = uniform(-50.f, 50.f);
+     if(r.iy > 0) r.y = uniform(-50.f, 50.f);
+     if(r.iz > 0) r.z = uniform(-50.f, 50.f);
+     float angle = uniform(0.f, 6.28f), radius = uniform(0.f, 0.98f);
+     if(r.iu > 0) r.u = radius*cosf(angle);
+     if(r.iv > 0) r.v = radius*sinf(angle);
+     if(r.iw > 0) r.w = (uniform(0.f, 1.f) < 0.5f) ? -0.5f : 0.5f;
+     if(r.iweight > 0) r.weight = uniform(0.f, 2.f);
+     for(int k = 0; k < r.iextrafloat; k++) r.extrafloat[k] = uniform(-1e3f, 1e3f);
+     for(int j = 0; j < r.iextralong; j++)
+        r.extralong[j] = (h->extralong_contents[j] == 1) ? n_stat : (IAEA_I32)(seed % 1000);
+     r.encode_particle(records + i*h->record_length);
+  }
+}
+
+// Index of the extra variable of given type and occurrence, -1 if absent
+static int find_extra(const int types[], int n, int type, int occurrence)
+{
+  for(int j = 0; j < n; j++)
+     if(types[j] == type && occurrence-- == 0) return(j);
+  return(-1);
+}
+
+// Occurrence of types[j] among types[0..j-1]
+static int occurrence_of(const int types[], int j)
+{
+  int occurrence = 0;
+  for(int k = 0; k < j; k++) if(types[k] == types[j]) occurrence++;
+  return(occurrence);
+}
+
+// One record copied particle by particle: decoded, the history counter
+// found as iaea_get_particle finds it, written as iaea_write_particle does
+static void copy_particle(const iaea_header_type *h_in, iaea_record_type *in,
+                          const iaea_header_type *h_out, iaea_record_type *out,
+                          const char *record, char *copy)
+{
+  in->decode_particle(record);
+  IAEA_I32 n_stat = (in->IsNewHistory > 0) ? 1 : 0;
+  for(int j = 0; j < in->iextralong; j++)
+     if(h_in->extralong_contents[j] == 1) n_stat = in->extralong[j];
+
+  out->IsNewHistory = (n_stat > 0) ? n_stat : 0;
+  out->particle = in->particle;
+  out->energy = in->energy;
+  if(out->ix > 0) out->x = in->x;
+  if(out->iy > 0) out->y = in->y;
+  if(out->iz > 0) out->z = in->z;
+  if(out->iu > 0) out->u = in->u;
+  if(out->iv > 0) out->v = in->v;
+  if(out->iw > 0) out->w = in->w;
+  if(out->iweight > 0) out->weight = in->weight;
+
+  // The k-th extra variable of a type from the k-th one of that type; a
+  // history counter the input lacks from the new history flag
+  for(int j = 0; j < out->iextrafloat; j++)
+  {
+     int k = find_extra(h_in->extrafloat_contents, in->iextrafloat,
+                        h_out->extrafloat_contents[j],
+                        occurrence_of(h_out->extrafloat_contents, j));
+     out->extrafloat[j] = (k < 0) ? 0.f : in->extrafloat[k];
+  }
+  for(int j = 0; j < out->iextralong; j++)
+  {
+     int type = h_out->extralong_contents[j];
+     int occurrence = occurrence_of(h_out->extralong_contents, j);
+     int k = find_extra(h_in->extralong_contents, in->iextralong, type, occurrence);
+     if(k >= 0) out->extralong[j] = in->extralong[k];
+     else if(type == 1 && occurrence == 0) out->extralong[j] = (n_stat > 0) ? 1 : 0;
+     else out->extralong[j] = 0;
+  }
+  out->encode_particle(copy);
+}
+
+int main()
+{
+  int failures = 0;
+  const int n_pairs = (int)(sizeof(pairs)/sizeof(pairs[0]));
+  iaea_header_type *h_in = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+  iaea_header_type *h_out = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+
+  for(int t = 0; t < n_pairs; t++)
+  {
+     iaea_record_type in_start, out_start;
+     set_layout(pairs[t].in, h_in, &in_start);
+     set_layout(pairs[t].out, h_out, &out_start);
+     int in_length = h_in->record_length, out_length = h_out->record_length;
+
+     iaea_transcode_plan plan;
+     if(plan.build(h_in, h_out) != OK)
+     {
+        printf("FAIL: %s: no plan\n", pairs[t].name);
+        failures++;
+        continue;
+     }
+
+     char *records = (char *) malloc((size_t)(N_RECORDS*in_length));
+     char *converted = (char *) malloc((size_t)(N_RECORDS*out_length));
+     char *copied = (char *) malloc((size_t)(N_RECORDS*out_length));
+     make_records(h_in, &in_start, records);
+     plan.run(records, converted, N_RECORDS);
+
+     iaea_record_type in = in_start, out = out_start;
+     for(int i = 0; i < N_RECORDS; i++)
+        copy_particle(h_in, &in, h_out, &out, records + i*in_length, copied + i*out_length);
+
+     int bad = 0, first_bad = -1;
+     for(int i = 0; i < N_RECORDS; i++)
+     {
+        if(memcmp(converted + i*out_length, copied + i*out_length, (size_t) out_length) == 0)
+           continue;
+        if(first_bad < 0) first_bad = i;
+        bad++;
+     }
+     bool identity = pairs[t].in == pairs[t].out;
+     if(plan.is_identity() != identity)
+     {
+        printf("FAIL: %s: is_identity() is %d\n", pairs[t].name, (int) plan.is_identity());
+        failures++;
+     }
+     if(bad > 0)
+     {
+        printf("FAIL: %s: %d of %d records differ (first: record %d)\n",
+               pairs[t].name, bad, N_RECORDS, first_bad);
+        failures++;
+     }
+     free(records);
+     free(converted);
+     free(copied);
+  }
+  free(h_in);
+  free(h_out);
+
+  if(failures > 0) return(1);
+  printf("Transcoded records match the particle by particle copy (%d layout pairs)\n", n_pairs);
+  return(0);
+}